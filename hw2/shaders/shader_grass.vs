@@ -0,0 +1,27 @@
+#version 330 core
+// Instanced variant of shader.vs for the billboard grass. Each instance only
+// carries its position; the yaw that turns the quad towards the camera is
+// computed here instead of building a model matrix per blade on the CPU.
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec3 aOffset;  // Per instance
+
+out vec2 TexCoord;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+
+
+void main()
+{
+    vec3 toCamera = viewPos - aOffset;
+    float yaw = atan(toCamera.x, toCamera.z);
+    float c = cos(yaw);
+    float s = sin(yaw);
+    // Same as glm::rotate(yaw, (0, 1, 0)).
+    vec3 pos = vec3(c * aPos.x + s * aPos.z, aPos.y, -s * aPos.x + c * aPos.z);
+
+    TexCoord = aTexCoord;
+    gl_Position = projection * view * vec4(pos + aOffset, 1.0f);
+}
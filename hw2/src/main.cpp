@@ -82,6 +82,7 @@ int main()
     // Define normal shader and skybox shader.
     Shader shader("../shaders/shader.vs", "../shaders/shader.fs");
     Shader skyboxShader("../shaders/shader_skybox.vs", "../shaders/shader_skybox.fs");
+    Shader grassShader("../shaders/shader_grass.vs", "../shaders/shader.fs");
 
     // Define textures (container, grass, grass_ground) & cubemap textures (day, night)
     // Object textures
@@ -126,6 +127,8 @@ int main()
     // Set texture & skybox texture uniform value (initialization)
     shader.use();
     shader.setInt("texture", 0);
+    grassShader.use();
+    grassShader.setInt("texture", 0);
     skyboxShader.use();
     skyboxShader.setInt("cubemap1", 0);
     skyboxShader.setInt("cubemap2", 1);
@@ -179,6 +182,19 @@ int main()
         grassPositions[i].z = z;
     }
 
+    // The grass is drawn in one instanced call, with the positions as a per
+    // instance attribute of the quad.
+    unsigned int grassInstanceVBO;
+    glGenBuffers(1, &grassInstanceVBO);
+    glBindVertexArray(grass.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, grassInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(grassPositions), &grassPositions[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glVertexAttribDivisor(2, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
     // Render loop
     // -----------
     while (!glfwWindowShouldClose(window)){
@@ -230,23 +246,15 @@ int main()
 		shader.setMat4("model", model);
 		glDrawElements(GL_TRIANGLES, grassGround.numVertices, GL_UNSIGNED_INT, 0);
 
-        // (3) Render billboard grasses(quad) using normal shader.
+        // (3) Render billboard grasses(quad) using the instanced grass shader.
 		glBindVertexArray(grass.VAO);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texGrass.ID);
-		for (size_t i = 0; i < n_grass; ++i){
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, grassPositions[i]);
-            glm::vec3 deltaPos = currentCamera->position - grassPositions[i];
-            float deltaAngle = glm::degrees(glm::atan(deltaPos.x, deltaPos.z));
-            model = glm::rotate(
-                model,
-                glm::radians(deltaAngle), // yaw
-                glm::vec3(0.0f, 1.0f, 0.0f)
-			);
-			shader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, grass.numVertices, GL_UNSIGNED_INT, 0);
-		}
+        grassShader.use();
+        grassShader.setMat4("projection", currentCamera->getProjectionMatrix(screen.width, screen.height));
+        grassShader.setMat4("view", currentCamera->getViewMatrix());
+        grassShader.setVec3("viewPos", currentCamera->position);
+        glDrawElementsInstanced(GL_TRIANGLES, grass.numVertices, GL_UNSIGNED_INT, 0, n_grass);
 
         // (4) Render skybox using skybox shader.
         glDepthMask(GL_FALSE);
@@ -274,6 +282,7 @@ int main()
     }
 
     // optional: De-allocate all resources once they've outlived their purpose:
+    glDeleteBuffers(1, &grassInstanceVBO);
 
     // GLFW: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
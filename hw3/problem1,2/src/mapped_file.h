@@ -0,0 +1,151 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace engine
+{
+// A read-only file mapped into memory. The pages are read in by the OS as
+// they are touched, so nothing is copied or parsed up front. An empty file
+// opens too, with a size of 0 and a data pointer that is not null.
+class MappedFile
+{
+public:
+    MappedFile() {}
+
+    MappedFile(const std::string& path)
+    {
+        this->open(path);
+    }
+
+    ~MappedFile()
+    {
+        this->close();
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    bool open(const std::string& path)
+    {
+        this->close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+        );
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            return false;
+        }
+        if (size.QuadPart == 0)
+        {
+            // Nothing to map.
+            CloseHandle(file);
+            this->bytes = getEmptyBytes();
+            return true;
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view)
+            return false;
+        this->bytes = static_cast<const unsigned char*>(view);
+        this->length = (size_t)size.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        if (info.st_size == 0)
+        {
+            // Nothing to map.
+            ::close(fd);
+            this->bytes = getEmptyBytes();
+            return true;
+        }
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED)
+            return false;
+        this->bytes = static_cast<const unsigned char*>(view);
+        this->length = (size_t)info.st_size;
+#endif
+        return true;
+    }
+
+    void close()
+    {
+        if (!this->bytes)
+            return;
+        if (this->length > 0)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(this->bytes);
+#else
+            munmap(const_cast<unsigned char*>(this->bytes), this->length);
+#endif
+        }
+        this->bytes = nullptr;
+        this->length = 0;
+    }
+
+    bool isOpen() const
+    {
+        return this->bytes != nullptr;
+    }
+
+    const unsigned char* data() const
+    {
+        return this->bytes;
+    }
+
+    size_t size() const
+    {
+        return this->length;
+    }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+
+    static const unsigned char* getEmptyBytes()
+    {
+        static const unsigned char empty = 0;
+        return &empty;
+    }
+};
+}
+
+#endif
@@ -1,59 +1,65 @@
 #ifndef RESOURCE_UTILS_H
 #define RESOURCE_UTILS_H
 
+#include <algorithm>
+#include <exception>
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "json.h"
 using json = nlohmann::json;
 
-#include "string_utils.h"
+#include "mapped_file.h"
+#include "text_tokenizer.h"
 
 
-void readFile(std::string path, std::string &data)
+void readFile(const std::string& path, std::string &data)
 {
     data.clear();
-    std::ifstream file;
-    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try 
-    {
-        file.open(path);
-        std::stringstream dataStream;
-        dataStream << file.rdbuf();	
-        file.close();
-
-        data = dataStream.str();
-    }
-    catch (std::ifstream::failure e)
+    engine::MappedFile file;
+    if (!file.open(path))
     {
         std::cout << "ERROR::RESOURCE_UTILS::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        return;
     }
+    data.assign(reinterpret_cast<const char*>(file.data()), file.size());
 }
 
 
-void readJson(std::string path, json &data)
+void readJson(const std::string& path, json &data)
 {
     data.clear();
-    std::ifstream file;
-    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    // Parsed straight from the mapped file.
+    engine::MappedFile file;
     try
     {
-        file.open(path);
-        data = json::parse(file);
-        file.close();
+        if (!file.open(path))
+            throw std::runtime_error("ERROR::RESOURCE_UTILS::FILE_NOT_SUCCESSFULLY_READ");
+        data = json::parse(file.data(), file.data() + file.size());
     }
-    catch (json::exception& e)
+    catch (std::exception& e)
     {
         std::cout << "ERROR::RESOURCE_UTILS::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
     }
 }
 
 
-void loadSplineControlPoints(const std::string &path, GLsizei &numVertices, std::vector<float> &vertexData)
+// The text of a mapped file; empty if it could not be opened.
+std::string_view getText(const engine::MappedFile& file)
 {
+    if (!file.isOpen())
+        return std::string_view("", 0);
+    return std::string_view(reinterpret_cast<const char*>(file.data()), file.size());
+}
+
+
+void loadSplineControlPoints(
+    const std::string &path, GLsizei &numVertices,
+    std::vector<float> &vertexData
+) {
     // Spline file structure
     //
     // N
@@ -63,9 +69,9 @@ void loadSplineControlPoints(const std::string &path, GLsizei &numVertices, std:
     // xN yN zN
 
 	// Load spline control point data and return VAO.
-    std::string data;
-    readFile(path, data);
-    if (data.empty())
+    engine::MappedFile file(path);
+    std::string_view text = getText(file);
+    if (text.empty())
     {
         std::cout << "ERROR::RESOURCE_UTILS::FILE_IS_EMPTY  "
             << path << std::endl;
@@ -75,56 +81,43 @@ void loadSplineControlPoints(const std::string &path, GLsizei &numVertices, std:
     numVertices = 0;
     vertexData.clear();
 
-    // Parse the data.
-    std::string line;
-    std::stringstream ss(data);
-
-    // First line is the number of vertices.
-    while (std::getline(ss, line, '\n'))
+    // Parse the data. Line breaks are whitespace like any other, so empty
+    // lines are allowed anywhere.
+    engine::TextTokenizer tokens(text);
+    int count = 0;
+    if (!tokens.nextInt(count) || count < 0)
     {
-        trim(line);
-        if (!line.empty())
-            break;
-
-        // We generously allow empty lines at the beginning.
-        line.clear();
+        std::cout << "ERROR::RESOURCE_UTILS::INTEGER_INVALID_ARGUMENT  "
+            << path << std::endl;
+        return;
     }
-    numVertices = jr::stoi(line);
-    line.clear();
 
-    // Following lines are the vertex coordinates.
-    GLsizei idx = 0;
-    while (std::getline(ss, line, '\n'))
+    // Following lines are the vertex coordinates. A vertex takes at least
+    // six characters, as "0 0 0\n", so a count the text cannot hold is not
+    // reserved for.
+    size_t maxVertices = text.size() / 6;
+    vertexData.reserve(std::min((size_t)count, maxVertices) * 3);
+    for (int i = 0; i < count; ++i)
     {
-        trim(line);
-        // We generously allow empty lines at the middle.
-        if (line.empty())
+        float x, y, z;
+        if (!tokens.nextFloat(x) || !tokens.nextFloat(y) || !tokens.nextFloat(z))
         {
-            line.clear();
-            continue;
+            std::cout << "ERROR::RESOURCE_UTILS::FLOAT_INVALID_ARGUMENT  "
+                << path << std::endl;
+            break;
         }
-
-        // Try to parse the data.
-        std::string::size_type sz;
-        float x = jr::stof(line, &sz);
-        line = line.substr(sz);
-        float y = jr::stof(line, &sz);
-        line = line.substr(sz);
-        float z = jr::stof(line, &sz);
-
         vertexData.push_back(x);
         vertexData.push_back(y);
         vertexData.push_back(z);
-
-        if (++idx >= numVertices)
-            break;
     }
+    numVertices = (GLsizei)(vertexData.size() / 3);
 }
 
 
-void loadBezierSurfaceControlPoints(const std::string &path, GLsizei &numPatches, GLsizei &numVertices, std::vector<float> &vertexData)
-
-{
+void loadBezierSurfaceControlPoints(
+    const std::string &path, GLsizei &numPatches, GLsizei &numVertices,
+    std::vector<float> &vertexData
+) {
     // Surface file structure
     //
     // N
@@ -148,9 +141,9 @@ void loadBezierSurfaceControlPoints(const std::string &path, GLsizei &numPatches
     // xNnm yNnm zNnm
 
 	// Load spline control point data and return VAO.
-    std::string data;
-    readFile(path, data);
-    if (data.empty())
+    engine::MappedFile file(path);
+    std::string_view text = getText(file);
+    if (text.empty())
     {
         std::cout << "ERROR::RESOURCE_UTILS::FILE_IS_EMPTY  "
             << path << std::endl;
@@ -161,73 +154,50 @@ void loadBezierSurfaceControlPoints(const std::string &path, GLsizei &numPatches
     numVertices = 0;
     vertexData.clear();
 
-    // Parse the data.
-    std::string line;
-    std::stringstream ss(data);
-
-    // First line is the number of vertices.
-    while (std::getline(ss, line, '\n'))
+    // Parse the data. Line breaks are whitespace like any other, so empty
+    // lines are allowed anywhere.
+    engine::TextTokenizer tokens(text);
+    int count = 0;
+    if (!tokens.nextInt(count) || count < 0)
     {
-        trim(line);
-        if (!line.empty())
-            break;
-
-        // We generously allow empty lines at the beginning.
-        line.clear();
+        std::cout << "ERROR::RESOURCE_UTILS::INTEGER_INVALID_ARGUMENT  "
+            << path << std::endl;
+        return;
     }
-    numPatches = jr::stoi(line);
-    line.clear();
 
-    // Following lines are the vertex coordinates.
-    GLsizei idx = 0;
-    while (std::getline(ss, line, '\n'))
+    for (int patch = 0; patch < count; ++patch)
     {
-        trim(line);
-        // We generously allow empty lines at the middle.
-        if (line.empty())
+        // Each block starting line gives the patch size.
+        int n, m;
+        if (!tokens.nextInt(n) || !tokens.nextInt(m) || n < 0 || m < 0)
         {
-            line.clear();
-            continue;
+            std::cout << "ERROR::RESOURCE_UTILS::INTEGER_INVALID_ARGUMENT  "
+                << path << std::endl;
+            return;
         }
 
-        // Try to parse the data.
-        std::string::size_type sz;
-        int n = jr::stoi(line, &sz);
-        line = line.substr(sz);
-        int m = jr::stoi(line, &sz);
-
-        line.clear();
-
-        // Each block starting line gives the patch size.
-        int patchVertices = (n + 1) * (m + 1);
-        numVertices += patchVertices;
-        for (int i = 0; i < patchVertices; ++i)
+        // A patch cut short is dropped whole, so the patches read stay
+        // complete.
+        size_t patchStart = vertexData.size();
+        GLsizei verticesStart = numVertices;
+        long long patchVertices = (long long)(n + 1LL) * (m + 1LL);
+        for (long long i = 0; i < patchVertices; ++i)
         {
-            if(!std::getline(ss, line, '\n'))
-                continue;
-            trim(line);
-            if (line.empty())
+            float x, y, z;
+            if (!tokens.nextFloat(x) || !tokens.nextFloat(y) || !tokens.nextFloat(z))
             {
-                --i;
-                continue;
+                std::cout << "ERROR::RESOURCE_UTILS::FLOAT_INVALID_ARGUMENT  "
+                    << path << std::endl;
+                vertexData.resize(patchStart);
+                numVertices = verticesStart;
+                return;
             }
-
-            // Try to parse the data.
-            std::string::size_type sz;
-            float x = jr::stof(line, &sz);
-            line = line.substr(sz);
-            float y = jr::stof(line, &sz);
-            line = line.substr(sz);
-            float z = jr::stof(line, &sz);
-
             vertexData.push_back(x);
             vertexData.push_back(y);
             vertexData.push_back(z);
-
-            line.clear();
+            ++numVertices;
         }
-        if (++idx >= numPatches)
-            break;
+        ++numPatches;
     }
 }
 
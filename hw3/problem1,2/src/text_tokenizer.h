@@ -0,0 +1,105 @@
+#ifndef TEXT_TOKENIZER_H
+#define TEXT_TOKENIZER_H
+
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <system_error>
+
+
+namespace engine
+{
+// Walks text, normally a MappedFile, token by token. Tokens are separated by
+// whitespace and handed out as views into the text, and numbers are parsed
+// with std::from_chars, so nothing is copied, allocated or thrown. Line
+// breaks only matter to nextLine(); everything else skips them like any
+// other whitespace.
+class TextTokenizer
+{
+public:
+    TextTokenizer(std::string_view text) : text(text) {}
+
+    // True once only whitespace is left.
+    bool atEnd()
+    {
+        this->skipWhitespace();
+        return this->position >= this->text.size();
+    }
+
+    bool next(std::string_view& token)
+    {
+        this->skipWhitespace();
+        size_t start = this->position;
+        while (this->position < this->text.size() && !isWhitespace(this->text[this->position]))
+            ++(this->position);
+        token = this->text.substr(start, this->position - start);
+        return !token.empty();
+    }
+
+    // The rest of the current line, without the line break, then moves to
+    // the next line. False at the end of the text.
+    bool nextLine(std::string_view& line)
+    {
+        if (this->position >= this->text.size())
+            return false;
+        size_t end = this->text.find('\n', this->position);
+        if (end == std::string_view::npos)
+            end = this->text.size();
+        line = this->text.substr(this->position, end - this->position);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        this->position = end + 1;
+        return true;
+    }
+
+    // False if the next token is missing or not entirely a number; the
+    // token is consumed either way.
+    bool nextInt(int& value)
+    {
+        return this->nextNumber(value);
+    }
+
+    bool nextFloat(float& value)
+    {
+        return this->nextNumber(value);
+    }
+
+    // Offset of the next character to read, for error messages.
+    size_t getPosition() const
+    {
+        return this->position;
+    }
+
+private:
+    std::string_view text;
+    size_t position = 0;
+
+
+    template <typename T>
+    bool nextNumber(T& value)
+    {
+        std::string_view token;
+        if (!this->next(token))
+            return false;
+        // std::stof accepted a leading plus, from_chars does not.
+        if (token.size() > 1 && token[0] == '+')
+            token.remove_prefix(1);
+        const char* last = token.data() + token.size();
+        std::from_chars_result result = std::from_chars(token.data(), last, value);
+        return result.ec == std::errc() && result.ptr == last;
+    }
+
+    void skipWhitespace()
+    {
+        while (this->position < this->text.size() && isWhitespace(this->text[this->position]))
+            ++(this->position);
+    }
+
+    static bool isWhitespace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+};
+}
+
+#endif
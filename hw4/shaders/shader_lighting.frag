@@ -1,19 +1,13 @@
 #version 330 core
+#define PI 3.14159265
+
 struct Material
 {
     sampler2D diffuseSampler;
     sampler2D specularSampler;
     sampler2D normalSampler;
-    float shininess;
 }; 
 
-struct Light
-{
-    // vec3 position;
-    vec3 direction;
-    vec3 color; // this is I_d (I_s = I_d, I_a = 0.3 * I_d)
-};
-
 in VS_OUT
 {
     vec2 TexCoord;
@@ -25,16 +19,49 @@ in VS_OUT
 
 out vec4 FragColor;
 
-uniform vec3 viewPos;
-uniform Light light;
+// Shared blocks, see render/shader_constants.h.
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float time;
+    vec2 screenSize;
+    float deltaTime;
+    float useLighting;
+    float useShadow;
+    float useProbes;
+    float useReflections;
+};
+
+layout (std140) uniform LightConstants
+{
+    mat4 lightSpace;
+    vec3 lightDirection;
+    vec3 lightColor; // this is I_d (I_s = I_d, I_a = 0.3 * I_d)
+};
+
+layout (std140) uniform MaterialConstants
+{
+    float useNormalMap;
+    float useSpecularMap;
+    float shininess;
+};
+
 uniform Material material;
 
 uniform sampler2D depthmapSampler;
 
-uniform float useNormalMap;
-uniform float useSpecularMap;
-uniform float useShadow;
-uniform float useLighting;
+// SH irradiance probe grid, see IrradianceVolume::upload().
+uniform sampler3D probeGrid;
+uniform vec3 probeGridMin;
+uniform vec3 probeGridSize;
+uniform vec3 probeGridResolution;
+
+// Prefiltered skybox and split-sum BRDF table, see environment_prefilter.h.
+uniform samplerCube prefilteredEnvMap;
+uniform float prefilteredEnvMaxLod;
+uniform sampler2D brdfLUT;
 
 
 float random(vec4 seed4)
@@ -44,11 +71,42 @@ float random(vec4 seed4)
 }
 
 
+// Trilinearly interpolated irradiance of the probe grid. Every coefficient
+// lives in its own z slab, so the z coordinate is clamped to texel centers
+// inside each slab.
+vec3 probeIrradiance(vec3 p, vec3 n)
+{
+    vec3 res = probeGridResolution;
+    vec3 cell = probeGridSize / (res - 1.0);
+    // Push the lookup off the surface to reduce leaking from behind it.
+    vec3 uvw = clamp((p + 0.5 * cell * n - probeGridMin) / probeGridSize, 0.0, 1.0);
+    vec3 texel = uvw * (res - 1.0) + 0.5;
+
+    vec4 t[7];
+    for (int i = 0; i < 7; ++i)
+    {
+        t[i] = texture(
+            probeGrid,
+            vec3(texel.xy / res.xy, (texel.z + i * res.z) / (7.0 * res.z))
+        );
+    }
+    vec3 c7 = vec3(t[0].a, t[1].a, t[2].a);
+    vec3 c8 = vec3(t[3].a, t[4].a, t[5].a);
+
+    vec3 irradiance = 0.282095 * t[0].rgb
+        + 0.488603 * (n.y * t[1].rgb + n.z * t[2].rgb + n.x * t[3].rgb)
+        + 1.092548 * (n.x * n.y * t[4].rgb + n.y * n.z * t[5].rgb + n.x * n.z * c7)
+        + 0.315392 * (3.0 * n.z * n.z - 1.0) * t[6].rgb
+        + 0.546274 * (n.x * n.x - n.y * n.y) * c8;
+    return max(irradiance, 0.0);
+}
+
+
 void main()
 {
 	vec3 color = texture(material.diffuseSampler, fs_in.TexCoord).rgb;
     vec3 surfaceNormal = normalize(fs_in.SurfaceNormal);
-    vec3 lightDir = normalize(light.direction);
+    vec3 lightDir = normalize(lightDirection);
     // vec3 lightDir = normalize(light.position - fs_in.FragPos);
 
     // On-off by key 3 (useLighting). 
@@ -142,10 +200,16 @@ void main()
 	}
 
     // Implement Phong illumination model.
-    color = color * light.color;
+    vec3 albedo = color;
+    color = color * lightColor;
 
     // 1. Ambiant color.
+    // The probes replace the constant term with baked sky and bounce light.
     vec3 ambiant = 0.3 * color;
+    if (useProbes > 0.5)
+    {
+        ambiant = albedo * probeIrradiance(fs_in.FragPos, surfaceNormal) / PI;
+    }
 
     // 2. Diffuse color.
     float diffuseCosine = max(dot(surfaceNormal, -lightDir), 0.0);
@@ -155,8 +219,33 @@ void main()
     vec3 viewDir = normalize(viewPos - fs_in.FragPos);
     vec3 reflectDir = reflect(lightDir, surfaceNormal);
     float specularCosine = max(dot(viewDir, reflectDir), 0.0);
-    float specularFactor = pow(specularCosine, material.shininess);
-    vec3 specular = specularCosine * light.color * specularColor;
+    float specularFactor = pow(specularCosine, shininess);
+    vec3 specular = specularCosine * lightColor * specularColor;
+
+    // 4. Glossy reflection of the sky, one lookup in the prefiltered
+    // environment. The GGX roughness is matched to the Phong exponent and
+    // every surface reflects like a dielectric (F0 = 0.04). It replaces the
+    // ambient specular the constant term stood for, and what the lobe
+    // reflects (Fresnel over roughness, from the split-sum table) is taken
+    // from the diffuse terms, so that light is not counted twice.
+    vec3 reflection = vec3(0.0);
+    if (useReflections > 0.5)
+    {
+        float roughness = sqrt(sqrt(2.0 / (shininess + 2.0)));
+        float NdotV = max(dot(surfaceNormal, viewDir), 0.0);
+        vec3 R = reflect(-viewDir, surfaceNormal);
+        vec2 brdf = texture(brdfLUT, vec2(NdotV, roughness)).rg;
+        vec3 prefiltered = textureLod(
+            prefilteredEnvMap, R, roughness * prefilteredEnvMaxLod
+        ).rgb;
+        float specularAlbedo = 0.04 * brdf.x + brdf.y;
+        reflection = prefiltered * specularAlbedo;
+        ambiant *= 1.0 - specularAlbedo;
+        diffuse *= 1.0 - specularAlbedo;
+        // The Phong highlight shares the same Fresnel budget rather than
+        // adding on top of the reflection in full.
+        specular *= 1.0 - specularAlbedo;
+    }
 
-    FragColor = vec4(ambiant + (1.0 - shadow) * (diffuse + specular), 1.0);
+    FragColor = vec4(ambiant + reflection + (1.0 - shadow) * (diffuse + specular), 1.0);
 }
@@ -1,8 +1,10 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
-layout (location = 2) in vec3 aNormal;
-layout (location = 3) in vec3 aTangent;
+layout (location = 2) in vec2 aNormal;  // Octahedral
+layout (location = 3) in vec2 aTangent; // Octahedral
+layout (location = 5) in mat4 aWorld;     // Per instance, also dequantizes aPos
+layout (location = 9) in mat3 aNormalMat; // Per instance, inverse transpose of aWorld
 
 out VS_OUT
 {
@@ -13,20 +15,52 @@ out VS_OUT
     mat3 TBN;
 } vs_out;
 
-uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpace;
+// Shared blocks, see render/shader_constants.h.
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float time;
+    vec2 screenSize;
+    float deltaTime;
+    float useLighting;
+    float useShadow;
+    float useProbes;
+    float useReflections;
+};
+
+layout (std140) uniform LightConstants
+{
+    mat4 lightSpace;
+    vec3 lightDirection;
+    vec3 lightColor; // this is I_d (I_s = I_d, I_a = 0.3 * I_d)
+};
+
+layout (std140) uniform MaterialConstants
+{
+    float useNormalMap;
+    float useSpecularMap;
+    float shininess;
+};
+
 
-uniform float useNormalMap;
+// Inverse of encodeOctahedral, see data/vertex.h.
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 
 void main()
 {
-    mat3 normalMat = mat3(transpose(inverse(world)));
+    mat3 normalMat = aNormalMat;
 	vs_out.TexCoord = aTexCoord;
-    vs_out.SurfaceNormal = normalize(normalMat * aNormal);
-    vs_out.FragPos = vec3(world * vec4(aPos, 1.0));
+    vs_out.SurfaceNormal = normalize(normalMat * decodeOctahedral(aNormal));
+    vs_out.FragPos = vec3(aWorld * vec4(aPos, 1.0));
     vs_out.FragPosLightSpace = lightSpace * vec4(vs_out.FragPos, 1.0);
 	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0);
 
@@ -38,7 +72,7 @@ void main()
 	if (useNormalMap > 0.5)
     {
         vec3 N = vs_out.SurfaceNormal;
-        vec3 T = normalize(normalMat * aTangent);
+        vec3 T = normalize(normalMat * decodeOctahedral(aTangent));
         T = normalize(T - dot(T, N) * N);
         vec3 B = cross(N, T);
         vs_out.TBN = mat3(T, B, N);
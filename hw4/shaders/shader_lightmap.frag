@@ -0,0 +1,51 @@
+#version 330 core
+// Lightmapped variant of shader_lighting.frag for static geometry. Direct
+// light, shadows and indirect light are baked into the lightmap as irradiance,
+// so the only lighting cost left is a single texture fetch. Specular highlights
+// are view dependent and therefore not baked.
+struct Material
+{
+    sampler2D diffuseSampler;
+};
+
+in VS_OUT
+{
+    vec2 TexCoord;
+    vec2 LightmapCoord;
+} fs_in;
+
+out vec4 FragColor;
+
+uniform Material material;
+uniform sampler2D lightmapSampler;
+
+// Shared block, see render/shader_constants.h.
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float time;
+    vec2 screenSize;
+    float deltaTime;
+    float useLighting;
+    float useShadow;
+    float useProbes;
+    float useReflections;
+};
+
+
+void main()
+{
+    vec3 color = texture(material.diffuseSampler, fs_in.TexCoord).rgb;
+
+    // On-off by key 3 (useLighting), same as shader_lighting.frag.
+    if (useLighting < 0.5)
+    {
+        FragColor = vec4(color, 1.0);
+        return;
+    }
+
+    vec3 irradiance = texture(lightmapSampler, fs_in.LightmapCoord).rgb;
+    FragColor = vec4(color * irradiance, 1.0);
+}
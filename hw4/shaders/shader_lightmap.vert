@@ -0,0 +1,34 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 4) in vec2 aLightmapCoord;
+layout (location = 5) in mat4 aWorld;     // Per instance
+
+out VS_OUT
+{
+    vec2 TexCoord;
+    vec2 LightmapCoord;
+} vs_out;
+
+// Shared block, see render/shader_constants.h.
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float time;
+    vec2 screenSize;
+    float deltaTime;
+    float useLighting;
+    float useShadow;
+    float useProbes;
+    float useReflections;
+};
+
+
+void main()
+{
+    vs_out.TexCoord = aTexCoord;
+    vs_out.LightmapCoord = aLightmapCoord;
+    gl_Position = projection * view * aWorld * vec4(aPos, 1.0);
+}
@@ -3,12 +3,25 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+// Shared block, see render/shader_constants.h.
+layout (std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float time;
+    vec2 screenSize;
+    float deltaTime;
+    float useLighting;
+    float useShadow;
+    float useProbes;
+    float useReflections;
+};
 
 void main()
 {
     TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0f);
+    // Rotation only, so the sky stays centered on the camera.
+    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0f);
     gl_Position = pos.xyww;
 }
@@ -1,14 +1,20 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 5) in mat4 aWorld;     // Per instance
 
 out vec4 FragPos;
 
-uniform mat4 world;
-uniform mat4 lightSpace;
+// Shared block, see render/shader_constants.h.
+layout (std140) uniform LightConstants
+{
+    mat4 lightSpace;
+    vec3 lightDirection;
+    vec3 lightColor; // this is I_d (I_s = I_d, I_a = 0.3 * I_d)
+};
 
 
 void main()
 {
-    gl_Position = lightSpace * world * vec4(aPos, 1.0);
+    gl_Position = lightSpace * aWorld * vec4(aPos, 1.0);
     FragPos = gl_Position;
 }
@@ -0,0 +1,355 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/logger.h"
+#include "utils/mapped_file.h"
+
+// Defined in base/system_global.h, which includes this header first.
+extern engine::Logger logger;
+
+namespace engine
+{
+constexpr uint32_t ASSET_BUNDLE_FILE_MAGIC = 0x4c444e42;    // "BNDL"
+constexpr uint32_t ASSET_BUNDLE_FILE_VERSION = 2;
+constexpr size_t ASSET_BUNDLE_ALIGNMENT = 64;               // Of every payload
+constexpr const char* ASSET_BUNDLE_PATH = "../resources/cache/main.bundle";
+constexpr const char* ASSET_BUNDLE_MANIFEST_PATH = "../resources/scene/main.assets";
+
+
+// How a payload is laid out, decided by the packer from the file extension.
+enum class AssetType : uint32_t
+{
+    RAW,        // The file as is: shaders, JSON
+    IMAGE,      // AssetImageHeader, then the decoded pixels
+    MESH        // MeshCacheHeader, then the arrays, as in a mesh cache file
+};
+
+
+// Start of a bundle. The payloads follow, then the table of contents.
+struct AssetBundleHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t padding;
+    uint64_t tocOffset;
+    uint64_t size;                      // Of the whole file
+};
+static_assert(sizeof(AssetBundleHeader) == 32, "AssetBundleHeader must have no padding");
+
+
+// Table of contents entry, sorted by id.
+struct AssetBundleEntry
+{
+    uint64_t id;                        // AssetBundle::getId() of the path
+    uint64_t offset;
+    uint64_t size;
+    uint64_t hash;                      // FNV-1a of the payload
+    uint64_t sourceSize;                // Of the file when it was packed
+    int64_t sourceTime;                 // Modification time, in seconds
+    AssetType type;
+    uint32_t padding;
+};
+static_assert(sizeof(AssetBundleEntry) == 56, "AssetBundleEntry must have no padding");
+
+
+// Start of an image payload. The pixels follow, tightly packed, top row
+// first as in the file they were decoded from.
+struct AssetImageHeader
+{
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    float averageColor[3];
+    uint32_t padding[2];
+
+    const unsigned char* getPixels() const
+    {
+        return reinterpret_cast<const unsigned char*>(this + 1);
+    }
+
+    size_t getPixelBytes() const
+    {
+        return (size_t)this->width * this->height * this->channels;
+    }
+};
+static_assert(sizeof(AssetImageHeader) == 32, "AssetImageHeader must have no padding");
+
+
+// Every asset of a scene in one file, written ahead of time by pack_assets
+// and mapped once at startup. Assets are looked up by the path the engine
+// would otherwise open, and handed out as pointers into the mapping: nothing
+// is read, decoded or copied until the loader touches it. Anything missing
+// from the bundle is loaded from its own file as before. So is an asset
+// whose file no longer has the size and modification time it was packed
+// with, so edits show up before pack_assets is run again; a missing file
+// is not stale, the bundle may be shipped alone.
+//
+// Files are little-endian; on a big-endian host the magic does not match and
+// the bundle is never used.
+class AssetBundle
+{
+public:
+    AssetBundle() {}
+
+    // No copy constructor nor copy assignment are allowed.
+    AssetBundle(const AssetBundle& other) = delete;
+    AssetBundle& operator=(const AssetBundle& other) = delete;
+
+    // Returns false, quietly, if there is no bundle at the path.
+    bool open(const std::string& path)
+    {
+        this->close();
+        if (!this->file.open(path))
+            return false;
+
+        AssetBundleHeader header;
+        bool valid = this->file.size() >= sizeof(header);
+        if (valid)
+        {
+            std::memcpy(&header, this->file.data(), sizeof(header));
+            valid = header.magic == ASSET_BUNDLE_FILE_MAGIC
+                && header.version == ASSET_BUNDLE_FILE_VERSION
+                && header.size == this->file.size()
+                && header.tocOffset % alignof(AssetBundleEntry) == 0
+                && header.tocOffset <= header.size
+                && header.numEntries <= (header.size - header.tocOffset) / sizeof(AssetBundleEntry);
+        }
+        if (valid)
+        {
+            this->entries = reinterpret_cast<const AssetBundleEntry*>(
+                this->file.data() + header.tocOffset
+            );
+            this->numEntries = header.numEntries;
+            for (size_t i = 0; i < this->numEntries && valid; ++i)
+            {
+                const AssetBundleEntry& entry = this->entries[i];
+                valid = entry.offset <= header.tocOffset
+                    && entry.size <= header.tocOffset - entry.offset;
+            }
+        }
+        if (!valid)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Invalid asset bundle {}", path);
+            this->close();
+        }
+        return valid;
+    }
+
+    void close()
+    {
+        this->file.close();
+        this->entries = nullptr;
+        this->numEntries = 0;
+    }
+
+    bool isOpen() const
+    {
+        return this->file.isOpen();
+    }
+
+    size_t getEntryCount() const
+    {
+        return this->numEntries;
+    }
+
+    // nullptr if the asset was not packed, was packed as another type, or
+    // its file changed since.
+    const AssetBundleEntry* find(const std::string& path, AssetType type) const
+    {
+        uint64_t id = getId(path);
+        const AssetBundleEntry* last = this->entries + this->numEntries;
+        const AssetBundleEntry* entry = std::lower_bound(
+            this->entries, last, id,
+            [](const AssetBundleEntry& entry, uint64_t id) { return entry.id < id; }
+        );
+        if (entry == last || entry->id != id || entry->type != type)
+            return nullptr;
+
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (getFileInfo(path, sourceSize, sourceTime)
+            && (sourceSize != entry->sourceSize || sourceTime != entry->sourceTime))
+        {
+            logger.warning(
+                LOG_CATEGORY_RESOURCE, "Asset {} changed since it was packed, loading the file", path
+            );
+            return nullptr;
+        }
+        return entry;
+    }
+
+    const unsigned char* getData(const AssetBundleEntry& entry) const
+    {
+        return this->file.data() + entry.offset;
+    }
+
+    // nullptr if the image was not packed.
+    const AssetImageHeader* findImage(const std::string& path) const
+    {
+        const AssetBundleEntry* entry = this->find(path, AssetType::IMAGE);
+        if (!entry || entry->size < sizeof(AssetImageHeader))
+            return nullptr;
+        const AssetImageHeader* image = reinterpret_cast<const AssetImageHeader*>(
+            this->getData(*entry)
+        );
+        if (image->getPixelBytes() > entry->size - sizeof(AssetImageHeader))
+            return nullptr;
+        return image;
+    }
+
+    // Hashes every payload again; reads the whole file. Returns the number
+    // of corrupted assets.
+    size_t verify() const
+    {
+        size_t corrupted = 0;
+        for (size_t i = 0; i < this->numEntries; ++i)
+        {
+            const AssetBundleEntry& entry = this->entries[i];
+            if (hash(this->getData(entry), entry.size) != entry.hash)
+                ++corrupted;
+        }
+        return corrupted;
+    }
+
+    static uint64_t getId(const std::string& path)
+    {
+        return hash(reinterpret_cast<const unsigned char*>(path.data()), path.size());
+    }
+
+    // FNV-1a.
+    static uint64_t hash(const unsigned char* data, size_t size)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+private:
+    MappedFile file;
+    const AssetBundleEntry* entries = nullptr;
+    size_t numEntries = 0;
+};
+
+
+// Writes a bundle for AssetBundle to map. Payloads go to the file as they
+// are added, aligned to ASSET_BUNDLE_ALIGNMENT; identical payloads are stored
+// once. finish() appends the table of contents and completes the header.
+class AssetBundleWriter
+{
+public:
+    AssetBundleWriter(const std::string& path)
+        : path(path), file(path, std::ios::binary | std::ios::trunc)
+    {
+        AssetBundleHeader header;
+        std::memset(&header, 0, sizeof(header));
+        this->file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        this->offset = sizeof(header);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    AssetBundleWriter(const AssetBundleWriter& other) = delete;
+    AssetBundleWriter& operator=(const AssetBundleWriter& other) = delete;
+
+    bool add(const std::string& assetPath, AssetType type, const std::vector<unsigned char>& payload)
+    {
+        AssetBundleEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.id = AssetBundle::getId(assetPath);
+        entry.size = payload.size();
+        entry.hash = AssetBundle::hash(payload.data(), payload.size());
+        entry.type = type;
+        if (!getFileInfo(assetPath, entry.sourceSize, entry.sourceTime))
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Cannot stat packed asset {}", assetPath);
+            return false;
+        }
+        if (!this->paths.emplace(entry.id, assetPath).second)
+        {
+            logger.error(
+                LOG_CATEGORY_RESOURCE, "Asset id collision between {} and {}",
+                assetPath, this->paths[entry.id]
+            );
+            return false;
+        }
+
+        auto stored = this->payloads.find({ entry.hash, entry.size });
+        if (stored != this->payloads.end())
+        {
+            entry.offset = stored->second;
+        }
+        else
+        {
+            this->align();
+            entry.offset = this->offset;
+            this->file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+            this->offset += payload.size();
+            this->payloads[{ entry.hash, entry.size }] = entry.offset;
+        }
+        this->entries.push_back(entry);
+        return true;
+    }
+
+    bool finish()
+    {
+        std::sort(
+            this->entries.begin(), this->entries.end(),
+            [](const AssetBundleEntry& a, const AssetBundleEntry& b) { return a.id < b.id; }
+        );
+        this->align();
+        AssetBundleHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = ASSET_BUNDLE_FILE_MAGIC;
+        header.version = ASSET_BUNDLE_FILE_VERSION;
+        header.numEntries = (uint32_t)this->entries.size();
+        header.tocOffset = this->offset;
+        header.size = this->offset + this->entries.size() * sizeof(AssetBundleEntry);
+        this->file.write(
+            reinterpret_cast<const char*>(this->entries.data()),
+            this->entries.size() * sizeof(AssetBundleEntry)
+        );
+        this->file.seekp(0);
+        this->file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        this->file.close();
+        if (!this->file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to write asset bundle {}", this->path);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string path;
+    std::ofstream file;
+    uint64_t offset = 0;
+    std::vector<AssetBundleEntry> entries;
+    std::map<uint64_t, std::string> paths;
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> payloads;  // (hash, size) to offset
+
+
+    void align()
+    {
+        static const char ZEROS[ASSET_BUNDLE_ALIGNMENT] = {};
+        size_t padding = (ASSET_BUNDLE_ALIGNMENT - this->offset % ASSET_BUNDLE_ALIGNMENT)
+            % ASSET_BUNDLE_ALIGNMENT;
+        this->file.write(ZEROS, padding);
+        this->offset += padding;
+    }
+};
+}
+
+#endif
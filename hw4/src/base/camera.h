@@ -37,6 +37,33 @@ constexpr float DEFAULT_CAMERA_MIN_ZOOM            =  10.0f;
 constexpr float DEFAULT_CAMERA_ZOOM_SENSITIVITY    =   1.0f;
 
 
+// Where a camera is and where it looks, copied out of a Camera so it can be
+// handed to another thread and blended between simulation ticks.
+struct CameraState
+{
+    glm::vec3 position;
+    glm::vec3 front;
+    glm::vec3 up;
+
+
+    glm::mat4 getViewMatrix() const
+    {
+        return glm::lookAt(this->position, this->position + this->front, this->up);
+    }
+
+    // alpha = 0 gives a, 1 gives b. The directions are blended linearly and
+    // renormalized, which is plenty for the rotation of one tick.
+    static CameraState interpolate(const CameraState& a, const CameraState& b, float alpha)
+    {
+        CameraState state;
+        state.position = glm::mix(a.position, b.position, alpha);
+        state.front = glm::normalize(glm::mix(a.front, b.front, alpha));
+        state.up = glm::normalize(glm::mix(a.up, b.up, alpha));
+        return state;
+    }
+};
+
+
 // The base camera class. Camera is defined as an entity.
 class Camera : public Entity
 {
@@ -84,6 +111,15 @@ public:
         updateCameraVectors();
     }
 
+    CameraState getState() const
+    {
+        CameraState state;
+        state.position = this->tf.position;
+        state.front = this->cameraFront;
+        state.up = this->cameraUp;
+        return state;
+    }
+
     // Returns the view matrix calculated using Euler angles and the LookAt matrix.
     glm::mat4 getViewMatrix()
     {
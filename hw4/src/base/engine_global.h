@@ -6,7 +6,7 @@
 
 
 // Only one instance per class
-// TODO make these thread safe
+// Main thread only; jobs must not touch these.
 engine::Commands cmd;
 engine::GameManager gameManager;
 
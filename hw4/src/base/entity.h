@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -18,6 +19,23 @@
 
 namespace engine
 {
+constexpr uint32_t INVALID_ENTITY_INDEX = 0xffffffff;
+
+
+// Stable reference to an entity of a scene, see EntityRegistry. The
+// generation tells a live entity from a later one reusing its slot.
+struct EntityHandle
+{
+    uint32_t index = INVALID_ENTITY_INDEX;
+    uint32_t generation = 0;
+
+    bool isValid() const
+    {
+        return this->index != INVALID_ENTITY_INDEX;
+    }
+};
+
+
 // Entity is the basic type of physical objects in the game. Entities in a
 // scene is stored in the form of tree. Each entity possesses a name and a
 // transform and a set of arbitrary attributions that do not have transforms.
@@ -28,6 +46,10 @@ public:
     Transform tf;
     std::vector<Attribute*> attribs = {};
     Entity* parent = nullptr;
+    // Set when the entity is added to a scene. From then on the scene's
+    // registry holds the transform the renderer uses; tf is the spawn pose,
+    // relative to the parent.
+    EntityHandle handle;
     // std::vector<Entity*> children = {};
 
 
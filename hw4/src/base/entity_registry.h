@@ -0,0 +1,386 @@
+#ifndef ENTITY_REGISTRY_H
+#define ENTITY_REGISTRY_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "base/entity.h"
+#include "base/job_system.h"
+#include "base/transform.h"
+#include "data/bounds.h"
+#include "data/lightmap.h"
+#include "data/model.h"
+
+
+namespace engine
+{
+// Levels with fewer dirty candidates than this are updated on the calling
+// thread; handing out jobs would cost more than the matrix products.
+constexpr size_t PARALLEL_HIERARCHY_MIN_NODES = 1024;
+constexpr size_t HIERARCHY_NODES_PER_JOB = 256;
+
+
+// Dense component storage of the entities of a scene. Each component lives in
+// its own array and all arrays share one order, so a pass over the scene is a
+// linear walk over contiguous memory:
+//
+//     for (size_t i = 0; i < registry.size(); ++i)
+//         draw(registry.models[i], registry.worldMatrices[i]);
+//
+// Removing an entity moves the last one into its place, so dense indices are
+// only valid until the next destroy(). Hold an EntityHandle instead; it stays
+// valid for the lifetime of the entity and is detected as stale afterwards.
+//
+// Entities form a transform hierarchy. Local transforms are only written
+// through the setters, which mark the entity dirty; updateWorldMatrices()
+// then recomputes the dirty entities and their descendants, parents before
+// children, and does nothing at all if no entity moved.
+//
+// getVersion() changes whenever the public arrays may have, so copies of them
+// made for another thread are only refreshed when needed. Code that writes an
+// array directly has to call markChanged().
+class EntityRegistry
+{
+public:
+    std::vector<LocalTransform> locals;     // Relative to the parent
+    std::vector<glm::mat4> worldMatrices;   // Valid after updateWorldMatrices()
+    std::vector<glm::mat3> normalMatrices;  // Same as above
+    std::vector<AABB> worldBounds;          // Of the model, same as above
+    std::vector<BoundingSphere> worldSpheres;
+    std::vector<EntityHandle> parents;      // Invalid for root entities
+    std::vector<Model*> models;             // nullptr if the entity has no model
+    std::vector<Lightmap*> lightmaps;       // nullptr if not lightmapped
+    std::vector<Entity*> entities;
+
+
+    EntityRegistry() {}
+
+    size_t size() const
+    {
+        return this->entities.size();
+    }
+
+    uint64_t getVersion() const
+    {
+        return this->version;
+    }
+
+    void markChanged()
+    {
+        ++(this->version);
+    }
+
+    void reserve(size_t capacity)
+    {
+        this->locals.reserve(capacity);
+        this->worldMatrices.reserve(capacity);
+        this->normalMatrices.reserve(capacity);
+        this->worldBounds.reserve(capacity);
+        this->worldSpheres.reserve(capacity);
+        this->parents.reserve(capacity);
+        this->models.reserve(capacity);
+        this->lightmaps.reserve(capacity);
+        this->entities.reserve(capacity);
+        this->dirty.reserve(capacity);
+        this->denseToSlot.reserve(capacity);
+    }
+
+    EntityHandle create(
+        Entity* entity, const Transform& tf, Model* model,
+        EntityHandle parent = EntityHandle()
+    ) {
+        if (parent.isValid())
+            this->indexOf(parent);
+
+        uint32_t slot;
+        if (!this->freeSlots.empty())
+        {
+            slot = this->freeSlots.back();
+            this->freeSlots.pop_back();
+        }
+        else
+        {
+            slot = (uint32_t)this->slots.size();
+            this->slots.push_back(Slot());
+        }
+        this->slots[slot].dense = (uint32_t)this->size();
+
+        this->locals.push_back(LocalTransform(tf));
+        this->worldMatrices.push_back(glm::mat4(1.0f));
+        this->normalMatrices.push_back(glm::mat3(1.0f));
+        this->worldBounds.push_back(AABB());
+        this->worldSpheres.push_back(BoundingSphere());
+        this->parents.push_back(parent);
+        this->models.push_back(model);
+        this->lightmaps.push_back(nullptr);
+        this->entities.push_back(entity);
+        this->dirty.push_back(1);
+        this->denseToSlot.push_back(slot);
+        ++(this->numDirty);
+        this->orderDirty = true;
+        this->markChanged();
+
+        EntityHandle handle;
+        handle.index = slot;
+        handle.generation = this->slots[slot].generation;
+        return handle;
+    }
+
+    // Children of the destroyed entity become roots. Their local transform is
+    // kept, so they jump unless the parent sat at the origin.
+    void destroy(EntityHandle handle)
+    {
+        size_t dense = this->indexOf(handle);
+        this->markChanged();
+        for (size_t i = 0; i < this->size(); ++i)
+        {
+            if (this->parents[i].index == handle.index)
+            {
+                this->parents[i] = EntityHandle();
+                this->markDirty(i);
+            }
+        }
+
+        size_t last = this->size() - 1;
+        if (dense != last)
+        {
+            // Keep the dirty count right when a clean entity takes the place
+            // of a dirty one.
+            if (this->dirty[dense])
+                --(this->numDirty);
+            this->locals[dense] = this->locals[last];
+            this->worldMatrices[dense] = this->worldMatrices[last];
+            this->normalMatrices[dense] = this->normalMatrices[last];
+            this->worldBounds[dense] = this->worldBounds[last];
+            this->worldSpheres[dense] = this->worldSpheres[last];
+            this->parents[dense] = this->parents[last];
+            this->models[dense] = this->models[last];
+            this->lightmaps[dense] = this->lightmaps[last];
+            this->entities[dense] = this->entities[last];
+            this->dirty[dense] = this->dirty[last];
+            this->denseToSlot[dense] = this->denseToSlot[last];
+            this->slots[this->denseToSlot[dense]].dense = (uint32_t)dense;
+        }
+        else if (this->dirty[dense])
+        {
+            --(this->numDirty);
+        }
+        this->locals.pop_back();
+        this->worldMatrices.pop_back();
+        this->normalMatrices.pop_back();
+        this->worldBounds.pop_back();
+        this->worldSpheres.pop_back();
+        this->parents.pop_back();
+        this->models.pop_back();
+        this->lightmaps.pop_back();
+        this->entities.pop_back();
+        this->dirty.pop_back();
+        this->denseToSlot.pop_back();
+        this->orderDirty = true;
+
+        ++(this->slots[handle.index].generation);
+        this->freeSlots.push_back(handle.index);
+    }
+
+    bool isAlive(EntityHandle handle) const
+    {
+        return handle.index < this->slots.size()
+            && this->slots[handle.index].generation == handle.generation;
+    }
+
+    // Current position of the entity in the component arrays.
+    size_t indexOf(EntityHandle handle) const
+    {
+        if (!this->isAlive(handle))
+        {
+            throw std::invalid_argument("ERROR::ENTITY_REGISTRY::Stale entity handle");
+        }
+        return this->slots[handle.index].dense;
+    }
+
+    // Pass an invalid handle to make the entity a root.
+    void setParent(EntityHandle handle, EntityHandle parent)
+    {
+        size_t dense = this->indexOf(handle);
+        for (EntityHandle p = parent; p.isValid(); p = this->parents[this->indexOf(p)])
+        {
+            if (p.index == handle.index)
+            {
+                throw std::invalid_argument("ERROR::ENTITY_REGISTRY::Cycle in transform hierarchy");
+            }
+        }
+        this->parents[dense] = parent;
+        this->markDirty(dense);
+        this->orderDirty = true;
+    }
+
+    void setLocalTransform(EntityHandle handle, const LocalTransform& local)
+    {
+        size_t dense = this->indexOf(handle);
+        this->locals[dense] = local;
+        this->markDirty(dense);
+    }
+
+    void setPosition(EntityHandle handle, const glm::vec3& position)
+    {
+        size_t dense = this->indexOf(handle);
+        this->locals[dense].position = position;
+        this->markDirty(dense);
+    }
+
+    void setRotation(EntityHandle handle, const glm::quat& rotation)
+    {
+        size_t dense = this->indexOf(handle);
+        this->locals[dense].rotation = rotation;
+        this->markDirty(dense);
+    }
+
+    void setScale(EntityHandle handle, const glm::vec3& scale)
+    {
+        size_t dense = this->indexOf(handle);
+        this->locals[dense].scale = scale;
+        this->markDirty(dense);
+    }
+
+    // Brings worldMatrices up to date. Call once per frame before rendering.
+    // Large levels are split among the threads of jobs, if given.
+    void updateWorldMatrices(JobSystem* jobs = nullptr)
+    {
+        if (this->numDirty == 0)
+            return;
+        if (this->orderDirty)
+            this->sortByDepth();
+
+        // Entities of one level only read the matrices and flags of the level
+        // above, so each level can be split among threads.
+        for (size_t l = 0; l + 1 < this->levelOffsets.size(); ++l)
+        {
+            size_t begin = this->levelOffsets[l];
+            size_t end = this->levelOffsets[l + 1];
+            if (!jobs || end - begin < PARALLEL_HIERARCHY_MIN_NODES)
+            {
+                for (size_t k = begin; k < end; ++k)
+                    this->updateNode(this->order[k]);
+                continue;
+            }
+
+            jobs->parallelFor(begin, end, HIERARCHY_NODES_PER_JOB, [this](size_t first, size_t last) {
+                for (size_t k = first; k < last; ++k)
+                    this->updateNode(this->order[k]);
+            });
+        }
+
+        std::fill(this->dirty.begin(), this->dirty.end(), (uint8_t)0);
+        this->numDirty = 0;
+        this->markChanged();
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t dense = 0;
+        uint32_t generation = 0;
+    };
+
+    std::vector<Slot> slots;                // Indexed by EntityHandle::index
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> denseToSlot;
+
+    // Hierarchy bookkeeping. Descendants of a dirty entity are not flagged
+    // eagerly; updateNode() inherits the flag from the parent instead.
+    std::vector<uint8_t> dirty;
+    size_t numDirty = 0;
+    std::vector<uint32_t> order;            // Dense indices sorted by depth
+    std::vector<size_t> levelOffsets;       // Start of each depth in order
+    bool orderDirty = true;
+    uint64_t version = 0;
+
+
+    void markDirty(size_t dense)
+    {
+        if (!this->dirty[dense])
+        {
+            this->dirty[dense] = 1;
+            ++(this->numDirty);
+        }
+    }
+
+    void updateNode(size_t dense)
+    {
+        const EntityHandle& parent = this->parents[dense];
+        if (!parent.isValid())
+        {
+            if (!this->dirty[dense])
+                return;
+            this->worldMatrices[dense] = this->locals[dense].getMatrix();
+        }
+        else
+        {
+            size_t p = this->slots[parent.index].dense;
+            if (!this->dirty[dense] && !this->dirty[p])
+                return;
+            this->worldMatrices[dense]
+                = this->worldMatrices[p] * this->locals[dense].getMatrix();
+            this->dirty[dense] = 1;
+        }
+
+        const glm::mat4& world = this->worldMatrices[dense];
+        this->normalMatrices[dense] = glm::transpose(glm::inverse(glm::mat3(world)));
+
+        const Model* model = this->models[dense];
+        if (model && model->mesh)
+        {
+            this->worldBounds[dense] = model->mesh->bounds.transformed(world);
+            this->worldSpheres[dense] = model->mesh->boundingSphere.transformed(world);
+        }
+    }
+
+    // Counting sort of the entities by their depth in the hierarchy.
+    void sortByDepth()
+    {
+        const uint32_t UNKNOWN = 0xffffffff;
+        std::vector<uint32_t> depths(this->size(), UNKNOWN);
+        std::vector<uint32_t> chain;
+        uint32_t maxDepth = 0;
+        for (size_t i = 0; i < this->size(); ++i)
+        {
+            // Walk up to the first entity of known depth, then assign the
+            // depths on the way back down.
+            size_t n = i;
+            while (depths[n] == UNKNOWN && this->parents[n].isValid())
+            {
+                chain.push_back((uint32_t)n);
+                n = this->slots[this->parents[n].index].dense;
+            }
+            if (depths[n] == UNKNOWN)
+                depths[n] = 0;
+            uint32_t depth = depths[n];
+            while (!chain.empty())
+            {
+                depths[chain.back()] = ++depth;
+                chain.pop_back();
+            }
+            maxDepth = std::max(maxDepth, depths[i]);
+        }
+
+        this->levelOffsets.assign(maxDepth + 2, 0);
+        for (size_t i = 0; i < this->size(); ++i)
+            ++(this->levelOffsets[depths[i] + 1]);
+        for (size_t l = 1; l < this->levelOffsets.size(); ++l)
+            this->levelOffsets[l] += this->levelOffsets[l - 1];
+
+        std::vector<size_t> cursor(this->levelOffsets.begin(), this->levelOffsets.end() - 1);
+        this->order.resize(this->size());
+        for (size_t i = 0; i < this->size(); ++i)
+            this->order[cursor[depths[i]]++] = (uint32_t)i;
+        this->orderDirty = false;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef FIXED_TIMESTEP_H
+#define FIXED_TIMESTEP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+
+namespace engine
+{
+constexpr double DEFAULT_TICK_RATE = 240.0;            // Ticks per second
+// At most this many ticks are run to catch up. If the simulation cannot keep
+// up, the rest of the backlog is dropped rather than making the next update
+// even longer.
+constexpr int DEFAULT_MAX_TICKS_PER_UPDATE = 8;
+
+
+// Runs the simulation in ticks of fixed length, however long the frames
+// are. Real time is fed in and accumulated, and every full tick's worth of
+// it is consumed by one step():
+//
+//     timestep.accumulate(glfwGetTime());
+//     while (timestep.step())
+//         simulate(timestep.getTickDuration());
+//
+// The simulation therefore advances by the same increments on every run,
+// whatever the frame rate. The fraction of a tick left over is what a
+// renderer interpolates by, see getAlpha().
+class FixedTimestep
+{
+public:
+    FixedTimestep(
+        double tickRate = DEFAULT_TICK_RATE,
+        int maxTicksPerUpdate = DEFAULT_MAX_TICKS_PER_UPDATE
+    ) : maxTicksPerUpdate(maxTicksPerUpdate)
+    {
+        this->setTickRate(tickRate);
+        if (maxTicksPerUpdate <= 0)
+            throw std::invalid_argument("ERROR::FIXED_TIMESTEP::Max ticks per update must be positive");
+    }
+
+    void setTickRate(double tickRate)
+    {
+        if (tickRate <= 0.0)
+            throw std::invalid_argument("ERROR::FIXED_TIMESTEP::Tick rate must be positive");
+        this->tickDuration = 1.0 / tickRate;
+    }
+
+    double getTickDuration() const
+    {
+        return this->tickDuration;
+    }
+
+    // Ticks run so far.
+    uint64_t getTick() const
+    {
+        return this->tick;
+    }
+
+    // Simulated time, in seconds.
+    double getTime() const
+    {
+        return this->tick * this->tickDuration;
+    }
+
+    // Real time dropped so far because the simulation fell behind.
+    double getDroppedTime() const
+    {
+        return this->droppedTime;
+    }
+
+    // Adds the real time passed since the previous call. The first call only
+    // starts the clock.
+    void accumulate(double now)
+    {
+        if (this->started)
+            this->accumulator += std::max(now - this->now, 0.0);
+        this->now = now;
+        this->started = true;
+        this->ticksThisUpdate = 0;
+    }
+
+    // Consumes one tick of accumulated time and returns true, or returns
+    // false once less than a tick is left or the catch-up limit is hit.
+    bool step()
+    {
+        if (this->accumulator < this->tickDuration)
+            return false;
+        if (this->ticksThisUpdate >= this->maxTicksPerUpdate)
+        {
+            // Spiral of death guard: forget the whole ticks left over, keep
+            // the fraction for interpolation.
+            double dropped = this->accumulator - std::fmod(this->accumulator, this->tickDuration);
+            this->accumulator -= dropped;
+            this->droppedTime += dropped;
+            return false;
+        }
+        this->accumulator -= this->tickDuration;
+        ++(this->tick);
+        ++(this->ticksThisUpdate);
+        return true;
+    }
+
+    // Fraction of a tick accumulated but not simulated yet, in [0, 1). The
+    // last tick's state is shown this far towards the next one.
+    double getAlpha() const
+    {
+        return std::min(this->accumulator / this->tickDuration, 1.0);
+    }
+
+    // Real time at which the simulation stands after the last step(), for
+    // threads that interpolate on their own clock.
+    double getSimulatedUntil() const
+    {
+        return this->now - this->accumulator;
+    }
+
+    // Seconds until the next tick is due.
+    double getTimeToNextTick() const
+    {
+        return std::max(this->tickDuration - this->accumulator, 0.0);
+    }
+
+private:
+    double tickDuration;
+    int maxTicksPerUpdate;
+    double accumulator = 0.0;
+    double now = 0.0;
+    bool started = false;
+    uint64_t tick = 0;
+    int ticksThisUpdate = 0;
+    double droppedTime = 0.0;
+};
+}
+
+#endif
@@ -18,6 +18,9 @@ struct GraphicsSettings
     bool useNormalMap = true;
     bool useSpecularMap = true;
     bool useShadow = true;
+    bool useLightmap = true;
+    bool useProbes = true;
+    bool useReflections = true;
 };
 }
 
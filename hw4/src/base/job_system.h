@@ -0,0 +1,345 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace engine
+{
+constexpr int64_t JOB_QUEUE_CAPACITY = 4096;   // Per thread, a power of two
+constexpr int JOB_SPINS_BEFORE_SLEEP = 64;
+
+
+// Number of unfinished jobs of a group. Pass the same counter to
+// JobSystem::run() for every job of the group and JobSystem::wait() on it to
+// join them; jobs may themselves run jobs on the counter they belong to.
+class JobCounter
+{
+public:
+    JobCounter() {}
+
+    // No copy constructor nor copy assignment are allowed.
+    JobCounter(const JobCounter& other) = delete;
+    JobCounter& operator=(const JobCounter& other) = delete;
+
+    bool done() const
+    {
+        return this->pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> pending{0};
+};
+
+
+struct Job
+{
+    std::function<void()> work;
+    JobCounter* counter;
+};
+
+
+// Chase-Lev work-stealing deque of fixed capacity. The owning thread pushes
+// and pops at the bottom; any other thread steals from the top. Only
+// steal() and the last element in pop() need a compare-and-swap.
+class JobDeque
+{
+public:
+    JobDeque()
+    {
+        for (auto& slot : this->buffer)
+            slot.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // Owner only. Returns false when the deque is full.
+    bool push(Job* job)
+    {
+        int64_t b = this->bottom.load(std::memory_order_relaxed);
+        int64_t t = this->top.load(std::memory_order_acquire);
+        if (b - t >= JOB_QUEUE_CAPACITY)
+            return false;
+        this->buffer[b & (JOB_QUEUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        this->bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Owner only. Takes the most recently pushed job.
+    Job* pop()
+    {
+        int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+        this->bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = this->top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            this->bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job* job = this->buffer[b & (JOB_QUEUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // Last job, race the thieves for it.
+            if (!this->top.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            this->bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Any thread. Takes the oldest job.
+    Job* steal()
+    {
+        int64_t t = this->top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = this->bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Job* job = this->buffer[t & (JOB_QUEUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!this->top.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+private:
+    // On separate cache lines, since thieves hammer top while the owner
+    // works on bottom.
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Job*> buffer[JOB_QUEUE_CAPACITY];
+};
+
+
+// A pool of one thread per core, each with its own JobDeque. A thread runs
+// the jobs it pushed itself in LIFO order and steals the oldest job of
+// another thread when it runs dry, so work spreads out without a shared
+// queue. The thread that creates the system owns deque 0 and takes part in
+// the work while it waits. Threads outside the system can run jobs too,
+// through a small locked queue.
+//
+//     JobCounter counter;
+//     jobs.run(counter, [&]() { ... });       // any number of times
+//     jobs.wait(counter);
+//
+// Jobs must not throw, and everything they capture by reference has to
+// outlive the wait.
+class JobSystem
+{
+public:
+    // numThreads counts the creating thread; 0 means one per core.
+    JobSystem(unsigned int numThreads = 0)
+    {
+        if (numThreads == 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        this->owner = std::this_thread::get_id();
+        for (unsigned int i = 0; i < numThreads; ++i)
+            this->queues.emplace_back(new JobDeque());
+        for (unsigned int i = 1; i < numThreads; ++i)
+            this->workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->stopping = true;
+        }
+        this->wakeup.notify_all();
+        for (auto& worker : this->workers)
+            worker.join();
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    JobSystem(const JobSystem& other) = delete;
+    JobSystem& operator=(const JobSystem& other) = delete;
+
+    unsigned int getNumThreads() const
+    {
+        return (unsigned int)this->queues.size();
+    }
+
+    void run(JobCounter& counter, std::function<void()> work)
+    {
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        Job* job = new Job{ std::move(work), &counter };
+
+        int index = this->currentIndex();
+        if (index >= 0)
+        {
+            if (!this->queues[index]->push(job))
+            {
+                // Full, so there is plenty to steal already.
+                this->execute(job);
+                return;
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(this->injectedMutex);
+            this->injected.push_back(job);
+        }
+
+        this->queuedJobs.fetch_add(1);
+        if (this->sleepers.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->wakeup.notify_one();
+        }
+    }
+
+    // Runs jobs, any jobs, until the counter drops to zero.
+    void wait(JobCounter& counter)
+    {
+        int index = this->currentIndex();
+        while (!counter.done())
+        {
+            Job* job = this->findJob(index);
+            if (job)
+                this->execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // Calls body(first, last) on ranges of at most grain indices covering
+    // [begin, end), in parallel, and returns once all of them are done.
+    template <typename F>
+    void parallelFor(size_t begin, size_t end, size_t grain, F body)
+    {
+        if (end <= begin)
+            return;
+        grain = std::max<size_t>(grain, 1);
+        if (end - begin <= grain || this->queues.size() == 1)
+        {
+            body(begin, end);
+            return;
+        }
+
+        JobCounter counter;
+        for (size_t first = begin; first < end; first += grain)
+        {
+            size_t last = std::min(first + grain, end);
+            this->run(counter, [&body, first, last]() { body(first, last); });
+        }
+        this->wait(counter);
+    }
+
+private:
+    std::thread::id owner;
+    std::vector<std::unique_ptr<JobDeque>> queues;     // One per thread
+    std::vector<std::thread> workers;
+
+    // Jobs run from threads that do not own a deque.
+    std::mutex injectedMutex;
+    std::deque<Job*> injected;
+
+    // Idle workers sleep until a job is queued.
+    std::atomic<int> queuedJobs{0};
+    std::atomic<int> sleepers{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+
+    struct WorkerContext
+    {
+        JobSystem* system = nullptr;
+        int index = -1;
+    };
+
+    static WorkerContext& context()
+    {
+        static thread_local WorkerContext ctx;
+        return ctx;
+    }
+
+    // Deque of the calling thread, -1 if it has none.
+    int currentIndex() const
+    {
+        const WorkerContext& ctx = context();
+        if (ctx.system == this)
+            return ctx.index;
+        return std::this_thread::get_id() == this->owner ? 0 : -1;
+    }
+
+    Job* findJob(int index)
+    {
+        Job* job = index >= 0 ? this->queues[index]->pop() : nullptr;
+        if (!job)
+        {
+            std::lock_guard<std::mutex> lock(this->injectedMutex);
+            if (!this->injected.empty())
+            {
+                job = this->injected.front();
+                this->injected.pop_front();
+            }
+        }
+        // Start at the next thread so thieves do not all hit the same victim.
+        size_t numQueues = this->queues.size();
+        for (size_t i = 1; !job && i <= numQueues; ++i)
+        {
+            size_t victim = (size_t)(index + 1) + i - 1;
+            job = this->queues[victim % numQueues]->steal();
+        }
+        if (job)
+            this->queuedJobs.fetch_sub(1);
+        return job;
+    }
+
+    void execute(Job* job)
+    {
+        job->work();
+        job->counter->pending.fetch_sub(1, std::memory_order_release);
+        delete job;
+    }
+
+    void workerLoop(int index)
+    {
+        WorkerContext& ctx = context();
+        ctx.system = this;
+        ctx.index = index;
+
+        int spins = 0;
+        while (true)
+        {
+            Job* job = this->findJob(index);
+            if (job)
+            {
+                this->execute(job);
+                spins = 0;
+                continue;
+            }
+            if (++spins < JOB_SPINS_BEFORE_SLEEP)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->sleepMutex);
+            this->sleepers.fetch_add(1);
+            this->wakeup.wait(lock, [this]() {
+                return this->stopping || this->queuedJobs.load() > 0;
+            });
+            this->sleepers.fetch_sub(1);
+            if (this->stopping)
+                return;
+            spins = 0;
+        }
+    }
+};
+}
+
+#endif
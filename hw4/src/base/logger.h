@@ -0,0 +1,481 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace engine
+{
+constexpr size_t LOG_BUFFER_CAPACITY = 1024;        // Records per thread, a power of two
+constexpr size_t LOG_PAYLOAD_SIZE = 200;            // Bytes of arguments per record
+constexpr int LOG_FLUSH_INTERVAL_MS = 20;
+
+enum LogLevel : uint8_t
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+enum LogCategory : uint8_t
+{
+    LOG_CATEGORY_ENGINE,
+    LOG_CATEGORY_RENDER,
+    LOG_CATEGORY_RESOURCE,
+    LOG_CATEGORY_INPUT,
+    LOG_CATEGORY_COUNT
+};
+
+
+// One message, with its arguments stored raw so that formatting happens on
+// the writer thread. Each argument is a type tag followed by its value.
+struct LogRecord
+{
+    uint64_t time;                      // Nanoseconds since the logger started
+    const char* format;                 // Must outlive the logger, e.g. a literal
+    uint32_t thread;
+    LogLevel level;
+    LogCategory category;
+    uint16_t size;
+    char payload[LOG_PAYLOAD_SIZE];
+
+    enum Tag : char
+    {
+        TAG_BOOL,
+        TAG_INT,
+        TAG_UINT,
+        TAG_DOUBLE,
+        TAG_STRING,
+        TAG_VEC3
+    };
+
+
+    void add(bool value) { this->put(TAG_BOOL, &value, sizeof(value)); }
+    void add(int value) { this->addInt(value); }
+    void add(long value) { this->addInt(value); }
+    void add(long long value) { this->addInt(value); }
+    void add(unsigned int value) { this->addUint(value); }
+    void add(unsigned long value) { this->addUint(value); }
+    void add(unsigned long long value) { this->addUint(value); }
+    void add(double value) { this->put(TAG_DOUBLE, &value, sizeof(value)); }
+    void add(const glm::vec3& value) { this->put(TAG_VEC3, &value, sizeof(value)); }
+    void add(const std::string& value) { this->addString(value.data(), value.size()); }
+
+    void add(const char* value)
+    {
+        this->addString(value, value ? std::strlen(value) : 0);
+    }
+
+    // Substitutes the arguments for the {} in the format, in order.
+    void write(std::string& out) const
+    {
+        size_t offset = 0;
+        for (const char* c = this->format; *c; ++c)
+        {
+            if (c[0] == '{' && c[1] == '}')
+            {
+                if (offset < this->size)
+                    this->formatArgument(out, offset);
+                else
+                    out += "{}";
+                ++c;
+            }
+            else
+            {
+                out += *c;
+            }
+        }
+    }
+
+private:
+    void addInt(long long value) { this->put(TAG_INT, &value, sizeof(value)); }
+    void addUint(unsigned long long value) { this->put(TAG_UINT, &value, sizeof(value)); }
+
+    void addString(const char* value, size_t length)
+    {
+        // Truncated to what fits.
+        length = std::min<size_t>(length, 255);
+        if ((size_t)this->size + 2 > LOG_PAYLOAD_SIZE)
+            return;
+        length = std::min<size_t>(length, LOG_PAYLOAD_SIZE - this->size - 2);
+        this->payload[this->size++] = TAG_STRING;
+        this->payload[this->size++] = (char)(uint8_t)length;
+        std::memcpy(this->payload + this->size, value, length);
+        this->size += (uint16_t)length;
+    }
+
+    void put(Tag tag, const void* value, size_t bytes)
+    {
+        if (this->size + 1 + bytes > LOG_PAYLOAD_SIZE)
+            return;
+        this->payload[this->size++] = tag;
+        std::memcpy(this->payload + this->size, value, bytes);
+        this->size += (uint16_t)bytes;
+    }
+
+    template <typename T>
+    T read(size_t& offset) const
+    {
+        T value;
+        std::memcpy(&value, this->payload + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    void formatArgument(std::string& out, size_t& offset) const
+    {
+        char text[96];
+        Tag tag = (Tag)this->payload[offset++];
+        switch (tag)
+        {
+        case TAG_BOOL:
+            out += this->read<bool>(offset) ? "true" : "false";
+            return;
+        case TAG_INT:
+            std::snprintf(text, sizeof(text), "%lld", this->read<long long>(offset));
+            break;
+        case TAG_UINT:
+            std::snprintf(text, sizeof(text), "%llu", this->read<unsigned long long>(offset));
+            break;
+        case TAG_DOUBLE:
+            std::snprintf(text, sizeof(text), "%g", this->read<double>(offset));
+            break;
+        case TAG_VEC3:
+        {
+            glm::vec3 v = this->read<glm::vec3>(offset);
+            std::snprintf(text, sizeof(text), "(%.3g, %.3g, %.3g)", v.x, v.y, v.z);
+            break;
+        }
+        case TAG_STRING:
+        {
+            size_t length = (uint8_t)this->payload[offset++];
+            out.append(this->payload + offset, length);
+            offset += length;
+            return;
+        }
+        }
+        out += text;
+    }
+};
+
+
+// Single-producer single-consumer ring of records. The producing thread
+// fills a slot in place and commits it; the writer thread consumes it.
+class LogBuffer
+{
+public:
+    LogBuffer() {}
+
+    // No copy constructor nor copy assignment are allowed.
+    LogBuffer(const LogBuffer& other) = delete;
+    LogBuffer& operator=(const LogBuffer& other) = delete;
+
+    // Producer only. nullptr when the ring is full.
+    LogRecord* acquire()
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head - this->tail.load(std::memory_order_acquire) >= LOG_BUFFER_CAPACITY)
+            return nullptr;
+        return &this->records[head & (LOG_BUFFER_CAPACITY - 1)];
+    }
+
+    // Producer only.
+    void commit()
+    {
+        this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer only. nullptr when the ring is empty.
+    const LogRecord* front() const
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail == this->head.load(std::memory_order_acquire))
+            return nullptr;
+        return &this->records[tail & (LOG_BUFFER_CAPACITY - 1)];
+    }
+
+    // Consumer only.
+    void pop()
+    {
+        this->tail.store(this->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    LogRecord records[LOG_BUFFER_CAPACITY];
+};
+
+
+// Lets a message through at most once per interval, for messages that would
+// otherwise be logged every frame. Safe to share between threads.
+class LogRateLimit
+{
+public:
+    LogRateLimit(double interval)
+        : interval((uint64_t)(interval * 1e9)) {}
+
+    bool allow()
+    {
+        uint64_t now = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+        uint64_t next = this->next.load(std::memory_order_relaxed);
+        if (now < next || !this->next.compare_exchange_strong(
+            next, now + this->interval, std::memory_order_relaxed))
+        {
+            this->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Messages held back so far.
+    uint64_t getSuppressed() const
+    {
+        return this->suppressed.load(std::memory_order_relaxed);
+    }
+
+private:
+    uint64_t interval;
+    std::atomic<uint64_t> next{0};
+    std::atomic<uint64_t> suppressed{0};
+};
+
+
+// Asynchronous logger. A message is filtered by level and category, then its
+// format string pointer and raw arguments are copied into a ring owned by
+// the calling thread; no lock is taken and nothing is formatted. A writer
+// thread drains the rings every LOG_FLUSH_INTERVAL_MS, formats the records
+// and writes them out in one batch. Messages logged while a thread's ring
+// is full are dropped and counted rather than waited for.
+//
+//     logger.info(LOG_CATEGORY_RESOURCE, "Loaded {} meshes from {}", count, path);
+//
+// Arguments may be integers, floating point numbers, bools, strings and
+// glm::vec3. Records from different threads are written in the order the
+// writer finds them, not strictly by time.
+class Logger
+{
+public:
+    Logger(std::ostream& out = std::cout)
+        : out(out), epoch(std::chrono::steady_clock::now())
+    {
+        for (int i = 0; i < LOG_CATEGORY_COUNT; ++i)
+            this->categoryEnabled[i].store(true, std::memory_order_relaxed);
+        this->writer = std::thread(&Logger::writerLoop, this);
+    }
+
+    ~Logger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->wakeupMutex);
+            this->stopping = true;
+        }
+        this->wakeup.notify_one();
+        this->writer.join();
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    Logger(const Logger& other) = delete;
+    Logger& operator=(const Logger& other) = delete;
+
+    void setLevel(LogLevel level)
+    {
+        this->minLevel.store(level, std::memory_order_relaxed);
+    }
+
+    void setCategoryEnabled(LogCategory category, bool enabled)
+    {
+        this->categoryEnabled[category].store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isEnabled(LogLevel level, LogCategory category) const
+    {
+        return level >= this->minLevel.load(std::memory_order_relaxed)
+            && this->categoryEnabled[category].load(std::memory_order_relaxed);
+    }
+
+    template <typename... Args>
+    void log(LogLevel level, LogCategory category, const char* format, const Args&... args)
+    {
+        if (!this->isEnabled(level, category))
+            return;
+        LogBuffer* buffer = this->getBuffer();
+        LogRecord* record = buffer->acquire();
+        if (!record)
+        {
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record->time = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - this->epoch
+        ).count();
+        record->format = format;
+        record->thread = this->getContext().index;
+        record->level = level;
+        record->category = category;
+        record->size = 0;
+        int unpack[] = { 0, (record->add(args), 0)... };
+        (void)unpack;
+        buffer->commit();
+
+        // Errors are written out promptly.
+        if (level >= LOG_LEVEL_ERROR)
+            this->wakeup.notify_one();
+    }
+
+    template <typename... Args>
+    void debug(LogCategory category, const char* format, const Args&... args)
+    {
+        this->log(LOG_LEVEL_DEBUG, category, format, args...);
+    }
+
+    template <typename... Args>
+    void info(LogCategory category, const char* format, const Args&... args)
+    {
+        this->log(LOG_LEVEL_INFO, category, format, args...);
+    }
+
+    template <typename... Args>
+    void warning(LogCategory category, const char* format, const Args&... args)
+    {
+        this->log(LOG_LEVEL_WARNING, category, format, args...);
+    }
+
+    template <typename... Args>
+    void error(LogCategory category, const char* format, const Args&... args)
+    {
+        this->log(LOG_LEVEL_ERROR, category, format, args...);
+    }
+
+    // Writes everything logged so far before returning.
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(this->writeMutex);
+        this->drain();
+    }
+
+private:
+    std::ostream& out;
+    std::chrono::steady_clock::time_point epoch;
+    std::atomic<uint8_t> minLevel{LOG_LEVEL_INFO};
+    std::atomic<bool> categoryEnabled[LOG_CATEGORY_COUNT];
+    std::atomic<uint64_t> dropped{0};
+    uint64_t droppedReported = 0;
+
+    // One ring per thread that ever logged.
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<LogBuffer>> buffers;
+
+    std::thread writer;
+    std::mutex writeMutex;              // Held while draining
+    std::mutex wakeupMutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::string text;                   // Batch being written
+
+
+    struct ThreadContext
+    {
+        Logger* logger = nullptr;
+        LogBuffer* buffer = nullptr;
+        uint32_t index = 0;
+    };
+
+    static ThreadContext& getContext()
+    {
+        static thread_local ThreadContext context;
+        return context;
+    }
+
+    LogBuffer* getBuffer()
+    {
+        ThreadContext& context = getContext();
+        if (context.logger != this)
+        {
+            std::lock_guard<std::mutex> lock(this->buffersMutex);
+            this->buffers.emplace_back(new LogBuffer());
+            context.logger = this;
+            context.buffer = this->buffers.back().get();
+            context.index = (uint32_t)this->buffers.size() - 1;
+        }
+        return context.buffer;
+    }
+
+    void drain()
+    {
+        static const char* LEVEL_NAMES[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+        static const char* CATEGORY_NAMES[] = { "engine", "render", "resource", "input" };
+
+        std::vector<LogBuffer*> rings;
+        {
+            std::lock_guard<std::mutex> lock(this->buffersMutex);
+            for (auto& buffer : this->buffers)
+                rings.push_back(buffer.get());
+        }
+
+        this->text.clear();
+        char prefix[64];
+        for (LogBuffer* ring : rings)
+        {
+            while (const LogRecord* record = ring->front())
+            {
+                std::snprintf(
+                    prefix, sizeof(prefix), "[%9.3f] %-7s #%u %s: ",
+                    record->time * 1e-9, LEVEL_NAMES[record->level], record->thread,
+                    CATEGORY_NAMES[record->category]
+                );
+                this->text += prefix;
+                record->write(this->text);
+                this->text += '\n';
+                ring->pop();
+            }
+        }
+        uint64_t dropped = this->dropped.load(std::memory_order_relaxed);
+        if (dropped != this->droppedReported)
+        {
+            this->text += "WARNING::LOGGER::DROPPED " + std::to_string(dropped - this->droppedReported)
+                + " messages\n";
+            this->droppedReported = dropped;
+        }
+
+        if (!this->text.empty())
+        {
+            this->out << this->text;
+            this->out.flush();
+        }
+    }
+
+    void writerLoop()
+    {
+        std::unique_lock<std::mutex> lock(this->wakeupMutex);
+        while (!this->stopping)
+        {
+            this->wakeup.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+            lock.unlock();
+            this->flush();
+            lock.lock();
+        }
+        lock.unlock();
+        this->flush();
+    }
+};
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/logger.h"
+
+
+// Build with ENGINE_PROFILE defined (the CMake option of the same name) to
+// record timings. Without it the PROFILE_* macros expand to nothing and the
+// Profiler methods return at once.
+#ifdef ENGINE_PROFILE
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+// Times the rest of the enclosing scope on the CPU. name must be a string
+// literal, or otherwise outlive the profiler.
+#define PROFILE_SCOPE(profiler, name) \
+    engine::ProfileScope PROFILE_JOIN(profileScope, __LINE__)((profiler), (name))
+#else
+#define PROFILE_SCOPE(profiler, name) ((void)0)
+#endif
+
+
+namespace engine
+{
+#ifdef ENGINE_PROFILE
+constexpr bool PROFILER_ENABLED = true;
+#else
+constexpr bool PROFILER_ENABLED = false;
+#endif
+constexpr size_t PROFILER_QUEUE_CAPACITY = 8192;    // Events, a power of two
+constexpr size_t PROFILER_TRACE_CAPACITY = 65536;   // Events kept for export
+constexpr size_t PROFILER_HISTORY = 256;            // Samples per scope for percentiles
+constexpr double PROFILER_SUMMARY_INTERVAL = 2.0;   // Seconds between summaries
+constexpr uint32_t PROFILER_GPU_THREAD = 0xFFFF;    // Trace track of GPU events
+
+
+enum class ProfileKind : uint8_t
+{
+    CPU,
+    GPU
+};
+
+
+// One timed scope. Times are in nanoseconds since the profiler started.
+struct ProfileEvent
+{
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+    uint32_t thread;
+    ProfileKind kind;
+};
+
+
+// Bounded multi-producer single-consumer queue of events. Producers never
+// block: when the queue is full the event is dropped and counted. Every slot
+// carries a sequence number telling whose turn it is, so producers only
+// contend on the head index.
+class ProfileQueue
+{
+public:
+    ProfileQueue()
+    {
+        for (size_t i = 0; i < PROFILER_QUEUE_CAPACITY; ++i)
+            this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    ProfileQueue(const ProfileQueue& other) = delete;
+    ProfileQueue& operator=(const ProfileQueue& other) = delete;
+
+    // Any thread.
+    bool push(const ProfileEvent& event)
+    {
+        size_t position = this->head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true)
+        {
+            slot = &this->slots[position & (PROFILER_QUEUE_CAPACITY - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0)
+            {
+                if (this->head.compare_exchange_weak(
+                    position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                this->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                position = this->head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->event = event;
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool pop(ProfileEvent& event)
+    {
+        Slot& slot = this->slots[this->tail & (PROFILER_QUEUE_CAPACITY - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != this->tail + 1)
+            return false;
+        event = slot.event;
+        slot.sequence.store(this->tail + PROFILER_QUEUE_CAPACITY, std::memory_order_release);
+        ++(this->tail);
+        return true;
+    }
+
+    uint64_t getDropped() const
+    {
+        return this->dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        ProfileEvent event;
+    };
+
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) size_t tail = 0;
+    std::atomic<uint64_t> dropped{0};
+    Slot slots[PROFILER_QUEUE_CAPACITY];
+};
+
+
+// Rolling percentiles of the last PROFILER_HISTORY durations of a scope.
+class ProfileStats
+{
+public:
+    void add(uint64_t duration)
+    {
+        if (this->samples.size() < PROFILER_HISTORY)
+            this->samples.push_back(duration);
+        else
+            this->samples[this->next] = duration;
+        this->next = (this->next + 1) % PROFILER_HISTORY;
+    }
+
+    size_t getCount() const
+    {
+        return this->samples.size();
+    }
+
+    // p in [0, 1], in nanoseconds.
+    uint64_t getPercentile(float p) const
+    {
+        if (this->samples.empty())
+            return 0;
+        std::vector<uint64_t> sorted(this->samples);
+        size_t index = std::min(
+            (size_t)(p * (sorted.size() - 1) + 0.5f), sorted.size() - 1
+        );
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+private:
+    std::vector<uint64_t> samples;
+    size_t next = 0;
+};
+
+
+// Collects timed scopes from any thread. Producers push events into a
+// lock-free queue; one consumer thread, normally the render thread, calls
+// collect() once a frame to fold them into the rolling statistics and the
+// trace kept for export.
+//
+//     {
+//         PROFILE_SCOPE(profiler, "shadow pass");
+//         ...
+//     }
+//     profiler.collect();
+//     profiler.logSummary(logger);
+//     profiler.writeChromeTrace("trace.json");  // chrome://tracing, Perfetto
+class Profiler
+{
+public:
+    Profiler() : epoch(std::chrono::steady_clock::now()) {}
+
+    // No copy constructor nor copy assignment are allowed.
+    Profiler(const Profiler& other) = delete;
+    Profiler& operator=(const Profiler& other) = delete;
+
+    // Nanoseconds since the profiler was created.
+    uint64_t now() const
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - this->epoch
+        ).count();
+    }
+
+    // Names the calling thread in exported traces.
+    void setThreadName(const std::string& name)
+    {
+        if (!PROFILER_ENABLED)
+            return;
+        std::lock_guard<std::mutex> lock(this->threadNamesMutex);
+        this->threadNames[this->getThreadIndex()] = name;
+    }
+
+    // Any thread.
+    void record(const char* name, uint64_t start, uint64_t end)
+    {
+        if (!PROFILER_ENABLED)
+            return;
+        this->queue.push({ name, start, end - start, this->getThreadIndex(), ProfileKind::CPU });
+    }
+
+    // Any thread. start is the CPU time the GPU work was submitted at, which
+    // is where the trace places it; duration is measured by the GPU.
+    void recordGpu(const char* name, uint64_t start, uint64_t duration)
+    {
+        if (!PROFILER_ENABLED)
+            return;
+        this->queue.push({ name, start, duration, PROFILER_GPU_THREAD, ProfileKind::GPU });
+    }
+
+    // Consumer thread only. Drains the queue.
+    void collect()
+    {
+        if (!PROFILER_ENABLED)
+            return;
+        ProfileEvent event;
+        while (this->queue.pop(event))
+        {
+            this->stats[{ event.kind, event.name }].add(event.duration);
+            if (this->trace.size() < PROFILER_TRACE_CAPACITY)
+                this->trace.push_back(event);
+            else
+                this->trace[this->traceNext] = event;
+            this->traceNext = (this->traceNext + 1) % PROFILER_TRACE_CAPACITY;
+        }
+    }
+
+    // Consumer thread only. p50/p95/p99 of every scope, in milliseconds,
+    // one line each.
+    void logSummary(Logger& log) const
+    {
+        if (!PROFILER_ENABLED)
+            return;
+        for (const auto& entry : this->stats)
+        {
+            const ProfileStats& scope = entry.second;
+            std::string label = (entry.first.first == ProfileKind::GPU ? "gpu " : "cpu ")
+                + std::string(entry.first.second);
+            log.info(
+                LOG_CATEGORY_ENGINE, "{}: p50 {} p95 {} p99 {} ms", label,
+                toMilliseconds(scope.getPercentile(0.50f)),
+                toMilliseconds(scope.getPercentile(0.95f)),
+                toMilliseconds(scope.getPercentile(0.99f))
+            );
+        }
+        if (this->queue.getDropped() > 0)
+        {
+            log.warning(
+                LOG_CATEGORY_ENGINE, "Profiler dropped {} events",
+                (unsigned long long)this->queue.getDropped()
+            );
+        }
+    }
+
+    // Consumer thread only. Writes the last PROFILER_TRACE_CAPACITY events in
+    // the Chrome trace event format. False if the file cannot be written.
+    bool writeChromeTrace(const std::string& path) const
+    {
+        if (!PROFILER_ENABLED)
+            return false;
+        std::ofstream file(path);
+        if (!file)
+            return false;
+
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+            << PROFILER_GPU_THREAD << ",\"args\":{\"name\":\"GPU\"}}";
+        {
+            std::lock_guard<std::mutex> lock(this->threadNamesMutex);
+            for (const auto& thread : this->threadNames)
+            {
+                file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+                    << thread.first << ",\"args\":{\"name\":\"" << escape(thread.second) << "\"}}";
+            }
+        }
+
+        // Oldest first.
+        size_t first = this->trace.size() < PROFILER_TRACE_CAPACITY ? 0 : this->traceNext;
+        file << std::fixed << std::setprecision(3);
+        for (size_t i = 0; i < this->trace.size(); ++i)
+        {
+            const ProfileEvent& event = this->trace[(first + i) % this->trace.size()];
+            file << ",\n{\"name\":\"" << escape(event.name) << "\",\"cat\":\""
+                << (event.kind == ProfileKind::GPU ? "gpu" : "cpu")
+                << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+                << ",\"ts\":" << event.start * 1e-3 << ",\"dur\":" << event.duration * 1e-3 << "}";
+        }
+        file << "\n]}\n";
+        return (bool)file;
+    }
+
+private:
+    std::chrono::steady_clock::time_point epoch;
+    ProfileQueue queue;
+    std::atomic<uint32_t> threadCount{0};
+
+    mutable std::mutex threadNamesMutex;
+    std::map<uint32_t, std::string> threadNames;
+
+    // Consumer thread only.
+    std::map<std::pair<ProfileKind, std::string>, ProfileStats> stats;
+    std::vector<ProfileEvent> trace;
+    size_t traceNext = 0;
+
+
+    // Small per-thread index, in the order threads first record something.
+    uint32_t getThreadIndex()
+    {
+        static thread_local uint32_t index = this->threadCount.fetch_add(1);
+        return index;
+    }
+
+    // Rounded to the microsecond, the resolution worth reading.
+    static double toMilliseconds(uint64_t nanoseconds)
+    {
+        return std::round(nanoseconds * 1e-3) * 1e-3;
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+
+// Records the time from its construction to the end of the scope.
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler& profiler, const char* name)
+        : profiler(profiler), name(name), start(profiler.now()) {}
+
+    ~ProfileScope()
+    {
+        this->profiler.record(this->name, this->start, this->profiler.now());
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    ProfileScope(const ProfileScope& other) = delete;
+    ProfileScope& operator=(const ProfileScope& other) = delete;
+
+private:
+    Profiler& profiler;
+    const char* name;
+    uint64_t start;
+};
+}
+
+#endif
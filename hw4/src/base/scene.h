@@ -10,8 +10,10 @@
 #include <vector>
 
 #include "base/entity.h"
+#include "base/entity_registry.h"
 
 #include "data/geometry.h"
+#include "data/lightmap.h"
 #include "data/model.h"
 #include "data/shader.h"
 #include "data/texture.h"
@@ -20,10 +22,23 @@
 
 namespace engine
 {
+// Threading: a scene belongs to the main thread, which runs the simulation.
+// Only it may add or delete anything, and no job may be in flight while it
+// does. Jobs may read the registry arrays and write to disjoint elements of
+// the arrays they are handed, as FrustumCuller and
+// EntityRegistry::updateWorldMatrices() do. Loading jobs only produce CPU
+// data; GL objects are created on the thread holding the GL context. Once the
+// render thread runs, it owns the context and sees the scene only through
+// FrameSnapshot, and the assets must not be deleted until it has stopped.
+// Textures still streaming in are filled by the render thread, through
+// TextureStreamer.
 class Scene
 {
 public:
+    // The name map is for lookups only; passes over the scene iterate the
+    // registry.
     std::map<std::string, Entity*> entities;
+    EntityRegistry registry;
 
 
     Scene()
@@ -58,6 +73,10 @@ public:
         {
             delete elem.second;
         }
+        for (auto& elem : this->lightmaps)
+        {
+            delete elem.second;
+        }
     }
 
     // Insert and delete interface.
@@ -153,6 +172,16 @@ public:
         {
             throw std::runtime_error("ERROR::SCENE::Key already exists in entities");
         }
+
+        // Resolve the model once, instead of casting attributes every frame.
+        // The parent has to be added first.
+        ModelAttribute* modelAttrib = entity->getAttribute<ModelAttribute>();
+        entity->handle = this->registry.create(
+            entity, entity->tf, modelAttrib ? modelAttrib->model : nullptr,
+            entity->parent ? entity->parent->handle : EntityHandle()
+        );
+        this->registry.lightmaps[this->registry.indexOf(entity->handle)]
+            = this->getLightmap(entity->name);
     }
 
     void addEntities(std::vector<Entity*> entities)
@@ -163,6 +192,43 @@ public:
         }
     }
 
+    void deleteEntity(const std::string& key)
+    {
+        auto ptr = this->entities.find(key);
+        if (ptr == this->entities.end())
+        {
+            throw std::runtime_error("ERROR::SCENE::Key does not exist in entities");
+        }
+        this->registry.destroy(ptr->second->handle);
+        delete ptr->second;
+        this->entities.erase(ptr);
+    }
+
+    // Lightmaps are keyed by the name of the entity they were baked for.
+    void addLightmap(Lightmap* lightmap)
+    {
+        auto ptr = this->lightmaps.insert(std::make_pair(lightmap->name, lightmap));
+        if (!ptr.second)
+        {
+            throw std::runtime_error("ERROR::SCENE::Key already exists in lightmaps");
+        }
+
+        auto entity = this->entities.find(lightmap->name);
+        if (entity != this->entities.end())
+        {
+            this->registry.lightmaps[this->registry.indexOf(entity->second->handle)] = lightmap;
+            this->registry.markChanged();
+        }
+    }
+
+    void addLightmaps(std::vector<Lightmap*> lightmaps)
+    {
+        for (auto& lightmap : lightmaps)
+        {
+            this->addLightmap(lightmap);
+        }
+    }
+
     // Getters.
     Shader* getShader(const std::string& key)
     {
@@ -194,6 +260,13 @@ public:
         return this->entities[key];
     }
 
+    // Most entities have no lightmap, so do not insert on lookup.
+    Lightmap* getLightmap(const std::string& key)
+    {
+        auto ptr = this->lightmaps.find(key);
+        return ptr == this->lightmaps.end() ? nullptr : ptr->second;
+    }
+
     // TODO: Read json and parse for the scene.
     // Manipulate entity tree.
     // void addEntity(Entity* toAdd, Entity* parent = nullptr)
@@ -214,6 +287,7 @@ private:
     std::map<std::string, CubemapTexture*> cubemapTextures;
     std::map<std::string, Geometry*> geometries;
     std::map<std::string, Model*> models;
+    std::map<std::string, Lightmap*> lightmaps;
 };
 }
 #endif
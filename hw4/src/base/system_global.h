@@ -3,9 +3,14 @@
 
 #include <vector>
 
+#include "base/asset_bundle.h"
 #include "base/screen.h"
 #include "base/timer.h"
 #include "base/graphics_settings.h"
+#include "base/job_system.h"
+#include "base/logger.h"
+#include "base/profiler.h"
+#include "data/mesh_arena.h"
 
 // #include "base/behavior.h"
 
@@ -14,6 +19,16 @@
 engine::ScreenInfo screen;
 engine::Timer timer;
 engine::GraphicsSettings graphicsSettings;
+// One worker per core, shared by every subsystem.
+engine::JobSystem jobSystem;
+// Timings of every thread; see PROFILE_SCOPE.
+engine::Profiler profiler;
+// Asynchronous log shared by every thread.
+engine::Logger logger;
+// Packed scene assets, when a bundle was built; see pack_assets.
+engine::AssetBundle assetBundle;
+// Vertex and index buffers shared by every mesh.
+engine::MeshArena meshArena;
 
 // TODO list of delegates to be called at startup or at each iteration.
 // std::vector<engine::Behavior*> behaviorQueue = {};
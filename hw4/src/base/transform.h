@@ -92,6 +92,14 @@ public:
         return model;
     }
 
+    // The rotation of getModelMatrix() as a quaternion.
+    glm::quat getQuaternion() const
+    {
+        return glm::angleAxis(glm::radians(this->rotation.z), glm::vec3(0.0f, 0.0f, 1.0f))
+            * glm::angleAxis(glm::radians(this->rotation.x), glm::vec3(1.0f, 0.0f, 0.0f))
+            * glm::angleAxis(glm::radians(this->rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
     // Interface for movements and transforms.
     void translate(glm::vec3 displacement)
     {
@@ -171,5 +179,34 @@ private:
         return tf;
     }
 };
+
+
+// Translation, rotation and scale of a node relative to its parent, as stored
+// by the transform hierarchy. Unlike Transform the rotation is a quaternion,
+// so building the matrix needs no trigonometry.
+struct LocalTransform
+{
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+
+    LocalTransform() {}
+
+    LocalTransform(const Transform& tf)
+        : position(tf.position), rotation(tf.getQuaternion()), scale(tf.scale) {}
+
+    // Same as Transform::getModelMatrix(), T * R * S.
+    glm::mat4 getMatrix() const
+    {
+        glm::mat3 r = glm::mat3_cast(this->rotation);
+        glm::mat4 model(1.0f);
+        model[0] = glm::vec4(r[0] * this->scale.x, 0.0f);
+        model[1] = glm::vec4(r[1] * this->scale.y, 0.0f);
+        model[2] = glm::vec4(r[2] * this->scale.z, 0.0f);
+        model[3] = glm::vec4(this->position, 1.0f);
+        return model;
+    }
+};
 }
 #endif
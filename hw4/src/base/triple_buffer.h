@@ -0,0 +1,75 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace engine
+{
+// Hands values from one producer thread to one consumer thread without
+// locks and without either side ever waiting. The producer fills the write
+// slot and publishes it; the consumer picks up the latest published slot and
+// keeps reading it until a newer one arrives. Values the consumer was too
+// slow to see are dropped.
+//
+//     // Producer                         // Consumer
+//     T& value = buffer.getWriteBuffer();  buffer.update();
+//     ...                                  const T& value = buffer.getReadBuffer();
+//     buffer.publish();
+//
+// The slots are reused, so a producer should overwrite every field it uses.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() {}
+
+    // No copy constructor nor copy assignment are allowed.
+    TripleBuffer(const TripleBuffer& other) = delete;
+    TripleBuffer& operator=(const TripleBuffer& other) = delete;
+
+    // Producer only.
+    T& getWriteBuffer()
+    {
+        return this->buffers[this->write];
+    }
+
+    // Producer only. Swaps the written slot with the middle one.
+    void publish()
+    {
+        uint8_t previous = this->middle.exchange(
+            (uint8_t)(this->write | FRESH), std::memory_order_acq_rel
+        );
+        this->write = previous & INDEX_MASK;
+    }
+
+    // Consumer only. Takes the latest published slot, if there is one the
+    // consumer has not seen yet, and returns whether it did.
+    bool update()
+    {
+        if (!(this->middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        uint8_t previous = this->middle.exchange(this->read, std::memory_order_acq_rel);
+        this->read = previous & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer only.
+    const T& getReadBuffer() const
+    {
+        return this->buffers[this->read];
+    }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH = 0x4;   // The middle slot is unread
+
+    T buffers[3];
+    uint8_t write = 0;
+    uint8_t read = 1;
+    std::atomic<uint8_t> middle{2};
+};
+}
+
+#endif
@@ -0,0 +1,259 @@
+// Compares a pass over the scene through the entity name map, the way the
+// renderer used to walk it, with a linear pass over the entity registry, and
+// times the transform hierarchy update for a few fractions of moving entities.
+// Finally shows how the hierarchy update and frustum culling scale with the
+// number of job system threads.
+//
+// Usage: entity_bench [frames]
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/attribute.h"
+#include "base/entity.h"
+#include "base/job_system.h"
+#include "base/scene.h"
+#include "base/transform.h"
+#include "data/model.h"
+#include "render/frustum_culler.h"
+
+
+constexpr int DEFAULT_BENCH_FRAMES = 100;
+// The renderer walks the scene once for shadows and once for lighting.
+constexpr int PASSES_PER_FRAME = 2;
+constexpr size_t HIERARCHY_BENCH_ENTITIES = 100000;
+constexpr size_t HIERARCHY_BENCH_FANOUT = 8;
+constexpr size_t SCALING_BENCH_ENTITIES = 100000;
+
+
+static engine::Scene* createScene(engine::Model* model, size_t count)
+{
+    engine::Scene* scene = new engine::Scene();
+    scene->registry.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        engine::Transform tf(glm::vec3(i % 100, (i / 100) % 100, i / 10000));
+        scene->addEntity(new engine::Entity(
+            "Entity " + std::to_string(i), nullptr, tf,
+            new engine::ModelAttribute(model)
+        ));
+    }
+    return scene;
+}
+
+// Sums the matrices so the compiler cannot drop the loops.
+static float mapPass(engine::Scene* scene)
+{
+    float sum = 0.0f;
+    for (const auto& entity : scene->entities)
+    {
+        engine::ModelAttribute* modelAttrib
+            = entity.second->getAttribute<engine::ModelAttribute>();
+        if (modelAttrib && !(modelAttrib->model->ignoreShadow))
+            sum += entity.second->tf.getModelMatrix()[3][0];
+    }
+    return sum;
+}
+
+static float registryPass(engine::Scene* scene)
+{
+    float sum = 0.0f;
+    engine::EntityRegistry& registry = scene->registry;
+    registry.updateWorldMatrices();
+    for (size_t i = 0; i < registry.size(); ++i)
+    {
+        engine::Model* model = registry.models[i];
+        if (model && !(model->ignoreShadow))
+            sum += registry.worldMatrices[i][3][0];
+    }
+    return sum;
+}
+
+// A tree where entity i is the child of entity (i - 1) / fanout.
+static engine::Scene* createHierarchy(engine::Model* model, size_t count)
+{
+    engine::Scene* scene = new engine::Scene();
+    scene->registry.reserve(count);
+    std::vector<engine::Entity*> entities(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        engine::Entity* parent = i > 0 ? entities[(i - 1) / HIERARCHY_BENCH_FANOUT] : nullptr;
+        entities[i] = new engine::Entity(
+            "Node " + std::to_string(i), parent,
+            engine::Transform(glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 10.0f, 0.0f)),
+            new engine::ModelAttribute(model)
+        );
+        scene->addEntity(entities[i]);
+    }
+    return scene;
+}
+
+static double timeHierarchyUpdate(
+    engine::Scene* scene, int frames, double movingFraction,
+    engine::JobSystem* jobs = nullptr
+) {
+    engine::EntityRegistry& registry = scene->registry;
+    registry.updateWorldMatrices(jobs);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    double total = 0.0;
+    for (int f = 0; f < frames; ++f)
+    {
+        for (size_t i = 0; i < registry.size(); ++i)
+        {
+            if (uniform(rng) < movingFraction)
+                registry.setPosition(registry.entities[i]->handle, glm::vec3(uniform(rng)));
+        }
+        auto start = std::chrono::steady_clock::now();
+        registry.updateWorldMatrices(jobs);
+        auto end = std::chrono::steady_clock::now();
+        total += std::chrono::duration<double, std::micro>(end - start).count();
+    }
+    return total / frames;
+}
+
+// Gives every entity a unit box around its position, as its mesh would.
+static void setUnitBounds(engine::EntityRegistry& registry)
+{
+    for (size_t i = 0; i < registry.size(); ++i)
+    {
+        glm::vec3 position = glm::vec3(registry.worldMatrices[i][3]);
+        registry.worldBounds[i].center = position;
+        registry.worldBounds[i].extents = glm::vec3(0.5f);
+        registry.worldSpheres[i].center = position;
+        registry.worldSpheres[i].radius = 0.87f;
+    }
+}
+
+static double timeCulling(
+    engine::Scene* scene, int frames, const glm::mat4& viewProjection,
+    engine::JobSystem* jobs, unsigned int& culled
+) {
+    std::vector<uint8_t> visible;
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        culled = engine::FrustumCuller::cull(
+            scene->registry, viewProjection, visible, jobs
+        ).culled;
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+// Runs the hierarchy update with every entity moving, and culling, on job
+// systems of 1, 2, 4, ... threads up to one per core.
+static void timeScaling(engine::Model* model, int frames)
+{
+    engine::Scene* hierarchy = createHierarchy(model, SCALING_BENCH_ENTITIES);
+    engine::Scene* grid = createScene(model, SCALING_BENCH_ENTITIES);
+    grid->registry.updateWorldMatrices();
+    setUnitBounds(grid->registry);
+    // From the side of the 100 x 100 x 10 grid, so part of it is culled.
+    glm::mat4 viewProjection
+        = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f)
+        * glm::lookAt(
+            glm::vec3(-10.0f, 50.0f, 5.0f), glm::vec3(90.0f, 50.0f, 5.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f)
+        );
+
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    std::cout << std::endl << "threads (" << SCALING_BENCH_ENTITIES
+        << " entities)	hierarchy (us/frame)	speedup	culling (us/frame)	speedup"
+        << std::endl;
+    double baseHierarchy = 0.0;
+    double baseCulling = 0.0;
+    unsigned int culled = 0;
+    for (unsigned int n : threadCounts)
+    {
+        engine::JobSystem jobs(n);
+        double hierarchyTime = timeHierarchyUpdate(hierarchy, frames, 1.0, &jobs);
+        double cullingTime = timeCulling(grid, frames, viewProjection, &jobs, culled);
+        if (n == 1)
+        {
+            baseHierarchy = hierarchyTime;
+            baseCulling = cullingTime;
+        }
+        std::cout << n << "				" << hierarchyTime << "			"
+            << baseHierarchy / hierarchyTime << "x	" << cullingTime << "			"
+            << baseCulling / cullingTime << "x" << std::endl;
+    }
+    std::cout << "(culled " << culled << ")" << std::endl;
+
+    delete grid;
+    delete hierarchy;
+}
+
+template <typename Pass>
+static double timeFrames(engine::Scene* scene, int frames, Pass pass, float& sink)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+        for (int p = 0; p < PASSES_PER_FRAME; ++p)
+            sink += pass(scene);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int frames = argc > 1 ? std::atoi(argv[1]) : DEFAULT_BENCH_FRAMES;
+    if (frames <= 0)
+    {
+        std::cout << "ERROR::ENTITY_BENCH::Invalid frame count " << argv[1] << std::endl;
+        return -1;
+    }
+
+    // Only the pointer is touched, so no mesh is needed.
+    engine::Model* model = new engine::Model("Bench Model", (engine::Mesh*)nullptr);
+
+    std::cout << "entities\tmap (us/frame)\tregistry (us/frame)\tspeedup" << std::endl;
+    float sink = 0.0f;
+    for (size_t count : { 100, 1000, 10000, 100000 })
+    {
+        engine::Scene* scene = createScene(model, count);
+        // Warm up the caches and the allocator once before timing.
+        sink += mapPass(scene) + registryPass(scene);
+        double mapTime = timeFrames(scene, frames, mapPass, sink);
+        double registryTime = timeFrames(scene, frames, registryPass, sink);
+        std::cout << count << "\t\t" << mapTime << "\t\t" << registryTime
+            << "\t\t\t" << mapTime / registryTime << "x" << std::endl;
+        delete scene;
+    }
+
+    engine::Scene* hierarchy = createHierarchy(model, HIERARCHY_BENCH_ENTITIES);
+    std::cout << std::endl << "moving (of " << HIERARCHY_BENCH_ENTITIES
+        << ", fanout " << HIERARCHY_BENCH_FANOUT << ")\tupdate (us/frame)" << std::endl;
+    for (double fraction : { 0.0, 0.001, 0.01, 0.1, 1.0 })
+    {
+        std::cout << fraction * 100.0 << "%\t\t\t\t"
+            << timeHierarchyUpdate(hierarchy, frames, fraction) << std::endl;
+    }
+    sink += registryPass(hierarchy);
+    delete hierarchy;
+
+    timeScaling(model, frames);
+
+    std::cout << "(checksum " << sink << ")" << std::endl;
+
+    delete model;
+    return 0;
+}
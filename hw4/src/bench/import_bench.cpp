@@ -0,0 +1,74 @@
+// Imports a model file with Assimp and with the native ObjImporter, a few
+// times each, and compares the best times and the meshes they produce. The
+// mesh cache and the asset bundle are bypassed.
+//
+// Usage: import_bench file.obj [runs]
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/system_global.h"
+#include "data/mesh.h"
+#include "data/model.h"
+#include "data/obj_importer.h"
+
+constexpr int DEFAULT_BENCH_RUNS = 3;
+
+
+template <typename F>
+double timeImport(int runs, F import, engine::MeshData& mesh)
+{
+    double best = 1e30;
+    for (int i = 0; i < runs; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!import(mesh))
+            return -1.0;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: import_bench file.obj [runs]" << std::endl;
+        return -1;
+    }
+    std::string path = argv[1];
+    int runs = argc > 2 ? std::atoi(argv[2]) : DEFAULT_BENCH_RUNS;
+    if (runs <= 0)
+    {
+        std::cout << "ERROR::IMPORT_BENCH::Invalid run count " << argv[2] << std::endl;
+        return -1;
+    }
+
+    engine::MeshData mesh;
+    std::cout << "importer\tbest (ms)\tvertices\tindices\t\tsubmeshes" << std::endl;
+
+    double assimpTime = timeImport(runs, [&](engine::MeshData& mesh) {
+        return engine::Model::importWithAssimp(path, mesh);
+    }, mesh);
+    std::cout << "assimp\t\t" << assimpTime << "\t\t" << mesh.vertices.size()
+        << "\t\t" << mesh.indices.size() << "\t\t" << mesh.submeshes.size() << std::endl;
+
+    double nativeTime = timeImport(runs, [&](engine::MeshData& mesh) {
+        return engine::ObjImporter::import(path, mesh, jobSystem);
+    }, mesh);
+    std::cout << "native\t\t" << nativeTime << "\t\t" << mesh.vertices.size()
+        << "\t\t" << mesh.indices.size() << "\t\t" << mesh.submeshes.size() << std::endl;
+
+    if (assimpTime > 0.0 && nativeTime > 0.0)
+        std::cout << "speedup " << assimpTime / nativeTime << "x" << std::endl;
+    logger.flush();
+    return 0;
+}
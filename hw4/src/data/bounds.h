@@ -0,0 +1,110 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+
+namespace engine
+{
+// Axis-aligned bounding box, stored as center and half extents since that is
+// what the frustum test wants. Empty boxes have negative extents.
+struct AABB
+{
+    glm::vec3 center = glm::vec3(0.0f);
+    glm::vec3 extents = glm::vec3(-1.0f);
+
+
+    bool isEmpty() const
+    {
+        return this->extents.x < 0.0f;
+    }
+
+    // Box of the transformed box (Arvo), conservative under rotation.
+    AABB transformed(const glm::mat4& m) const
+    {
+        if (this->isEmpty())
+            return *this;
+        glm::mat3 a = glm::mat3(m);
+        glm::mat3 absA;
+        for (int c = 0; c < 3; ++c)
+            absA[c] = glm::abs(a[c]);
+
+        AABB box;
+        box.center = glm::vec3(m * glm::vec4(this->center, 1.0f));
+        box.extents = absA * this->extents;
+        return box;
+    }
+};
+
+
+struct BoundingSphere
+{
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = -1.0f;
+
+
+    BoundingSphere transformed(const glm::mat4& m) const
+    {
+        if (this->radius < 0.0f)
+            return *this;
+        // Non-uniform scales stretch the sphere by the largest axis scale.
+        float scale = std::max(std::max(
+            glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1]))),
+            glm::length(glm::vec3(m[2]))
+        );
+
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(m * glm::vec4(this->center, 1.0f));
+        sphere.radius = this->radius * scale;
+        return sphere;
+    }
+};
+
+
+template <typename VertexT>
+AABB computeAABB(const std::vector<VertexT>& vertices)
+{
+    AABB box;
+    if (vertices.empty())
+        return box;
+
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
+    for (const VertexT& v : vertices)
+    {
+        lo = glm::min(lo, v.position);
+        hi = glm::max(hi, v.position);
+    }
+    box.center = 0.5f * (lo + hi);
+    box.extents = 0.5f * (hi - lo);
+    return box;
+}
+
+// Sphere around the box center. Not the minimal sphere, but never larger
+// than the sphere around the box and cheap to build.
+template <typename VertexT>
+BoundingSphere computeBoundingSphere(
+    const std::vector<VertexT>& vertices, const AABB& box
+) {
+    BoundingSphere sphere;
+    if (vertices.empty())
+        return sphere;
+
+    float radius2 = 0.0f;
+    for (const VertexT& v : vertices)
+    {
+        glm::vec3 d = v.position - box.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    sphere.center = box.center;
+    sphere.radius = std::sqrt(radius2);
+    return sphere;
+}
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base/asset.h"
+#include "base/system_global.h"
+#include "data/mesh.h"
+
+
+namespace engine
+{
+constexpr unsigned int DEFAULT_LIGHTMAP_RESOLUTION = 256;
+// Largest atlas generated, or accepted from a file.
+constexpr unsigned int LIGHTMAP_MAX_RESOLUTION = 4096;
+constexpr unsigned int LIGHTMAP_CHART_PADDING = 2;      // Texels around each chart
+constexpr float LIGHTMAP_FILL_RATIO = 0.6f;             // Initial packing guess
+constexpr uint32_t LIGHTMAP_FILE_MAGIC = 0x50414d4c;    // "LMAP"
+constexpr uint32_t LIGHTMAP_FILE_VERSION = 1;
+
+
+// Baked irradiance of a single static entity. Texels are addressed with the
+// lightmap coordinates of the entity's model, so instances sharing a model
+// share the atlas layout but own separate lightmaps.
+class Lightmap : public Asset
+{
+public:
+    unsigned int ID = 0;
+    int width;
+    int height;
+    float azimuth;                  // Sun direction the lightmap was baked for
+    float elevation;
+    std::vector<glm::vec3> texels;
+
+
+    Lightmap(const std::string& name, int width, int height)
+        : Asset(name), width(width), height(height), azimuth(0.0f),
+          elevation(0.0f), texels(width * height, glm::vec3(0.0f)) {}
+
+    // Loads a lightmap written by save(). On failure the lightmap is left
+    // empty and isLoaded() returns false.
+    Lightmap(const std::string& name, const std::string& filePath)
+        : Asset(name), width(0), height(0), azimuth(0.0f), elevation(0.0f)
+    {
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+            return;
+
+        uint32_t header[4];
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!file || header[0] != LIGHTMAP_FILE_MAGIC
+            || header[1] != LIGHTMAP_FILE_VERSION)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Invalid lightmap file {}", filePath);
+            return;
+        }
+        file.read(reinterpret_cast<char*>(&this->azimuth), sizeof(float));
+        file.read(reinterpret_cast<char*>(&this->elevation), sizeof(float));
+
+        if (header[2] == 0 || header[3] == 0
+            || header[2] > LIGHTMAP_MAX_RESOLUTION || header[3] > LIGHTMAP_MAX_RESOLUTION)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Lightmap size out of range in {}", filePath);
+            return;
+        }
+        std::vector<glm::vec3> texels((size_t)header[2] * header[3]);
+        file.read(
+            reinterpret_cast<char*>(texels.data()),
+            texels.size() * sizeof(glm::vec3)
+        );
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Truncated lightmap file {}", filePath);
+            return;
+        }
+        this->width = (int)header[2];
+        this->height = (int)header[3];
+        this->texels.swap(texels);
+        this->upload();
+    }
+
+    ~Lightmap()
+    {
+        if (this->ID)
+            glDeleteTextures(1, &(this->ID));
+    }
+
+    bool isLoaded() const
+    {
+        return this->ID != 0;
+    }
+
+    // The lightmap holds the sun's contribution, so it is only valid while the
+    // sun stays where it was during the bake.
+    bool matches(float azimuth, float elevation) const
+    {
+        return std::abs(this->azimuth - azimuth) < 1e-3f
+            && std::abs(this->elevation - elevation) < 1e-3f;
+    }
+
+    void upload()
+    {
+        if (!this->ID)
+            glGenTextures(1, &(this->ID));
+        glBindTexture(GL_TEXTURE_2D, this->ID);
+
+        // No mipmaps: lower levels would blend neighbouring charts together.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_RGB16F, this->width, this->height, 0,
+            GL_RGB, GL_FLOAT, this->texels.data()
+        );
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    bool save(const std::string& filePath) const
+    {
+        std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to write lightmap {}", filePath);
+            return false;
+        }
+
+        uint32_t header[4] = {
+            LIGHTMAP_FILE_MAGIC, LIGHTMAP_FILE_VERSION,
+            (uint32_t)this->width, (uint32_t)this->height
+        };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(&this->azimuth), sizeof(float));
+        file.write(reinterpret_cast<const char*>(&this->elevation), sizeof(float));
+        file.write(
+            reinterpret_cast<const char*>(this->texels.data()),
+            this->texels.size() * sizeof(glm::vec3)
+        );
+        return (bool)file;
+    }
+};
+
+
+// Builds a lightmap atlas for a mesh. Triangles are grouped into charts of
+// edge-connected faces sharing the same dominant normal axis, each chart is
+// projected onto that axis plane, and the charts are shelf-packed into a
+// square of the given resolution with a gutter of LIGHTMAP_CHART_PADDING
+// texels. Every triangle gets its own corners in the output, so the mesh is
+// unwelded: vertices and indices are replaced. Triangles come out chart by
+// chart; sourceTriangles, if given, receives the input triangle of each.
+// Returns false, leaving the mesh as it is, if the charts do not fit the
+// resolution even at the smallest texel density tried.
+bool generateLightmapCoords(
+    std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+    unsigned int resolution, std::vector<unsigned int>* sourceTriangles = nullptr
+) {
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return true;
+
+    // Dominant axis bucket (0..5) of every triangle.
+    std::vector<int> bucket(numTriangles);
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+        const glm::vec3& p0 = vertices[indices[3 * t]].position;
+        const glm::vec3& p1 = vertices[indices[3 * t + 1]].position;
+        const glm::vec3& p2 = vertices[indices[3 * t + 2]].position;
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        glm::vec3 a = glm::abs(n);
+        int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+        bucket[t] = 2 * axis + (n[axis] < 0.0f ? 1 : 0);
+    }
+
+    // Union triangles across shared edges. Vertices are matched by position,
+    // since the importer splits them along texture seams.
+    std::vector<size_t> parent(numTriangles);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](size_t x) {
+        while (parent[x] != x)
+        {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+
+    typedef std::tuple<float, float, float> PositionKey;
+    std::map<PositionKey, unsigned int> positionIds;
+    std::vector<unsigned int> cornerIds(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        const glm::vec3& p = vertices[indices[i]].position;
+        auto ptr = positionIds.insert(std::make_pair(
+            PositionKey(p.x, p.y, p.z), (unsigned int)positionIds.size()
+        ));
+        cornerIds[i] = ptr.first->second;
+    }
+
+    std::map<std::pair<unsigned int, unsigned int>, size_t> edgeOwner;
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+        for (int e = 0; e < 3; ++e)
+        {
+            unsigned int a = cornerIds[3 * t + e];
+            unsigned int b = cornerIds[3 * t + (e + 1) % 3];
+            auto key = std::make_pair(std::min(a, b), std::max(a, b));
+            auto ptr = edgeOwner.insert(std::make_pair(key, t));
+            if (!ptr.second && bucket[ptr.first->second] == bucket[t])
+                parent[find(t)] = find(ptr.first->second);
+        }
+    }
+
+    // Collect charts and their projected 2D bounds.
+    struct Chart
+    {
+        std::vector<size_t> triangles;
+        glm::vec2 bmin = glm::vec2(std::numeric_limits<float>::max());
+        glm::vec2 bmax = glm::vec2(-std::numeric_limits<float>::max());
+        glm::vec2 offset = glm::vec2(0.0f);     // Position in the atlas (texels)
+    };
+    auto project = [](const glm::vec3& p, int b) {
+        int axis = b / 2;
+        return glm::vec2(p[(axis + 1) % 3], p[(axis + 2) % 3]);
+    };
+
+    std::map<size_t, size_t> chartIds;
+    std::vector<Chart> charts;
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+        size_t root = find(t);
+        auto ptr = chartIds.insert(std::make_pair(root, charts.size()));
+        if (ptr.second)
+            charts.push_back(Chart());
+        Chart& chart = charts[ptr.first->second];
+        chart.triangles.push_back(t);
+        for (int c = 0; c < 3; ++c)
+        {
+            glm::vec2 uv = project(vertices[indices[3 * t + c]].position, bucket[t]);
+            chart.bmin = glm::min(chart.bmin, uv);
+            chart.bmax = glm::max(chart.bmax, uv);
+        }
+    }
+
+    // Shelf packing, tallest charts first. Start from a texel density that
+    // would fill LIGHTMAP_FILL_RATIO of the atlas and shrink until it fits.
+    std::vector<size_t> order(charts.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&charts](size_t a, size_t b) {
+        float ha = charts[a].bmax.y - charts[a].bmin.y;
+        float hb = charts[b].bmax.y - charts[b].bmin.y;
+        return ha > hb;
+    });
+
+    float area = 0.0f;
+    for (const auto& chart : charts)
+    {
+        glm::vec2 size = chart.bmax - chart.bmin;
+        area += size.x * size.y;
+    }
+    float res = (float)resolution;
+    float pad = (float)LIGHTMAP_CHART_PADDING;
+    float scale = area > 0.0f ? std::sqrt(LIGHTMAP_FILL_RATIO * res * res / area) : res;
+
+    bool fits = false;
+    for (int attempt = 0; attempt < 64 && !fits; ++attempt)
+    {
+        float x = 0.0f;
+        float y = 0.0f;
+        float shelfHeight = 0.0f;
+        fits = true;
+        for (size_t idx : order)
+        {
+            Chart& chart = charts[idx];
+            glm::vec2 size = glm::ceil((chart.bmax - chart.bmin) * scale) + 2.0f * pad;
+            if (x + size.x > res)
+            {
+                x = 0.0f;
+                y += shelfHeight;
+                shelfHeight = 0.0f;
+            }
+            if (size.x > res || y + size.y > res)
+            {
+                fits = false;
+                break;
+            }
+            chart.offset = glm::vec2(x, y) + pad;
+            x += size.x;
+            shelfHeight = std::max(shelfHeight, size.y);
+        }
+        if (!fits)
+            scale *= 0.9f;
+    }
+    // The gutters alone may not fit: overlapping charts would bleed into
+    // each other.
+    if (!fits)
+        return false;
+
+    // Emit the unwelded mesh.
+    std::vector<Vertex> unwelded;
+    std::vector<unsigned int> unweldedIndices;
+    unwelded.reserve(indices.size());
+    unweldedIndices.reserve(indices.size());
+    for (const auto& chart : charts)
+    {
+        for (size_t t : chart.triangles)
+        {
+            if (sourceTriangles)
+                sourceTriangles->push_back((unsigned int)t);
+            for (int c = 0; c < 3; ++c)
+            {
+                Vertex vertex = vertices[indices[3 * t + c]];
+                glm::vec2 uv = project(vertex.position, bucket[t]);
+                glm::vec2 texel = chart.offset + (uv - chart.bmin) * scale;
+                vertex.lightmapCoords = texel / res;
+                unweldedIndices.push_back((unsigned int)unwelded.size());
+                unwelded.push_back(vertex);
+            }
+        }
+    }
+    vertices.swap(unwelded);
+    indices.swap(unweldedIndices);
+    return true;
+}
+}
+
+#endif
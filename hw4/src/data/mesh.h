@@ -5,81 +5,278 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/asset.h"
+#include "base/system_global.h"
+#include "data/bounds.h"
+#include "data/mesh_arena.h"
+#include "data/vertex.h"
 
 
 namespace engine
 {
-struct Vertex
+// Triangles whose texture coordinates span less than this have no tangent.
+constexpr float TANGENT_MIN_UV_AREA = 1e-12f;
+
+
+// Sums the tangent of every triangle into its corners, then makes each
+// vertex tangent unit length and orthogonal to the normal. indices must
+// hold triangles. Triangles with degenerate texture coordinates, such as
+// faces without any, add nothing; vertices left without a tangent get any
+// unit vector orthogonal to their normal.
+void computeTangents(std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+{
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        unsigned int i0 = indices[i];
+        unsigned int i1 = indices[i + 1];
+        unsigned int i2 = indices[i + 2];
+
+        glm::vec2 uv0 = vertices[i0].texCoords;
+        glm::vec2 uv1 = vertices[i1].texCoords;
+        glm::vec2 uv2 = vertices[i2].texCoords;
+        glm::vec3 pos0 = vertices[i0].position;
+        glm::vec3 pos1 = vertices[i1].position;
+        glm::vec3 pos2 = vertices[i2].position;
+
+        glm::vec3 edge0 = pos1 - pos0;
+        glm::vec3 edge1 = pos2 - pos0;
+        glm::vec2 deltaUV0 = uv1 - uv0;
+        glm::vec2 deltaUV1 = uv2 - uv0;
+        float determinant = deltaUV0.x * deltaUV1.y - deltaUV0.y * deltaUV1.x;
+        if (!(std::abs(determinant) >= TANGENT_MIN_UV_AREA))
+            continue;
+        float eta = 1.0f / determinant;
+
+        glm::vec3 tangent = eta * glm::vec3(
+            deltaUV1.y * edge0.x - deltaUV0.y * edge1.x,
+            deltaUV1.y * edge0.y - deltaUV0.y * edge1.y,
+            deltaUV1.y * edge0.z - deltaUV0.y * edge1.z
+        );
+        vertices[i0].tangent += tangent;
+        vertices[i1].tangent += tangent;
+        vertices[i2].tangent += tangent;
+    }
+
+    for (Vertex& vertex : vertices)
+    {
+        glm::vec3 normal = vertex.normal;
+        glm::vec3 tangent = vertex.tangent - glm::dot(vertex.tangent, normal) * normal;
+        float length = glm::length(tangent);
+        if (!(length > 0.0f) || !std::isfinite(length))
+        {
+            // Crossed with the axis least aligned with the normal.
+            glm::vec3 axis = std::abs(normal.x) < 0.9f
+                ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            tangent = glm::cross(normal, axis);
+            length = glm::length(tangent);
+            if (!(length > 0.0f) || !std::isfinite(length))
+            {
+                tangent = axis;
+                length = 1.0f;
+            }
+        }
+        vertex.tangent = tangent / length;
+    }
+}
+
+
+// A range of the index array drawn with one material.
+struct Submesh
 {
-    glm::vec3 position;
-    glm::vec2 texCoords;
-    glm::vec3 normal;
-    glm::vec3 tangent;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t material;                  // Into Mesh::materials
 };
 
 
+// The texture files a source file names for one material, resolved against
+// its folder. Empty if it names none.
+struct MeshMaterial
+{
+    std::string diffuse;
+    std::string normal;
+    std::string specular;
+};
+
+
+// Everything an importer reads from a file: every mesh of it in one vertex
+// and one index array, in model space, the submeshes and their materials.
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<Submesh> submeshes;
+    std::vector<MeshMaterial> materials;
+
+
+    void clear()
+    {
+        this->vertices.clear();
+        this->indices.clear();
+        this->submeshes.clear();
+        this->materials.clear();
+    }
+};
+
+
+// Orders the triangles by material, keeping their order within a material,
+// and makes one submesh per material that has any. triangleMaterials holds
+// an index into data.materials per triangle; materials no triangle uses are
+// dropped.
+void groupByMaterial(MeshData& data, const std::vector<uint32_t>& triangleMaterials)
+{
+    size_t numMaterials = std::max(data.materials.size(), (size_t)1);
+    std::vector<size_t> cursors(numMaterials, 0);
+    for (uint32_t material : triangleMaterials)
+        ++cursors[material];
+
+    std::vector<MeshMaterial> used;
+    data.submeshes.clear();
+    size_t first = 0;
+    for (size_t m = 0; m < numMaterials; ++m)
+    {
+        size_t count = cursors[m];
+        cursors[m] = first;
+        if (count == 0)
+            continue;
+        Submesh submesh;
+        submesh.firstIndex = (uint32_t)(3 * first);
+        submesh.indexCount = (uint32_t)(3 * count);
+        submesh.material = (uint32_t)used.size();
+        data.submeshes.push_back(submesh);
+        used.push_back(m < data.materials.size() ? data.materials[m] : MeshMaterial());
+        first += count;
+    }
+    data.materials.swap(used);
+    if (data.submeshes.size() < 2)
+        return;
+
+    std::vector<unsigned int> sorted(data.indices.size());
+    for (size_t t = 0; t < triangleMaterials.size(); ++t)
+    {
+        size_t destination = 3 * cursors[triangleMaterials[t]]++;
+        for (int c = 0; c < 3; ++c)
+            sorted[destination + c] = data.indices[3 * t + c];
+    }
+    data.indices.swap(sorted);
+}
+
+
+// CPU copy of a model's geometry and its place in the shared MeshArena.
 class Mesh : public Asset
 {
 public:
-    unsigned int VAO;
+    unsigned int id;                    // Small and unique, for sort keys
+    unsigned int VAO;                   // The arena's, shared by every mesh
+    MeshAllocation allocation;
+    // Maps the quantized positions the arena holds back to model space;
+    // folded into the world matrix of every instance.
+    glm::mat4 dequantization;
 
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
+    std::vector<Submesh> submeshes;     // In index order, covering indices
+    std::vector<MeshMaterial> materials;
+    AABB bounds;                        // In model space
+    BoundingSphere boundingSphere;
 
 
+    // One submesh with one empty material.
     Mesh(
         const std::string& name, std::vector<Vertex> vertices,
         std::vector<unsigned int> indices
-    ) : Asset(name)
+    ) : Asset(name), vertices(std::move(vertices)), indices(std::move(indices))
+    {
+        this->computeBounds();
+        initialize();
+    }
+
+    Mesh(const std::string& name, MeshData data) : Asset(name)
     {
-        this->vertices = vertices;
-        this->indices = indices;
+        this->take(data);
+        this->computeBounds();
+        initialize();
+    }
 
-        // Now that we have all the required data, set the vertex buffers and
-        // its attribute pointers.
+    // Arrays prepared elsewhere, such as a mapped MeshCache file, together
+    // with their bounds.
+    Mesh(
+        const std::string& name, MeshData data,
+        const AABB& bounds, const BoundingSphere& boundingSphere
+    ) : Asset(name), bounds(bounds), boundingSphere(boundingSphere)
+    {
+        this->take(data);
         initialize();
     }
 
+    ~Mesh()
+    {
+        meshArena.release(this->allocation);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    Mesh(const Mesh& other) = delete;
+    Mesh& operator=(const Mesh& other) = delete;
+
+    // Replaces the geometry and moves it to a new place in the arena. The
+    // triangles must stay within the index ranges of their submeshes.
+    void setGeometry(
+        std::vector<Vertex> vertices, std::vector<unsigned int> indices
+    ) {
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->computeBounds();
+        meshArena.release(this->allocation);
+        this->upload();
+    }
+
 private:
-    unsigned int VBO;
-    unsigned int EBO;
+    void take(MeshData& data)
+    {
+        this->vertices.swap(data.vertices);
+        this->indices.swap(data.indices);
+        this->submeshes.swap(data.submeshes);
+        this->materials.swap(data.materials);
+    }
 
+    void computeBounds()
+    {
+        this->bounds = computeAABB(this->vertices);
+        this->boundingSphere = computeBoundingSphere(this->vertices, this->bounds);
+    }
 
-    // Initializes all the buffer objects/arrays.
     void initialize()
     {
-        // Create buffers and arrays.
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is
-        // sequential for all its items. The effect is that we can simply pass
-        // a pointer to the struct and it translates perfectly to a
-        // glm::vec3/2 array which again translates to 3/2 floats which
-        // translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // Set the vertex attribute pointers.
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
-
-        glBindVertexArray(0);
+        if (this->submeshes.empty())
+            this->submeshes.push_back(Submesh{ 0, (uint32_t)this->indices.size(), 0 });
+        if (this->materials.empty())
+            this->materials.resize(1);
+        this->id = nextId();
+        this->upload();
+    }
+
+    void upload()
+    {
+        VertexQuantization quantization = VertexQuantization::fromBounds(this->bounds);
+        this->allocation = meshArena.allocate(
+            this->vertices.data(), this->vertices.size(),
+            this->indices.data(), this->indices.size(), quantization
+        );
+        this->VAO = meshArena.getVAO();
+        this->dequantization = quantization.toModel();
+    }
+
+    static unsigned int nextId()
+    {
+        static unsigned int next = 0;
+        return ++next;
     }
 };
 }
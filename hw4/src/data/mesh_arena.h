@@ -0,0 +1,227 @@
+#ifndef MESH_ARENA_H
+#define MESH_ARENA_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "data/vertex.h"
+
+
+namespace engine
+{
+constexpr size_t MESH_ARENA_INITIAL_VERTICES = 1 << 16;
+constexpr size_t MESH_ARENA_INITIAL_INDICES = 1 << 18;
+
+
+// Where the arrays of a mesh live in the arena. Indices are stored as the
+// mesh has them, relative to its first vertex, so draws pass baseVertex.
+struct MeshAllocation
+{
+    uint32_t baseVertex = 0;
+    uint32_t firstIndex = 0;
+    uint32_t numVertices = 0;
+    uint32_t numIndices = 0;
+};
+
+
+// Hands out ranges of a growing array, first fit. Released ranges are merged
+// with their free neighbours, and given back to the end when they reach it.
+class RangeAllocator
+{
+public:
+    size_t allocate(size_t count)
+    {
+        for (auto ptr = this->freeRanges.begin(); ptr != this->freeRanges.end(); ++ptr)
+        {
+            if (ptr->second < count)
+                continue;
+            size_t offset = ptr->first;
+            size_t remaining = ptr->second - count;
+            this->freeRanges.erase(ptr);
+            if (remaining > 0)
+                this->freeRanges.insert(std::make_pair(offset + count, remaining));
+            return offset;
+        }
+        size_t offset = this->end;
+        this->end += count;
+        return offset;
+    }
+
+    void release(size_t offset, size_t count)
+    {
+        if (count == 0)
+            return;
+        auto next = this->freeRanges.lower_bound(offset);
+        if (next != this->freeRanges.end() && offset + count == next->first)
+        {
+            count += next->second;
+            next = this->freeRanges.erase(next);
+        }
+        if (next != this->freeRanges.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset)
+            {
+                offset = previous->first;
+                count += previous->second;
+                this->freeRanges.erase(previous);
+            }
+        }
+        if (offset + count == this->end)
+            this->end = offset;
+        else
+            this->freeRanges.insert(std::make_pair(offset, count));
+    }
+
+    // One past the last element in use.
+    size_t getEnd() const
+    {
+        return this->end;
+    }
+
+private:
+    std::map<size_t, size_t> freeRanges;    // Offset to count
+    size_t end = 0;
+};
+
+
+// One vertex buffer and one index buffer shared by every mesh, behind one
+// vertex array, so drawing another mesh never switches buffers: the draw
+// only changes its index range and base vertex. Vertices are stored as
+// PackedVertex, laid out by PACKED_VERTEX_LAYOUT. The buffers grow by copying
+// on the GPU when full, which keeps the vertex array and the offsets handed
+// out so far valid.
+//
+// GL objects are created by the first allocate(), so the arena can be a
+// global constructed before the context.
+class MeshArena
+{
+public:
+    MeshArena() {}
+
+    // No copy constructor nor copy assignment are allowed.
+    MeshArena(const MeshArena& other) = delete;
+    MeshArena& operator=(const MeshArena& other) = delete;
+
+    // Packs the vertices with the quantization of their mesh.
+    MeshAllocation allocate(
+        const Vertex* vertices, size_t numVertices,
+        const unsigned int* indices, size_t numIndices,
+        const VertexQuantization& quantization
+    ) {
+        this->packed.resize(numVertices);
+        for (size_t i = 0; i < numVertices; ++i)
+            this->packed[i] = packVertex(vertices[i], quantization);
+
+        MeshAllocation allocation;
+        allocation.baseVertex = (uint32_t)this->vertexRanges.allocate(numVertices);
+        allocation.firstIndex = (uint32_t)this->indexRanges.allocate(numIndices);
+        allocation.numVertices = (uint32_t)numVertices;
+        allocation.numIndices = (uint32_t)numIndices;
+        this->reserve(this->vertexRanges.getEnd(), this->indexRanges.getEnd());
+
+        // Through the copy target, so the element buffer of whatever vertex
+        // array is bound stays as it is.
+        glBindBuffer(GL_COPY_WRITE_BUFFER, this->VBO);
+        glBufferSubData(
+            GL_COPY_WRITE_BUFFER, (size_t)allocation.baseVertex * sizeof(PackedVertex),
+            numVertices * sizeof(PackedVertex), this->packed.data()
+        );
+        glBindBuffer(GL_COPY_WRITE_BUFFER, this->EBO);
+        glBufferSubData(
+            GL_COPY_WRITE_BUFFER, (size_t)allocation.firstIndex * sizeof(unsigned int),
+            numIndices * sizeof(unsigned int), indices
+        );
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return allocation;
+    }
+
+    // Only gives the ranges back, touches no GL state.
+    void release(const MeshAllocation& allocation)
+    {
+        this->vertexRanges.release(allocation.baseVertex, allocation.numVertices);
+        this->indexRanges.release(allocation.firstIndex, allocation.numIndices);
+    }
+
+    // 0 before the first allocate().
+    GLuint getVAO() const
+    {
+        return this->VAO;
+    }
+
+private:
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+    GLuint EBO = 0;
+    size_t vertexCapacity = 0;
+    size_t indexCapacity = 0;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+    std::vector<PackedVertex> packed;   // Scratch of allocate()
+
+
+    void reserve(size_t numVertices, size_t numIndices)
+    {
+        if (numVertices <= this->vertexCapacity && numIndices <= this->indexCapacity && this->VAO)
+            return;
+        if (!this->VAO)
+            glGenVertexArrays(1, &(this->VAO));
+
+        if (numVertices > this->vertexCapacity || !this->VBO)
+        {
+            size_t capacity = std::max(
+                numVertices, std::max(2 * this->vertexCapacity, MESH_ARENA_INITIAL_VERTICES)
+            );
+            this->VBO = grow(
+                this->VBO, this->vertexCapacity * sizeof(PackedVertex),
+                capacity * sizeof(PackedVertex)
+            );
+            this->vertexCapacity = capacity;
+        }
+        if (numIndices > this->indexCapacity || !this->EBO)
+        {
+            size_t capacity = std::max(
+                numIndices, std::max(2 * this->indexCapacity, MESH_ARENA_INITIAL_INDICES)
+            );
+            this->EBO = grow(
+                this->EBO, this->indexCapacity * sizeof(unsigned int),
+                capacity * sizeof(unsigned int)
+            );
+            this->indexCapacity = capacity;
+        }
+
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        setVertexAttributes(PACKED_VERTEX_LAYOUT);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // A new buffer of size bytes holding the old one's contents.
+    static GLuint grow(GLuint buffer, size_t oldSize, size_t size)
+    {
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        if (buffer)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return grown;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "data/bounds.h"
+#include "data/mesh.h"
+#include "utils/mapped_file.h"
+
+
+namespace engine
+{
+constexpr uint32_t MESH_CACHE_FILE_MAGIC = 0x4853454d;  // "MESH"
+constexpr uint32_t MESH_CACHE_FILE_VERSION = 4;
+constexpr const char* MESH_CACHE_DIRECTORY = "../resources/cache/";
+
+
+// Start of a mesh cache file. The vertex, index and submesh arrays follow
+// right after it, exactly as Mesh holds them, then the texture paths of
+// every material as three null-terminated strings.
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexSize;                // sizeof(Vertex), in case it changes
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numSubmeshes;
+    uint32_t numMaterials;
+    uint32_t materialSize;              // Bytes of the texture paths
+    uint32_t importer;                  // Model's MeshImporter that read the source
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceTime;                 // Modification time, in seconds
+    uint64_t sourceHash;
+    AABB bounds;
+    BoundingSphere boundingSphere;
+};
+static_assert(sizeof(MeshCacheHeader) == 104, "MeshCacheHeader must have no padding");
+
+
+// Imported meshes, cached on disk so Assimp runs only the first time a
+// model is loaded. Later loads map the file and take the arrays as they
+// are, bounds included. A cache is used while its source keeps the size and
+// modification time it was written for; if those changed, the source is
+// hashed and the cache still used if the contents did not. Meshes read by
+// another importer than the one asked for are never used.
+//
+// The asset bundle stores meshes in the same layout, without the source
+// fields, see serialize() and fromMemory().
+//
+// Files are little-endian; on a big-endian host the cache is never used.
+class MeshCache
+{
+public:
+    // Returns nullptr if there is no valid cache for the source.
+    static Mesh* load(const std::string& name, const std::string& sourcePath, uint32_t importer)
+    {
+        if (!isLittleEndian())
+            return nullptr;
+        std::string cachePath = getPath(sourcePath);
+        MappedFile file;
+        if (!file.open(cachePath))
+            return nullptr;
+
+        // Written by another version, or truncated: imported again.
+        MeshCacheHeader header;
+        if (!readHeader(file.data(), file.size(), header) || header.importer != importer)
+            return nullptr;
+
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!getFileInfo(sourcePath, sourceSize, sourceTime))
+            return nullptr;
+        if (sourceSize != header.sourceSize || sourceTime != header.sourceTime)
+        {
+            // Touched, maybe not changed.
+            if (hashFile(sourcePath) != header.sourceHash)
+                return nullptr;
+            header.sourceSize = sourceSize;
+            header.sourceTime = sourceTime;
+            std::fstream rewrite(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+            rewrite.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+
+        return createMesh(name, file.data(), header);
+    }
+
+    // A mesh stored as by serialize(), or nullptr if the data is not one.
+    static Mesh* fromMemory(
+        const std::string& name, const unsigned char* data, size_t size, uint32_t importer
+    ) {
+        MeshCacheHeader header;
+        if (!isLittleEndian() || !readHeader(data, size, header) || header.importer != importer)
+            return nullptr;
+        return createMesh(name, data, header);
+    }
+
+    // Header and arrays in one block, the source fields left zero.
+    static std::vector<unsigned char> serialize(
+        const MeshData& mesh, const AABB& bounds, const BoundingSphere& boundingSphere,
+        uint32_t importer
+    ) {
+        MeshCacheHeader header{};
+        return encode(
+            mesh.vertices, mesh.indices, mesh.submeshes, mesh.materials,
+            bounds, boundingSphere, importer, header
+        );
+    }
+
+    static bool save(const Mesh& mesh, const std::string& sourcePath, uint32_t importer)
+    {
+        if (!isLittleEndian())
+            return false;
+        MeshCacheHeader header{};
+        std::vector<unsigned char> data = encode(
+            mesh.vertices, mesh.indices, mesh.submeshes, mesh.materials,
+            mesh.bounds, mesh.boundingSphere, importer, header
+        );
+        if (!getFileInfo(sourcePath, header.sourceSize, header.sourceTime))
+            return false;
+        header.sourceHash = hashFile(sourcePath);
+        std::memcpy(data.data(), &header, sizeof(header));
+
+        std::string cachePath = getPath(sourcePath);
+        std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to write mesh cache {}", cachePath);
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        return (bool)file;
+    }
+
+    // Cache files are named after the whole source path, so models of the
+    // same file name in different folders do not collide.
+    static std::string getPath(const std::string& sourcePath)
+    {
+        std::string fileName = sourcePath;
+        for (char& c : fileName)
+        {
+            if (c == '/' || c == '\\' || c == '.' || c == ':' || c == ' ')
+                c = '_';
+        }
+        return MESH_CACHE_DIRECTORY + fileName + ".mesh";
+    }
+
+    // FNV-1a of the file contents, 0 if it cannot be read.
+    static uint64_t hashFile(const std::string& path)
+    {
+        MappedFile file;
+        if (!file.open(path))
+            return 0;
+        uint64_t hash = 0xcbf29ce484222325ull;
+        const unsigned char* bytes = file.data();
+        for (size_t i = 0; i < file.size(); ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+private:
+    // The whole file, with header filled in but for its source fields.
+    static std::vector<unsigned char> encode(
+        const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+        const std::vector<Submesh>& submeshes, const std::vector<MeshMaterial>& materials,
+        const AABB& bounds, const BoundingSphere& boundingSphere, uint32_t importer,
+        MeshCacheHeader& header
+    ) {
+        std::string paths;
+        for (const MeshMaterial& material : materials)
+        {
+            for (const std::string* path : { &material.diffuse, &material.normal, &material.specular })
+            {
+                paths += *path;
+                paths += '\0';
+            }
+        }
+
+        header = MeshCacheHeader{};
+        header.magic = MESH_CACHE_FILE_MAGIC;
+        header.version = MESH_CACHE_FILE_VERSION;
+        header.vertexSize = sizeof(Vertex);
+        header.numVertices = (uint32_t)vertices.size();
+        header.numIndices = (uint32_t)indices.size();
+        header.numSubmeshes = (uint32_t)submeshes.size();
+        header.numMaterials = (uint32_t)materials.size();
+        header.materialSize = (uint32_t)paths.size();
+        header.importer = importer;
+        header.sourceSize = 0;
+        header.sourceTime = 0;
+        header.sourceHash = 0;
+        header.bounds = bounds;
+        header.boundingSphere = boundingSphere;
+
+        size_t vertexBytes = vertices.size() * sizeof(Vertex);
+        size_t indexBytes = indices.size() * sizeof(unsigned int);
+        size_t submeshBytes = submeshes.size() * sizeof(Submesh);
+        std::vector<unsigned char> data(
+            sizeof(header) + vertexBytes + indexBytes + submeshBytes + paths.size()
+        );
+        unsigned char* out = data.data();
+        std::memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        std::memcpy(out, vertices.data(), vertexBytes);
+        out += vertexBytes;
+        std::memcpy(out, indices.data(), indexBytes);
+        out += indexBytes;
+        std::memcpy(out, submeshes.data(), submeshBytes);
+        out += submeshBytes;
+        std::memcpy(out, paths.data(), paths.size());
+        return data;
+    }
+
+    // Checks the header and that the arrays fit exactly in size bytes.
+    static bool readHeader(const unsigned char* data, size_t size, MeshCacheHeader& header)
+    {
+        if (size < sizeof(header))
+            return false;
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != MESH_CACHE_FILE_MAGIC
+            || header.version != MESH_CACHE_FILE_VERSION
+            || header.vertexSize != sizeof(Vertex))
+            return false;
+        size_t vertexBytes = (size_t)header.numVertices * sizeof(Vertex);
+        size_t indexBytes = (size_t)header.numIndices * sizeof(unsigned int);
+        size_t submeshBytes = (size_t)header.numSubmeshes * sizeof(Submesh);
+        return size == sizeof(header) + vertexBytes + indexBytes + submeshBytes + header.materialSize;
+    }
+
+    // nullptr if the indices, the submeshes or the texture paths do not add
+    // up.
+    static Mesh* createMesh(
+        const std::string& name, const unsigned char* data, const MeshCacheHeader& header
+    ) {
+        MeshData mesh;
+        const unsigned char* arrays = data + sizeof(header);
+        const Vertex* vertices = reinterpret_cast<const Vertex*>(arrays);
+        mesh.vertices.assign(vertices, vertices + header.numVertices);
+        arrays += (size_t)header.numVertices * sizeof(Vertex);
+        const unsigned int* indices = reinterpret_cast<const unsigned int*>(arrays);
+        mesh.indices.assign(indices, indices + header.numIndices);
+        arrays += (size_t)header.numIndices * sizeof(unsigned int);
+        for (unsigned int index : mesh.indices)
+        {
+            if (index >= header.numVertices)
+                return nullptr;
+        }
+        const Submesh* submeshes = reinterpret_cast<const Submesh*>(arrays);
+        mesh.submeshes.assign(submeshes, submeshes + header.numSubmeshes);
+        arrays += (size_t)header.numSubmeshes * sizeof(Submesh);
+
+        const char* paths = reinterpret_cast<const char*>(arrays);
+        const char* pathsEnd = paths + header.materialSize;
+        mesh.materials.resize(header.numMaterials);
+        for (MeshMaterial& material : mesh.materials)
+        {
+            for (std::string* path : { &material.diffuse, &material.normal, &material.specular })
+            {
+                const char* end = std::find(paths, pathsEnd, '\0');
+                if (end == pathsEnd)
+                    return nullptr;
+                path->assign(paths, end);
+                paths = end + 1;
+            }
+        }
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            if ((size_t)submesh.firstIndex + submesh.indexCount > mesh.indices.size()
+                || submesh.material >= mesh.materials.size())
+                return nullptr;
+        }
+        return new Mesh(name, std::move(mesh), header.bounds, header.boundingSphere);
+    }
+
+    static bool isLittleEndian()
+    {
+        const uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "data/mesh.h"
+
+
+namespace engine
+{
+// Post-transform cache the statistics assume: a FIFO of this many vertices,
+// a fair guess for current hardware.
+constexpr unsigned int VERTEX_CACHE_SIZE = 16;
+// LRU cache the triangle order is scored against, as in Forsyth's paper.
+constexpr unsigned int FORSYTH_CACHE_SIZE = 32;
+constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+// How much worse the cache may get for the sake of overdraw.
+constexpr float MESH_OPTIMIZER_OVERDRAW_THRESHOLD = 1.05f;
+
+
+// Average cache miss ratio, vertex shader runs per triangle (0.5 at best,
+// 3 at worst), and average transform to vertex ratio, runs per vertex
+// referenced (1 at best).
+struct VertexCacheStats
+{
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+struct MeshOptimizerReport
+{
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+
+// Reorders the index and vertex buffers of a mesh for the GPU, as the
+// importers leave them in file order:
+//
+//   1. triangles for the post-transform vertex cache, greedily by Forsyth's
+//      vertex scores;
+//   2. clusters of those triangles for overdraw, outward-facing ones first,
+//      as long as the cache stays within MESH_OPTIMIZER_OVERDRAW_THRESHOLD;
+//   3. vertices in the order the triangles first use them, so fetches walk
+//      the vertex buffer forward.
+//
+// Triangles only move within their submesh, so material ranges hold.
+class MeshOptimizer
+{
+public:
+    static MeshOptimizerReport optimize(
+        std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+        const std::vector<Submesh>& submeshes
+    ) {
+        MeshOptimizerReport report;
+        report.before = analyze(indices, vertices.size());
+        for (const Submesh& submesh : submeshes)
+        {
+            unsigned int* range = indices.data() + submesh.firstIndex;
+            optimizeVertexCache(range, submesh.indexCount, vertices.size());
+            optimizeOverdraw(range, submesh.indexCount, vertices, MESH_OPTIMIZER_OVERDRAW_THRESHOLD);
+        }
+        optimizeVertexFetch(vertices, indices);
+        report.after = analyze(indices, vertices.size());
+        return report;
+    }
+
+    static VertexCacheStats analyze(
+        const std::vector<unsigned int>& indices, size_t numVertices,
+        unsigned int cacheSize = VERTEX_CACHE_SIZE
+    ) {
+        VertexCacheStats stats;
+        if (indices.empty())
+            return stats;
+        size_t misses = countCacheMisses(indices.data(), indices.size(), numVertices, cacheSize);
+        std::vector<uint8_t> used(numVertices, 0);
+        size_t numUsed = 0;
+        for (unsigned int index : indices)
+        {
+            numUsed += used[index] ? 0 : 1;
+            used[index] = 1;
+        }
+        stats.acmr = (float)misses / (float)(indices.size() / 3);
+        stats.atvr = (float)misses / (float)numUsed;
+        return stats;
+    }
+
+    // Forsyth, "Linear-Speed Vertex Cache Optimisation". Picks the next
+    // triangle among those of the cached vertices, by the scores of their
+    // vertices: high when the vertex was used recently, higher still when
+    // few triangles are left to use it. When none is left there, the next
+    // triangle in input order starts over.
+    static void optimizeVertexCache(unsigned int* indices, size_t numIndices, size_t numVertices)
+    {
+        size_t numTriangles = numIndices / 3;
+        if (numTriangles < 2)
+            return;
+
+        // Triangles not yet emitted, per vertex, as ranges of one array.
+        std::vector<uint32_t> valence(numVertices, 0);
+        for (size_t i = 0; i < 3 * numTriangles; ++i)
+            ++valence[indices[i]];
+        std::vector<uint32_t> firstTriangle(numVertices, 0);
+        uint32_t sum = 0;
+        for (size_t v = 0; v < numVertices; ++v)
+        {
+            firstTriangle[v] = sum;
+            sum += valence[v];
+        }
+        std::vector<uint32_t> adjacency(sum);
+        std::vector<uint32_t> filled(numVertices, 0);
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                unsigned int v = indices[3 * t + c];
+                adjacency[firstTriangle[v] + filled[v]++] = (uint32_t)t;
+            }
+        }
+
+        std::vector<int> cachePositions(numVertices, -1);
+        std::vector<float> vertexScores(numVertices);
+        for (size_t v = 0; v < numVertices; ++v)
+            vertexScores[v] = getVertexScore(-1, valence[v]);
+        std::vector<float> triangleScores(numTriangles);
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]]
+                + vertexScores[indices[3 * t + 2]];
+        }
+
+        std::vector<uint8_t> emitted(numTriangles, 0);
+        std::vector<unsigned int> output;
+        output.reserve(3 * numTriangles);
+        unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+        unsigned int grown[FORSYTH_CACHE_SIZE + 3];
+        size_t cacheCount = 0;
+        size_t nextInput = 0;
+        int64_t best = -1;
+        while (true)
+        {
+            if (best < 0)
+            {
+                while (nextInput < numTriangles && emitted[nextInput])
+                    ++nextInput;
+                if (nextInput == numTriangles)
+                    break;
+                best = (int64_t)nextInput;
+            }
+
+            const unsigned int* triangle = indices + 3 * best;
+            emitted[best] = 1;
+            output.insert(output.end(), triangle, triangle + 3);
+            for (int c = 0; c < 3; ++c)
+            {
+                unsigned int v = triangle[c];
+                uint32_t* first = adjacency.data() + firstTriangle[v];
+                uint32_t* last = first + valence[v];
+                std::iter_swap(std::find(first, last, (uint32_t)best), last - 1);
+                --valence[v];
+            }
+
+            // The triangle's vertices move to the front, and whatever no
+            // longer fits falls out.
+            size_t grownCount = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                if (std::find(grown, grown + grownCount, triangle[c]) == grown + grownCount)
+                    grown[grownCount++] = triangle[c];
+            }
+            for (size_t i = 0; i < cacheCount; ++i)
+            {
+                if (std::find(triangle, triangle + 3, cache[i]) == triangle + 3)
+                    grown[grownCount++] = cache[i];
+            }
+
+            // Rescore what moved, then pick the best remaining triangle of
+            // the cache once every score is up to date.
+            for (size_t i = 0; i < grownCount; ++i)
+            {
+                unsigned int v = grown[i];
+                int position = i < FORSYTH_CACHE_SIZE ? (int)i : -1;
+                cachePositions[v] = position;
+                float score = getVertexScore(position, valence[v]);
+                float delta = score - vertexScores[v];
+                vertexScores[v] = score;
+                for (uint32_t j = 0; j < valence[v]; ++j)
+                    triangleScores[adjacency[firstTriangle[v] + j]] += delta;
+            }
+            cacheCount = std::min(grownCount, (size_t)FORSYTH_CACHE_SIZE);
+            std::copy(grown, grown + cacheCount, cache);
+
+            best = -1;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < cacheCount; ++i)
+            {
+                unsigned int v = cache[i];
+                for (uint32_t j = 0; j < valence[v]; ++j)
+                {
+                    uint32_t t = adjacency[firstTriangle[v] + j];
+                    if (triangleScores[t] > bestScore)
+                    {
+                        bestScore = triangleScores[t];
+                        best = t;
+                    }
+                }
+            }
+        }
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    // After Sander et al., "Fast Triangle Reordering for Vertex Locality and
+    // Reduced Overdraw". The cache-ordered triangles are cut into clusters
+    // where the cache runs cold, and the clusters sorted so those facing
+    // away from the center of the mesh, likely in front of the others, are
+    // drawn first. Kept only if the cache does not suffer more than
+    // threshold allows.
+    static void optimizeOverdraw(
+        unsigned int* indices, size_t numIndices, const std::vector<Vertex>& vertices,
+        float threshold
+    ) {
+        size_t numTriangles = numIndices / 3;
+        if (numTriangles < 2)
+            return;
+
+        // A cluster starts at every triangle whose three vertices miss.
+        std::vector<size_t> clusterStarts;
+        std::vector<uint32_t> cacheTimes(vertices.size(), 0);
+        uint32_t time = VERTEX_CACHE_SIZE + 1;
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            int misses = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                unsigned int v = indices[3 * t + c];
+                if (time - cacheTimes[v] > VERTEX_CACHE_SIZE)
+                {
+                    cacheTimes[v] = time++;
+                    ++misses;
+                }
+            }
+            if (misses == 3 || t == 0)
+                clusterStarts.push_back(t);
+        }
+        size_t numClusters = clusterStarts.size();
+        if (numClusters < 2)
+            return;
+        clusterStarts.push_back(numTriangles);
+
+        // Area-weighted centroids and normals.
+        std::vector<glm::vec3> centroids(numClusters, glm::vec3(0.0f));
+        std::vector<glm::vec3> normals(numClusters, glm::vec3(0.0f));
+        std::vector<float> areas(numClusters, 0.0f);
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        for (size_t k = 0; k < numClusters; ++k)
+        {
+            for (size_t t = clusterStarts[k]; t < clusterStarts[k + 1]; ++t)
+            {
+                const glm::vec3& p0 = vertices[indices[3 * t]].position;
+                const glm::vec3& p1 = vertices[indices[3 * t + 1]].position;
+                const glm::vec3& p2 = vertices[indices[3 * t + 2]].position;
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(normal);
+                centroids[k] += area * (p0 + p1 + p2) / 3.0f;
+                normals[k] += normal;
+                areas[k] += area;
+            }
+            meshCentroid += centroids[k];
+            meshArea += areas[k];
+            if (areas[k] > 0.0f)
+                centroids[k] /= areas[k];
+        }
+        if (meshArea > 0.0f)
+            meshCentroid /= meshArea;
+
+        std::vector<float> keys(numClusters, 0.0f);
+        for (size_t k = 0; k < numClusters; ++k)
+        {
+            float length = glm::length(normals[k]);
+            if (length > 0.0f)
+                keys[k] = glm::dot(centroids[k] - meshCentroid, normals[k] / length);
+        }
+        std::vector<size_t> order(numClusters);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+            return keys[a] > keys[b];
+        });
+
+        std::vector<unsigned int> sorted;
+        sorted.reserve(3 * numTriangles);
+        for (size_t k : order)
+        {
+            sorted.insert(
+                sorted.end(), indices + 3 * clusterStarts[k], indices + 3 * clusterStarts[k + 1]
+            );
+        }
+        size_t missesBefore = countCacheMisses(indices, 3 * numTriangles, vertices.size(), VERTEX_CACHE_SIZE);
+        size_t missesAfter = countCacheMisses(sorted.data(), sorted.size(), vertices.size(), VERTEX_CACHE_SIZE);
+        if ((float)missesAfter <= threshold * (float)missesBefore)
+            std::copy(sorted.begin(), sorted.end(), indices);
+    }
+
+    // Renumbers the vertices in the order the indices first use them.
+    // Vertices no index uses are dropped.
+    static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+    {
+        std::vector<unsigned int> remap(vertices.size(), UINT32_MAX);
+        std::vector<Vertex> ordered;
+        ordered.reserve(vertices.size());
+        for (unsigned int& index : indices)
+        {
+            if (remap[index] == UINT32_MAX)
+            {
+                remap[index] = (unsigned int)ordered.size();
+                ordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(ordered);
+    }
+
+    // Merges vertices that are bit for bit the same, as unwelding leaves
+    // them, so the cache can share them again.
+    static void weldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+    {
+        std::vector<unsigned int> order(vertices.size());
+        std::iota(order.begin(), order.end(), 0);
+        auto less = [&vertices](unsigned int a, unsigned int b) {
+            int difference = std::memcmp(&vertices[a], &vertices[b], sizeof(Vertex));
+            return difference < 0 || (difference == 0 && a < b);
+        };
+        std::sort(order.begin(), order.end(), less);
+
+        std::vector<unsigned int> remap(vertices.size());
+        std::vector<Vertex> welded;
+        welded.reserve(vertices.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            if (i == 0 || std::memcmp(&vertices[order[i]], &vertices[order[i - 1]], sizeof(Vertex)) != 0)
+                welded.push_back(vertices[order[i]]);
+            remap[order[i]] = (unsigned int)welded.size() - 1;
+        }
+        for (unsigned int& index : indices)
+            index = remap[index];
+        vertices.swap(welded);
+    }
+
+private:
+    static float getVertexScore(int cachePosition, uint32_t valence)
+    {
+        if (valence == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // The last triangle's vertices score the same, so the order they
+            // were given in does not matter.
+            if (cachePosition < 3)
+                score = FORSYTH_LAST_TRIANGLE_SCORE;
+            else
+            {
+                float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+            }
+        }
+        return score + FORSYTH_VALENCE_BOOST_SCALE * std::pow((float)valence, -FORSYTH_VALENCE_BOOST_POWER);
+    }
+
+    // Through a FIFO of cacheSize vertices. A vertex is cached while fewer
+    // than cacheSize misses happened since its own.
+    static size_t countCacheMisses(
+        const unsigned int* indices, size_t numIndices, size_t numVertices, unsigned int cacheSize
+    ) {
+        std::vector<uint32_t> cacheTimes(numVertices, 0);
+        uint32_t time = cacheSize + 1;
+        size_t misses = 0;
+        for (size_t i = 0; i < numIndices; ++i)
+        {
+            unsigned int v = indices[i];
+            if (time - cacheTimes[v] > cacheSize)
+            {
+                cacheTimes[v] = time++;
+                ++misses;
+            }
+        }
+        return misses;
+    }
+};
+}
+
+#endif
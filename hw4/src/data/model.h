@@ -8,33 +8,76 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <map>
+#include <utility>
 
 #include "base/asset.h"
+#include "base/system_global.h"
+#include "data/lightmap.h"
 #include "data/mesh.h"
+#include "data/mesh_cache.h"
+#include "data/mesh_optimizer.h"
+#include "data/obj_importer.h"
 #include "data/texture.h"
 
 
 namespace engine
 {
+// What reads the files of an extension, see Model::setImporter().
+enum class MeshImporter
+{
+    ASSIMP,
+    OBJ         // ObjImporter
+};
+
+
+// Textures a submesh is drawn with.
+struct Material
+{
+    Texture* diffuse = nullptr;
+    Texture* normal = nullptr;
+    Texture* specular = nullptr;
+
+
+    bool operator==(const Material& other) const
+    {
+        return this->diffuse == other.diffuse && this->normal == other.normal
+            && this->specular == other.specular;
+    }
+
+    bool operator!=(const Material& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+
 class Model : public Asset
 {
 public:
     Mesh* mesh = nullptr;
+    // The textures of the first material. Textures given to the constructor
+    // are used by every material instead of those the file names.
     Texture* diffuse = nullptr;
     Texture* normal = nullptr;
     Texture* specular = nullptr;
+    std::vector<Material> materials;    // One per mesh material
     bool ignoreShadow = false;
+    unsigned int lightmapResolution = 0; // 0 if the model is not lightmapped
 
 
     Model(const std::string& name, const std::string& path) : Asset(name)
     {
         loadModel(path);
+        resolveMaterials();
     }
 
     Model(
@@ -43,6 +86,7 @@ public:
     ) : Asset(name), diffuse(diffuse), normal(normal), specular(specular)
     {
         loadModel(path);
+        resolveMaterials();
     }
 
     Model(
@@ -52,11 +96,81 @@ public:
         ignoreShadow(ignoreShadow)
     {
         loadModel(path);
+        resolveMaterials();
+    }
+
+    // Wraps a mesh built in code. The model takes ownership of the mesh.
+    Model(const std::string& name, Mesh* mesh) : Asset(name), mesh(mesh)
+    {
+        resolveMaterials();
     }
 
     ~Model()
     {
         delete this->mesh;
+        for (Texture* texture : this->ownedTextures)
+            delete texture;
+    }
+
+    // Lays out a lightmap atlas for the mesh. Only static models should be
+    // lightmapped, as the mesh is unwelded in the process. The resolution is
+    // doubled, up to LIGHTMAP_MAX_RESOLUTION, while the charts do not fit;
+    // returns false, leaving the model without a lightmap, if they never do.
+    bool generateLightmapCoords(unsigned int resolution)
+    {
+        std::vector<Vertex> vertices = this->mesh->vertices;
+        std::vector<unsigned int> indices = this->mesh->indices;
+        std::vector<unsigned int> sourceTriangles;
+        while (!engine::generateLightmapCoords(vertices, indices, resolution, &sourceTriangles))
+        {
+            if (resolution * 2 > LIGHTMAP_MAX_RESOLUTION)
+            {
+                logger.error(
+                    LOG_CATEGORY_RESOURCE, "Lightmap charts of {} do not fit {}x{}",
+                    this->name, resolution, resolution
+                );
+                return false;
+            }
+            resolution *= 2;
+            sourceTriangles.clear();
+            logger.warning(
+                LOG_CATEGORY_RESOURCE, "Lightmap charts of {} do not fit, trying {}x{}",
+                this->name, resolution, resolution
+            );
+        }
+
+        // The atlas orders the triangles by chart, across submeshes. Put each
+        // back into the range of its submesh; the unwelded vertices belong to
+        // one corner each, so only they have to move.
+        const std::vector<Submesh>& submeshes = this->mesh->submeshes;
+        if (submeshes.size() > 1)
+        {
+            std::vector<uint32_t> triangleSubmeshes(this->mesh->indices.size() / 3);
+            std::vector<size_t> cursors(submeshes.size());
+            for (size_t s = 0; s < submeshes.size(); ++s)
+            {
+                cursors[s] = submeshes[s].firstIndex / 3;
+                for (uint32_t i = 0; i < submeshes[s].indexCount / 3; ++i)
+                    triangleSubmeshes[cursors[s] + i] = (uint32_t)s;
+            }
+            std::vector<Vertex> grouped(vertices.size());
+            for (size_t t = 0; t < sourceTriangles.size(); ++t)
+            {
+                size_t destination = cursors[triangleSubmeshes[sourceTriangles[t]]]++;
+                for (int c = 0; c < 3; ++c)
+                    grouped[3 * destination + c] = vertices[indices[3 * t + c]];
+            }
+            vertices.swap(grouped);
+        }
+
+        // Corners of a chart that share a vertex come out the same, so they
+        // can share it again.
+        MeshOptimizer::weldVertices(vertices, indices);
+        MeshOptimizerReport report = MeshOptimizer::optimize(vertices, indices, submeshes);
+        logOptimization(this->name, report);
+        this->mesh->setGeometry(vertices, indices);
+        this->lightmapResolution = resolution;
+        return true;
     }
 
     void bind()
@@ -73,12 +187,45 @@ public:
             glBindTexture(GL_TEXTURE_2D, this->normal->ID);
         }
     }
-    
-private:
-    // Loads a model with supported ASSIMP extensions from file and stores the
-    // resulting meshes in the meshes vector.
-    void loadModel(std::string const &path)
+
+    // Chooses the importer of the files with an extension, such as ".obj".
+    // OBJ files go through ObjImporter unless set back to Assimp, everything
+    // else through Assimp.
+    static void setImporter(const std::string& extension, MeshImporter importer)
     {
+        getImporters()[toLower(extension)] = importer;
+    }
+
+    // The importer that reads a file, chosen by its extension.
+    static MeshImporter getImporter(const std::string& path)
+    {
+        std::string extension = toLower(path.substr(std::min(path.rfind('.'), path.size())));
+        auto importer = getImporters().find(extension);
+        return importer != getImporters().end() ? importer->second : MeshImporter::ASSIMP;
+    }
+
+    // Reads the meshes of a file with the importer chosen for its extension,
+    // computes their tangents and optimizes the buffers for the GPU, which
+    // the mesh cache then keeps. Touches no GL state, so pack_assets uses it
+    // too.
+    static bool importMesh(const std::string& path, MeshData& mesh)
+    {
+        bool imported = getImporter(path) == MeshImporter::OBJ
+            ? ObjImporter::import(path, mesh, jobSystem)
+            : importWithAssimp(path, mesh);
+        if (!imported)
+            return false;
+        MeshOptimizerReport report = MeshOptimizer::optimize(mesh.vertices, mesh.indices, mesh.submeshes);
+        logOptimization(path, report);
+        return true;
+    }
+
+    // Reads every mesh of a file with supported ASSIMP extensions into one,
+    // with the transforms of their nodes applied, and a submesh per
+    // material.
+    static bool importWithAssimp(const std::string& path, MeshData& mesh)
+    {
+        mesh.clear();
         // Read file via ASSIMP.
         Assimp::Importer importer;
 
@@ -86,46 +233,207 @@ private:
         // const aiScene* scene = importer.ReadFile(
         //     path, aiProcess_Triangulate | aiProcess_CalcTangentSpace
         // );
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenNormals);
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
-            std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
-            return;
+            logger.error(engine::LOG_CATEGORY_RESOURCE, "ERROR::ASSIMP:: {}", importer.GetErrorString());
+            return false;
         }
 
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+            mesh.materials.push_back(processMaterial(scene->mMaterials[i], directory));
+
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode->mChildren[0], scene);
+        std::vector<uint32_t> triangleMaterials;
+        processNode(scene->mRootNode, glm::mat4(1.0f), scene, mesh, triangleMaterials);
+
+        // Tangent vectors are evaluated manually.
+        computeTangents(mesh.vertices, mesh.indices);
+        groupByMaterial(mesh, triangleMaterials);
+        return true;
+    }
+    
+private:
+    std::vector<Texture*> ownedTextures;    // Loaded for the file's materials
+
+
+    static std::map<std::string, MeshImporter>& getImporters()
+    {
+        static std::map<std::string, MeshImporter> importers = {
+            { ".obj", MeshImporter::OBJ }
+        };
+        return importers;
+    }
+
+    static void logOptimization(const std::string& name, const MeshOptimizerReport& report)
+    {
+        logger.info(
+            engine::LOG_CATEGORY_RESOURCE, "Optimized {}: ACMR {} -> {}, ATVR {} -> {}",
+            name, (double)report.before.acmr, (double)report.after.acmr,
+            (double)report.before.atvr, (double)report.after.atvr
+        );
+    }
+
+    static std::string toLower(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) {
+            return (char)std::tolower(c);
+        });
+        return text;
+    }
+
+    // Loads a model with supported ASSIMP extensions from file and stores the
+    // resulting meshes in the mesh.
+    void loadModel(std::string const &path)
+    {
+        // Packed meshes are taken from the asset bundle, then the cache is
+        // tried. The file is only imported when both miss, or when they were
+        // written by another importer than the one now chosen.
+        uint32_t importer = (uint32_t)getImporter(path);
+        const AssetBundleEntry* entry = assetBundle.find(path, AssetType::MESH);
+        if (entry)
+            this->mesh = MeshCache::fromMemory(this->name, assetBundle.getData(*entry), entry->size, importer);
+        if (!this->mesh)
+            this->mesh = MeshCache::load(this->name, path, importer);
+        if (this->mesh)
+            return;
+
+        MeshData data;
+        if (!importMesh(path, data))
+            return;
+        this->mesh = new Mesh(this->name, std::move(data));
+        MeshCache::save(*(this->mesh), path, importer);
+    }
+
+    // Textures given to the constructor stand for every material. Otherwise
+    // each material gets the textures its file names, and a mid grey diffuse
+    // map if it names none.
+    void resolveMaterials()
+    {
+        if (!this->mesh)
+            return;
+        bool given = this->diffuse != nullptr;
+        std::map<std::pair<std::string, TextureRole>, Texture*> loaded;
+        for (const MeshMaterial& source : this->mesh->materials)
+        {
+            Material material;
+            if (given)
+            {
+                material.diffuse = this->diffuse;
+                material.normal = this->normal;
+                material.specular = this->specular;
+            }
+            else
+            {
+                material.diffuse = this->loadTexture(source.diffuse, TextureRole::DIFFUSE, loaded);
+                material.normal = this->loadTexture(source.normal, TextureRole::NORMAL, loaded);
+                material.specular = this->loadTexture(source.specular, TextureRole::SPECULAR, loaded);
+            }
+            this->materials.push_back(material);
+        }
+        if (!given)
+        {
+            this->diffuse = this->materials[0].diffuse;
+            this->normal = this->materials[0].normal;
+            this->specular = this->materials[0].specular;
+        }
+    }
+
+    // nullptr if path is empty or missing, except for diffuse maps, which
+    // fall back to a placeholder. Each file is loaded once per model.
+    Texture* loadTexture(
+        const std::string& path, TextureRole role,
+        std::map<std::pair<std::string, TextureRole>, Texture*>& loaded
+    ) {
+        auto key = std::make_pair(path, role);
+        auto ptr = loaded.find(key);
+        if (ptr != loaded.end())
+            return ptr->second;
+
+        Texture* texture = nullptr;
+        if (!path.empty() && (assetBundle.findImage(path) || std::ifstream(path)))
+            texture = new Texture(path, path);
+        else if (!path.empty())
+            logger.warning(engine::LOG_CATEGORY_RESOURCE, "MODEL::TEXTURE_NOT_FOUND {}", path);
+        if (!texture && role == TextureRole::DIFFUSE)
+            texture = new Texture(this->name + " Diffuse", role);
+        if (texture)
+            this->ownedTextures.push_back(texture);
+        loaded.insert(std::make_pair(key, texture));
+        return texture;
+    }
+
+    // The diffuse, normal and specular maps a material names. OBJ bump maps
+    // come in as height maps.
+    static MeshMaterial processMaterial(const aiMaterial* material, const std::string& directory)
+    {
+        auto getTexture = [&](aiTextureType type, std::string& path) {
+            aiString file;
+            // Embedded textures, named "*0" and so on, are not supported.
+            if (material->GetTextureCount(type) > 0
+                && material->GetTexture(type, 0, &file) == aiReturn_SUCCESS
+                && file.C_Str()[0] != '*')
+                path = directory + file.C_Str();
+            return !path.empty();
+        };
+        MeshMaterial result;
+        getTexture(aiTextureType_DIFFUSE, result.diffuse);
+        if (!getTexture(aiTextureType_NORMALS, result.normal))
+            getTexture(aiTextureType_HEIGHT, result.normal);
+        getTexture(aiTextureType_SPECULAR, result.specular);
+        return result;
     }
 
     // Original code : processes a node in a recursive fashion. Processes each
     //                 individual mesh located at the node and repeats this
     //                 process on its children nodes (if any).
-    // Modified version : only process FIRST item of obj file. Do not consider
-    //                    texture or material.
-    void processNode(aiNode* node, const aiScene* scene)
-    {
-        aiMesh* mesh = scene->mMeshes[node->mMeshes[0]];
-        this->mesh = processMesh(mesh, scene);
+    // The meshes of every node are appended to one, in model space.
+    static void processNode(
+        aiNode* node, const glm::mat4& parentTransform, const aiScene* scene,
+        MeshData& mesh, std::vector<uint32_t>& triangleMaterials
+    ) {
+        // aiMatrix4x4 is row major.
+        const aiMatrix4x4& m = node->mTransformation;
+        glm::mat4 transform = parentTransform * glm::mat4(
+            m.a1, m.b1, m.c1, m.d1,
+            m.a2, m.b2, m.c2, m.d2,
+            m.a3, m.b3, m.c3, m.d3,
+            m.a4, m.b4, m.c4, m.d4
+        );
+        for (unsigned int i = 0; i < node->mNumMeshes; ++i)
+            processMesh(scene->mMeshes[node->mMeshes[i]], transform, mesh, triangleMaterials);
+        for (unsigned int i = 0; i < node->mNumChildren; ++i)
+            processNode(node->mChildren[i], transform, scene, mesh, triangleMaterials);
     }
 
-    Mesh* processMesh(aiMesh* mesh, const aiScene* scene)
-    {
-        // Data to fill.
-        std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
-        std::vector<Texture> textures;
+    // Appends the vertices and triangles of one mesh, and the material of
+    // each triangle.
+    static void processMesh(
+        aiMesh* mesh, const glm::mat4& transform, MeshData& data,
+        std::vector<uint32_t>& triangleMaterials
+    ) {
+        std::vector<Vertex>& vertices = data.vertices;
+        std::vector<unsigned int>& indices = data.indices;
+        unsigned int baseVertex = (unsigned int)vertices.size();
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
 
         // Walk through each of the mesh's vertices.
-        for (int i = 0; i < mesh->mNumVertices; ++i)
+        for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
         {
             // An intermediate placeholder between ASSIMP and our vertex.
             Vertex vertex;
-            vertex.position = glm::vec3(
-                mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z
-            );
-            vertex.normal = glm::vec3(
-                mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z
-            );
+            vertex.position = glm::vec3(transform * glm::vec4(
+                mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f
+            ));
+            if (mesh->mNormals)
+            {
+                vertex.normal = glm::normalize(normalMatrix * glm::vec3(
+                    mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z
+                ));
+            }
+            else
+                vertex.normal = glm::vec3(0.0f);
             if (mesh->mTextureCoords[0])
             {
                 // A vertex can contain up to 8 different texture coordinates.
@@ -143,62 +451,26 @@ private:
             //     mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z
             // );
             vertex.tangent = glm::vec3(0.0f);
+            vertex.lightmapCoords = glm::vec2(0.0f);
             vertices.push_back(vertex);
         }
 
         // Walk through each of the mesh's faces (a face is a mesh its
-        // triangle) and retrieve the corresponding vertex indices.
-        for (int i = 0; i < mesh->mNumFaces; ++i)
+        // triangle) and retrieve the corresponding vertex indices. Points and
+        // lines, which triangulation leaves alone, are dropped.
+        for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
+            if (face.mNumIndices != 3)
+                continue;
             // Retrieve all indices of the face and store them in the index
             // vector.
-            for (int j = 0; j < face.mNumIndices; ++j)
+            for (unsigned int j = 0; j < face.mNumIndices; ++j)
             {
-                indices.push_back(face.mIndices[j]);
+                indices.push_back(baseVertex + face.mIndices[j]);
             }
-
-            // Tangent vectors are evaluated manually.
-            // Assume the number of vertices is a multiple of 3
-            // (triangluarization).
-            unsigned int i0 = face.mIndices[0];
-            unsigned int i1 = face.mIndices[1];
-            unsigned int i2 = face.mIndices[2];
-
-            glm::vec2 uv0 = vertices[i0].texCoords;
-            glm::vec2 uv1 = vertices[i1].texCoords;
-            glm::vec2 uv2 = vertices[i2].texCoords;
-            glm::vec3 pos0 = vertices[i0].position;
-            glm::vec3 pos1 = vertices[i1].position;
-            glm::vec3 pos2 = vertices[i2].position;
-
-            glm::vec3 edge0 = pos1 - pos0;
-            glm::vec3 edge1 = pos2 - pos0;
-            glm::vec2 deltaUV0 = uv1 - uv0;
-            glm::vec2 deltaUV1 = uv2 - uv0;
-            float eta = 1.0f / (deltaUV0.x * deltaUV1.y - deltaUV0.y * deltaUV1.x);
-
-            glm::vec3 tangent = eta * glm::vec3(
-                deltaUV1.y * edge0.x - deltaUV0.y * edge1.x,
-                deltaUV1.y * edge0.y - deltaUV0.y * edge1.y,
-                deltaUV1.y * edge0.z - deltaUV0.y * edge1.z
-            );
-            vertices[i0].tangent += tangent;
-            vertices[i1].tangent += tangent;
-            vertices[i2].tangent += tangent;
-        }
-
-        for (int i = 0; i < mesh->mNumVertices; ++i)
-        {
-            glm::vec3 normal = vertices[i].normal;
-            glm::vec3 tangent = vertices[i].tangent;
-            vertices[i].tangent = glm::normalize(
-                tangent - glm::dot(tangent, normal) * normal
-            );
+            triangleMaterials.push_back(mesh->mMaterialIndex);
         }
-        
-        // Return a mesh object created from the extracted mesh data.
-        return new Mesh(this->name, vertices, indices);
     }
 };
 }
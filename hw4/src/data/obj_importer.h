@@ -0,0 +1,661 @@
+#ifndef OBJ_IMPORTER_H
+#define OBJ_IMPORTER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "base/job_system.h"
+#include "base/system_global.h"
+#include "data/mesh.h"
+#include "utils/file_view.h"
+#include "utils/text_tokenizer.h"
+
+
+namespace engine
+{
+constexpr size_t OBJ_IMPORT_CHUNK_SIZE = 1 << 20;   // Bytes of text per parse job
+constexpr size_t OBJ_IMPORT_GRAIN = 1 << 16;        // Corners per job when indexing
+
+
+// One corner of a triangle as the file gives it. Indices are 0-based once
+// resolved, -1 for a missing texture coordinate or normal.
+struct ObjCorner
+{
+    int32_t index[3];                   // Position, texture coordinates, normal
+    uint8_t present;                    // Bit per index
+    uint8_t relative;                   // Bit per index, still to be offset
+};
+
+
+// The distinct (position, texture coordinates, normal) triples of a file,
+// filled by many threads at once with open addressing. A thread claims an
+// empty slot by swapping its position from EMPTY to WRITING, writes the
+// rest of the key and then publishes the position; a thread finding the key
+// already there only lowers the first corner that used it, so the vertex
+// order does not depend on the scheduling.
+class ObjVertexTable
+{
+public:
+    ObjVertexTable(size_t maxKeys)
+    {
+        size_t capacity = 16;
+        while (capacity < maxKeys + maxKeys / 2)
+            capacity *= 2;
+        this->mask = capacity - 1;
+        this->slots.reset(new Slot[capacity]);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    ObjVertexTable(const ObjVertexTable& other) = delete;
+    ObjVertexTable& operator=(const ObjVertexTable& other) = delete;
+
+    // Any thread. Returns the slot of the key.
+    uint32_t insert(const int32_t key[3], uint32_t corner)
+    {
+        size_t index = hash(key) & this->mask;
+        while (true)
+        {
+            Slot& slot = this->slots[index];
+            int32_t position = slot.position.load(std::memory_order_acquire);
+            if (position == EMPTY)
+            {
+                if (slot.position.compare_exchange_strong(
+                    position, WRITING, std::memory_order_acquire))
+                {
+                    slot.texCoords = key[1];
+                    slot.normal = key[2];
+                    slot.position.store(key[0], std::memory_order_release);
+                    lowerFirstCorner(slot, corner);
+                    return (uint32_t)index;
+                }
+            }
+            // Claimed a moment ago, the key is a couple of stores away.
+            while (position == WRITING)
+                position = slot.position.load(std::memory_order_acquire);
+            if (position == key[0] && slot.texCoords == key[1] && slot.normal == key[2])
+            {
+                lowerFirstCorner(slot, corner);
+                return (uint32_t)index;
+            }
+            index = (index + 1) & this->mask;
+        }
+    }
+
+    // Once every insert() is done.
+    uint32_t getFirstCorner(uint32_t slot) const
+    {
+        return this->slots[slot].firstCorner.load(std::memory_order_relaxed);
+    }
+
+    // The first corner is not needed any more once the vertices are
+    // numbered, so the slot keeps the vertex index in its place.
+    void setVertex(uint32_t slot, uint32_t vertex)
+    {
+        this->slots[slot].firstCorner.store(vertex, std::memory_order_relaxed);
+    }
+
+    uint32_t getVertex(uint32_t slot) const
+    {
+        return this->slots[slot].firstCorner.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int32_t EMPTY = -1;    // Positions are never negative
+    static constexpr int32_t WRITING = -2;
+
+    struct Slot
+    {
+        std::atomic<int32_t> position{EMPTY};
+        int32_t texCoords = 0;
+        int32_t normal = 0;
+        std::atomic<uint32_t> firstCorner{UINT32_MAX};
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+
+    static void lowerFirstCorner(Slot& slot, uint32_t corner)
+    {
+        uint32_t first = slot.firstCorner.load(std::memory_order_relaxed);
+        while (corner < first
+            && !slot.firstCorner.compare_exchange_weak(first, corner, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    static uint64_t hash(const int32_t key[3])
+    {
+        uint64_t h = (uint64_t)(uint32_t)key[0] * 0x9e3779b97f4a7c15ull;
+        h ^= (uint64_t)(uint32_t)key[1] * 0xc2b2ae3d27d4eb4full;
+        h ^= (uint64_t)(uint32_t)key[2] * 0x165667b19e3779f9ull;
+        h ^= h >> 32;
+        return h;
+    }
+};
+
+
+// Reads Wavefront OBJ files without Assimp, on the job system. The file is
+// mapped and cut into chunks at line breaks, and every pass works on all
+// the chunks in parallel:
+//
+//   1. parse the v, vt, vn and f lines of each chunk, fans triangulating
+//      the faces;
+//   2. once the counts of the chunks before are known, resolve negative
+//      indices and put every corner into an ObjVertexTable;
+//   3. number the distinct corners in the order they first appear and
+//      build the vertices right where they belong;
+//   4. write the index buffer, one entry per corner.
+//
+// Corners sharing position, texture coordinates and normal become one
+// vertex, so unlike an Assimp import without aiProcess_JoinIdenticalVertices
+// the mesh is indexed and tangents are smoothed across the faces sharing a
+// vertex. Every face of the file goes into the one mesh, with a submesh per
+// usemtl material whose texture maps are read from the mtllib files; groups
+// and objects are ignored. Vertices without a normal get the area-weighted
+// normal of their faces.
+class ObjImporter
+{
+public:
+    static bool import(const std::string& path, MeshData& mesh, JobSystem& jobs)
+    {
+        mesh.clear();
+        std::vector<Vertex>& vertices = mesh.vertices;
+        std::vector<unsigned int>& indices = mesh.indices;
+        FileView file;
+        if (!file.open(path))
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "ERROR::OBJ_IMPORTER::FILE_NOT_SUCCESFULLY_READ {}", path);
+            return false;
+        }
+
+        std::vector<Chunk> chunks = split(file.getText());
+        jobs.parallelFor(0, chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+                parse(chunks[i]);
+        });
+
+        size_t numPositions = 0;
+        size_t numTexCoords = 0;
+        size_t numNormals = 0;
+        size_t numCorners = 0;
+        for (Chunk& chunk : chunks)
+        {
+            if (chunk.error)
+            {
+                logger.error(LOG_CATEGORY_RESOURCE, "ERROR::OBJ_IMPORTER::{} {}", chunk.error, path);
+                return false;
+            }
+            chunk.firstPosition = numPositions;
+            chunk.firstTexCoords = numTexCoords;
+            chunk.firstNormal = numNormals;
+            chunk.firstCorner = numCorners;
+            numPositions += chunk.positions.size();
+            numTexCoords += chunk.texCoords.size();
+            numNormals += chunk.normals.size();
+            numCorners += chunk.corners.size();
+        }
+
+        // Number the materials in the order they are first used. Faces
+        // before any usemtl get a material of their own, without textures.
+        std::vector<std::string_view> materialNames;
+        std::vector<std::string_view> libraries;
+        std::map<std::string_view, uint32_t> materialIds;
+        uint32_t currentMaterial = UINT32_MAX;
+        auto getMaterialId = [&](std::string_view name) {
+            auto ptr = materialIds.insert(std::make_pair(name, (uint32_t)materialNames.size()));
+            if (ptr.second)
+                materialNames.push_back(name);
+            return ptr.first->second;
+        };
+        for (Chunk& chunk : chunks)
+        {
+            libraries.insert(libraries.end(), chunk.libraries.begin(), chunk.libraries.end());
+            if (currentMaterial == UINT32_MAX && (chunk.materialChanges.empty()
+                || chunk.materialChanges[0].first > 0))
+                currentMaterial = getMaterialId(std::string_view());
+            chunk.firstMaterial = currentMaterial;
+            for (const auto& change : chunk.materialChanges)
+            {
+                currentMaterial = getMaterialId(change.second);
+                chunk.materialIds.push_back(currentMaterial);
+            }
+        }
+        if (numCorners == 0 || numCorners >= CORNER_FIRST_FLAG || numPositions > INT32_MAX
+            || numTexCoords > INT32_MAX || numNormals > INT32_MAX)
+        {
+            logger.error(
+                LOG_CATEGORY_RESOURCE, "ERROR::OBJ_IMPORTER::{} {}",
+                numCorners == 0 ? "NO_FACES" : "TOO_LARGE", path
+            );
+            return false;
+        }
+
+        // Gather the attributes and put the corners into the table.
+        std::vector<glm::vec3> positions(numPositions);
+        std::vector<glm::vec2> texCoords(numTexCoords);
+        std::vector<glm::vec3> normals(numNormals);
+        const int64_t counts[3] = { (int64_t)numPositions, (int64_t)numTexCoords, (int64_t)numNormals };
+        ObjVertexTable table(numCorners);
+        std::vector<uint32_t> cornerSlots(numCorners);
+        std::atomic<bool> outOfRange{false};
+        jobs.parallelFor(0, chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+            {
+                Chunk& chunk = chunks[i];
+                std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.firstPosition);
+                std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + chunk.firstTexCoords);
+                std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.firstNormal);
+                const int64_t offsets[3] = {
+                    (int64_t)chunk.firstPosition, (int64_t)chunk.firstTexCoords,
+                    (int64_t)chunk.firstNormal
+                };
+                for (size_t j = 0; j < chunk.corners.size(); ++j)
+                {
+                    ObjCorner& corner = chunk.corners[j];
+                    if (!resolve(corner, offsets, counts))
+                    {
+                        outOfRange.store(true, std::memory_order_relaxed);
+                        corner.index[0] = corner.index[1] = corner.index[2] = 0;
+                    }
+                    uint32_t id = (uint32_t)(chunk.firstCorner + j);
+                    cornerSlots[id] = table.insert(corner.index, id);
+                }
+            }
+        });
+        if (outOfRange.load())
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "ERROR::OBJ_IMPORTER::INDEX_OUT_OF_RANGE {}", path);
+            return false;
+        }
+
+        // Flag the corners that introduce a vertex, and count them per chunk.
+        jobs.parallelFor(0, chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+            {
+                Chunk& chunk = chunks[i];
+                chunk.numVertices = 0;
+                for (size_t j = 0; j < chunk.corners.size(); ++j)
+                {
+                    uint32_t id = (uint32_t)(chunk.firstCorner + j);
+                    if (table.getFirstCorner(cornerSlots[id]) == id)
+                    {
+                        cornerSlots[id] |= CORNER_FIRST_FLAG;
+                        ++(chunk.numVertices);
+                    }
+                }
+            }
+        });
+        size_t numVertices = 0;
+        for (Chunk& chunk : chunks)
+        {
+            chunk.firstVertex = numVertices;
+            numVertices += chunk.numVertices;
+        }
+
+        // Build the vertices in place.
+        vertices.resize(numVertices);
+        std::vector<unsigned char> missingNormals(numVertices, 0);
+        std::atomic<bool> anyMissingNormal{false};
+        jobs.parallelFor(0, chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+            {
+                Chunk& chunk = chunks[i];
+                uint32_t vertexIndex = (uint32_t)chunk.firstVertex;
+                for (size_t j = 0; j < chunk.corners.size(); ++j)
+                {
+                    uint32_t slot = cornerSlots[chunk.firstCorner + j];
+                    if (!(slot & CORNER_FIRST_FLAG))
+                        continue;
+                    const ObjCorner& corner = chunk.corners[j];
+                    Vertex& vertex = vertices[vertexIndex];
+                    vertex.position = positions[corner.index[0]];
+                    vertex.texCoords = corner.index[1] >= 0 ? texCoords[corner.index[1]] : glm::vec2(0.0f);
+                    vertex.normal = corner.index[2] >= 0 ? normals[corner.index[2]] : glm::vec3(0.0f);
+                    vertex.tangent = glm::vec3(0.0f);
+                    vertex.lightmapCoords = glm::vec2(0.0f);
+                    if (corner.index[2] < 0)
+                    {
+                        missingNormals[vertexIndex] = 1;
+                        anyMissingNormal.store(true, std::memory_order_relaxed);
+                    }
+                    table.setVertex(slot & ~CORNER_FIRST_FLAG, vertexIndex);
+                    ++vertexIndex;
+                }
+            }
+        });
+
+        indices.resize(numCorners);
+        jobs.parallelFor(0, numCorners, OBJ_IMPORT_GRAIN, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+                indices[i] = table.getVertex(cornerSlots[i] & ~CORNER_FIRST_FLAG);
+        });
+
+        if (anyMissingNormal.load())
+            computeMissingNormals(vertices, indices, missingNormals);
+        computeTangents(vertices, indices);
+
+        // The material of every triangle, then the triangles grouped into one
+        // submesh per material.
+        std::vector<uint32_t> triangleMaterials(numCorners / 3, 0);
+        if (materialNames.size() > 1)
+        {
+            jobs.parallelFor(0, chunks.size(), 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i)
+                {
+                    const Chunk& chunk = chunks[i];
+                    uint32_t material = chunk.firstMaterial;
+                    size_t change = 0;
+                    size_t firstTriangle = chunk.firstCorner / 3;
+                    for (size_t t = 0; t < chunk.corners.size() / 3; ++t)
+                    {
+                        while (change < chunk.materialChanges.size()
+                            && chunk.materialChanges[change].first <= t)
+                            material = chunk.materialIds[change++];
+                        triangleMaterials[firstTriangle + t] = material;
+                    }
+                }
+            });
+        }
+        mesh.materials = readMaterials(path, libraries, materialNames);
+        groupByMaterial(mesh, triangleMaterials);
+        return true;
+    }
+
+private:
+    static constexpr uint32_t CORNER_FIRST_FLAG = 0x80000000u;
+
+    struct Chunk
+    {
+        std::string_view text;
+        const char* error = nullptr;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> texCoords;
+        std::vector<glm::vec3> normals;
+        std::vector<ObjCorner> corners;     // Three per triangle
+        std::vector<std::string_view> libraries;
+        // Triangle of the chunk each usemtl applies from, and its material.
+        std::vector<std::pair<size_t, std::string_view>> materialChanges;
+        std::vector<uint32_t> materialIds;  // Of the changes
+        uint32_t firstMaterial = 0;         // In use when the chunk starts
+
+        // Of the chunks before.
+        size_t firstPosition = 0;
+        size_t firstTexCoords = 0;
+        size_t firstNormal = 0;
+        size_t firstCorner = 0;
+        size_t firstVertex = 0;
+        size_t numVertices = 0;
+    };
+
+
+    static std::vector<Chunk> split(std::string_view text)
+    {
+        std::vector<Chunk> chunks;
+        size_t start = 0;
+        while (start < text.size())
+        {
+            size_t end = std::min(start + OBJ_IMPORT_CHUNK_SIZE, text.size());
+            if (end < text.size())
+            {
+                size_t lineEnd = text.find('\n', end);
+                end = lineEnd == std::string_view::npos ? text.size() : lineEnd + 1;
+            }
+            chunks.emplace_back();
+            chunks.back().text = text.substr(start, end - start);
+            start = end;
+        }
+        return chunks;
+    }
+
+    static void parse(Chunk& chunk)
+    {
+        // Rough guesses, to skip most of the reallocations.
+        chunk.positions.reserve(chunk.text.size() / 96);
+        chunk.corners.reserve(chunk.text.size() / 12);
+
+        TextTokenizer lines(chunk.text);
+        std::string_view line;
+        std::vector<ObjCorner> face;
+        while (lines.nextLine(line))
+        {
+            TextTokenizer tokens(line);
+            std::string_view keyword;
+            if (!tokens.next(keyword) || keyword[0] == '#')
+                continue;
+
+            if (keyword == "v")
+            {
+                glm::vec3 position;
+                if (!tokens.nextFloat(position.x) || !tokens.nextFloat(position.y)
+                    || !tokens.nextFloat(position.z))
+                {
+                    chunk.error = "INVALID_POSITION";
+                    return;
+                }
+                chunk.positions.push_back(position);
+            }
+            else if (keyword == "vt")
+            {
+                // v is optional, and so is the w we drop.
+                glm::vec2 texCoords(0.0f);
+                if (!tokens.nextFloat(texCoords.x)
+                    || (!tokens.atEnd() && !tokens.nextFloat(texCoords.y)))
+                {
+                    chunk.error = "INVALID_TEXTURE_COORDINATES";
+                    return;
+                }
+                chunk.texCoords.push_back(texCoords);
+            }
+            else if (keyword == "vn")
+            {
+                glm::vec3 normal;
+                if (!tokens.nextFloat(normal.x) || !tokens.nextFloat(normal.y)
+                    || !tokens.nextFloat(normal.z))
+                {
+                    chunk.error = "INVALID_NORMAL";
+                    return;
+                }
+                chunk.normals.push_back(normal);
+            }
+            else if (keyword == "f")
+            {
+                face.clear();
+                std::string_view token;
+                while (tokens.next(token))
+                {
+                    ObjCorner corner;
+                    if (!parseCorner(token, chunk, corner))
+                    {
+                        chunk.error = "INVALID_FACE";
+                        return;
+                    }
+                    face.push_back(corner);
+                }
+                for (size_t i = 1; i + 1 < face.size(); ++i)
+                {
+                    chunk.corners.push_back(face[0]);
+                    chunk.corners.push_back(face[i]);
+                    chunk.corners.push_back(face[i + 1]);
+                }
+            }
+            else if (keyword == "usemtl")
+            {
+                std::string_view name;
+                tokens.next(name);
+                chunk.materialChanges.push_back(std::make_pair(chunk.corners.size() / 3, name));
+            }
+            else if (keyword == "mtllib")
+            {
+                std::string_view library;
+                while (tokens.next(library))
+                    chunk.libraries.push_back(library);
+            }
+            // Anything else, groups, objects, smoothing groups, lines and
+            // points, is skipped.
+        }
+    }
+
+    // v, v/vt, v//vn or v/vt/vn. Negative indices count back from the last
+    // attribute read so far, which is only known relative to the chunk yet.
+    static bool parseCorner(std::string_view token, const Chunk& chunk, ObjCorner& corner)
+    {
+        const size_t counts[3] = {
+            chunk.positions.size(), chunk.texCoords.size(), chunk.normals.size()
+        };
+        corner.present = 0;
+        corner.relative = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            corner.index[i] = -1;
+            size_t slash = std::min(token.find('/'), token.size());
+            std::string_view part = token.substr(0, slash);
+            token.remove_prefix(std::min(slash + 1, token.size()));
+            if (part.empty())
+            {
+                if (i == 0)
+                    return false;
+                continue;
+            }
+            int value = 0;
+            const char* last = part.data() + part.size();
+            std::from_chars_result result = std::from_chars(part.data(), last, value);
+            if (result.ec != std::errc() || result.ptr != last || value == 0)
+                return false;
+            corner.present |= 1 << i;
+            if (value > 0)
+            {
+                corner.index[i] = value - 1;
+            }
+            else
+            {
+                corner.index[i] = (int32_t)counts[i] + value;
+                corner.relative |= 1 << i;
+            }
+        }
+        return token.empty();
+    }
+
+    static bool resolve(ObjCorner& corner, const int64_t offsets[3], const int64_t counts[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            if (!(corner.present & (1 << i)))
+                continue;
+            int64_t index = corner.index[i];
+            if (corner.relative & (1 << i))
+                index += offsets[i];
+            if (index < 0 || index >= counts[i])
+                return false;
+            corner.index[i] = (int32_t)index;
+        }
+        return true;
+    }
+
+    // The texture maps of the named materials, from the mtllib files next
+    // to the OBJ file. Materials that are not found get no textures.
+    static std::vector<MeshMaterial> readMaterials(
+        const std::string& path, const std::vector<std::string_view>& libraries,
+        const std::vector<std::string_view>& names
+    ) {
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::map<std::string, MeshMaterial, std::less<>> found;
+        for (std::string_view library : libraries)
+        {
+            std::string libraryPath = directory + std::string(library);
+            FileView file;
+            if (!file.open(libraryPath))
+            {
+                logger.warning(
+                    LOG_CATEGORY_RESOURCE, "OBJ_IMPORTER::MATERIAL_LIBRARY_NOT_FOUND {}", libraryPath
+                );
+                continue;
+            }
+            TextTokenizer lines(file.getText());
+            std::string_view line;
+            MeshMaterial* material = nullptr;
+            while (lines.nextLine(line))
+            {
+                TextTokenizer tokens(line);
+                std::string_view keyword;
+                if (!tokens.next(keyword))
+                    continue;
+                if (keyword == "newmtl")
+                {
+                    std::string_view name;
+                    tokens.next(name);
+                    material = &(found[std::string(name)]);
+                    continue;
+                }
+                if (!material)
+                    continue;
+                std::string* map = nullptr;
+                if (keyword == "map_Kd")
+                    map = &(material->diffuse);
+                else if (keyword == "map_Bump" || keyword == "map_bump" || keyword == "bump"
+                    || keyword == "norm")
+                    map = &(material->normal);
+                else if (keyword == "map_Ks")
+                    map = &(material->specular);
+                if (!map)
+                    continue;
+                // Options such as -bm 1.0 come first, the file name last.
+                std::string_view token;
+                std::string_view fileName;
+                while (tokens.next(token))
+                    fileName = token;
+                if (!fileName.empty())
+                    *map = directory + std::string(fileName);
+            }
+        }
+
+        std::vector<MeshMaterial> materials(names.size());
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            auto ptr = found.find(names[i]);
+            if (ptr != found.end())
+                materials[i] = ptr->second;
+        }
+        return materials;
+    }
+
+    static void computeMissingNormals(
+        std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+        const std::vector<unsigned char>& missing
+    ) {
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            const unsigned int corners[3] = { indices[i], indices[i + 1], indices[i + 2] };
+            // Twice the area, so larger faces weigh more.
+            glm::vec3 normal = glm::cross(
+                vertices[corners[1]].position - vertices[corners[0]].position,
+                vertices[corners[2]].position - vertices[corners[0]].position
+            );
+            for (unsigned int corner : corners)
+            {
+                if (missing[corner])
+                    vertices[corner].normal += normal;
+            }
+        }
+        for (size_t i = 0; i < vertices.size(); ++i)
+        {
+            float length = glm::length(vertices[i].normal);
+            if (missing[i] && length > 0.0f)
+                vertices[i].normal /= length;
+        }
+    }
+};
+}
+
+#endif
@@ -4,16 +4,96 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <string_view>
+#include <stdexcept>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 #include "base/asset.h"
+#include "base/system_global.h"
+#include "utils/file_view.h"
 
 
 namespace engine
 {
+// Handle to a uniform of a Shader, see Shader::getUniform().
+template <typename T>
+struct Uniform
+{
+    int slot = -1;                      // -1 if the uniform is inactive
+};
+
+
+// GL types a C++ type may be uploaded to, and how.
+template <typename T> struct UniformTraits;
+
+template <> struct UniformTraits<int>
+{
+    static bool accepts(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_INT: case GL_BOOL:
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D:
+        case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_SHADOW:
+        case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_BUFFER:
+        case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+            return true;
+        default:
+            return false;
+        }
+    }
+    static void upload(GLint location, int value) { glUniform1i(location, value); }
+};
+
+template <> struct UniformTraits<float>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT; }
+    static void upload(GLint location, float value) { glUniform1f(location, value); }
+};
+
+template <> struct UniformTraits<glm::vec2>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC2; }
+    static void upload(GLint location, const glm::vec2& value) { glUniform2fv(location, 1, &value[0]); }
+};
+
+template <> struct UniformTraits<glm::vec3>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+    static void upload(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+};
+
+template <> struct UniformTraits<glm::vec4>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+    static void upload(GLint location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+};
+
+template <> struct UniformTraits<glm::mat2>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT2; }
+    static void upload(GLint location, const glm::mat2& value) { glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+
+template <> struct UniformTraits<glm::mat3>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT3; }
+    static void upload(GLint location, const glm::mat3& value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+
+template <> struct UniformTraits<glm::mat4>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+    static void upload(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+
+
 // This is updated version of shader that can handle geometry and tessellation shader.
 class Shader : public Asset
 {
@@ -51,6 +131,7 @@ public:
         // }
         glLinkProgram(this->ID);
         checkCompileErrors(this->ID, std::string("PROGRAM"));
+        this->reflect();
 
         // Delete the shaders as they're linked into our program now and no longer necessery.
         glDeleteShader(vertex);
@@ -72,66 +153,210 @@ public:
         glUseProgram(this->ID); 
     }
 
-    // Utility uniform functions.
+    // Location of an active uniform, or -1 if the program does not use it.
+    // Arrays are reflected per element ("lights[2]"), and also under their
+    // plain name for the first element.
+    GLint getUniformLocation(const std::string& name) const
+    {
+        auto ptr = this->uniformSlots.find(name);
+        return ptr == this->uniformSlots.end() ? -1 : this->uniforms[ptr->second].location;
+    }
+
+    // Index of an active uniform block, or GL_INVALID_INDEX.
+    GLuint getUniformBlockIndex(const std::string& name) const
+    {
+        auto ptr = this->uniformBlocks.find(name);
+        return ptr == this->uniformBlocks.end() ? GL_INVALID_INDEX : ptr->second;
+    }
+
+    // Connects a uniform block to a binding point of glBindBufferRange().
+    // Does nothing if the program does not use the block.
+    void bindUniformBlock(const std::string& name, GLuint binding)
+    {
+        GLuint index = this->getUniformBlockIndex(name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(this->ID, index, binding);
+    }
+
+    // Resolves a uniform once, for setters in hot loops. Inactive uniforms
+    // give a handle that is silently ignored, like location -1 in GL, but a
+    // type that does not match the declaration in GLSL is an error.
+    template <typename T>
+    Uniform<T> getUniform(const std::string& name) const
+    {
+        Uniform<T> handle;
+        auto ptr = this->uniformSlots.find(name);
+        if (ptr == this->uniformSlots.end())
+            return handle;
+        if (!UniformTraits<T>::accepts(this->uniforms[ptr->second].type))
+        {
+            throw std::invalid_argument(
+                "ERROR::SHADER::Uniform type mismatch for " + name + " in " + this->name
+            );
+        }
+        handle.slot = ptr->second;
+        return handle;
+    }
+
+    // Uploads the value unless the uniform already holds it. The program must
+    // be in use, as for the setters below.
+    template <typename T>
+    void set(Uniform<T> handle, const T& value)
+    {
+        if (handle.slot < 0)
+            return;
+        UniformSlot& slot = this->uniforms[handle.slot];
+        if (slot.hasValue && std::memcmp(slot.value, &value, sizeof(T)) == 0)
+            return;
+        std::memcpy(slot.value, &value, sizeof(T));
+        slot.hasValue = true;
+        UniformTraits<T>::upload(slot.location, value);
+    }
+
+    // Utility uniform functions. These look the name up in the reflected
+    // table, so they cost no driver round trip, but prefer getUniform() in
+    // per-draw code.
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    void setBool(const std::string& name, bool value)
     {         
-        glUniform1i(glGetUniformLocation(this->ID, name.c_str()), (int)value); 
+        this->setByName(name, (int)value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    void setInt(const std::string& name, int value)
     { 
-        glUniform1i(glGetUniformLocation(this->ID, name.c_str()), value); 
+        this->setByName(name, value);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    void setFloat(const std::string& name, float value)
     { 
-        glUniform1f(glGetUniformLocation(this->ID, name.c_str()), value); 
+        this->setByName(name, value);
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string& name, const glm::vec2& value) const
+    void setVec2(const std::string& name, const glm::vec2& value)
     { 
-        glUniform2fv(glGetUniformLocation(this->ID, name.c_str()), 1, &value[0]); 
+        this->setByName(name, value);
     }
-    void setVec2(const std::string& name, float x, float y) const
+    void setVec2(const std::string& name, float x, float y)
     { 
-        glUniform2f(glGetUniformLocation(this->ID, name.c_str()), x, y); 
+        this->setByName(name, glm::vec2(x, y));
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string& name, const glm::vec3& value) const
+    void setVec3(const std::string& name, const glm::vec3& value)
     { 
-        glUniform3fv(glGetUniformLocation(this->ID, name.c_str()), 1, &value[0]); 
+        this->setByName(name, value);
     }
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void setVec3(const std::string& name, float x, float y, float z)
     { 
-        glUniform3f(glGetUniformLocation(this->ID, name.c_str()), x, y, z); 
+        this->setByName(name, glm::vec3(x, y, z));
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string& name, const glm::vec4& value) const
+    void setVec4(const std::string& name, const glm::vec4& value)
     { 
-        glUniform4fv(glGetUniformLocation(this->ID, name.c_str()), 1, &value[0]); 
+        this->setByName(name, value);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(this->ID, name.c_str()), x, y, z, w); 
+        this->setByName(name, glm::vec4(x, y, z, w));
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string& name, const glm::mat2& mat) const
+    void setMat2(const std::string& name, const glm::mat2& mat)
     {
-        glUniformMatrix2fv(glGetUniformLocation(this->ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        this->setByName(name, mat);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string& name, const glm::mat3& mat) const
+    void setMat3(const std::string& name, const glm::mat3& mat)
     {
-        glUniformMatrix3fv(glGetUniformLocation(this->ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        this->setByName(name, mat);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string& name, const glm::mat4& mat) const
+    void setMat4(const std::string& name, const glm::mat4& mat)
     {
-        glUniformMatrix4fv(glGetUniformLocation(this->ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        this->setByName(name, mat);
     }
 
 private:
+    struct UniformSlot
+    {
+        GLint location;
+        GLenum type;
+        bool hasValue = false;
+        unsigned char value[sizeof(glm::mat4)];     // Last uploaded value
+    };
+
+    std::vector<UniformSlot> uniforms;
+    std::unordered_map<std::string, int> uniformSlots;
+    std::unordered_map<std::string, GLuint> uniformBlocks;
+
+
+    template <typename T>
+    void setByName(const std::string& name, const T& value)
+    {
+        auto ptr = this->uniformSlots.find(name);
+        if (ptr == this->uniformSlots.end())
+            return;
+        // Loose on types, as glUniform* is: setInt() also sets bools and
+        // samplers, setFloat() a float.
+        Uniform<T> handle;
+        handle.slot = ptr->second;
+        this->set(handle, value);
+    }
+
+    // Reads the active uniforms and uniform blocks of the linked program.
+    void reflect()
+    {
+        GLint numUniforms = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(this->ID, GL_ACTIVE_UNIFORMS, &numUniforms);
+        glGetProgramiv(this->ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(std::max(maxLength, 1) + 16);
+        for (GLint i = 0; i < numUniforms; ++i)
+        {
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(
+                this->ID, (GLuint)i, (GLsizei)buffer.size(), nullptr, &size, &type,
+                buffer.data()
+            );
+            std::string uniformName(buffer.data());
+            // Members of uniform blocks have no location.
+            if (glGetUniformLocation(this->ID, uniformName.c_str()) < 0)
+                continue;
+
+            // Arrays are reported once as "name[0]". Members of arrays of
+            // structs are reported one by one and need no expansion.
+            std::string base = uniformName;
+            bool isArray = base.size() > 3
+                && base.compare(base.size() - 3, 3, "[0]") == 0;
+            if (isArray)
+                base = base.substr(0, base.size() - 3);
+            for (GLint e = 0; e < size; ++e)
+            {
+                std::string element = isArray
+                    ? base + "[" + std::to_string(e) + "]" : base;
+                UniformSlot slot;
+                slot.location = glGetUniformLocation(this->ID, element.c_str());
+                slot.type = type;
+                int index = (int)this->uniforms.size();
+                this->uniforms.push_back(slot);
+                this->uniformSlots.insert(std::make_pair(element, index));
+                if (e == 0)
+                    this->uniformSlots.insert(std::make_pair(base, index));
+            }
+        }
+
+        GLint numBlocks = 0;
+        glGetProgramiv(this->ID, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+        glGetProgramiv(this->ID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        buffer.resize(std::max(maxLength, 1) + 1);
+        for (GLint i = 0; i < numBlocks; ++i)
+        {
+            glGetActiveUniformBlockName(
+                this->ID, (GLuint)i, (GLsizei)buffer.size(), nullptr, buffer.data()
+            );
+            this->uniformBlocks.insert(std::make_pair(std::string(buffer.data()), (GLuint)i));
+        }
+    }
+
     // Utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, const std::string& type)
@@ -166,26 +391,15 @@ private:
 
     unsigned int load_shader(const std::string& path, unsigned int shaderType)
     {
-        std::string code;
-        std::ifstream file;
-        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            file.open(path);
-            std::stringstream shaderStream;
-            shaderStream << file.rdbuf();	
-            file.close();
-
-            code = shaderStream.str();
-        }
-        catch (std::ifstream::failure e)
-        {
+        // Compiled right from the mapped file, or its packed copy.
+        FileView file;
+        if (!file.open(path))
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
-        const char* shaderCode = code.c_str();
+        std::string_view code = file.getText();
+        const char* shaderCode = code.data();
 
         unsigned int shaderID = glCreateShader(shaderType);
-        int codeLength = code.length();
+        int codeLength = (int)code.size();
         glShaderSource(shaderID, 1, &shaderCode, &codeLength);
         glCompileShader(shaderID);
         std::string type;
@@ -3,32 +3,104 @@
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION   // use of stb functions once and for all
 #include "ext/stb_image.h"
 
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "base/asset.h"
+#include "base/system_global.h"
 
 
 namespace engine
 {
+// What a texture is used for, which decides the placeholder shown while it
+// streams in: the mean of its kind, so the swap is hardly noticed.
+enum class TextureRole
+{
+    DIFFUSE,
+    NORMAL,
+    SPECULAR
+};
+
+
 class Texture : public Asset
 {
 public:
-    unsigned int ID;
-    int width;
-    int height;
-    int channels;
+    unsigned int ID = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    // Mean texel color, known once the file is decoded.
+    glm::vec3 averageColor = glm::vec3(0.5f);
 
 
     Texture(const std::string& name, const std::string& filePath) : Asset(name)
-    {   
+    {
+        if (!this->map(filePath))
+            this->decode(filePath);
+        glGenTextures(1, &(this->ID));
+        this->setParameters();
+        this->uploadPixels();
+        this->releasePixels();
+    }
+
+    ~Texture()
+    {
+        this->releasePixels();
+    }
+
+    // Mean of the RGB channels, in [0, 1].
+    static glm::vec3 computeAverageColor(
+        const unsigned char* pixels, int width, int height, int channels
+    ) {
+        glm::dvec3 sum(0.0);
+        size_t texels = (size_t)width * height;
+        if (texels == 0 || channels < 3)
+            return glm::vec3(0.5f);
+        for (size_t i = 0; i < texels; ++i)
+        {
+            const unsigned char* texel = pixels + i * channels;
+            sum += glm::dvec3(texel[0], texel[1], texel[2]);
+        }
+        return glm::vec3(sum / (255.0 * texels));
+    }
+
+private:
+    friend class TextureStreamer;
+    friend class Model;                 // Placeholders for missing maps
+
+    unsigned char* pixels = nullptr;    // Decoded, until uploaded
+    // Or, for a packed texture, the image in the asset bundle. Its rows are
+    // top first and flipped while copied out, see copyPixels().
+    const unsigned char* mappedPixels = nullptr;
+
+
+    // Streamed textures start as a 1x1 placeholder, see TextureStreamer.
+    Texture(const std::string& name, TextureRole role) : Asset(name)
+    {
+        static const unsigned char PLACEHOLDERS[][4] = {
+            { 128, 128, 128, 255 },     // Diffuse: mid grey
+            { 128, 128, 255, 255 },     // Normal: flat
+            { 0, 0, 0, 255 }            // Specular: none
+        };
         glGenTextures(1, &(this->ID));
+        this->setParameters();
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, PLACEHOLDERS[(int)role]
+        );
+    }
+
+    void setParameters()
+    {
         glBindTexture(GL_TEXTURE_2D, this->ID);
 
         // Set the texture wrapping parameters.
@@ -38,14 +110,17 @@ public:
         // Set texture filtering parameters.
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
 
-        stbi_set_flip_vertically_on_load(true);
-
-        unsigned char *data = stbi_load(
-            filePath.c_str(), &(this->width), &(this->height), &(this->channels), 0
-        );
-        if (data)
-        {   
+    // Replaces the image with the decoded one. data is either the pixels
+    // themselves or, with a pixel unpack buffer bound, the offset into it.
+    void upload(const void* data)
+    {
+        glBindTexture(GL_TEXTURE_2D, this->ID);
+        if (this->hasPixels())
+        {
+            // Rows of RGB images are not 4-byte aligned in general.
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
             if (channels == 3)
                 glTexImage2D(
                     GL_TEXTURE_2D, 0, GL_RGB, this->width, this->height, 0,
@@ -57,16 +132,112 @@ public:
                     GL_RGBA, GL_UNSIGNED_BYTE, data
                 );
             else
-                std::cout << "ERROR::TEXTURE::WRONG_CHANNEL_SIZE" << std::endl;
-            
+                logger.error(
+                    LOG_CATEGORY_RESOURCE, "Texture {} has {} channels", this->name, channels
+                );
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
             glGenerateMipmap(GL_TEXTURE_2D);
         }
         else
         {
-            std::cout << "ERROR::TEXTURE::FAILED_TO_LOAD_TEXTURE" << std::endl;
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to load texture {}", this->name);
         }
+    }
+
+    // Uploads straight from the decoded pixels, or a flipped copy of the
+    // mapped ones.
+    void uploadPixels()
+    {
+        if (!this->mappedPixels)
+        {
+            this->upload(this->pixels);
+            return;
+        }
+        std::vector<unsigned char> flipped(this->getPixelBytes());
+        this->copyPixels(flipped.data());
+        this->upload(flipped.data());
+    }
+
+    bool hasPixels() const
+    {
+        return this->pixels || this->mappedPixels;
+    }
 
-        stbi_image_free(data);
+    size_t getPixelBytes() const
+    {
+        return (size_t)this->width * this->height * this->channels;
+    }
+
+    // Writes the image bottom row first, as GL wants it.
+    void copyPixels(unsigned char* destination) const
+    {
+        if (this->pixels)
+        {
+            std::memcpy(destination, this->pixels, this->getPixelBytes());
+            return;
+        }
+        size_t rowSize = (size_t)this->width * this->channels;
+        for (int y = 0; y < this->height; ++y)
+        {
+            std::memcpy(
+                destination + y * rowSize,
+                this->mappedPixels + (this->height - 1 - y) * rowSize, rowSize
+            );
+        }
+    }
+
+    void releasePixels()
+    {
+        stbi_image_free(this->pixels);
+        this->pixels = nullptr;
+        this->mappedPixels = nullptr;
+    }
+
+    // Takes the image from the asset bundle, if it was packed. Touches no GL
+    // state.
+    bool map(const std::string& filePath)
+    {
+        const AssetImageHeader* image = assetBundle.findImage(filePath);
+        if (!image)
+            return false;
+        this->width = image->width;
+        this->height = image->height;
+        this->channels = image->channels;
+        this->averageColor = glm::vec3(
+            image->averageColor[0], image->averageColor[1], image->averageColor[2]
+        );
+        this->mappedPixels = image->getPixels();
+        return true;
+    }
+
+    // Touches no GL state, so it may run on any thread. The rows are flipped
+    // here rather than through stbi_set_flip_vertically_on_load(), whose flag
+    // is global and also set by CubemapTexture.
+    void decode(const std::string& filePath)
+    {
+        this->pixels = stbi_load(
+            filePath.c_str(), &(this->width), &(this->height), &(this->channels), 0
+        );
+        if (!this->pixels)
+            return;
+
+        // The scene tracer only needs the mean color, so it never has to
+        // wait for the upload.
+        this->averageColor = computeAverageColor(
+            this->pixels, this->width, this->height, this->channels
+        );
+
+        size_t rowSize = (size_t)this->width * this->channels;
+        std::vector<unsigned char> row(rowSize);
+        for (int y = 0; y < this->height / 2; ++y)
+        {
+            unsigned char* top = this->pixels + y * rowSize;
+            unsigned char* bottom = this->pixels + (this->height - 1 - y) * rowSize;
+            std::memcpy(row.data(), top, rowSize);
+            std::memcpy(top, bottom, rowSize);
+            std::memcpy(bottom, row.data(), rowSize);
+        }
     }
 };
 
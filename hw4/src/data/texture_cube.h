@@ -3,6 +3,7 @@
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
 
 #include <iostream>
 #include <fstream>
@@ -11,6 +12,8 @@
 #include <vector>
 
 #include "base/asset.h"
+#include "base/job_system.h"
+#include "base/system_global.h"
 
 
 namespace engine
@@ -24,7 +27,11 @@ public:
     int channels;
 
 
-    CubemapTexture(const std::string& name, std::vector<std::string> faces) : Asset(name)
+    // The faces are decoded in parallel when jobs is given.
+    CubemapTexture(
+        const std::string& name, std::vector<std::string> faces,
+        JobSystem* jobs = nullptr
+    ) : Asset(name)
     {
         glGenTextures(1, &(this->ID));
         glBindTexture(GL_TEXTURE_CUBE_MAP, this->ID);
@@ -40,25 +47,49 @@ public:
 
         stbi_set_flip_vertically_on_load(false);
 
+        // Packed faces are uploaded from the asset bundle as they are, the
+        // others are decoded.
+        std::vector<const unsigned char*> pixels(faces.size(), nullptr);
+        std::vector<unsigned char*> decoded(faces.size(), nullptr);
+        std::vector<glm::ivec3> sizes(faces.size(), glm::ivec3(0));
+        auto decodeFaces = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+            {
+                if (const AssetImageHeader* image = assetBundle.findImage(faces[i]))
+                {
+                    sizes[i] = glm::ivec3(image->width, image->height, image->channels);
+                    pixels[i] = image->getPixels();
+                    continue;
+                }
+                decoded[i] = stbi_load(
+                    faces[i].c_str(), &(sizes[i].x), &(sizes[i].y), &(sizes[i].z), 0
+                );
+                pixels[i] = decoded[i];
+            }
+        };
+        if (jobs)
+            jobs->parallelFor(0, faces.size(), 1, decodeFaces);
+        else
+            decodeFaces(0, faces.size());
+
         for (unsigned int i = 0; i < faces.size(); i++)
         {
-            unsigned char *data = stbi_load(
-                faces[i].c_str(), &(this->width), &(this->height),
-                &(this->channels), 0
-            );
+            const unsigned char *data = pixels[i];
+            this->width = sizes[i].x;
+            this->height = sizes[i].y;
+            this->channels = sizes[i].z;
             if (data)
             {
                 glTexImage2D(
                     GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, this->width,
                     this->height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
                 );
-                stbi_image_free(data);
             }
             else
             {
-                std::cout << "ERROR::TEXTURE::FAILED_TO_LOAD_TEXTURE: " << faces[i] << std::endl;
-                stbi_image_free(data);
+                logger.error(LOG_CATEGORY_RESOURCE, "Failed to load cubemap face {}", faces[i]);
             }
+            stbi_image_free(decoded[i]);
         }
     }
 };
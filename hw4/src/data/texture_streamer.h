@@ -0,0 +1,165 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+
+#include "base/job_system.h"
+#include "data/texture.h"
+
+
+namespace engine
+{
+constexpr double TEXTURE_UPLOAD_BUDGET = 0.002;     // Seconds of uploads per frame
+constexpr unsigned int TEXTURE_STAGING_BUFFERS = 2;
+
+
+// Loads textures without holding up the GL thread. load() hands back a
+// texture showing a 1x1 placeholder right away and decodes the file on a
+// job. update(), called once a frame on the GL thread, copies decoded images
+// into a pixel unpack buffer and uploads from there, until the frame's
+// budget is spent. The texture name never changes, so whatever binds it
+// shows the real image from the next draw on. Textures in the asset bundle
+// skip the decode and are copied from the mapping into the staging buffer.
+//
+// The staging buffers are orphaned before every copy rather than mapped
+// persistently, which would need GL 4.4.
+class TextureStreamer
+{
+public:
+    // Needs a current GL context.
+    TextureStreamer(JobSystem& jobs) : jobs(jobs)
+    {
+        glGenBuffers(TEXTURE_STAGING_BUFFERS, this->stagingBuffers);
+    }
+
+    ~TextureStreamer()
+    {
+        // The jobs write to textures the scene is about to delete.
+        this->jobs.wait(this->decodes);
+        glDeleteBuffers(TEXTURE_STAGING_BUFFERS, this->stagingBuffers);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    TextureStreamer(const TextureStreamer& other) = delete;
+    TextureStreamer& operator=(const TextureStreamer& other) = delete;
+
+    // GL thread. The texture belongs to the caller, as with new Texture.
+    Texture* load(const std::string& name, const std::string& filePath, TextureRole role)
+    {
+        Texture* texture = new Texture(name, role);
+        ++(this->pending);
+        if (texture->map(filePath))
+        {
+            // Packed: already decoded, straight to the upload queue.
+            std::lock_guard<std::mutex> lock(this->decodedMutex);
+            this->decoded.push_back(texture);
+            return texture;
+        }
+        this->jobs.run(this->decodes, [this, texture, filePath]() {
+            texture->decode(filePath);
+            std::lock_guard<std::mutex> lock(this->decodedMutex);
+            this->decoded.push_back(texture);
+        });
+        return texture;
+    }
+
+    // Blocks until every file is decoded, after which the sizes and mean
+    // colors of the textures are known. Uploads may still be pending.
+    void waitForDecodes()
+    {
+        this->jobs.wait(this->decodes);
+    }
+
+    // GL thread. Uploads decoded textures for about budget seconds, at least
+    // one if any is ready, and returns how many.
+    unsigned int update(double budget = TEXTURE_UPLOAD_BUDGET)
+    {
+        double start = glfwGetTime();
+        unsigned int uploaded = 0;
+        while (uploaded == 0 || glfwGetTime() - start < budget)
+        {
+            Texture* texture = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(this->decodedMutex);
+                if (this->decoded.empty())
+                    break;
+                texture = this->decoded.front();
+                this->decoded.pop_front();
+            }
+            this->upload(texture);
+            ++uploaded;
+        }
+        return uploaded;
+    }
+
+    // GL thread. Decodes and uploads everything before returning.
+    void finish()
+    {
+        this->waitForDecodes();
+        this->update(std::numeric_limits<double>::infinity());
+    }
+
+    // Textures loaded but not uploaded yet.
+    unsigned int getPending() const
+    {
+        return this->pending;
+    }
+
+private:
+    JobSystem& jobs;
+    JobCounter decodes;
+    unsigned int pending = 0;
+
+    // Decoded on a job, waiting for the GL thread.
+    std::mutex decodedMutex;
+    std::deque<Texture*> decoded;
+
+    GLuint stagingBuffers[TEXTURE_STAGING_BUFFERS];
+    unsigned int nextStagingBuffer = 0;
+
+
+    void upload(Texture* texture)
+    {
+        --(this->pending);
+        size_t bytes = texture->getPixelBytes();
+        if (!texture->hasPixels() || bytes == 0)
+        {
+            texture->upload(nullptr);   // Reports the error
+            return;
+        }
+
+        // Orphan the buffer, so the copy never waits for the GPU to finish
+        // reading what was staged in it before.
+        GLuint buffer = this->stagingBuffers[this->nextStagingBuffer];
+        this->nextStagingBuffer = (this->nextStagingBuffer + 1) % TEXTURE_STAGING_BUFFERS;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        void* staging = glMapBufferRange(
+            GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+        );
+        if (staging)
+        {
+            texture->copyPixels(static_cast<unsigned char*>(staging));
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            texture->upload((const void*)0);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        else
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            texture->uploadPixels();
+        }
+        texture->releasePixels();
+    }
+};
+}
+
+#endif
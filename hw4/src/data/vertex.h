@@ -0,0 +1,164 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "data/bounds.h"
+
+
+namespace engine
+{
+// A vertex as importers, the caches and the CPU side of the renderer (BVH,
+// lightmap baker) use it.
+struct Vertex
+{
+    glm::vec3 position;
+    glm::vec2 texCoords;
+    glm::vec3 normal;
+    glm::vec3 tangent;
+    glm::vec2 lightmapCoords;
+};
+
+
+// A vertex as the GPU stores it, 24 bytes instead of the 52 of Vertex.
+// Positions are quantized within the bounds of their mesh, which the
+// instance world matrix scales back, see VertexQuantization. Normals and
+// tangents are octahedral, decoded by the shaders. Texture coordinates may
+// tile, so they are half floats; lightmap coordinates stay in [0, 1].
+struct PackedVertex
+{
+    uint16_t position[4];               // Unorm, w unused
+    int16_t normal[2];                  // Snorm, octahedral
+    int16_t tangent[2];                 // Snorm, octahedral
+    uint16_t texCoords[2];              // Half float
+    uint16_t lightmapCoords[2];         // Unorm
+};
+static_assert(sizeof(PackedVertex) == 24, "PackedVertex must have no padding");
+
+
+// One attribute of a vertex layout, as glVertexAttribPointer takes it.
+struct VertexAttribute
+{
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset;
+};
+
+struct VertexLayout
+{
+    GLsizei stride;
+    const VertexAttribute* attributes;
+    size_t numAttributes;
+};
+
+// Locations 0-4, in the order of Vertex.
+constexpr VertexAttribute PACKED_VERTEX_ATTRIBUTES[] = {
+    { 0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedVertex, position) },
+    { 1, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texCoords) },
+    { 2, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, normal) },
+    { 3, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, tangent) },
+    { 4, 2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedVertex, lightmapCoords) }
+};
+constexpr VertexLayout PACKED_VERTEX_LAYOUT = {
+    sizeof(PackedVertex), PACKED_VERTEX_ATTRIBUTES,
+    sizeof(PACKED_VERTEX_ATTRIBUTES) / sizeof(VertexAttribute)
+};
+
+
+// Maps the bounds of a mesh onto the unit cube its positions are quantized
+// in. toModel() is the matrix that maps them back.
+struct VertexQuantization
+{
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+
+    static VertexQuantization fromBounds(const AABB& bounds)
+    {
+        VertexQuantization quantization;
+        if (bounds.isEmpty())
+            return quantization;
+        quantization.origin = bounds.center - bounds.extents;
+        quantization.scale = 2.0f * bounds.extents;
+        return quantization;
+    }
+
+    glm::mat4 toModel() const
+    {
+        glm::mat4 matrix(1.0f);
+        for (int i = 0; i < 3; ++i)
+        {
+            matrix[i][i] = this->scale[i];
+            matrix[3][i] = this->origin[i];
+        }
+        return matrix;
+    }
+};
+
+
+// Folds a unit vector onto the octahedron |x| + |y| + |z| = 1 and unfolds
+// the lower half over the upper one, into [-1, 1]^2.
+glm::vec2 encodeOctahedral(const glm::vec3& v)
+{
+    float sum = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (!(sum > 0.0f))
+        return glm::vec2(0.0f);
+    glm::vec2 p = glm::vec2(v.x, v.y) / sum;
+    if (v.z < 0.0f)
+    {
+        p = glm::vec2(
+            (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f)
+        );
+    }
+    return p;
+}
+
+PackedVertex packVertex(const Vertex& vertex, const VertexQuantization& quantization)
+{
+    PackedVertex packed;
+    for (int i = 0; i < 3; ++i)
+    {
+        float extent = quantization.scale[i];
+        float t = extent > 0.0f ? (vertex.position[i] - quantization.origin[i]) / extent : 0.0f;
+        packed.position[i] = glm::packUnorm1x16(t);
+    }
+    packed.position[3] = 0;
+    glm::vec2 normal = encodeOctahedral(vertex.normal);
+    glm::vec2 tangent = encodeOctahedral(vertex.tangent);
+    for (int i = 0; i < 2; ++i)
+    {
+        packed.normal[i] = (int16_t)glm::packSnorm1x16(normal[i]);
+        packed.tangent[i] = (int16_t)glm::packSnorm1x16(tangent[i]);
+        packed.texCoords[i] = glm::packHalf1x16(vertex.texCoords[i]);
+        packed.lightmapCoords[i] = glm::packUnorm1x16(vertex.lightmapCoords[i]);
+    }
+    return packed;
+}
+
+
+// Points the attributes of the bound vertex array at the bound array
+// buffer, which holds vertices of the given layout.
+void setVertexAttributes(const VertexLayout& layout)
+{
+    for (size_t i = 0; i < layout.numAttributes; ++i)
+    {
+        const VertexAttribute& attribute = layout.attributes[i];
+        glEnableVertexAttribArray(attribute.location);
+        glVertexAttribPointer(
+            attribute.location, attribute.size, attribute.type, attribute.normalized,
+            layout.stride, (void*)attribute.offset
+        );
+    }
+}
+}
+
+#endif
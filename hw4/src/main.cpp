@@ -6,7 +6,12 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <utility>
 
@@ -14,15 +19,31 @@
 #include "base/engine_global.h"
 
 #include "base/camera.h"
+#include "base/fixed_timestep.h"
 #include "base/scene.h"
+#include "base/triple_buffer.h"
 
 #include "data/geometry.h"
 #include "data/light.h"
+#include "data/lightmap.h"
 #include "data/mesh.h"
 #include "data/model.h"
 #include "data/shader.h"
 #include "data/texture.h"
 #include "data/texture_cube.h"
+#include "data/texture_streamer.h"
+
+#include "render/cubemap_sampler.h"
+#include "render/environment_prefilter.h"
+#include "render/frame_snapshot.h"
+#include "render/frustum_culler.h"
+#include "render/gpu_timer.h"
+#include "render/render_queue.h"
+#include "render/irradiance_volume.h"
+#include "render/lightmap_baker.h"
+#include "render/scene_tracer.h"
+#include "render/shader_constants.h"
+#include "render/uniform_ring.h"
 
 #include "utils/math_utils.h"
 
@@ -34,10 +55,34 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window, engine::DirectionalLight* sun);
+std::string getLightmapPath(const std::string& entityName);
 
+// Profiler traces requested by processInput(), written by the render thread.
+unsigned int traceRequests = 0;
+std::string tracePath;
 
-int main()
+
+int main(int argc, char* argv[])
 {
+    // Run with --bake-lightmaps to bake the lightmaps of the static models
+    // before rendering. Otherwise the previously baked ones are loaded.
+    bool bakeLightmaps = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--bake-lightmaps") == 0)
+            bakeLightmaps = true;
+    }
+
+    // Assets packed by pack_assets are mapped once and read from memory;
+    // without a bundle every asset is loaded from its own file.
+    if (assetBundle.open(engine::ASSET_BUNDLE_PATH))
+    {
+        logger.info(
+            engine::LOG_CATEGORY_RESOURCE, "Asset bundle mapped: {} assets",
+            (unsigned int)assetBundle.getEntryCount()
+        );
+    }
+
     // GLFW: Initialize and configure.
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -80,6 +125,8 @@ int main()
 
     // Configure global OpenGL state.
     glEnable(GL_DEPTH_TEST);
+    // Filter across cube faces, the rough prefiltered levels are tiny.
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
 
     // Create scenes and declare assets.
@@ -107,8 +154,13 @@ int main()
     //     "../shaders/shadow_debug.vert"s,
     //     "../shaders/shadow_debug.frag"s
     // );
+    engine::Shader* lightmapShader = new engine::Shader(
+        "Lightmap Shader"s,
+        "../shaders/shader_lightmap.vert"s,
+        "../shaders/shader_lightmap.frag"s
+    );
     scene->addShaders(std::vector<engine::Shader*> {
-        lightingShader, shadowShader, skyboxShader // , shadowDebugShader
+        lightingShader, shadowShader, skyboxShader, lightmapShader // , shadowDebugShader
     });
 
     // Define models.
@@ -119,18 +171,24 @@ int main()
     engine::Texture* diffuseTexture = nullptr;
     engine::Texture* normalTexture = nullptr;
     engine::Texture* specularTexture = nullptr;
+    // Texture files are decoded on the workers while the meshes load here,
+    // and uploaded by the render thread a few per frame.
+    engine::TextureStreamer* textureStreamer = new engine::TextureStreamer(jobSystem);
 
-    diffuseTexture = new engine::Texture(
+    diffuseTexture = textureStreamer->load(
         "Brick Cube Diffuse"s,
-        "../resources/prop/brickcube/brickcube_d.png"s
+        "../resources/prop/brickcube/brickcube_d.png"s,
+        engine::TextureRole::DIFFUSE
     );
-    normalTexture = new engine::Texture(
+    normalTexture = textureStreamer->load(
         "Brick Cube Normal"s,
-        "../resources/prop/brickcube/brickcube_n.png"s
+        "../resources/prop/brickcube/brickcube_n.png"s,
+        engine::TextureRole::NORMAL
     );
-    specularTexture = new engine::Texture(
+    specularTexture = textureStreamer->load(
         "Brick Cube Specular"s,
-        "../resources/prop/brickcube/brickcube_s.png"s
+        "../resources/prop/brickcube/brickcube_s.png"s,
+        engine::TextureRole::SPECULAR
     );
     scene->addTextures(std::vector<engine::Texture*> {
         diffuseTexture, normalTexture, specularTexture
@@ -141,13 +199,15 @@ int main()
     );
     scene->addModel(brickCubeModel);
 
-    diffuseTexture = new engine::Texture(
+    diffuseTexture = textureStreamer->load(
         "Boulder Diffuse"s,
-        "../resources/prop/boulder/boulder_d.png"s
+        "../resources/prop/boulder/boulder_d.png"s,
+        engine::TextureRole::DIFFUSE
     );
-    normalTexture = new engine::Texture(
+    normalTexture = textureStreamer->load(
         "Boulder Normal"s,
-        "../resources/prop/boulder/boulder_n.png"s
+        "../resources/prop/boulder/boulder_n.png"s,
+        engine::TextureRole::NORMAL
     );
     scene->addTextures(std::vector<engine::Texture*> {
         diffuseTexture, normalTexture
@@ -158,9 +218,10 @@ int main()
     );
     scene->addModel(boulderModel);
 
-    diffuseTexture = new engine::Texture(
+    diffuseTexture = textureStreamer->load(
         "Grass Ground Diffuse"s,
-        "../resources/landscape/simple_ground/grass_ground.jpg"s
+        "../resources/landscape/simple_ground/grass_ground.jpg"s,
+        engine::TextureRole::DIFFUSE
     );
     scene->addTexture(diffuseTexture);
     engine::Model* grassGroundModel = new engine::Model(
@@ -170,17 +231,20 @@ int main()
     scene->addModel(grassGroundModel);
 
     // TODO: Add more models (barrels, fire extinguisher) and YOUR own model.
-    diffuseTexture = new engine::Texture(
+    diffuseTexture = textureStreamer->load(
         "Barrel Diffuse"s,
-        "../resources/prop/barrel/barrel_d.png"s
+        "../resources/prop/barrel/barrel_d.png"s,
+        engine::TextureRole::DIFFUSE
     );
-    normalTexture = new engine::Texture(
+    normalTexture = textureStreamer->load(
         "Barrel Normal"s,
-        "../resources/prop/barrel/barrel_n.png"s
+        "../resources/prop/barrel/barrel_n.png"s,
+        engine::TextureRole::NORMAL
     );
-    specularTexture = new engine::Texture(
+    specularTexture = textureStreamer->load(
         "Barrel Specular"s,
-        "../resources/prop/barrel/barrel_s.png"s
+        "../resources/prop/barrel/barrel_s.png"s,
+        engine::TextureRole::SPECULAR
     );
     scene->addTextures(std::vector<engine::Texture*> {
         diffuseTexture, normalTexture, specularTexture
@@ -191,17 +255,20 @@ int main()
     );
     scene->addModel(barrelModel);
 
-    diffuseTexture = new engine::Texture(
+    diffuseTexture = textureStreamer->load(
         "Fire Extinguisher Diffuse"s,
-        "../resources/prop/fireext/fireext_d.jpg"s
+        "../resources/prop/fireext/fireext_d.jpg"s,
+        engine::TextureRole::DIFFUSE
     );
-    normalTexture = new engine::Texture(
+    normalTexture = textureStreamer->load(
         "Fire Extinguisher Normal"s,
-        "../resources/prop/fireext/fireext_n.jpg"s
+        "../resources/prop/fireext/fireext_n.jpg"s,
+        engine::TextureRole::NORMAL
     );
-    specularTexture = new engine::Texture(
+    specularTexture = textureStreamer->load(
         "Fire Extinguisher Specular"s,
-        "../resources/prop/fireext/fireext_s.jpg"s
+        "../resources/prop/fireext/fireext_s.jpg"s,
+        engine::TextureRole::SPECULAR
     );
     scene->addTextures(std::vector<engine::Texture*> {
         diffuseTexture, normalTexture, specularTexture
@@ -213,17 +280,20 @@ int main()
     scene->addModel(fireExtModel);
 
     // TODO Model yourOwnModel;
-    diffuseTexture = new engine::Texture(
+    diffuseTexture = textureStreamer->load(
         "Red Apple Diffuse"s,
-        "../resources/prop/red_apple/red_apple_d.jpg"s
+        "../resources/prop/red_apple/red_apple_d.jpg"s,
+        engine::TextureRole::DIFFUSE
     );
-    normalTexture = new engine::Texture(
+    normalTexture = textureStreamer->load(
         "Red Apple Normal"s,
-        "../resources/prop/red_apple/red_apple_n.jpg"s
+        "../resources/prop/red_apple/red_apple_n.jpg"s,
+        engine::TextureRole::NORMAL
     );
-    specularTexture = new engine::Texture(
+    specularTexture = textureStreamer->load(
         "Red Apple Specular"s,
-        "../resources/prop/red_apple/red_apple_s.jpg"s
+        "../resources/prop/red_apple/red_apple_s.jpg"s,
+        engine::TextureRole::SPECULAR
     );
     scene->addTextures(std::vector<engine::Texture*> {
         diffuseTexture, normalTexture, specularTexture
@@ -234,6 +304,15 @@ int main()
     );
     scene->addModel(redAppleModel);
 
+    // Static models get a lightmap atlas. The ground is scaled up a lot, so it
+    // needs more texels to keep the shadows sharp.
+    brickCubeModel->generateLightmapCoords(engine::DEFAULT_LIGHTMAP_RESOLUTION / 2);
+    boulderModel->generateLightmapCoords(engine::DEFAULT_LIGHTMAP_RESOLUTION);
+    grassGroundModel->generateLightmapCoords(engine::DEFAULT_LIGHTMAP_RESOLUTION * 4);
+    barrelModel->generateLightmapCoords(engine::DEFAULT_LIGHTMAP_RESOLUTION);
+    fireExtModel->generateLightmapCoords(engine::DEFAULT_LIGHTMAP_RESOLUTION);
+    redAppleModel->generateLightmapCoords(engine::DEFAULT_LIGHTMAP_RESOLUTION / 2);
+
 
     // Add entities to scene.
     // You can change the position/orientation.
@@ -293,11 +372,12 @@ int main()
     ));
 
     float planeSize = 15.0f;
+    float groundHeight = -0.5f;
     scene->addEntity(new engine::Entity(
         "Grass Ground"s,
         nullptr,
         engine::Transform(
-            glm::vec3(0.0f, -0.5f, 0.0f),
+            glm::vec3(0.0f, groundHeight, 0.0f),
             glm::vec3(0.0f),
             planeSize
         ),
@@ -324,6 +404,48 @@ int main()
     // Install our sun.
     gameManager.sun = sun;
 
+    // The bakes below only need the mean color of each texture, which is
+    // known once the files are decoded.
+    textureStreamer->waitForDecodes();
+
+    // Bake or load the lightmaps.
+    if (bakeLightmaps)
+    {
+        engine::LightmapBaker baker;
+        double bakeStart = glfwGetTime();
+        std::vector<engine::Lightmap*> lightmaps = baker.bake(scene, sun);
+        logger.info(
+            engine::LOG_CATEGORY_RENDER, "Baked {} lightmaps in {}s",
+            (unsigned int)lightmaps.size(), glfwGetTime() - bakeStart
+        );
+        for (auto& lightmap : lightmaps)
+        {
+            lightmap->save(getLightmapPath(lightmap->name));
+        }
+        scene->addLightmaps(lightmaps);
+    }
+    else
+    {
+        const engine::EntityRegistry& registry = scene->registry;
+        for (size_t i = 0; i < registry.size(); ++i)
+        {
+            engine::Model* model = registry.models[i];
+            if (!model || model->lightmapResolution == 0)
+                continue;
+
+            const std::string& name = registry.entities[i]->name;
+            engine::Lightmap* lightmap = new engine::Lightmap(
+                name, getLightmapPath(name)
+            );
+            // Lightmaps baked for another atlas layout are useless.
+            if (lightmap->isLoaded()
+                && lightmap->width == (int)model->lightmapResolution)
+                scene->addLightmap(lightmap);
+            else
+                delete lightmap;
+        }
+    }
+
     // Define depth texture.
     engine::DepthmapTexture* depthmap = new engine::DepthmapTexture(
         "Depth Map Texture",
@@ -341,7 +463,8 @@ int main()
             "../resources/cubemap/skybox/bottom.jpg"s,
             "../resources/cubemap/skybox/front.jpg"s,
             "../resources/cubemap/skybox/back.jpg"s
-        }
+        },
+        &jobSystem
     );
     scene->addCubemapTexture(skyboxTexture);
     engine::Geometry* cubemapGeometry = new engine::Geometry(
@@ -355,6 +478,70 @@ int main()
         new engine::CubemapAttribute(cubemapGeometry, skyboxTexture)
     ));
 
+    // CPU copy of the skybox for the bakes below.
+    engine::CubemapSampler skySampler(skyboxTexture);
+
+    // Bake the irradiance probes from the skybox and the sunlit scene. The
+    // grid covers the ground plane up to a few meters above it, its bottom
+    // layer just over the top of the ground: probes under it would bake
+    // occluded, dark irradiance into everything standing on the floor.
+    float probeGridBottom = groundHeight;
+    if (grassGroundModel->mesh && !grassGroundModel->mesh->bounds.isEmpty())
+    {
+        const engine::AABB& groundBounds = grassGroundModel->mesh->bounds;
+        probeGridBottom += planeSize * (groundBounds.center.y + groundBounds.extents.y);
+    }
+    probeGridBottom += 0.05f;
+    engine::IrradianceVolume* probes = new engine::IrradianceVolume(
+        "Irradiance Probes"s,
+        glm::vec3(-planeSize, probeGridBottom, -planeSize),
+        glm::vec3(2.0f * planeSize, 6.0f, 2.0f * planeSize),
+        glm::ivec3(16, 4, 16)
+    );
+    {
+        engine::SceneTracer tracer;
+        tracer.build(scene, sun);
+        // The skybox is much brighter than the old constant ambient term.
+        float skyIntensity = 0.5f;
+
+        double probeStart = glfwGetTime();
+        probes->bake([&](const glm::vec3& p, const glm::vec3& dir, std::mt19937& rng) {
+            return tracer.radiance(p, dir, rng, &skySampler, skyIntensity);
+        });
+        probes->upload();
+        logger.info(
+            engine::LOG_CATEGORY_RENDER, "Baked {} irradiance probes in {}s",
+            (unsigned int)probes->probes.size(), glfwGetTime() - probeStart
+        );
+    }
+
+    // Prefilter the skybox for glossy reflections. Both tables are cached on
+    // disk; the environment is keyed by a hash of the skybox texels.
+    engine::PrefilteredEnvironment* environment
+        = new engine::PrefilteredEnvironment("Skybox Prefiltered"s);
+    if (!environment->load(
+        "../resources/cache/skybox.penv"s,
+        engine::PrefilteredEnvironment::hashSource(skySampler)
+    ))
+    {
+        double prefilterStart = glfwGetTime();
+        environment->prefilter(skySampler);
+        environment->save("../resources/cache/skybox.penv"s);
+        logger.info(
+            engine::LOG_CATEGORY_RENDER, "Prefiltered the environment in {}s",
+            glfwGetTime() - prefilterStart
+        );
+    }
+    environment->upload();
+
+    engine::BRDFLookupTable* brdfLUT = new engine::BRDFLookupTable("BRDF LUT"s);
+    if (!brdfLUT->load("../resources/cache/brdf_lut.bin"s))
+    {
+        brdfLUT->compute();
+        brdfLUT->save("../resources/cache/brdf_lut.bin"s);
+    }
+    brdfLUT->upload();
+
     // For debugging the shadow map.
     // engine::Geometry* quadGeometry = new engine::Geometry(
     //     "Simple Quad"s, "../resources/shape_primitive/quadPT.json"s
@@ -367,7 +554,13 @@ int main()
     lightingShader->setInt("material.specularSampler"s, 1);
     lightingShader->setInt("material.normalSampler"s, 2);
     lightingShader->setInt("depthmapSampler"s, 3);
-    lightingShader->setFloat("material.shininess"s, 64.0f); // Set shininess to constant value.
+    probes->setUniforms(lightingShader, 5);
+    environment->setUniforms(lightingShader, 6);
+    brdfLUT->setUniforms(lightingShader, 7);
+
+    lightmapShader->use();
+    lightmapShader->setInt("material.diffuseSampler"s, 0);
+    lightmapShader->setInt("lightmapSampler"s, 4);
 
     skyboxShader->use();
     skyboxShader->setInt("skyboxSampler1"s, 0);
@@ -375,139 +568,255 @@ int main()
     // shadowDebugShader->use();
     // shadowDebugShader->setInt("depthSampler"s, 0);
 
+    // Constants shared by the shaders live in uniform buffers at fixed
+    // binding points instead of per-shader uniforms.
+    for (engine::Shader* shader : { lightingShader, lightmapShader, skyboxShader })
+        shader->bindUniformBlock("FrameConstants"s, engine::UNIFORM_BINDING_FRAME);
+    for (engine::Shader* shader : { lightingShader, shadowShader })
+        shader->bindUniformBlock("LightConstants"s, engine::UNIFORM_BINDING_LIGHT);
+    lightingShader->bindUniformBlock("MaterialConstants"s, engine::UNIFORM_BINDING_MATERIAL);
+
+
+    // Per-entity visibility of the current frame, one array per pass.
+    std::vector<uint8_t> shadowVisible;
+    std::vector<uint8_t> cameraVisible;
+    // Draws of both passes, sorted to minimize state changes.
+    engine::RenderQueue* queue = new engine::RenderQueue();
+    // Uniform buffer ranges of the frame. Material constants only depend on
+    // which maps a material has, so there is one range per combination:
+    // bit 0 for a normal map, bit 1 for a specular map.
+    engine::UniformRing* uniforms = new engine::UniformRing();
+    engine::UniformRange materialRanges[4];
+
+    // Snapshots of the simulation, handed from this thread to the render
+    // thread.
+    engine::TripleBuffer<engine::FrameSnapshot> snapshots;
+    engine::FixedTimestep timestep;
+    engine::CameraState previousCamera = gameManager.defaultCamera->getState();
+    auto publishSnapshot = [&]() {
+        engine::Camera* currentCamera = gameManager.defaultCamera;
+        engine::FrameSnapshot& snapshot = snapshots.getWriteBuffer();
+        snapshot.tick = timestep.getTick();
+        snapshot.time = (float)timestep.getTime();
+        snapshot.deltaTime = (float)timestep.getTickDuration();
+        snapshot.simulatedUntil = timestep.getSimulatedUntil();
+        snapshot.screenWidth = screen.width;
+        snapshot.screenHeight = screen.height;
+        snapshot.settings = graphicsSettings;
+
+        snapshot.previousCamera = previousCamera;
+        snapshot.camera = currentCamera->getState();
+        snapshot.projection = currentCamera->getProjectionMatrix(
+            screen.width, screen.height
+        );
 
-    // Render loop.
-    while (!glfwWindowShouldClose(window))
-    {
-        // Get current camera.
-		engine::Camera* currentCamera = gameManager.defaultCamera;
-
-        // Maintain loop time.
-        timer.update((float)glfwGetTime());
+        snapshot.lightSpace = sun->getProjectionMatrix()
+            * sun->getViewMatrix(currentCamera->tf.position);
+        snapshot.lightDirection = sun->lightDir;
+        snapshot.lightColor = sun->lightColor;
+        snapshot.sunAzimuth = sun->azimuth;
+        snapshot.sunElevation = sun->elevation;
+        snapshot.traceRequests = traceRequests;
+        snapshot.tracePath = tracePath;
+
+        // Only entities that moved since the last tick are recomputed.
+        scene->registry.updateWorldMatrices(&jobSystem);
+        snapshot.copyEntities(scene->registry);
+        snapshots.publish();
+    };
+
+    // Draws one snapshot. Runs on the render thread and touches nothing the
+    // simulation writes. The GPU timers are created by the render thread.
+    engine::GpuTimerPool* gpuTimers = nullptr;
+    engine::LogRateLimit frameLogLimit(1.0);
+    auto renderFrame = [&](const engine::FrameSnapshot& snapshot) {
+        PROFILE_SCOPE(profiler, "frame");
+
+        // The camera is drawn between the last two ticks, so its motion stays
+        // smooth whatever the tick and frame rates are.
+        const engine::CameraState camera = snapshot.getCamera(glfwGetTime());
+        const glm::mat4& lightSpace = snapshot.lightSpace;
+        const glm::mat4& projection = snapshot.projection;
+        const glm::mat4 view = camera.getViewMatrix();
+
+        engine::CullingStats shadowCulling;
+        engine::CullingStats cameraCulling;
+        {
+            PROFILE_SCOPE(profiler, "cull");
+            shadowCulling = engine::FrustumCuller::cull(
+                snapshot, lightSpace, shadowVisible, &jobSystem
+            );
+            cameraCulling = engine::FrustumCuller::cull(
+                snapshot, projection * view, cameraVisible, &jobSystem
+            );
+        }
 
-        // Process input.
-        processInput(window, sun);
-        gameManager.processCommands(&cmd);
+        // Static entities use their baked lighting while the sun is where it
+        // was during the bake.
+        auto getBakedLightmap = [&](size_t i) {
+            engine::Lightmap* lightmap = snapshot.settings.useLightmap
+                ? snapshot.lightmaps[i] : nullptr;
+            if (lightmap && !lightmap->matches(snapshot.sunAzimuth, snapshot.sunElevation))
+                lightmap = nullptr;
+            return lightmap;
+        };
+
+        // Queue the draws of both passes. The queue sorts them by state and
+        // depth and merges the instances of a model into one draw, then write
+        // the constants into the uniform buffer.
+        {
+            PROFILE_SCOPE(profiler, "submit");
+            queue->clear();
+            for (size_t i = 0; i < snapshot.size(); ++i)
+            {
+                engine::Model* model = snapshot.models[i];
+                if (!model)
+                    continue;
+                glm::vec4 center = glm::vec4(snapshot.worldBounds[i].center, 1.0f);
+
+                if (!(model->ignoreShadow) && shadowVisible[i])
+                {
+                    glm::vec4 clip = lightSpace * center;
+                    queue->submit(
+                        engine::RENDER_PASS_SHADOW, shadowShader, model, nullptr, false,
+                        snapshot.worldMatrices[i], snapshot.normalMatrices[i],
+                        0.5f * (clip.z / clip.w + 1.0f)
+                    );
+                }
+                if (cameraVisible[i])
+                {
+                    engine::Lightmap* lightmap = getBakedLightmap(i);
+                    float distance = glm::length(glm::vec3(center) - camera.position);
+                    queue->submit(
+                        engine::RENDER_PASS_OPAQUE, lightmap ? lightmapShader : lightingShader,
+                        model, lightmap, true,
+                        snapshot.worldMatrices[i], snapshot.normalMatrices[i],
+                        distance / engine::DEFAULT_CAMERA_FAR
+                    );
+                }
+            }
+            queue->prepare();
+
+            // Write the constants of the frame, the sun and every batch's
+            // material into one uniform buffer upload.
+            uniforms->beginFrame();
+            engine::FrameConstants frame;
+            frame.view = view;
+            frame.projection = projection;
+            frame.viewPos = camera.position;
+            frame.time = snapshot.time;
+            frame.screenSize = glm::vec2((float)snapshot.screenWidth, (float)snapshot.screenHeight);
+            frame.deltaTime = snapshot.deltaTime;
+            frame.useLighting = snapshot.settings.useLighting ? 1.0f : 0.0f;
+            frame.useShadow = snapshot.settings.useShadow ? 1.0f : 0.0f;
+            frame.useProbes = snapshot.settings.useProbes ? 1.0f : 0.0f;
+            frame.useReflections = snapshot.settings.useReflections ? 1.0f : 0.0f;
+            frame.padding = 0.0f;
+            engine::UniformRange frameRange = uniforms->push(frame);
+
+            // TODO : Maybe allow some other light sources?
+            engine::LightConstants light;
+            light.lightSpace = lightSpace;
+            light.lightDirection = snapshot.lightDirection;
+            light.padding0 = 0.0f;
+            light.lightColor = snapshot.lightColor;
+            light.padding1 = 0.0f;
+            engine::UniformRange lightRange = uniforms->push(light);
+
+            for (int maps = 0; maps < 4; ++maps)
+            {
+                engine::MaterialConstants material;
+                bool useNormalMap = (maps & 1) && snapshot.settings.useNormalMap;
+                bool useSpecularMap = (maps & 2) && snapshot.settings.useSpecularMap;
+                material.useNormalMap = useNormalMap ? 1.0f : 0.0f;
+                material.useSpecularMap = useSpecularMap ? 1.0f : 0.0f;
+                material.shininess = 64.0f;  // Constant for every model.
+                material.padding = 0.0f;
+                materialRanges[maps] = uniforms->push(material);
+            }
+            uniforms->upload();
+            uniforms->bind(engine::UNIFORM_BINDING_FRAME, frameRange);
+            uniforms->bind(engine::UNIFORM_BINDING_LIGHT, lightRange);
+        }
 
         // TODO : Render
         // (1) Render shadow map!
             // framebuffer: shadow frame buffer(depth.depthMapFBO)
             // shader : shadow.fs/vs
-        glViewport(0, 0, graphicsSettings.shadowWidth, graphicsSettings.shadowHeight);
-
-        glm::mat4 projection = sun->getProjectionMatrix();
-        glm::mat4 view = sun->getViewMatrix(currentCamera->tf.position);
-        glm::mat4 lightSpace = projection * view;
-
-        shadowShader->use();
-        shadowShader->setMat4("lightSpace"s, lightSpace);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, depthmap->FBO);
-        // glClear(GL_DEPTH_BUFFER_BIT);
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glCullFace(GL_FRONT);
-        for (const auto& entity : scene->entities)
         {
-            engine::ModelAttribute* modelAttrib
-                = entity.second->getAttribute<engine::ModelAttribute>();;
-            if (modelAttrib && !(modelAttrib->model->ignoreShadow))
-            {
-                engine::Model* model = modelAttrib->model;
-                glm::mat4 world = entity.second->tf.getModelMatrix();
-                shadowShader->setMat4("world"s, world);
-                model->bind();
-
-                glDrawElements(
-                    GL_TRIANGLES,
-                    (GLsizei)(model->mesh->indices.size()),
-                    GL_UNSIGNED_INT,
-                    nullptr
-                );
-                glBindVertexArray(0);
-            }
+            PROFILE_SCOPE(profiler, "shadow pass");
+            PROFILE_GPU_SCOPE(*gpuTimers, "shadow pass");
+            glViewport(0, 0, snapshot.settings.shadowWidth, snapshot.settings.shadowHeight);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, depthmap->FBO);
+            // glClear(GL_DEPTH_BUFFER_BIT);
+            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glCullFace(GL_FRONT);
+            queue->state.invalidate();
+            queue->execute(
+                engine::RENDER_PASS_SHADOW, false,
+                [](const engine::InstanceBatcher::Batch&, const engine::Material&) {}
+            );
+            glCullFace(GL_BACK);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
-        glCullFace(GL_BACK);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
         // (2) Render objects in the scene!
             // framebuffer : default frame buffer(0)
             // shader : shader_lighting.fs/vs
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, screen.width, screen.height);
-
-        projection = currentCamera->getProjectionMatrix(
-            screen.width, screen.height
-        );
-        view = currentCamera->getViewMatrix();
-
-        lightingShader->use();
-        lightingShader->setMat4("view"s, view);
-        lightingShader->setMat4("projection"s, projection);
-        lightingShader->setMat4("lightSpace"s, lightSpace);
-        lightingShader->setVec3("viewPos"s, currentCamera->tf.position);
-        lightingShader->setFloat(
-            "useLighting"s, graphicsSettings.useLighting ? 1.0f : 0.0f
-        );
-
-        // TODO : Maybe allow some other light sources?
-        // lightingShader->setVec3("light.position"s, -sun->lightDir);
-        lightingShader->setVec3("light.direction"s, sun->lightDir);
-        lightingShader->setVec3("light.color"s, sun->lightColor);
-
-        lightingShader->setFloat(
-            "useShadow"s, graphicsSettings.useShadow ? 1.0f : 0.0f
-        );
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthmap->ID);
-        for (const auto& entity : scene->entities)
         {
-            engine::ModelAttribute* modelAttrib
-                = entity.second->getAttribute<engine::ModelAttribute>();;
-            if (modelAttrib)
-            {
-                engine::Model* model = modelAttrib->model;
-                glm::mat4 world = entity.second->tf.getModelMatrix();
-                lightingShader->setMat4("world"s, world);
-                model->bind();
-
-                bool useNormalMap = (model->normal != nullptr)
-                    && graphicsSettings.useNormalMap;
-                bool useSpecularMap = (model->specular != nullptr)
-                    && graphicsSettings.useSpecularMap;
-                lightingShader->setFloat("useNormalMap"s, useNormalMap ? 1.0f : 0.0f);
-                lightingShader->setFloat("useSpecularMap"s, useSpecularMap ? 1.0f : 0.0f);
-                glDrawElements(
-                    GL_TRIANGLES,
-                    (GLsizei)(model->mesh->indices.size()),
-                    GL_UNSIGNED_INT,
-                    nullptr
-                );
-                glBindVertexArray(0);
-            }
+            PROFILE_SCOPE(profiler, "lighting pass");
+            PROFILE_GPU_SCOPE(*gpuTimers, "lighting pass");
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glViewport(0, 0, snapshot.screenWidth, snapshot.screenHeight);
+
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, depthmap->ID);
+            probes->bind(5);
+            environment->bind(6);
+            brdfLUT->bind(7);
+
+            queue->state.invalidate();
+            queue->execute(engine::RENDER_PASS_OPAQUE, true, [&](
+                const engine::InstanceBatcher::Batch& batch, const engine::Material& material
+            ) {
+                if (batch.shader != lightingShader)
+                    return;
+                int maps = (material.normal ? 1 : 0) | (material.specular ? 2 : 0);
+                uniforms->bind(engine::UNIFORM_BINDING_MATERIAL, materialRanges[maps]);
+            });
         }
 
         // Render the skybox.
-        skyboxShader->use();
-        glDepthFunc(GL_LEQUAL);
-
-        view = glm::mat4(glm::mat3(currentCamera->getViewMatrix()));
-        skyboxShader->setMat4("view"s, view);
-        skyboxShader->setMat4("projection"s, projection);
-
-        glBindVertexArray(cubemapGeometry->VAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture->ID);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
+        {
+            PROFILE_SCOPE(profiler, "skybox");
+            PROFILE_GPU_SCOPE(*gpuTimers, "skybox");
+            skyboxShader->use();
+            glDepthFunc(GL_LEQUAL);
+
+            glBindVertexArray(cubemapGeometry->VAO);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture->ID);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+
+            glBindVertexArray(0);
+            glDepthFunc(GL_LESS);
+        }
+        uniforms->endFrame();
 
-        // Log camera position.
-        std::cout << std::setw(7) << std::setprecision(3)
-            << currentCamera->tf.position.x << "  "
-            << currentCamera->tf.position.y << "  "
-            << currentCamera->tf.position.z << std::endl;
+        // Log camera position and the objects culled per pass, once a second.
+        if (frameLogLimit.allow())
+        {
+            logger.info(
+                engine::LOG_CATEGORY_RENDER,
+                "camera {}  culled shadow {}/{} camera {}/{}  draws {} ({} instances)  binds {}/{}",
+                camera.position, shadowCulling.culled, shadowCulling.tested,
+                cameraCulling.culled, cameraCulling.tested,
+                queue->batcher.drawCalls, queue->batcher.instancesDrawn,
+                queue->state.issuedBinds, queue->state.requestedBinds
+            );
+        }
 
         // Debug shadow shader.
         // if (false)
@@ -529,15 +838,115 @@ int main()
         //     );
         //     glBindVertexArray(0);
         // }
+    };
+
+    // The GL context moves to a render thread, so a slow frame no longer
+    // holds up input and the camera. Window events stay on this thread, as
+    // GLFW requires.
+    publishSnapshot();
+    glfwMakeContextCurrent(NULL);
+    std::atomic<bool> rendering(true);
+    std::thread renderThread([&]() {
+        glfwMakeContextCurrent(window);
+        profiler.setThreadName("render"s);
+        gpuTimers = new engine::GpuTimerPool(profiler);
+        unsigned int tracesWritten = 0;
+        double streamStart = glfwGetTime();
+        double nextSummary = glfwGetTime() + engine::PROFILER_SUMMARY_INTERVAL;
+        while (rendering.load())
+        {
+            // Always draw the latest snapshot; older ones are dropped.
+            snapshots.update();
+            const engine::FrameSnapshot& snapshot = snapshots.getReadBuffer();
+            gpuTimers->beginFrame();
+            if (textureStreamer->getPending() > 0)
+            {
+                PROFILE_SCOPE(profiler, "texture uploads");
+                textureStreamer->update();
+                if (textureStreamer->getPending() == 0)
+                    logger.info(
+                        engine::LOG_CATEGORY_RESOURCE, "Textures streamed in {} s",
+                        glfwGetTime() - streamStart
+                    );
+            }
+            renderFrame(snapshot);
+            {
+                PROFILE_SCOPE(profiler, "swap");
+                glfwSwapBuffers(window);
+            }
 
-        // GLFW: Swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
+            profiler.collect();
+            if (glfwGetTime() >= nextSummary)
+            {
+                profiler.logSummary(logger);
+                nextSummary += engine::PROFILER_SUMMARY_INTERVAL;
+            }
+            if (snapshot.traceRequests != tracesWritten)
+            {
+                if (profiler.writeChromeTrace(snapshot.tracePath))
+                {
+                    logger.info(
+                        engine::LOG_CATEGORY_ENGINE, "Profiler trace written to {}",
+                        snapshot.tracePath
+                    );
+                }
+                else
+                {
+                    logger.error(
+                        engine::LOG_CATEGORY_ENGINE, "Failed to write profiler trace {}",
+                        snapshot.tracePath
+                    );
+                }
+                tracesWritten = snapshot.traceRequests;
+            }
+        }
+        delete gpuTimers;
+        glfwMakeContextCurrent(NULL);
+    });
+
+    // Simulation loop. The simulation advances in fixed ticks, as many as
+    // the real time passed calls for, so it runs the same at any frame rate.
+    profiler.setThreadName("simulation"s);
+    timestep.accumulate(glfwGetTime());
+    while (!glfwWindowShouldClose(window))
+    {
+        // Process input.
         glfwPollEvents();
+        processInput(window, sun);
+
+        timestep.accumulate(glfwGetTime());
+        bool ticked = false;
+        while (timestep.step())
+        {
+            PROFILE_SCOPE(profiler, "tick");
+            previousCamera = gameManager.defaultCamera->getState();
+            timer.step((float)timestep.getTickDuration());
+            gameManager.processCommands(&cmd);
+            ticked = true;
+        }
+        if (ticked)
+        {
+            PROFILE_SCOPE(profiler, "publish snapshot");
+            publishSnapshot();
+        }
+
+        std::this_thread::sleep_for(
+            std::chrono::duration<double>(timestep.getTimeToNextTick())
+        );
     }
 
+    rendering.store(false);
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+
     // Optional: De-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
+    delete probes;
+    delete environment;
+    delete brdfLUT;
+    delete queue;
+    delete uniforms;
+    delete textureStreamer;
     delete scene;
 
     // GLFW: Terminate, clearing all previously allocated GLFW resources.
@@ -554,6 +963,9 @@ void processInput(GLFWwindow* window, engine::DirectionalLight* sun)
     static float toggleSpecularMapLastFrame = 0.0f;
     static float toggleShadowLastFrame = 0.0f;
     static float toggleLightingLastFrame = 0.0f;
+    static float toggleLightmapLastFrame = 0.0f;
+    static float toggleProbesLastFrame = 0.0f;
+    static float toggleReflectionsLastFrame = 0.0f;
 
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
@@ -599,6 +1011,10 @@ void processInput(GLFWwindow* window, engine::DirectionalLight* sun)
     // key 1 : toggle using normal map
     // key 2 : toggle using shadow
     // key 3 : toggle using whole lighting
+    // key 5 : toggle using baked lightmaps
+    // key 6 : toggle using irradiance probes for ambient light
+    // key 7 : toggle glossy environment reflections
+    // key P : write a profiler trace
     int azimuthEast = 0;
     int elevationUp = 0;
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
@@ -623,6 +1039,9 @@ void processInput(GLFWwindow* window, engine::DirectionalLight* sun)
     bool toggleShadow = false;
     bool toggleLighting = false;
     bool toggleSpecularMap = false;
+    bool toggleLightmap = false;
+    bool toggleProbes = false;
+    bool toggleReflections = false;
     if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
     {
         if (toggleNormalMapLastFrame + engine::KEYBOARD_TOGGLE_DELAY < lastFrame)
@@ -655,6 +1074,30 @@ void processInput(GLFWwindow* window, engine::DirectionalLight* sun)
             toggleSpecularMapLastFrame = lastFrame;
         }
     }
+    if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS)
+    {
+        if (toggleLightmapLastFrame + engine::KEYBOARD_TOGGLE_DELAY < lastFrame)
+        {
+            toggleLightmap = true;
+            toggleLightmapLastFrame = lastFrame;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_6) == GLFW_PRESS)
+    {
+        if (toggleProbesLastFrame + engine::KEYBOARD_TOGGLE_DELAY < lastFrame)
+        {
+            toggleProbes = true;
+            toggleProbesLastFrame = lastFrame;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_7) == GLFW_PRESS)
+    {
+        if (toggleReflectionsLastFrame + engine::KEYBOARD_TOGGLE_DELAY < lastFrame)
+        {
+            toggleReflections = true;
+            toggleReflectionsLastFrame = lastFrame;
+        }
+    }
         
     // Update the commands.
     cmd.moveForward = moveForward;
@@ -673,18 +1116,51 @@ void processInput(GLFWwindow* window, engine::DirectionalLight* sun)
         ? !graphicsSettings.useLighting : graphicsSettings.useLighting;
     graphicsSettings.useSpecularMap = toggleSpecularMap
         ? !graphicsSettings.useSpecularMap : graphicsSettings.useSpecularMap;
+    graphicsSettings.useLightmap = toggleLightmap
+        ? !graphicsSettings.useLightmap : graphicsSettings.useLightmap;
+    graphicsSettings.useProbes = toggleProbes
+        ? !graphicsSettings.useProbes : graphicsSettings.useProbes;
+    graphicsSettings.useReflections = toggleReflections
+        ? !graphicsSettings.useReflections : graphicsSettings.useReflections;
+
+    // Write a profiler trace, for chrome://tracing or Perfetto.
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && screen.isKeyboardDone[GLFW_KEY_P] == false)
+    {
+        time_t t = time(NULL);
+        struct tm tm = *localtime(&t);
+        char date_char[128];
+        sprintf(
+            date_char, "trace_%d_%d_%d_%d_%d_%d.json",
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+            tm.tm_hour, tm.tm_min, tm.tm_sec
+        );
+        tracePath = date_char;
+        ++traceRequests;
+        screen.isKeyboardDone[GLFW_KEY_P] = true;
+    }
+    else if (glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE)
+    {
+        screen.isKeyboardDone[GLFW_KEY_P] = false;
+    }
+}
+
+// Lightmaps are stored per entity, with spaces in the name replaced.
+std::string getLightmapPath(const std::string& entityName)
+{
+    std::string fileName = entityName;
+    std::replace(fileName.begin(), fileName.end(), ' ', '_');
+    return "../resources/lightmap/"s + fileName + ".lmap"s;
 }
 
 // GLFW: Whenever the window size changed (by OS or user resize) this callback function executes.
 // ----------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+    // The render thread sets the viewport from the next snapshot; note that
+    // width and height will be significantly larger than specified on retina
+    // displays.
     screen.width = width;
     screen.height = height;
-
-    // Make sure the viewport matches the new window dimensions; note that width and 
-    // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
 }
 
 
@@ -0,0 +1,367 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "data/mesh.h"
+
+
+namespace engine
+{
+constexpr unsigned int BVH_NUM_BINS = 16;
+constexpr unsigned int BVH_MAX_LEAF_SIZE = 4;
+constexpr unsigned int BVH_STACK_SIZE = 64;
+// Traversal keeps at most one pending sibling per level, so trees this deep
+// fit the stack; nodes at this depth become leaves whatever their size.
+constexpr unsigned int BVH_MAX_DEPTH = BVH_STACK_SIZE - 1;
+
+
+struct BVHRay
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct BVHHit
+{
+    float t = std::numeric_limits<float>::infinity();
+    float u = 0.0f;                 // Barycentric coordinates of the hit
+    float v = 0.0f;
+    unsigned int triangle = 0;      // Index into BVH::triangles
+};
+
+// World-space triangle stored with two edges for Moller-Trumbore.
+struct BVHTriangle
+{
+    glm::vec3 v0;
+    glm::vec3 e1;
+    glm::vec3 e2;
+    glm::vec3 normal;               // Geometric normal
+    unsigned int instance;          // User id of the owning instance
+    unsigned int primitive;         // Triangle index within the instance mesh
+};
+
+
+// Bounding volume hierarchy over the world-space triangles of static meshes,
+// built with a binned SAH. Nodes live in a flat array; a leaf references a
+// contiguous range of the (reordered) triangle array.
+class BVH
+{
+public:
+    std::vector<BVHTriangle> triangles;
+
+
+    BVH() {}
+
+    // Appends the triangles of a mesh transformed by the world matrix.
+    void addMesh(const Mesh* mesh, const glm::mat4& world, unsigned int instance)
+    {
+        for (size_t i = 0; i + 2 < mesh->indices.size(); i += 3)
+        {
+            glm::vec3 p0 = glm::vec3(world * glm::vec4(mesh->vertices[mesh->indices[i]].position, 1.0f));
+            glm::vec3 p1 = glm::vec3(world * glm::vec4(mesh->vertices[mesh->indices[i + 1]].position, 1.0f));
+            glm::vec3 p2 = glm::vec3(world * glm::vec4(mesh->vertices[mesh->indices[i + 2]].position, 1.0f));
+
+            BVHTriangle tri;
+            tri.v0 = p0;
+            tri.e1 = p1 - p0;
+            tri.e2 = p2 - p0;
+            glm::vec3 n = glm::cross(tri.e1, tri.e2);
+            float len = glm::length(n);
+            // Degenerated triangles can never be hit.
+            if (len == 0.0f)
+                continue;
+            tri.normal = n / len;
+            tri.instance = instance;
+            tri.primitive = (unsigned int)(i / 3);
+            this->triangles.push_back(tri);
+        }
+    }
+
+    void build()
+    {
+        this->nodes.clear();
+        if (this->triangles.empty())
+            return;
+
+        // Centroids and bounds are cached so the splits never touch vertices.
+        this->centroids.resize(this->triangles.size());
+        this->bounds.resize(this->triangles.size());
+        for (size_t i = 0; i < this->triangles.size(); ++i)
+        {
+            const BVHTriangle& tri = this->triangles[i];
+            glm::vec3 p1 = tri.v0 + tri.e1;
+            glm::vec3 p2 = tri.v0 + tri.e2;
+            this->bounds[i].bmin = glm::min(tri.v0, glm::min(p1, p2));
+            this->bounds[i].bmax = glm::max(tri.v0, glm::max(p1, p2));
+            this->centroids[i] = (tri.v0 + p1 + p2) / 3.0f;
+        }
+        this->order.resize(this->triangles.size());
+        for (size_t i = 0; i < this->order.size(); ++i)
+            this->order[i] = (unsigned int)i;
+
+        this->nodes.reserve(2 * this->triangles.size());
+        this->nodes.push_back(Node());
+        this->subdivide(0, 0, (unsigned int)this->triangles.size(), 0);
+
+        // Reorder the triangles so that every leaf is contiguous.
+        std::vector<BVHTriangle> sorted(this->triangles.size());
+        for (size_t i = 0; i < this->order.size(); ++i)
+            sorted[i] = this->triangles[this->order[i]];
+        this->triangles.swap(sorted);
+
+        this->centroids.clear();
+        this->bounds.clear();
+        this->order.clear();
+    }
+
+    // Finds the closest hit in (tMin, hit.t).
+    bool intersect(const BVHRay& ray, BVHHit& hit, float tMin = 0.0f) const
+    {
+        return this->traverse(ray, hit, tMin, false);
+    }
+
+    // Tests if anything blocks the ray in (tMin, tMax).
+    bool occluded(const BVHRay& ray, float tMin, float tMax) const
+    {
+        BVHHit hit;
+        hit.t = tMax;
+        return this->traverse(ray, hit, tMin, true);
+    }
+
+private:
+    struct Bounds
+    {
+        glm::vec3 bmin = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 bmax = glm::vec3(-std::numeric_limits<float>::max());
+
+        void grow(const Bounds& other)
+        {
+            this->bmin = glm::min(this->bmin, other.bmin);
+            this->bmax = glm::max(this->bmax, other.bmax);
+        }
+
+        float area() const
+        {
+            glm::vec3 d = this->bmax - this->bmin;
+            if (d.x < 0.0f)
+                return 0.0f;
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+    };
+
+    struct Node
+    {
+        Bounds box;
+        unsigned int first = 0;     // First triangle (leaf) or left child
+        unsigned int count = 0;     // Number of triangles, 0 for inner nodes
+    };
+
+    std::vector<Node> nodes;
+    std::vector<glm::vec3> centroids;
+    std::vector<Bounds> bounds;
+    std::vector<unsigned int> order;
+
+
+    void subdivide(unsigned int nodeIdx, unsigned int first, unsigned int count, unsigned int depth)
+    {
+        Bounds box;
+        Bounds centroidBox;
+        for (unsigned int i = first; i < first + count; ++i)
+        {
+            box.grow(this->bounds[this->order[i]]);
+            Bounds c;
+            c.bmin = c.bmax = this->centroids[this->order[i]];
+            centroidBox.grow(c);
+        }
+        this->nodes[nodeIdx].box = box;
+
+        if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAX_DEPTH)
+        {
+            this->makeLeaf(nodeIdx, first, count);
+            return;
+        }
+
+        // Find the cheapest split plane among the bins of every axis.
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        unsigned int bestBin = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float lo = centroidBox.bmin[axis];
+            float hi = centroidBox.bmax[axis];
+            if (hi <= lo)
+                continue;
+
+            Bounds binBox[BVH_NUM_BINS];
+            unsigned int binCount[BVH_NUM_BINS] = { 0 };
+            float scale = BVH_NUM_BINS / (hi - lo);
+            for (unsigned int i = first; i < first + count; ++i)
+            {
+                unsigned int b = std::min(
+                    BVH_NUM_BINS - 1,
+                    (unsigned int)((this->centroids[this->order[i]][axis] - lo) * scale)
+                );
+                binBox[b].grow(this->bounds[this->order[i]]);
+                ++binCount[b];
+            }
+
+            // Sweep from the right to get the suffix areas, then from the left.
+            float rightArea[BVH_NUM_BINS];
+            unsigned int rightCount[BVH_NUM_BINS];
+            Bounds acc;
+            unsigned int accCount = 0;
+            for (int b = BVH_NUM_BINS - 1; b > 0; --b)
+            {
+                acc.grow(binBox[b]);
+                accCount += binCount[b];
+                rightArea[b] = acc.area();
+                rightCount[b] = accCount;
+            }
+            acc = Bounds();
+            accCount = 0;
+            for (unsigned int b = 0; b < BVH_NUM_BINS - 1; ++b)
+            {
+                acc.grow(binBox[b]);
+                accCount += binCount[b];
+                float cost = accCount * acc.area()
+                    + rightCount[b + 1] * rightArea[b + 1];
+                if (accCount > 0 && rightCount[b + 1] > 0 && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        // Splitting is not worth it, or all centroids coincide.
+        if (bestAxis < 0 || bestCost >= count * box.area())
+        {
+            this->makeLeaf(nodeIdx, first, count);
+            return;
+        }
+
+        float lo = centroidBox.bmin[bestAxis];
+        float scale = BVH_NUM_BINS / (centroidBox.bmax[bestAxis] - lo);
+        auto mid = std::partition(
+            this->order.begin() + first, this->order.begin() + first + count,
+            [&](unsigned int idx) {
+                unsigned int b = std::min(
+                    BVH_NUM_BINS - 1,
+                    (unsigned int)((this->centroids[idx][bestAxis] - lo) * scale)
+                );
+                return b <= bestBin;
+            }
+        );
+        unsigned int leftCount = (unsigned int)(mid - (this->order.begin() + first));
+
+        unsigned int left = (unsigned int)this->nodes.size();
+        this->nodes.push_back(Node());
+        this->nodes.push_back(Node());
+        this->nodes[nodeIdx].first = left;
+        this->nodes[nodeIdx].count = 0;
+        this->subdivide(left, first, leftCount, depth + 1);
+        this->subdivide(left + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+
+    void makeLeaf(unsigned int nodeIdx, unsigned int first, unsigned int count)
+    {
+        this->nodes[nodeIdx].first = first;
+        this->nodes[nodeIdx].count = count;
+    }
+
+    static bool boxIntersect(
+        const Bounds& box, const glm::vec3& origin, const glm::vec3& invdir,
+        float tMin, float tMax
+    ) {
+        glm::vec3 t0 = (box.bmin - origin) * invdir;
+        glm::vec3 t1 = (box.bmax - origin) * invdir;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+        return enter <= exit;
+    }
+
+    // Moller-Trumbore ray-triangle intersection.
+    static bool triangleIntersect(
+        const BVHTriangle& tri, const BVHRay& ray, float tMin, BVHHit& hit,
+        unsigned int idx
+    ) {
+        glm::vec3 pvec = glm::cross(ray.direction, tri.e2);
+        float det = glm::dot(tri.e1, pvec);
+        if (std::abs(det) < 1e-12f)
+            return false;
+
+        float invDet = 1.0f / det;
+        glm::vec3 tvec = ray.origin - tri.v0;
+        float u = glm::dot(tvec, pvec) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        glm::vec3 qvec = glm::cross(tvec, tri.e1);
+        float v = glm::dot(ray.direction, qvec) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        float t = glm::dot(tri.e2, qvec) * invDet;
+        if (t <= tMin || t >= hit.t)
+            return false;
+
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        hit.triangle = idx;
+        return true;
+    }
+
+    bool traverse(const BVHRay& ray, BVHHit& hit, float tMin, bool anyHit) const
+    {
+        if (this->nodes.empty())
+            return false;
+
+        glm::vec3 invdir = 1.0f / ray.direction;
+        unsigned int stack[BVH_STACK_SIZE];
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        bool hitAny = false;
+        while (stackSize > 0)
+        {
+            const Node& node = this->nodes[stack[--stackSize]];
+            if (!boxIntersect(node.box, ray.origin, invdir, tMin, hit.t))
+                continue;
+
+            if (node.count > 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; ++i)
+                {
+                    if (triangleIntersect(this->triangles[i], ray, tMin, hit, i))
+                    {
+                        if (anyHit)
+                            return true;
+                        hitAny = true;
+                    }
+                }
+            }
+            else
+            {
+                // Holds by BVH_MAX_DEPTH.
+                assert(stackSize + 2 <= BVH_STACK_SIZE);
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+        return hitAny;
+    }
+};
+}
+
+#endif
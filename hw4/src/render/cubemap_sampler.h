@@ -0,0 +1,199 @@
+#ifndef CUBEMAP_SAMPLER_H
+#define CUBEMAP_SAMPLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "data/texture_cube.h"
+
+
+namespace engine
+{
+constexpr int DEFAULT_CUBEMAP_SAMPLER_RESOLUTION = 128;
+
+
+// CPU copy of a cubemap for the bake passes. The faces are read back from
+// the GL texture and box-filtered down to a small resolution, since the
+// skybox faces are far too large to keep around as floats.
+class CubemapSampler
+{
+public:
+    typedef std::array<std::vector<glm::vec3>, 6> Faces;
+
+    int resolution;
+    Faces faces;                        // Row-major, in GL face order
+    std::vector<Faces> mips;            // Levels 1.., see generateMipmaps()
+
+
+    CubemapSampler(
+        const CubemapTexture* cubemap,
+        int resolution = DEFAULT_CUBEMAP_SAMPLER_RESOLUTION
+    ) : resolution(resolution)
+    {
+        int size = cubemap->width;
+        // Downsample by an integer factor only.
+        this->resolution = std::max(1, std::min(resolution, size));
+        while (size % this->resolution != 0)
+            --this->resolution;
+        int factor = size / this->resolution;
+
+        std::vector<unsigned char> pixels(size * size * 3);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap->ID);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (int f = 0; f < 6; ++f)
+        {
+            glGetTexImage(
+                GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGB,
+                GL_UNSIGNED_BYTE, pixels.data()
+            );
+
+            std::vector<glm::vec3>& face = this->faces[f];
+            face.assign(this->resolution * this->resolution, glm::vec3(0.0f));
+            float norm = 1.0f / (255.0f * factor * factor);
+            for (int y = 0; y < size; ++y)
+            {
+                for (int x = 0; x < size; ++x)
+                {
+                    const unsigned char* p = &pixels[3 * (y * size + x)];
+                    face[(y / factor) * this->resolution + x / factor]
+                        += glm::vec3(p[0], p[1], p[2]) * norm;
+                }
+            }
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    // Box-filters the faces down to 1x1. Needed by sampleLod().
+    void generateMipmaps()
+    {
+        this->mips.clear();
+        const Faces* src = &this->faces;
+        int res = this->resolution;
+        while (res > 1 && res % 2 == 0)
+        {
+            int half = res / 2;
+            Faces dst;
+            for (int f = 0; f < 6; ++f)
+            {
+                dst[f].resize(half * half);
+                for (int y = 0; y < half; ++y)
+                {
+                    for (int x = 0; x < half; ++x)
+                    {
+                        const std::vector<glm::vec3>& s = (*src)[f];
+                        dst[f][y * half + x] = 0.25f * (
+                            s[(2 * y) * res + 2 * x] + s[(2 * y) * res + 2 * x + 1]
+                            + s[(2 * y + 1) * res + 2 * x] + s[(2 * y + 1) * res + 2 * x + 1]
+                        );
+                    }
+                }
+            }
+            this->mips.push_back(dst);
+            src = &this->mips.back();
+            res = half;
+        }
+    }
+
+    int getNumLevels() const
+    {
+        return 1 + (int)this->mips.size();
+    }
+
+    // Trilinear lookup in the mip chain.
+    glm::vec3 sampleLod(const glm::vec3& dir, float lod) const
+    {
+        lod = std::min(std::max(lod, 0.0f), (float)(this->getNumLevels() - 1));
+        int l0 = (int)lod;
+        int l1 = std::min(l0 + 1, this->getNumLevels() - 1);
+        glm::vec3 a = this->sampleLevel(dir, l0);
+        if (l1 == l0)
+            return a;
+        return glm::mix(a, this->sampleLevel(dir, l1), lod - l0);
+    }
+
+    // Bilinear lookup with the face selection rules of the GL spec.
+    glm::vec3 sample(const glm::vec3& dir) const
+    {
+        return this->sampleLevel(dir, 0);
+    }
+
+    glm::vec3 sampleLevel(const glm::vec3& dir, int level) const
+    {
+        glm::vec3 a = glm::abs(dir);
+        int face;
+        float sc, tc, ma;
+        if (a.x >= a.y && a.x >= a.z)
+        {
+            face = dir.x > 0.0f ? 0 : 1;
+            sc = dir.x > 0.0f ? -dir.z : dir.z;
+            tc = -dir.y;
+            ma = a.x;
+        }
+        else if (a.y >= a.z)
+        {
+            face = dir.y > 0.0f ? 2 : 3;
+            sc = dir.x;
+            tc = dir.y > 0.0f ? dir.z : -dir.z;
+            ma = a.y;
+        }
+        else
+        {
+            face = dir.z > 0.0f ? 4 : 5;
+            sc = dir.z > 0.0f ? dir.x : -dir.x;
+            tc = -dir.y;
+            ma = a.z;
+        }
+        int res = this->resolution >> level;
+        const Faces& faces = level == 0 ? this->faces : this->mips[level - 1];
+        float s = 0.5f * (sc / ma + 1.0f) * res - 0.5f;
+        float t = 0.5f * (tc / ma + 1.0f) * res - 0.5f;
+        return texel(faces[face], res, s, t);
+    }
+
+    // Direction through the center of texel (s, t) of a face with the given
+    // resolution, the inverse of sample().
+    static glm::vec3 direction(int face, float s, float t, int resolution)
+    {
+        float sc = 2.0f * (s + 0.5f) / resolution - 1.0f;
+        float tc = 2.0f * (t + 0.5f) / resolution - 1.0f;
+        glm::vec3 dir;
+        switch (face)
+        {
+        case 0: dir = glm::vec3(1.0f, -tc, -sc); break;
+        case 1: dir = glm::vec3(-1.0f, -tc, sc); break;
+        case 2: dir = glm::vec3(sc, 1.0f, tc); break;
+        case 3: dir = glm::vec3(sc, -1.0f, -tc); break;
+        case 4: dir = glm::vec3(sc, -tc, 1.0f); break;
+        default: dir = glm::vec3(-sc, -tc, -1.0f); break;
+        }
+        return glm::normalize(dir);
+    }
+
+private:
+    static glm::vec3 texel(
+        const std::vector<glm::vec3>& f, int resolution, float s, float t
+    ) {
+        int maxIdx = resolution - 1;
+        s = std::min(std::max(s, 0.0f), (float)maxIdx);
+        t = std::min(std::max(t, 0.0f), (float)maxIdx);
+        int s0 = (int)s;
+        int t0 = (int)t;
+        int s1 = std::min(s0 + 1, maxIdx);
+        int t1 = std::min(t0 + 1, maxIdx);
+        float fs = s - s0;
+        float ft = t - t0;
+
+        glm::vec3 top = glm::mix(f[t0 * resolution + s0], f[t0 * resolution + s1], fs);
+        glm::vec3 bottom = glm::mix(f[t1 * resolution + s0], f[t1 * resolution + s1], fs);
+        return glm::mix(top, bottom, ft);
+    }
+};
+}
+
+#endif
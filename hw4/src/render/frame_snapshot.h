@@ -0,0 +1,104 @@
+#ifndef FRAME_SNAPSHOT_H
+#define FRAME_SNAPSHOT_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/camera.h"
+#include "base/entity_registry.h"
+#include "base/graphics_settings.h"
+#include "data/bounds.h"
+#include "data/lightmap.h"
+#include "data/model.h"
+
+
+namespace engine
+{
+// Everything the render thread needs to draw a frame, copied out of the
+// camera, the sun, the settings and the entity registry by the simulation
+// thread. The renderer reads nothing else that the simulation writes, so
+// the two threads never share live state. Snapshots travel through a
+// TripleBuffer and are reused, so every field is rewritten on each tick.
+//
+// The models and lightmaps pointed to are owned by the scene and must stay
+// alive while the render thread runs.
+struct FrameSnapshot
+{
+    uint64_t tick = 0;
+    float time = 0.0f;                  // Of the simulation, in seconds
+    float deltaTime = 0.0f;             // One tick
+    double simulatedUntil = 0.0;        // Real time the last tick caught up to
+    unsigned int screenWidth = 0;
+    unsigned int screenHeight = 0;
+    GraphicsSettings settings;
+
+    // Camera, at the previous tick and at the last one.
+    CameraState previousCamera;
+    CameraState camera;
+    glm::mat4 projection;
+
+    // Sun.
+    glm::mat4 lightSpace;
+    glm::vec3 lightDirection;
+    glm::vec3 lightColor;
+    float sunAzimuth = 0.0f;
+    float sunElevation = 0.0f;
+
+    // The render thread writes the profiler trace whenever the request count
+    // changes, so requests survive snapshots it never sees.
+    unsigned int traceRequests = 0;
+    std::string tracePath;
+
+    // Entities, laid out as in EntityRegistry.
+    std::vector<Model*> models;
+    std::vector<Lightmap*> lightmaps;
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<glm::mat3> normalMatrices;
+    std::vector<AABB> worldBounds;
+    std::vector<BoundingSphere> worldSpheres;
+
+
+    size_t size() const
+    {
+        return this->models.size();
+    }
+
+    // The camera as seen at real time now, blended from the last two ticks.
+    // The snapshot is published when the simulation reaches simulatedUntil,
+    // which is one tick after previousCamera was current; rendering shows
+    // that much of the way from previousCamera to camera.
+    CameraState getCamera(double now) const
+    {
+        float alpha = 1.0f;
+        if (this->deltaTime > 0.0f)
+            alpha = (float)glm::clamp((now - this->simulatedUntil) / this->deltaTime, 0.0, 1.0);
+        return CameraState::interpolate(this->previousCamera, this->camera, alpha);
+    }
+
+    // Copies the entity arrays, unless this snapshot already holds the
+    // current version of the registry. Static scenes are copied only once
+    // per slot of the triple buffer.
+    void copyEntities(const EntityRegistry& registry)
+    {
+        if (this->hasEntities && this->registryVersion == registry.getVersion())
+            return;
+        this->models = registry.models;
+        this->lightmaps = registry.lightmaps;
+        this->worldMatrices = registry.worldMatrices;
+        this->normalMatrices = registry.normalMatrices;
+        this->worldBounds = registry.worldBounds;
+        this->worldSpheres = registry.worldSpheres;
+        this->registryVersion = registry.getVersion();
+        this->hasEntities = true;
+    }
+
+private:
+    uint64_t registryVersion = 0;
+    bool hasEntities = false;
+};
+}
+
+#endif
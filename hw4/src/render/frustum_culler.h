@@ -0,0 +1,196 @@
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_CULLER_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "base/entity_registry.h"
+#include "base/job_system.h"
+#include "data/bounds.h"
+
+
+namespace engine
+{
+constexpr size_t CULL_ENTITIES_PER_JOB = 1024;
+
+
+// Objects tested and rejected by one cull() call.
+struct CullingStats
+{
+    unsigned int tested = 0;
+    unsigned int culled = 0;
+};
+
+
+// The six planes of a view-projection matrix, normals pointing inwards. They
+// are kept as two groups of four in structure-of-arrays form, so one box is
+// tested against four planes per SSE instruction. The last two slots hold a
+// plane nothing is ever outside of.
+class Frustum
+{
+public:
+    alignas(16) float nx[8];
+    alignas(16) float ny[8];
+    alignas(16) float nz[8];
+    alignas(16) float w[8];
+
+
+    Frustum() : Frustum(glm::mat4(1.0f)) {}
+
+    // Gribb-Hartmann extraction, for GL clip space (-w <= z <= w).
+    Frustum(const glm::mat4& viewProjection)
+    {
+        glm::vec4 row[4];
+        for (int r = 0; r < 4; ++r)
+        {
+            row[r] = glm::vec4(
+                viewProjection[0][r], viewProjection[1][r],
+                viewProjection[2][r], viewProjection[3][r]
+            );
+        }
+        glm::vec4 planes[8] = {
+            row[3] + row[0], row[3] - row[0],
+            row[3] + row[1], row[3] - row[1],
+            row[3] + row[2], row[3] - row[2],
+            glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
+        };
+        for (int p = 0; p < 8; ++p)
+        {
+            // Normalized so that sphere radii compare against distances.
+            float len = glm::length(glm::vec3(planes[p]));
+            glm::vec4 plane = len > 0.0f ? planes[p] / len : planes[p];
+            this->nx[p] = plane.x;
+            this->ny[p] = plane.y;
+            this->nz[p] = plane.z;
+            this->w[p] = plane.w;
+        }
+    }
+
+    bool intersects(const BoundingSphere& sphere) const
+    {
+        return this->test(sphere.center, glm::vec3(0.0f), sphere.radius);
+    }
+
+    bool intersects(const AABB& box) const
+    {
+        return this->test(box.center, box.extents, 0.0f);
+    }
+
+private:
+    // A volume is outside if it lies behind any plane, that is if for some
+    // plane dot(n, c) + w + dot(|n|, e) + radius < 0. Conservative near the
+    // frustum corners, which is fine for culling.
+    bool test(const glm::vec3& c, const glm::vec3& e, float radius) const
+    {
+#ifdef FRUSTUM_CULLER_SSE
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        __m128 cx = _mm_set1_ps(c.x);
+        __m128 cy = _mm_set1_ps(c.y);
+        __m128 cz = _mm_set1_ps(c.z);
+        __m128 ex = _mm_set1_ps(e.x);
+        __m128 ey = _mm_set1_ps(e.y);
+        __m128 ez = _mm_set1_ps(e.z);
+        __m128 r = _mm_set1_ps(radius);
+        int outside = 0;
+        for (int g = 0; g < 8; g += 4)
+        {
+            __m128 px = _mm_load_ps(this->nx + g);
+            __m128 py = _mm_load_ps(this->ny + g);
+            __m128 pz = _mm_load_ps(this->nz + g);
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                _mm_add_ps(_mm_mul_ps(pz, cz), _mm_load_ps(this->w + g))
+            );
+            __m128 reach = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_andnot_ps(signMask, px), ex),
+                    _mm_mul_ps(_mm_andnot_ps(signMask, py), ey)
+                ),
+                _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, pz), ez), r)
+            );
+            outside |= _mm_movemask_ps(
+                _mm_cmplt_ps(_mm_add_ps(d, reach), _mm_setzero_ps())
+            );
+        }
+        return outside == 0;
+#else
+        for (int p = 0; p < 6; ++p)
+        {
+            float d = this->nx[p] * c.x + this->ny[p] * c.y + this->nz[p] * c.z + this->w[p];
+            float reach = std::abs(this->nx[p]) * e.x + std::abs(this->ny[p]) * e.y
+                + std::abs(this->nz[p]) * e.z + radius;
+            if (d + reach < 0.0f)
+                return false;
+        }
+        return true;
+#endif
+    }
+};
+
+
+// Marks the entities of a registry whose model overlaps a frustum. The
+// sphere test runs first as it rejects most far away objects; survivors are
+// checked against their box. Entities without bounds are always visible.
+// Each entity only writes its own flag, so ranges of entities are culled in
+// parallel on jobs, if given. Works on anything laid out like an
+// EntityRegistry, such as a FrameSnapshot.
+class FrustumCuller
+{
+public:
+    template <typename Entities>
+    static CullingStats cull(
+        const Entities& registry, const glm::mat4& viewProjection,
+        std::vector<uint8_t>& visible, JobSystem* jobs = nullptr
+    ) {
+        Frustum frustum(viewProjection);
+        visible.assign(registry.size(), 1);
+        if (!jobs)
+            return cullRange(registry, frustum, visible, 0, registry.size());
+
+        std::atomic<unsigned int> tested(0);
+        std::atomic<unsigned int> culled(0);
+        jobs->parallelFor(0, registry.size(), CULL_ENTITIES_PER_JOB, [&](size_t first, size_t last) {
+            CullingStats stats = cullRange(registry, frustum, visible, first, last);
+            tested.fetch_add(stats.tested, std::memory_order_relaxed);
+            culled.fetch_add(stats.culled, std::memory_order_relaxed);
+        });
+        CullingStats stats;
+        stats.tested = tested.load();
+        stats.culled = culled.load();
+        return stats;
+    }
+
+private:
+    template <typename Entities>
+    static CullingStats cullRange(
+        const Entities& registry, const Frustum& frustum,
+        std::vector<uint8_t>& visible, size_t first, size_t last
+    ) {
+        CullingStats stats;
+        for (size_t i = first; i < last; ++i)
+        {
+            if (!registry.models[i] || registry.worldBounds[i].isEmpty())
+                continue;
+            ++(stats.tested);
+            if (!frustum.intersects(registry.worldSpheres[i])
+                || !frustum.intersects(registry.worldBounds[i]))
+            {
+                visible[i] = 0;
+                ++(stats.culled);
+            }
+        }
+        return stats;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+#include "base/profiler.h"
+
+
+#ifdef ENGINE_PROFILE
+// Times the GPU work issued in the rest of the enclosing scope. Scopes must
+// not nest, as only one GL_TIME_ELAPSED query can be active at a time.
+#define PROFILE_GPU_SCOPE(timers, name) \
+    engine::GpuProfileScope PROFILE_JOIN(gpuProfileScope, __LINE__)((timers), (name))
+#else
+#define PROFILE_GPU_SCOPE(timers, name) ((void)0)
+#endif
+
+
+namespace engine
+{
+constexpr unsigned int GPU_TIMER_FRAMES = 2;        // Frames in flight
+constexpr unsigned int GPU_TIMERS_PER_FRAME = 16;
+
+
+// GL_TIME_ELAPSED queries for a few passes a frame, in one set per frame in
+// flight. A set is read back only when its turn comes again, GPU_TIMER_FRAMES
+// frames later, by which time the GPU is normally done with it; results that
+// are still not available are dropped rather than waited for, so reading
+// never stalls the pipeline.
+//
+// Needs a current GL context; create and delete it on the render thread.
+class GpuTimerPool
+{
+public:
+    GpuTimerPool(Profiler& profiler) : profiler(profiler)
+    {
+        if (PROFILER_ENABLED)
+            glGenQueries(GPU_TIMER_FRAMES * GPU_TIMERS_PER_FRAME, this->queries);
+    }
+
+    ~GpuTimerPool()
+    {
+        if (PROFILER_ENABLED)
+            glDeleteQueries(GPU_TIMER_FRAMES * GPU_TIMERS_PER_FRAME, this->queries);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    GpuTimerPool(const GpuTimerPool& other) = delete;
+    GpuTimerPool& operator=(const GpuTimerPool& other) = delete;
+
+    // Reads back the set this frame is about to reuse.
+    void beginFrame()
+    {
+        if (!PROFILER_ENABLED)
+            return;
+        this->frame = (this->frame + 1) % GPU_TIMER_FRAMES;
+        PendingTimer* timers = this->timers[this->frame];
+        for (unsigned int i = 0; i < this->used[this->frame]; ++i)
+        {
+            GLuint query = this->queries[this->frame * GPU_TIMERS_PER_FRAME + i];
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                ++(this->lost);
+                continue;
+            }
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            this->profiler.recordGpu(timers[i].name, timers[i].start, elapsed);
+        }
+        this->used[this->frame] = 0;
+    }
+
+    void begin(const char* name)
+    {
+        if (!PROFILER_ENABLED || this->used[this->frame] >= GPU_TIMERS_PER_FRAME)
+            return;
+        unsigned int index = this->used[this->frame]++;
+        this->timers[this->frame][index] = { name, this->profiler.now() };
+        glBeginQuery(GL_TIME_ELAPSED, this->queries[this->frame * GPU_TIMERS_PER_FRAME + index]);
+        this->active = true;
+    }
+
+    void end()
+    {
+        if (!this->active)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        this->active = false;
+    }
+
+    // Results not ready when read back.
+    uint64_t getLost() const
+    {
+        return this->lost;
+    }
+
+private:
+    struct PendingTimer
+    {
+        const char* name;
+        uint64_t start;
+    };
+
+    Profiler& profiler;
+    GLuint queries[GPU_TIMER_FRAMES * GPU_TIMERS_PER_FRAME];
+    PendingTimer timers[GPU_TIMER_FRAMES][GPU_TIMERS_PER_FRAME];
+    unsigned int used[GPU_TIMER_FRAMES] = {};
+    unsigned int frame = 0;
+    bool active = false;
+    uint64_t lost = 0;
+};
+
+
+// Times the GPU work issued from its construction to the end of the scope.
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(GpuTimerPool& timers, const char* name) : timers(timers)
+    {
+        this->timers.begin(name);
+    }
+
+    ~GpuProfileScope()
+    {
+        this->timers.end();
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    GpuProfileScope(const GpuProfileScope& other) = delete;
+    GpuProfileScope& operator=(const GpuProfileScope& other) = delete;
+
+private:
+    GpuTimerPool& timers;
+};
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef INSTANCE_BATCHER_H
+#define INSTANCE_BATCHER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "data/lightmap.h"
+#include "data/model.h"
+#include "data/shader.h"
+
+
+namespace engine
+{
+// Vertex attribute locations of the per-instance data. Locations 0-4 are
+// taken by Vertex.
+constexpr GLuint INSTANCE_WORLD_LOCATION = 5;          // mat4, 5-8
+constexpr GLuint INSTANCE_NORMAL_MATRIX_LOCATION = 9;  // mat3, 9-11
+
+
+struct InstanceData
+{
+    glm::mat4 world;
+    glm::mat3 normalMatrix;             // transpose(inverse(mat3(world)))
+};
+
+
+// Merges runs of instances of the same model into batches, so a pass issues
+// one glDrawElementsInstancedBaseVertex per model and material instead of
+// one draw per entity. Entities with different lightmaps cannot share a draw
+// and get their own batch. Instances are expected in draw order, with the instances of a model
+// next to each other; RenderQueue sorts them that way.
+//
+// All instances of a frame are streamed into one buffer, which is orphaned on
+// each upload so the driver never waits for the previous frame to finish.
+class InstanceBatcher
+{
+public:
+    struct Batch
+    {
+        unsigned int pass;
+        Shader* shader;
+        Model* model;
+        Lightmap* lightmap;
+        size_t first;                   // Into the instance buffer
+        size_t count;
+    };
+
+    std::vector<Batch> batches;         // Valid after upload()
+    unsigned int drawCalls = 0;         // Since the last resetStats()
+    unsigned int instancesDrawn = 0;
+
+
+    InstanceBatcher()
+    {
+        glGenBuffers(1, &this->VBO);
+    }
+
+    ~InstanceBatcher()
+    {
+        glDeleteBuffers(1, &this->VBO);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    InstanceBatcher(const InstanceBatcher& other) = delete;
+    InstanceBatcher& operator=(const InstanceBatcher& other) = delete;
+
+    void clear()
+    {
+        this->items.clear();
+        this->batches.clear();
+    }
+
+    void add(
+        unsigned int pass, Shader* shader, Model* model, Lightmap* lightmap,
+        const glm::mat4& world, const glm::mat3& normalMatrix
+    ) {
+        Item item;
+        item.pass = pass;
+        item.shader = shader;
+        item.model = model;
+        item.lightmap = lightmap;
+        // Positions come quantized within the mesh bounds. Normals are
+        // stored apart, so the normal matrix stays the entity's.
+        item.instance.world = world * model->mesh->dequantization;
+        item.instance.normalMatrix = normalMatrix;
+        this->items.push_back(item);
+    }
+
+    // Splits the instances into batches and streams them to the GPU.
+    void upload()
+    {
+        this->instances.resize(this->items.size());
+        for (size_t i = 0; i < this->items.size(); ++i)
+        {
+            const Item& item = this->items[i];
+            this->instances[i] = item.instance;
+            if (this->batches.empty()
+                || this->batches.back().pass != item.pass
+                || this->batches.back().shader != item.shader
+                || this->batches.back().model != item.model
+                || this->batches.back().lightmap != item.lightmap)
+            {
+                this->batches.push_back(Batch{
+                    item.pass, item.shader, item.model, item.lightmap, i, 0
+                });
+            }
+            ++(this->batches.back().count);
+        }
+
+        if (this->instances.empty())
+            return;
+        size_t size = this->instances.size() * sizeof(InstanceData);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        if (size > this->capacity)
+            this->capacity = std::max(size, 2 * this->capacity);
+        glBufferData(GL_ARRAY_BUFFER, this->capacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, this->instances.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Points the instance attributes of the bound vertex array at the
+    // instances of a batch, before draw().
+    void bindInstances(const Batch& batch)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        size_t base = batch.first * sizeof(InstanceData);
+        for (GLuint c = 0; c < 4; ++c)
+        {
+            GLuint location = INSTANCE_WORLD_LOCATION + c;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(
+                location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (void*)(base + offsetof(InstanceData, world) + c * sizeof(glm::vec4))
+            );
+            glVertexAttribDivisor(location, 1);
+        }
+        for (GLuint c = 0; c < 3; ++c)
+        {
+            GLuint location = INSTANCE_NORMAL_MATRIX_LOCATION + c;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(
+                location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (void*)(base + offsetof(InstanceData, normalMatrix) + c * sizeof(glm::vec3))
+            );
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Draws indices [firstIndex, firstIndex + indexCount) of the batch's mesh
+    // from the mesh arena, whose VAO must be bound already.
+    void draw(const Batch& batch, uint32_t firstIndex, uint32_t indexCount)
+    {
+        const MeshAllocation& allocation = batch.model->mesh->allocation;
+        glDrawElementsInstancedBaseVertex(
+            GL_TRIANGLES,
+            (GLsizei)indexCount,
+            GL_UNSIGNED_INT,
+            (void*)(((size_t)allocation.firstIndex + firstIndex) * sizeof(unsigned int)),
+            (GLsizei)batch.count,
+            (GLint)allocation.baseVertex
+        );
+        ++(this->drawCalls);
+        this->instancesDrawn += (unsigned int)batch.count;
+    }
+
+    void resetStats()
+    {
+        this->drawCalls = 0;
+        this->instancesDrawn = 0;
+    }
+
+private:
+    struct Item
+    {
+        unsigned int pass;
+        Shader* shader;
+        Model* model;
+        Lightmap* lightmap;
+        InstanceData instance;
+    };
+
+    unsigned int VBO = 0;
+    size_t capacity = 0;                // Of the buffer, in bytes
+    std::vector<Item> items;
+    std::vector<InstanceData> instances;
+};
+}
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef IRRADIANCE_VOLUME_H
+#define IRRADIANCE_VOLUME_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/asset.h"
+#include "data/shader.h"
+
+
+namespace engine
+{
+constexpr unsigned int DEFAULT_PROBE_SAMPLES = 1024;
+constexpr int SH_NUM_COEFFICIENTS = 9;
+// Seven RGBA texels hold the 27 floats of an L2 probe. They are stored as
+// slabs stacked along z, see upload().
+constexpr int SH_NUM_TEXELS = 7;
+
+
+// Evaluates the real spherical harmonics basis up to l = 2.
+void evaluateSHBasis(const glm::vec3& n, float basis[SH_NUM_COEFFICIENTS])
+{
+    basis[0] = 0.282095f;
+    basis[1] = 0.488603f * n.y;
+    basis[2] = 0.488603f * n.z;
+    basis[3] = 0.488603f * n.x;
+    basis[4] = 1.092548f * n.x * n.y;
+    basis[5] = 1.092548f * n.y * n.z;
+    basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+    basis[7] = 1.092548f * n.x * n.z;
+    basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+}
+
+
+// L2 spherical harmonics of the irradiance around a point. The coefficients
+// are already convolved with the clamped cosine lobe, so evaluating them for
+// a normal gives the irradiance at a surface facing that way.
+struct SHProbe
+{
+    glm::vec3 coefficients[SH_NUM_COEFFICIENTS];
+
+    glm::vec3 evaluate(const glm::vec3& n) const
+    {
+        float basis[SH_NUM_COEFFICIENTS];
+        evaluateSHBasis(n, basis);
+        glm::vec3 result = glm::vec3(0.0f);
+        for (int i = 0; i < SH_NUM_COEFFICIENTS; ++i)
+            result += this->coefficients[i] * basis[i];
+        return glm::max(result, glm::vec3(0.0f));
+    }
+};
+
+
+// Regular grid of irradiance probes covering an axis-aligned box. Probes sit
+// on the corners of the cells, so the probe (i, j, k) is at
+// origin + size * (i, j, k) / (resolution - 1).
+class IrradianceVolume : public Asset
+{
+public:
+    unsigned int ID = 0;
+    glm::vec3 origin;
+    glm::vec3 size;
+    glm::ivec3 resolution;
+    std::vector<SHProbe> probes;
+
+
+    IrradianceVolume(
+        const std::string& name, glm::vec3 origin, glm::vec3 size,
+        glm::ivec3 resolution
+    ) : Asset(name), origin(origin), size(size), resolution(resolution)
+    {
+        if (resolution.x < 2 || resolution.y < 2 || resolution.z < 2)
+        {
+            throw std::invalid_argument(
+                "ERROR::IRRADIANCE_VOLUME::Resolution must be at least 2"
+            );
+        }
+        this->probes.resize(resolution.x * resolution.y * resolution.z);
+    }
+
+    ~IrradianceVolume()
+    {
+        if (this->ID)
+            glDeleteTextures(1, &(this->ID));
+    }
+
+    glm::vec3 getProbePosition(int i, int j, int k) const
+    {
+        return this->origin + this->size * glm::vec3(i, j, k)
+            / glm::vec3(this->resolution - glm::ivec3(1));
+    }
+
+    // Projects the incoming radiance of every probe onto SH. The radiance
+    // callback is called from several threads at once as
+    // radiance(origin, direction, rng) and must be thread safe.
+    template<typename RadianceFunc>
+    void bake(RadianceFunc radiance, unsigned int numSamples = DEFAULT_PROBE_SAMPLES)
+    {
+        std::atomic<size_t> next(0);
+        unsigned int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < numWorkers; ++w)
+        {
+            workers.emplace_back([this, &next, &radiance, numSamples, w]() {
+                std::mt19937 rng(0x85ebca6bu * (w + 1));
+                std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+                size_t idx;
+                while ((idx = next.fetch_add(1)) < this->probes.size())
+                {
+                    int i = (int)(idx % this->resolution.x);
+                    int j = (int)((idx / this->resolution.x) % this->resolution.y);
+                    int k = (int)(idx / (this->resolution.x * this->resolution.y));
+                    glm::vec3 p = this->getProbePosition(i, j, k);
+
+                    SHProbe probe;
+                    for (auto& c : probe.coefficients)
+                        c = glm::vec3(0.0f);
+
+                    // Stratified uniform sphere sampling.
+                    unsigned int strata = (unsigned int)std::sqrt((float)numSamples);
+                    unsigned int count = strata * strata;
+                    float basis[SH_NUM_COEFFICIENTS];
+                    for (unsigned int s = 0; s < count; ++s)
+                    {
+                        float u = ((s % strata) + uniform(rng)) / strata;
+                        float v = ((s / strata) + uniform(rng)) / strata;
+                        float z = 1.0f - 2.0f * u;
+                        float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+                        float phi = 2.0f * glm::pi<float>() * v;
+                        glm::vec3 dir = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+
+                        glm::vec3 L = radiance(p, dir, rng);
+                        evaluateSHBasis(dir, basis);
+                        for (int c = 0; c < SH_NUM_COEFFICIENTS; ++c)
+                            probe.coefficients[c] += L * basis[c];
+                    }
+
+                    // Monte Carlo weight of a uniform sphere sample, times the
+                    // cosine lobe convolution per band.
+                    float weight = 4.0f * glm::pi<float>() / count;
+                    const float bandScale[3] = {
+                        glm::pi<float>(),
+                        2.0f * glm::pi<float>() / 3.0f,
+                        glm::pi<float>() / 4.0f
+                    };
+                    for (int c = 0; c < SH_NUM_COEFFICIENTS; ++c)
+                    {
+                        int band = c == 0 ? 0 : (c < 4 ? 1 : 2);
+                        probe.coefficients[c] *= weight * bandScale[band];
+                    }
+                    this->probes[idx] = probe;
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // Uploads the probes as one 3D texture of size (x, y, 7z). Slab n holds
+    // coefficient n in rgb; the alphas of slabs 0-2 and 3-5 hold coefficients
+    // 7 and 8. Shaders sample every slab with the z coordinate clamped to its
+    // texel centers, so the trilinear filter never mixes two slabs.
+    void upload()
+    {
+        glm::ivec3 res = this->resolution;
+        std::vector<glm::vec4> texels(res.x * res.y * res.z * SH_NUM_TEXELS);
+        for (int k = 0; k < res.z; ++k)
+        {
+            for (int j = 0; j < res.y; ++j)
+            {
+                for (int i = 0; i < res.x; ++i)
+                {
+                    const SHProbe& probe = this->probes[(k * res.y + j) * res.x + i];
+                    for (int n = 0; n < SH_NUM_TEXELS; ++n)
+                    {
+                        float alpha = 0.0f;
+                        if (n < 3)
+                            alpha = probe.coefficients[7][n];
+                        else if (n < 6)
+                            alpha = probe.coefficients[8][n - 3];
+                        size_t slice = n * res.z + k;
+                        texels[(slice * res.y + j) * res.x + i]
+                            = glm::vec4(probe.coefficients[n], alpha);
+                    }
+                }
+            }
+        }
+
+        if (!this->ID)
+            glGenTextures(1, &(this->ID));
+        glBindTexture(GL_TEXTURE_3D, this->ID);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexImage3D(
+            GL_TEXTURE_3D, 0, GL_RGBA16F, res.x, res.y, res.z * SH_NUM_TEXELS,
+            0, GL_RGBA, GL_FLOAT, texels.data()
+        );
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // Sets the probe grid uniforms shared by the shaders that sample it.
+    void setUniforms(Shader* shader, int unit) const
+    {
+        shader->setInt("probeGrid", unit);
+        shader->setVec3("probeGridMin", this->origin);
+        shader->setVec3("probeGridSize", this->size);
+        shader->setVec3("probeGridResolution", glm::vec3(this->resolution));
+    }
+
+    void bind(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_3D, this->ID);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef LIGHTMAP_BAKER_H
+#define LIGHTMAP_BAKER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/scene.h"
+#include "data/light.h"
+#include "data/lightmap.h"
+#include "data/model.h"
+#include "render/bvh.h"
+#include "render/scene_tracer.h"
+
+
+namespace engine
+{
+constexpr unsigned int DEFAULT_LIGHTMAP_SHADOW_SAMPLES = 8;
+constexpr unsigned int DEFAULT_LIGHTMAP_INDIRECT_SAMPLES = 128;
+constexpr float DEFAULT_LIGHTMAP_AMBIENT = 0.3f; // Same as the lighting shader
+constexpr unsigned int LIGHTMAP_TEXELS_PER_JOB = 64;
+
+
+// Bakes the sun, its soft shadows, sky occlusion and one diffuse bounce into
+// the lightmaps of every entity whose model has lightmap coordinates. The
+// lightmaps store irradiance; the lightmapped shader multiplies it by the
+// diffuse texture.
+class LightmapBaker
+{
+public:
+    unsigned int shadowSamples = DEFAULT_LIGHTMAP_SHADOW_SAMPLES;
+    unsigned int indirectSamples = DEFAULT_LIGHTMAP_INDIRECT_SAMPLES;
+    float sunAngularRadius = DEFAULT_SUN_ANGULAR_RADIUS;
+    float ambient = DEFAULT_LIGHTMAP_AMBIENT;
+    unsigned int dilationPasses = 2 * LIGHTMAP_CHART_PADDING;
+
+
+    LightmapBaker() {}
+
+    // Returns one uploaded lightmap per lightmapped entity, named after the
+    // entity. The caller owns the lightmaps.
+    std::vector<Lightmap*> bake(Scene* scene, const DirectionalLight* sun)
+    {
+        // Every model casts and receives bounce light, lightmapped or not.
+        this->tracer.sunAngularRadius = this->sunAngularRadius;
+        this->tracer.build(scene, sun);
+        this->samples.clear();
+
+        std::vector<Lightmap*> lightmaps;
+        EntityRegistry& registry = scene->registry;
+        registry.updateWorldMatrices();
+        for (size_t i = 0; i < registry.size(); ++i)
+        {
+            Model* model = registry.models[i];
+            if (!model)
+                continue;
+
+            const glm::mat4& world = registry.worldMatrices[i];
+            if (model->lightmapResolution > 0)
+            {
+                Lightmap* lightmap = new Lightmap(
+                    registry.entities[i]->name,
+                    (int)model->lightmapResolution,
+                    (int)model->lightmapResolution
+                );
+                lightmap->azimuth = sun->azimuth;
+                lightmap->elevation = sun->elevation;
+                this->rasterize(lightmap, model->mesh, world, lightmaps.size());
+                lightmaps.push_back(lightmap);
+            }
+        }
+
+        // Texels are handed out to the workers in small jobs, since the cost
+        // per texel varies a lot between open ground and crevices.
+        std::atomic<size_t> next(0);
+        unsigned int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < numWorkers; ++w)
+        {
+            workers.emplace_back([this, &next, &lightmaps, w]() {
+                std::mt19937 rng(0x9e3779b9u * (w + 1));
+                while (true)
+                {
+                    size_t first = next.fetch_add(LIGHTMAP_TEXELS_PER_JOB);
+                    if (first >= this->samples.size())
+                        break;
+                    size_t last = std::min(
+                        first + LIGHTMAP_TEXELS_PER_JOB, this->samples.size()
+                    );
+                    for (size_t i = first; i < last; ++i)
+                    {
+                        const Sample& s = this->samples[i];
+                        lightmaps[s.lightmap]->texels[s.texel]
+                            = this->irradiance(s, rng);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+
+        for (size_t i = 0; i < lightmaps.size(); ++i)
+        {
+            this->dilate(lightmaps[i], this->coverage[i]);
+            lightmaps[i]->upload();
+        }
+
+        this->samples.clear();
+        this->coverage.clear();
+        return lightmaps;
+    }
+
+private:
+    struct Sample
+    {
+        size_t lightmap;
+        unsigned int texel;
+        glm::vec3 position;
+        glm::vec3 normal;           // Interpolated shading normal
+        glm::vec3 faceNormal;       // Geometric normal, for ray offsets
+    };
+
+    SceneTracer tracer;
+    std::vector<Sample> samples;
+    std::vector<std::vector<uint8_t>> coverage;
+
+
+    // Finds the texels whose centers are covered by a triangle of the mesh
+    // and records their world-space surface points.
+    void rasterize(
+        Lightmap* lightmap, const Mesh* mesh, const glm::mat4& world,
+        size_t lightmapIdx
+    ) {
+        glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(world)));
+        glm::vec2 size = glm::vec2((float)lightmap->width, (float)lightmap->height);
+        std::vector<uint8_t> covered(lightmap->texels.size(), 0);
+
+        for (size_t i = 0; i + 2 < mesh->indices.size(); i += 3)
+        {
+            const Vertex& a = mesh->vertices[mesh->indices[i]];
+            const Vertex& b = mesh->vertices[mesh->indices[i + 1]];
+            const Vertex& c = mesh->vertices[mesh->indices[i + 2]];
+            glm::vec2 ta = a.lightmapCoords * size;
+            glm::vec2 tb = b.lightmapCoords * size;
+            glm::vec2 tc = c.lightmapCoords * size;
+
+            float area = (tb.x - ta.x) * (tc.y - ta.y) - (tb.y - ta.y) * (tc.x - ta.x);
+            if (std::abs(area) < 1e-12f)
+                continue;
+
+            glm::vec3 pa = glm::vec3(world * glm::vec4(a.position, 1.0f));
+            glm::vec3 pb = glm::vec3(world * glm::vec4(b.position, 1.0f));
+            glm::vec3 pc = glm::vec3(world * glm::vec4(c.position, 1.0f));
+            glm::vec3 faceNormal = glm::cross(pb - pa, pc - pa);
+            if (glm::length(faceNormal) == 0.0f)
+                continue;
+            faceNormal = glm::normalize(faceNormal);
+
+            glm::vec2 bmin = glm::min(ta, glm::min(tb, tc));
+            glm::vec2 bmax = glm::max(ta, glm::max(tb, tc));
+            int x0 = std::max(0, (int)std::floor(bmin.x));
+            int y0 = std::max(0, (int)std::floor(bmin.y));
+            int x1 = std::min(lightmap->width - 1, (int)std::ceil(bmax.x));
+            int y1 = std::min(lightmap->height - 1, (int)std::ceil(bmax.y));
+            for (int y = y0; y <= y1; ++y)
+            {
+                for (int x = x0; x <= x1; ++x)
+                {
+                    glm::vec2 p = glm::vec2(x + 0.5f, y + 0.5f);
+                    float w0 = ((tb.x - p.x) * (tc.y - p.y) - (tb.y - p.y) * (tc.x - p.x)) / area;
+                    float w1 = ((tc.x - p.x) * (ta.y - p.y) - (tc.y - p.y) * (ta.x - p.x)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        continue;
+
+                    unsigned int texel = (unsigned int)(y * lightmap->width + x);
+                    if (covered[texel])
+                        continue;
+                    covered[texel] = 1;
+
+                    Sample s;
+                    s.lightmap = lightmapIdx;
+                    s.texel = texel;
+                    s.position = w0 * pa + w1 * pb + w2 * pc;
+                    s.normal = glm::normalize(
+                        normalMat * (w0 * a.normal + w1 * b.normal + w2 * c.normal)
+                    );
+                    s.faceNormal = faceNormal;
+                    // The shading normal decides which side is lit.
+                    if (glm::dot(s.faceNormal, s.normal) < 0.0f)
+                        s.faceNormal = -s.faceNormal;
+                    this->samples.push_back(s);
+                }
+            }
+        }
+        this->coverage.push_back(covered);
+    }
+
+    glm::vec3 irradiance(const Sample& s, std::mt19937& rng) const
+    {
+        glm::vec3 result = this->tracer.direct(
+            s.position, s.normal, s.faceNormal, this->shadowSamples, rng
+        );
+
+        // Cosine-weighted hemisphere sampling: the estimator of the irradiance
+        // is the mean of the incoming radiance times pi, which cancels the
+        // Lambertian 1/pi of the surfaces we hit.
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        glm::vec3 t, b;
+        SceneTracer::basis(s.normal, t, b);
+        BVHRay ray;
+        ray.origin = s.position + SCENE_TRACER_RAY_OFFSET * s.faceNormal;
+
+        unsigned int sky = 0;
+        glm::vec3 bounce = glm::vec3(0.0f);
+        for (unsigned int i = 0; i < this->indirectSamples; ++i)
+        {
+            float r = std::sqrt(uniform(rng));
+            float phi = 2.0f * glm::pi<float>() * uniform(rng);
+            ray.direction = r * std::cos(phi) * t + r * std::sin(phi) * b
+                + std::sqrt(std::max(0.0f, 1.0f - r * r)) * s.normal;
+            // Directions below the geometric surface are blocked by itself.
+            if (glm::dot(ray.direction, s.faceNormal) <= 0.0f)
+                continue;
+
+            BVHHit hit;
+            if (!this->tracer.bvh.intersect(ray, hit))
+            {
+                ++sky;
+                continue;
+            }
+
+            const BVHTriangle& tri = this->tracer.bvh.triangles[hit.triangle];
+            glm::vec3 hitNormal = glm::dot(tri.normal, ray.direction) < 0.0f
+                ? tri.normal : -tri.normal;
+            glm::vec3 hitPos = ray.origin + hit.t * ray.direction;
+            bounce += this->tracer.albedos[tri.instance]
+                * this->tracer.direct(hitPos, hitNormal, hitNormal, 1, rng);
+        }
+
+        float invSamples = 1.0f / this->indirectSamples;
+        result += this->ambient * this->tracer.sunColor * (sky * invSamples);
+        result += bounce * invSamples;
+        return result;
+    }
+
+    // Grows the charts into their gutters, so that bilinear filtering near a
+    // chart border never reads unbaked texels.
+    void dilate(Lightmap* lightmap, std::vector<uint8_t>& covered) const
+    {
+        int w = lightmap->width;
+        int h = lightmap->height;
+        for (unsigned int pass = 0; pass < this->dilationPasses; ++pass)
+        {
+            std::vector<uint8_t> next = covered;
+            for (int y = 0; y < h; ++y)
+            {
+                for (int x = 0; x < w; ++x)
+                {
+                    if (covered[y * w + x])
+                        continue;
+
+                    glm::vec3 sum = glm::vec3(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int dx = -1; dx <= 1; ++dx)
+                        {
+                            int nx = x + dx;
+                            int ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= w || ny >= h
+                                || !covered[ny * w + nx])
+                                continue;
+                            sum += lightmap->texels[ny * w + nx];
+                            ++count;
+                        }
+                    }
+                    if (count > 0)
+                    {
+                        lightmap->texels[y * w + x] = sum / (float)count;
+                        next[y * w + x] = 1;
+                    }
+                }
+            }
+            covered.swap(next);
+        }
+    }
+};
+}
+
+#endif
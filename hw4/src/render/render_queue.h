@@ -0,0 +1,341 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "data/lightmap.h"
+#include "data/model.h"
+#include "data/shader.h"
+#include "data/texture.h"
+#include "render/instance_batcher.h"
+
+
+namespace engine
+{
+// Layout of a sort key, most significant field first. Sorting by key puts
+// the packets of a pass together, then those of a shader, a texture set and a
+// mesh, and finally orders them front to back. Every mesh lives in the one
+// MeshArena, so the mesh field keeps instances together rather than saving
+// vertex array binds.
+constexpr int SORT_KEY_PASS_BITS = 4;
+constexpr int SORT_KEY_SHADER_BITS = 8;
+constexpr int SORT_KEY_TEXTURES_BITS = 16;
+constexpr int SORT_KEY_MESH_BITS = 16;
+constexpr int SORT_KEY_DEPTH_BITS = 20;
+
+constexpr int SORT_KEY_DEPTH_SHIFT = 0;
+constexpr int SORT_KEY_MESH_SHIFT = SORT_KEY_DEPTH_SHIFT + SORT_KEY_DEPTH_BITS;
+constexpr int SORT_KEY_TEXTURES_SHIFT = SORT_KEY_MESH_SHIFT + SORT_KEY_MESH_BITS;
+constexpr int SORT_KEY_SHADER_SHIFT = SORT_KEY_TEXTURES_SHIFT + SORT_KEY_TEXTURES_BITS;
+constexpr int SORT_KEY_PASS_SHIFT = SORT_KEY_SHADER_SHIFT + SORT_KEY_SHADER_BITS;
+
+// Texture units the queue binds materials to, as in Model::bind() and the
+// lightmap pass.
+constexpr GLuint RENDER_QUEUE_DIFFUSE_UNIT = 0;
+constexpr GLuint RENDER_QUEUE_SPECULAR_UNIT = 1;
+constexpr GLuint RENDER_QUEUE_NORMAL_UNIT = 2;
+constexpr GLuint RENDER_QUEUE_LIGHTMAP_UNIT = 4;
+constexpr GLuint RENDER_QUEUE_MAX_TEXTURE_UNITS = 16;
+
+// Passes of the hw4 frame, in draw order.
+constexpr unsigned int RENDER_PASS_SHADOW = 0;
+constexpr unsigned int RENDER_PASS_OPAQUE = 1;
+
+
+inline uint64_t makeSortKey(
+    unsigned int pass, unsigned int shader, unsigned int textures,
+    unsigned int mesh, float depth
+) {
+    auto field = [](uint64_t value, int bits, int shift) {
+        return (value & ((uint64_t(1) << bits) - 1)) << shift;
+    };
+    uint64_t maxDepth = (uint64_t(1) << SORT_KEY_DEPTH_BITS) - 1;
+    uint64_t quantized = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * maxDepth);
+    return field(pass, SORT_KEY_PASS_BITS, SORT_KEY_PASS_SHIFT)
+        | field(shader, SORT_KEY_SHADER_BITS, SORT_KEY_SHADER_SHIFT)
+        | field(textures, SORT_KEY_TEXTURES_BITS, SORT_KEY_TEXTURES_SHIFT)
+        | field(mesh, SORT_KEY_MESH_BITS, SORT_KEY_MESH_SHIFT)
+        | field(quantized, SORT_KEY_DEPTH_BITS, SORT_KEY_DEPTH_SHIFT);
+}
+
+
+// Shadows the GL bindings the queue changes and drops the redundant ones.
+// Code that binds behind its back, such as Shader::use(), must call
+// invalidate() afterwards.
+class GLStateCache
+{
+public:
+    unsigned int requestedBinds = 0;    // Since the last resetStats()
+    unsigned int issuedBinds = 0;
+
+
+    GLStateCache()
+    {
+        this->invalidate();
+    }
+
+    void invalidate()
+    {
+        this->program = INVALID;
+        this->vao = INVALID;
+        this->activeUnit = INVALID;
+        std::fill(this->textures, this->textures + RENDER_QUEUE_MAX_TEXTURE_UNITS, INVALID);
+    }
+
+    void useProgram(GLuint program)
+    {
+        ++(this->requestedBinds);
+        if (program == this->program)
+            return;
+        glUseProgram(program);
+        this->program = program;
+        ++(this->issuedBinds);
+    }
+
+    void bindVertexArray(GLuint vao)
+    {
+        ++(this->requestedBinds);
+        if (vao == this->vao)
+            return;
+        glBindVertexArray(vao);
+        this->vao = vao;
+        ++(this->issuedBinds);
+    }
+
+    void bindTexture2D(GLuint unit, GLuint texture)
+    {
+        ++(this->requestedBinds);
+        if (texture == this->textures[unit])
+            return;
+        if (unit != this->activeUnit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            this->activeUnit = unit;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        this->textures[unit] = texture;
+        ++(this->issuedBinds);
+    }
+
+    void resetStats()
+    {
+        this->requestedBinds = 0;
+        this->issuedBinds = 0;
+    }
+
+private:
+    static constexpr GLuint INVALID = 0xffffffff;
+
+    GLuint program;
+    GLuint vao;
+    GLuint activeUnit;
+    GLuint textures[RENDER_QUEUE_MAX_TEXTURE_UNITS];
+};
+
+
+// Collects the draws of a frame as packets with 64-bit sort keys, sorts them
+// with a radix sort and feeds them to an InstanceBatcher in key order, so
+// instances of one model end up in one batch and batches sharing state are
+// drawn back to back. Per frame:
+//
+//     queue.clear();
+//     queue.submit(...);                      // for each entity and pass
+//     queue.prepare();
+//     // per pass: set up the pass, then
+//     queue.execute(pass, bindMaterials, setMaterialUniforms);
+//
+class RenderQueue
+{
+public:
+    InstanceBatcher batcher;
+    GLStateCache state;
+
+
+    RenderQueue() {}
+
+    // No copy constructor nor copy assignment are allowed.
+    RenderQueue(const RenderQueue& other) = delete;
+    RenderQueue& operator=(const RenderQueue& other) = delete;
+
+    size_t size() const
+    {
+        return this->packets.size();
+    }
+
+    void clear()
+    {
+        this->packets.clear();
+        this->payloads.clear();
+        this->batcher.clear();
+        this->batcher.resetStats();
+        this->state.resetStats();
+    }
+
+    // depth is the normalized distance to the viewer, 0 being the closest.
+    // Passes that do not bind materials should leave lightmap null so their
+    // packets are grouped by mesh only.
+    void submit(
+        unsigned int pass, Shader* shader, Model* model, Lightmap* lightmap,
+        bool bindMaterials, const glm::mat4& world, const glm::mat3& normalMatrix,
+        float depth
+    ) {
+        unsigned int textures = bindMaterials ? this->getTextureSetId(model, lightmap) : 0;
+        Packet packet;
+        packet.key = makeSortKey(pass, shader->ID, textures, model->mesh->id, depth);
+        packet.payload = (uint32_t)this->payloads.size();
+        this->packets.push_back(packet);
+
+        Payload payload;
+        payload.pass = pass;
+        payload.shader = shader;
+        payload.model = model;
+        payload.lightmap = lightmap;
+        payload.world = world;
+        payload.normalMatrix = normalMatrix;
+        this->payloads.push_back(payload);
+    }
+
+    // Sorts the packets and uploads their instance data.
+    void prepare()
+    {
+        radixSort(this->packets, this->scratch);
+        for (const Packet& packet : this->packets)
+        {
+            const Payload& p = this->payloads[packet.payload];
+            this->batcher.add(p.pass, p.shader, p.model, p.lightmap, p.world, p.normalMatrix);
+        }
+        this->batcher.upload();
+    }
+
+    // Draws the batches of one pass. Without materials a batch is one draw
+    // of its whole mesh; with them, one draw per run of submeshes sharing a
+    // material, and setMaterialUniforms(batch, material) is called before
+    // each with the batch's shader bound.
+    template <typename F>
+    void execute(unsigned int pass, bool bindMaterials, F setMaterialUniforms)
+    {
+        for (const auto& batch : this->batcher.batches)
+        {
+            if (batch.pass != pass)
+                continue;
+            const Mesh* mesh = batch.model->mesh;
+            this->state.useProgram(batch.shader->ID);
+            this->state.bindVertexArray(mesh->VAO);
+            this->batcher.bindInstances(batch);
+            if (!bindMaterials)
+            {
+                this->batcher.draw(batch, 0, (uint32_t)mesh->indices.size());
+                continue;
+            }
+            if (batch.lightmap)
+                this->state.bindTexture2D(RENDER_QUEUE_LIGHTMAP_UNIT, batch.lightmap->ID);
+
+            // Submeshes are in index order, so a run is one index range.
+            const std::vector<Submesh>& submeshes = mesh->submeshes;
+            for (size_t s = 0; s < submeshes.size();)
+            {
+                const Material& material = batch.model->materials[submeshes[s].material];
+                uint32_t firstIndex = submeshes[s].firstIndex;
+                uint32_t indexCount = 0;
+                for (; s < submeshes.size()
+                    && batch.model->materials[submeshes[s].material] == material; ++s)
+                    indexCount += submeshes[s].indexCount;
+
+                this->state.bindTexture2D(RENDER_QUEUE_DIFFUSE_UNIT, material.diffuse->ID);
+                if (material.specular)
+                    this->state.bindTexture2D(RENDER_QUEUE_SPECULAR_UNIT, material.specular->ID);
+                if (material.normal)
+                    this->state.bindTexture2D(RENDER_QUEUE_NORMAL_UNIT, material.normal->ID);
+                setMaterialUniforms(batch, material);
+                this->batcher.draw(batch, firstIndex, indexCount);
+            }
+        }
+        this->state.bindVertexArray(0);
+    }
+
+private:
+    struct Packet
+    {
+        uint64_t key;
+        uint32_t payload;
+    };
+
+    struct Payload
+    {
+        unsigned int pass;
+        Shader* shader;
+        Model* model;
+        Lightmap* lightmap;
+        glm::mat4 world;
+        glm::mat3 normalMatrix;
+    };
+
+    std::vector<Packet> packets;
+    std::vector<Packet> scratch;
+    std::vector<Payload> payloads;
+    // Small ids for the texture sets seen so far, kept across frames so keys
+    // are stable. A set is the textures of every material of a model, in
+    // order, then the lightmap.
+    std::map<std::vector<const void*>, unsigned int> textureSets;
+    std::vector<const void*> textureSetKey;     // Scratch of getTextureSetId()
+
+
+    unsigned int getTextureSetId(Model* model, Lightmap* lightmap)
+    {
+        this->textureSetKey.clear();
+        for (const Material& material : model->materials)
+        {
+            this->textureSetKey.push_back(material.diffuse);
+            this->textureSetKey.push_back(material.normal);
+            this->textureSetKey.push_back(material.specular);
+        }
+        this->textureSetKey.push_back(lightmap);
+        auto ptr = this->textureSets.find(this->textureSetKey);
+        if (ptr != this->textureSets.end())
+            return ptr->second;
+        // 0 is the empty set of passes without materials.
+        unsigned int id = (unsigned int)this->textureSets.size() + 1;
+        this->textureSets.insert(std::make_pair(this->textureSetKey, id));
+        return id;
+    }
+
+    // LSD radix sort on bytes. Bytes all packets share, such as the unused
+    // high bits of the pass field, are skipped.
+    static void radixSort(std::vector<Packet>& packets, std::vector<Packet>& scratch)
+    {
+        constexpr int DIGIT_BITS = 8;
+        constexpr size_t BUCKETS = size_t(1) << DIGIT_BITS;
+        std::array<size_t, BUCKETS> counts;
+        scratch.resize(packets.size());
+        for (int shift = 0; shift < 64; shift += DIGIT_BITS)
+        {
+            std::fill(counts.begin(), counts.end(), 0);
+            for (const Packet& packet : packets)
+                ++counts[(packet.key >> shift) & (BUCKETS - 1)];
+            if (packets.empty()
+                || counts[(packets[0].key >> shift) & (BUCKETS - 1)] == packets.size())
+                continue;
+
+            size_t sum = 0;
+            for (size_t& count : counts)
+            {
+                size_t c = count;
+                count = sum;
+                sum += c;
+            }
+            for (const Packet& packet : packets)
+                scratch[counts[(packet.key >> shift) & (BUCKETS - 1)]++] = packet;
+            packets.swap(scratch);
+        }
+    }
+};
+}
+
+#endif
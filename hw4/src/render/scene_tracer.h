@@ -0,0 +1,147 @@
+#ifndef SCENE_TRACER_H
+#define SCENE_TRACER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "base/scene.h"
+#include "data/light.h"
+#include "data/model.h"
+#include "data/texture.h"
+#include "render/bvh.h"
+#include "render/cubemap_sampler.h"
+
+
+namespace engine
+{
+constexpr float DEFAULT_SUN_ANGULAR_RADIUS = 1.0f; // degrees
+constexpr float SCENE_TRACER_RAY_OFFSET = 0.001f;
+
+
+// CPU view of the raster scene for the bake passes: every model instance in
+// a BVH, the mean albedo of each instance and the sun. All queries are const
+// and safe to call from several threads.
+class SceneTracer
+{
+public:
+    BVH bvh;
+    std::vector<glm::vec3> albedos;     // Indexed by BVHTriangle::instance
+    glm::vec3 sunDir;                   // Towards the sun
+    glm::vec3 sunColor;
+    float sunAngularRadius = DEFAULT_SUN_ANGULAR_RADIUS;
+
+
+    SceneTracer() {}
+
+    // Instances are numbered in the order of the scene registry.
+    void build(Scene* scene, const DirectionalLight* sun)
+    {
+        this->bvh = BVH();
+        this->albedos.clear();
+        this->sunDir = -glm::normalize(sun->lightDir);
+        this->sunColor = sun->lightColor;
+
+        std::map<const Texture*, glm::vec3> albedoCache;
+        EntityRegistry& registry = scene->registry;
+        registry.updateWorldMatrices();
+        for (size_t i = 0; i < registry.size(); ++i)
+        {
+            Model* model = registry.models[i];
+            if (!model)
+                continue;
+
+            unsigned int instance = (unsigned int)this->albedos.size();
+
+            auto ptr = albedoCache.find(model->diffuse);
+            if (ptr == albedoCache.end())
+                ptr = albedoCache.insert(std::make_pair(
+                    model->diffuse, averageAlbedo(model->diffuse)
+                )).first;
+            this->albedos.push_back(ptr->second);
+
+            // Keep the traced shadows consistent with the shadow map.
+            if (!model->ignoreShadow)
+                this->bvh.addMesh(model->mesh, registry.worldMatrices[i], instance);
+        }
+        this->bvh.build();
+    }
+
+    // Sun irradiance at a point, with soft shadows from a sun disk.
+    glm::vec3 direct(
+        const glm::vec3& p, const glm::vec3& n, const glm::vec3& faceNormal,
+        unsigned int numSamples, std::mt19937& rng
+    ) const {
+        float cosine = glm::dot(n, this->sunDir);
+        if (cosine <= 0.0f || numSamples == 0)
+            return glm::vec3(0.0f);
+
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        glm::vec3 t, b;
+        basis(this->sunDir, t, b);
+        float radius = std::tan(glm::radians(this->sunAngularRadius));
+
+        BVHRay ray;
+        ray.origin = p + SCENE_TRACER_RAY_OFFSET * faceNormal;
+        unsigned int visible = 0;
+        for (unsigned int i = 0; i < numSamples; ++i)
+        {
+            float r = radius * std::sqrt(uniform(rng));
+            float phi = 2.0f * glm::pi<float>() * uniform(rng);
+            ray.direction = glm::normalize(
+                this->sunDir + r * (std::cos(phi) * t + std::sin(phi) * b)
+            );
+            if (!this->bvh.occluded(ray, 0.0f, std::numeric_limits<float>::infinity()))
+                ++visible;
+        }
+        return this->sunColor * cosine * ((float)visible / numSamples);
+    }
+
+    // Radiance arriving at origin from the given direction: the sky if the
+    // ray escapes, else the sunlit diffuse surface it hits. Back faces are
+    // black, so that probes inside geometry do not leak light.
+    glm::vec3 radiance(
+        const glm::vec3& origin, const glm::vec3& dir, std::mt19937& rng,
+        const CubemapSampler* sky, float skyIntensity
+    ) const {
+        BVHRay ray;
+        ray.origin = origin;
+        ray.direction = dir;
+        BVHHit hit;
+        if (!this->bvh.intersect(ray, hit))
+            return sky ? skyIntensity * sky->sample(dir) : glm::vec3(0.0f);
+
+        const BVHTriangle& tri = this->bvh.triangles[hit.triangle];
+        if (glm::dot(tri.normal, dir) > 0.0f)
+            return glm::vec3(0.0f);
+        glm::vec3 p = origin + hit.t * dir;
+        return this->albedos[tri.instance] * this->direct(p, tri.normal, tri.normal, 1, rng);
+    }
+
+    // Builds an orthonormal basis around n.
+    static void basis(const glm::vec3& n, glm::vec3& t, glm::vec3& b)
+    {
+        glm::vec3 up = std::abs(n.y) < 0.999f
+            ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        t = glm::normalize(glm::cross(up, n));
+        b = glm::cross(n, t);
+    }
+
+    // Mean color of a texture, computed when its file was decoded.
+    static glm::vec3 averageAlbedo(const Texture* texture)
+    {
+        if (!texture || texture->width <= 0 || texture->height <= 0)
+            return glm::vec3(0.5f);
+        return texture->averageColor;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SHADER_CONSTANTS_H
+#define SHADER_CONSTANTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+
+namespace engine
+{
+// Binding points of the uniform blocks shared by the hw4 shaders. A shader
+// declares the blocks it reads and Shader::bindUniformBlock() attaches them.
+constexpr GLuint UNIFORM_BINDING_FRAME = 0;
+constexpr GLuint UNIFORM_BINDING_LIGHT = 1;
+constexpr GLuint UNIFORM_BINDING_MATERIAL = 2;
+
+
+// The structs below mirror std140 blocks of the same name in the shaders.
+// std140 rounds a vec3 up to 16 bytes unless a scalar follows it, so every
+// vec3 is paired with a float, and the sizes are multiples of 16.
+
+// Camera and frame wide settings, written once per frame.
+struct FrameConstants
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float time;
+    glm::vec2 screenSize;
+    float deltaTime;
+    float useLighting;
+    float useShadow;
+    float useProbes;
+    float useReflections;
+    float padding;
+};
+static_assert(sizeof(FrameConstants) == 176, "FrameConstants must match its std140 block");
+
+
+// The sun, written once per frame.
+struct LightConstants
+{
+    glm::mat4 lightSpace;
+    glm::vec3 lightDirection;
+    float padding0;
+    glm::vec3 lightColor;               // I_d (I_s = I_d, I_a = 0.3 * I_d)
+    float padding1;
+};
+static_assert(sizeof(LightConstants) == 96, "LightConstants must match its std140 block");
+
+
+// Per-model switches of shader_lighting, written once per batch.
+struct MaterialConstants
+{
+    float useNormalMap;
+    float useSpecularMap;
+    float shininess;
+    float padding;
+};
+static_assert(sizeof(MaterialConstants) == 16, "MaterialConstants must match its std140 block");
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace engine
+{
+constexpr int UNIFORM_RING_FRAMES = 3;
+constexpr size_t DEFAULT_UNIFORM_RING_SIZE = 64 * 1024;   // Per frame, grows
+
+
+// Range of a uniform buffer written this frame.
+struct UniformRange
+{
+    GLuint buffer = 0;
+    GLintptr offset = 0;
+    GLsizeiptr size = 0;
+};
+
+
+// Sub-allocates the uniform data of a frame from one of a ring of buffers.
+// Data is staged on the CPU and uploaded with one call per frame. A fence
+// guards each buffer, so a buffer is rewritten only once the GPU has finished
+// the frame that used it, which with three buffers is practically never a
+// wait. Per frame:
+//
+//     ring.beginFrame();
+//     UniformRange range = ring.push(constants);     // any number of times
+//     ring.upload();
+//     ring.bind(binding, range);                      // before the draws
+//     ...
+//     ring.endFrame();
+//
+class UniformRing
+{
+public:
+    UniformRing(size_t size = DEFAULT_UNIFORM_RING_SIZE)
+    {
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        this->alignment = std::max<GLint>(alignment, 16);
+
+        glGenBuffers(UNIFORM_RING_FRAMES, this->buffers);
+        for (int i = 0; i < UNIFORM_RING_FRAMES; ++i)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, this->buffers[i]);
+            glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+            this->sizes[i] = size;
+            this->fences[i] = nullptr;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~UniformRing()
+    {
+        for (int i = 0; i < UNIFORM_RING_FRAMES; ++i)
+        {
+            if (this->fences[i])
+                glDeleteSync(this->fences[i]);
+        }
+        glDeleteBuffers(UNIFORM_RING_FRAMES, this->buffers);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    UniformRing(const UniformRing& other) = delete;
+    UniformRing& operator=(const UniformRing& other) = delete;
+
+    void beginFrame()
+    {
+        this->current = (this->current + 1) % UNIFORM_RING_FRAMES;
+        GLsync& fence = this->fences[this->current];
+        if (fence)
+        {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        this->staging.clear();
+    }
+
+    // Copies the data into the frame's staging area. The range is valid
+    // after upload().
+    template <typename T>
+    UniformRange push(const T& data)
+    {
+        size_t offset = (this->staging.size() + this->alignment - 1)
+            / this->alignment * this->alignment;
+        this->staging.resize(offset + sizeof(T));
+        std::memcpy(this->staging.data() + offset, &data, sizeof(T));
+
+        UniformRange range;
+        range.buffer = this->buffers[this->current];
+        range.offset = (GLintptr)offset;
+        range.size = (GLsizeiptr)sizeof(T);
+        return range;
+    }
+
+    void upload()
+    {
+        if (this->staging.empty())
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, this->buffers[this->current]);
+        if (this->staging.size() > this->sizes[this->current])
+        {
+            // Reallocating orphans the old storage, so this never waits.
+            this->sizes[this->current] = std::max(this->staging.size(), 2 * this->sizes[this->current]);
+            glBufferData(GL_UNIFORM_BUFFER, this->sizes[this->current], nullptr, GL_DYNAMIC_DRAW);
+        }
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, this->staging.size(), this->staging.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void bind(GLuint binding, const UniformRange& range) const
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, range.buffer, range.offset, range.size);
+    }
+
+    // Call after the last draw that reads this frame's data.
+    void endFrame()
+    {
+        this->fences[this->current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    GLuint buffers[UNIFORM_RING_FRAMES];
+    size_t sizes[UNIFORM_RING_FRAMES];
+    GLsync fences[UNIFORM_RING_FRAMES];
+    int current = 0;
+    size_t alignment = 256;
+    std::vector<unsigned char> staging;
+};
+}
+
+#endif
@@ -0,0 +1,141 @@
+// Packs the assets of a scene into the bundle the engine maps at startup, see
+// AssetBundle. The manifest lists one path per line, exactly as the engine
+// opens it, so run this from the bin directory like main. Images are stored
+// decoded, models as imported meshes and everything else as is. Files changed
+// since are loaded from disk by the engine, with a warning, until this runs
+// again.
+//
+// Usage: pack_assets [manifest] [bundle]
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "base/asset_bundle.h"
+#include "data/bounds.h"
+#include "data/mesh_cache.h"
+#include "data/model.h"
+#include "data/texture.h"
+#include "utils/string_utils.h"
+
+
+engine::AssetType getAssetType(const std::string& path)
+{
+    std::string extension = path.substr(std::min(path.rfind('.'), path.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == ".png" || extension == ".jpg" || extension == ".jpeg"
+        || extension == ".tga" || extension == ".bmp")
+        return engine::AssetType::IMAGE;
+    if (extension == ".obj" || extension == ".fbx")
+        return engine::AssetType::MESH;
+    return engine::AssetType::RAW;
+}
+
+
+bool packImage(const std::string& path, std::vector<unsigned char>& payload)
+{
+    engine::AssetImageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    // Rows stay top first; the engine flips them while uploading.
+    unsigned char* pixels = stbi_load(
+        path.c_str(), &(header.width), &(header.height), &(header.channels), 0
+    );
+    if (!pixels)
+        return false;
+    glm::vec3 averageColor = engine::Texture::computeAverageColor(
+        pixels, header.width, header.height, header.channels
+    );
+    for (int i = 0; i < 3; ++i)
+        header.averageColor[i] = averageColor[i];
+
+    payload.resize(sizeof(header) + header.getPixelBytes());
+    std::memcpy(payload.data(), &header, sizeof(header));
+    std::memcpy(payload.data() + sizeof(header), pixels, header.getPixelBytes());
+    stbi_image_free(pixels);
+    return true;
+}
+
+
+bool packMesh(const std::string& path, std::vector<unsigned char>& payload)
+{
+    engine::MeshData mesh;
+    if (!engine::Model::importMesh(path, mesh))
+        return false;
+    engine::AABB bounds = engine::computeAABB(mesh.vertices);
+    engine::BoundingSphere boundingSphere = engine::computeBoundingSphere(mesh.vertices, bounds);
+    payload = engine::MeshCache::serialize(
+        mesh, bounds, boundingSphere, (uint32_t)engine::Model::getImporter(path)
+    );
+    return true;
+}
+
+
+bool packRaw(const std::string& path, std::vector<unsigned char>& payload)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    payload.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string manifestPath = argc > 1 ? argv[1] : engine::ASSET_BUNDLE_MANIFEST_PATH;
+    std::string bundlePath = argc > 2 ? argv[2] : engine::ASSET_BUNDLE_PATH;
+
+    std::ifstream manifest(manifestPath);
+    if (!manifest)
+    {
+        std::cout << "ERROR::PACK_ASSETS::Cannot read manifest " << manifestPath << std::endl;
+        return -1;
+    }
+
+    engine::AssetBundleWriter writer(bundlePath);
+    size_t packed = 0;
+    size_t failed = 0;
+    std::string line;
+    std::vector<unsigned char> payload;
+    while (std::getline(manifest, line))
+    {
+        trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        engine::AssetType type = getAssetType(line);
+        bool loaded = false;
+        switch (type)
+        {
+        case engine::AssetType::IMAGE:
+            loaded = packImage(line, payload);
+            break;
+        case engine::AssetType::MESH:
+            loaded = packMesh(line, payload);
+            break;
+        default:
+            loaded = packRaw(line, payload);
+            break;
+        }
+        if (!loaded || !writer.add(line, type, payload))
+        {
+            std::cout << "ERROR::PACK_ASSETS::Cannot pack " << line << std::endl;
+            ++failed;
+            continue;
+        }
+        ++packed;
+    }
+
+    if (!writer.finish())
+        return -1;
+    logger.flush();
+    std::cout << "Packed " << packed << " assets into " << bundlePath << std::endl;
+    return failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,53 @@
+#version 330 core
+layout (location = 0) out vec4 gPosition;
+layout (location = 1) out vec4 gNormal;
+
+in vec3 FragPos;
+in vec3 Normal;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 cameraPosition;
+uniform int materialId;
+// Radius of the analytic sphere the proxy is inscribed in, 0 otherwise.
+uniform float sphereRadius;
+// Open surfaces face the camera, as planes and triangles do in the ray tracer.
+uniform bool doubleSided;
+
+
+void main()
+{
+    vec3 p = FragPos;
+    vec3 n = normalize(Normal);
+    float depth = gl_FragCoord.z;
+
+    // Move the fragment from the facet onto the sphere along the view ray,
+    // so that the secondary rays start on the surface the ray tracer uses.
+    if (sphereRadius > 0.0)
+    {
+        vec3 center = model[3].xyz;
+        vec3 dir = normalize(FragPos - cameraPosition);
+        vec3 co = center - cameraPosition;
+        float tc = dot(co, dir);
+        float d2 = dot(co, co) - tc * tc;
+        float dt = sqrt(max(sphereRadius * sphereRadius - d2, 0.0));
+        float t = tc - dt >= 0.0 ? tc - dt : tc + dt;
+        p = cameraPosition + t * dir;
+        n = normalize(p - center);
+
+        // Depth of the snapped point, so that what the depth test keeps is
+        // what the ray tracer would hit.
+        vec4 clip = projection * view * vec4(p, 1.0);
+        depth = 0.5 * (gl_DepthRange.diff * (clip.z / clip.w)
+            + gl_DepthRange.near + gl_DepthRange.far);
+    }
+    else if (doubleSided && dot(n, cameraPosition - p) < 0.0)
+    {
+        n = -n;
+    }
+
+    gl_FragDepth = depth;
+    gPosition = vec4(p, 1.0);
+    gNormal = vec4(n, float(materialId));
+}
@@ -24,6 +24,10 @@
 // Number of samples per pixel.
 #define NUM_SAMPLES 32
 #define NUM_SAMPLES_SHADOW 8
+// Surfaces reflecting less than this still trace a mirror ray.
+#define GLOSSY_LOOKUP_MAX_R0 0.5
+// Paths per pixel in the hybrid mode for surfaces that only cast shadow rays.
+#define HYBRID_SAMPLES_DIRECT 4
 
 
 struct Ray
@@ -140,6 +144,34 @@ layout (std140) uniform mesh_tri_indices_ubo {
 };
 uniform int meshTriangleNumber;
 
+// Caustic photon map (see render/photon_map.h).
+// Each photon is two texels: (position, 1) and (power, 0).
+uniform bool useCaustics;
+uniform samplerBuffer photonMap;
+uniform isamplerBuffer photonCells; // (start, count) of each bucket
+uniform int photonHashSize;
+uniform float photonGatherRadius;
+// Photons read from a bucket at most, see PhotonMap::maxGather.
+uniform int photonMaxGather;
+
+// SH irradiance probe grid, see IrradianceVolume::upload().
+uniform bool useProbes;
+uniform sampler3D probeGrid;
+uniform vec3 probeGridMin;
+uniform vec3 probeGridSize;
+uniform vec3 probeGridResolution;
+
+// Prefiltered skybox and split-sum BRDF table, see environment_prefilter.h.
+uniform bool usePrefilteredEnvironment;
+uniform samplerCube prefilteredEnvMap;
+uniform float prefilteredEnvMaxLod;
+uniform sampler2D brdfLUT;
+
+// Rasterized primary hits, see HybridRenderer.
+uniform bool useHybrid;
+uniform sampler2D gPosition;    // w = 1 where a surface was drawn
+uniform sampler2D gNormal;      // w = material id
+
 
 Sphere spheres[] = Sphere[](
     Sphere(vec3( 1.0, 0.5,-1.0), 0.499, material_gold),
@@ -410,6 +442,58 @@ bool triangleIntersect(Triangle tri, Ray r, inout HitRecord hit)
     return true;
 }
 
+// Spatial hash of a grid cell. Must match PhotonMap::hashCell().
+int photonHash(ivec3 cell)
+{
+    uint h = (uint(cell.x) * 73856093u)
+        ^ (uint(cell.y) * 19349663u)
+        ^ (uint(cell.z) * 83492791u);
+    return int(h & uint(photonHashSize - 1));
+}
+
+// Density estimation of the caustic photons around the hit point with a cone
+// filter (k = 1). The grid cells are twice the gather radius wide, so the
+// gather sphere overlaps at most 2x2x2 of them. At most photonMaxGather
+// photons of a bucket are read, so a dense caustic cannot stall the frame.
+// The buckets are shuffled when built, so the photons read are a uniform
+// sample of the bucket, and scaling by the fraction read keeps the estimate
+// unbiased.
+vec3 causticIrradiance(HitRecord hit)
+{
+    float r = photonGatherRadius;
+    ivec3 base = ivec3(floor((hit.p - r) / (2.0 * r)));
+    int buckets[8];
+    vec3 power = vec3(0.0);
+    for (int i = 0; i < 8; ++i)
+    {
+        ivec3 cell = base + ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        buckets[i] = photonHash(cell);
+        // Cells hashed into a bucket already read would count it twice.
+        bool visited = false;
+        for (int k = 0; k < i; ++k)
+            visited = visited || buckets[k] == buckets[i];
+        if (visited)
+            continue;
+
+        ivec2 range = texelFetch(photonCells, buckets[i]).xy;
+        int count = min(range.y, photonMaxGather);
+        vec3 bucketPower = vec3(0.0);
+        for (int j = 0; j < count; ++j)
+        {
+            int idx = 2 * (range.x + j);
+            vec3 d = texelFetch(photonMap, idx).xyz - hit.p;
+            float dist = length(d);
+            // Photons far from the tangent plane belong to another surface.
+            if (dist < r && abs(dot(d, hit.normal)) < 0.25 * r)
+                bucketPower += (1.0 - dist / r) * texelFetch(photonMap, idx + 1).rgb;
+        }
+        if (count > 0)
+            power += bucketPower * (float(range.y) / float(count));
+    }
+    // Normalization of the cone filter is (1 - 2 / 3k) * PI * r^2.
+    return power / (PI * r * r / 3.0);
+}
+
 float schlick(float cosine, float ior)
 {
     float r0 = (1.0 - ior) / (1.0 + ior);
@@ -483,8 +567,11 @@ vec3 calculateShadow(HitRecord hit, vec3 lightDir)
         vec3 shadowAttnSample = vec3(1.0);
         if (trace(shadowRay, shadowHit))
         {
-            // Dielectric material casts a semi-transparent shadow.
-            if (shadowHit.mat.scatter_type == SCATTER_TYPE_REFRACTIVE)
+            // Dielectric material casts a semi-transparent shadow. The photon
+            // map already carries the light through the dielectrics, so they
+            // become opaque when the caustics are on.
+            if (shadowHit.mat.scatter_type == SCATTER_TYPE_REFRACTIVE
+                && !useCaustics)
             {
                 // Ray goes into and then out of a dielectric material.
                 // Due to the performance issue, we check only two
@@ -567,12 +654,49 @@ vec3 calculateDiffuseSpecular(HitRecord hit, vec3 lightDir, vec3 lightColor, boo
     return shadowAttn * (specular + diffuse) * lightColor;
 }
 
+// Trilinearly interpolated irradiance of the probe grid. Every coefficient
+// lives in its own z slab, so the z coordinate is clamped to texel centers
+// inside each slab.
+vec3 probeIrradiance(vec3 p, vec3 n)
+{
+    vec3 res = probeGridResolution;
+    vec3 cell = probeGridSize / (res - 1.0);
+    // Push the lookup off the surface to reduce leaking from behind it.
+    vec3 uvw = clamp((p + 0.5 * cell * n - probeGridMin) / probeGridSize, 0.0, 1.0);
+    vec3 texel = uvw * (res - 1.0) + 0.5;
+
+    vec4 t[7];
+    for (int i = 0; i < 7; ++i)
+    {
+        t[i] = texture(
+            probeGrid,
+            vec3(texel.xy / res.xy, (texel.z + i * res.z) / (7.0 * res.z))
+        );
+    }
+    vec3 c7 = vec3(t[0].a, t[1].a, t[2].a);
+    vec3 c8 = vec3(t[3].a, t[4].a, t[5].a);
+
+    vec3 irradiance = 0.282095 * t[0].rgb
+        + 0.488603 * (n.y * t[1].rgb + n.z * t[2].rgb + n.x * t[3].rgb)
+        + 1.092548 * (n.x * n.y * t[4].rgb + n.y * n.z * t[5].rgb + n.x * n.z * c7)
+        + 0.315392 * (3.0 * n.z * n.z - 1.0) * t[6].rgb
+        + 0.546274 * (n.x * n.x - n.y * n.y) * c8;
+    return max(irradiance, 0.0);
+}
+
 vec3 phongIllumination(HitRecord hit, Ray ray)
 {
     // Do Phong lighting.
     // 1. Ambient
+    // The probes replace the constant ambient light with the diffuse
+    // indirect light of the sky and the scene.
     vec3 ambient = hit.mat.Ka;
     vec3 phong = ambient * ambientLightColor;
+    if (useProbes)
+    {
+        vec3 n = dot(ray.direction, hit.normal) < 0.0 ? hit.normal : -hit.normal;
+        phong = hit.mat.Kd * probeIrradiance(hit.p, n) / PI;
+    }
 
     // Diffuse and specular lighting for each point light source.
     for (int i = 0; i < NUM_POINT_LIGHTS; ++i)
@@ -603,6 +727,21 @@ vec3 phongIllumination(HitRecord hit, Ray ray)
     return clamp(phong, 0.0, 1.0);
 }
 
+// Glossy reflection of the sky from the prefiltered environment, in place of
+// a secondary ray. Other objects are not reflected. The GGX roughness is
+// matched to the Phong exponent.
+vec3 environmentReflection(HitRecord hit, Ray ray)
+{
+    float cosine = abs(dot(ray.direction, hit.normal));
+    float roughness = sqrt(sqrt(2.0 / (hit.mat.shininess + 2.0)));
+    vec2 brdf = texture(brdfLUT, vec2(cosine, roughness)).rg;
+    vec3 prefiltered = textureLod(
+        prefilteredEnvMap, reflect(ray.direction, hit.normal),
+        roughness * prefilteredEnvMaxLod
+    ).rgb;
+    return prefiltered * (hit.mat.R0 * brdf.x + brdf.y);
+}
+
 bool mirrorScatter(HitRecord hit, inout Ray ray, inout vec3 attenuation)
 {
     float cosine = dot(ray.direction, hit.normal);
@@ -689,19 +828,17 @@ bool specularScatter(HitRecord hit, inout Ray ray, inout vec3 attenuation)
     return dot(ray.direction, hit.normal) > 0.0;
 }
 
-vec3 castRay(Ray r)
+// Follows a path from the first surface it hits. The hybrid mode reads that
+// surface from the G-buffer instead of tracing the primary ray.
+vec3 castRayFrom(Ray r, HitRecord hit)
 {
-    // Trace a ray in iterative way.
     Ray currentRay = r;
-    HitRecord hit;
-    
-    // Return the default (miss) color.
     vec3 attenuation = vec3(1.0);
     vec3 color = vec3(0.0);
     bool flagStopIteration = false;
     for (int b = 0; b < MAX_DEPTH; ++b)
     {
-        if (!trace(currentRay, hit))
+        if (b > 0 && !trace(currentRay, hit))
         {
             color += attenuation
                 * texture(environmentMap, currentRay.direction).rgb;
@@ -709,22 +846,45 @@ vec3 castRay(Ray r)
         }
 
         vec3 deltaColor = attenuation * phongIllumination(hit, currentRay);
+        if (useCaustics
+            && (hit.mat.scatter_type == SCATTER_TYPE_PHONG
+                || hit.mat.scatter_type == SCATTER_TYPE_LAMBERTIAN))
+        {
+            deltaColor += attenuation * hit.mat.Kd * causticIrradiance(hit);
+        }
         switch (hit.mat.scatter_type)
         {
         case SCATTER_TYPE_PHONG:
             color += deltaColor;
-            flagStopIteration = !mirrorScatter(hit, currentRay, attenuation);
+            // Only the mirror is worth a secondary ray; the faint reflections
+            // of the other surfaces are looked up.
+            if (usePrefilteredEnvironment
+                && max(hit.mat.R0.r, max(hit.mat.R0.g, hit.mat.R0.b)) < GLOSSY_LOOKUP_MAX_R0)
+            {
+                color += attenuation * environmentReflection(hit, currentRay);
+                flagStopIteration = true;
+            }
+            else
+                flagStopIteration = !mirrorScatter(hit, currentRay, attenuation);
             break;
         case SCATTER_TYPE_LAMBERTIAN:
             color += deltaColor;
-            flagStopIteration = !lambertianScatter(hit, currentRay, attenuation);
+            // The probes already hold the diffuse bounce.
+            flagStopIteration = useProbes
+                || !lambertianScatter(hit, currentRay, attenuation);
             break;
         case SCATTER_TYPE_REFRACTIVE:
             flagStopIteration = !refractiveScatter(hit, currentRay, attenuation);
             break;
         case SCATTER_TYPE_SPECULAR:
             color += deltaColor;
-            flagStopIteration = !specularScatter(hit, currentRay, attenuation);
+            if (usePrefilteredEnvironment)
+            {
+                color += attenuation * environmentReflection(hit, currentRay);
+                flagStopIteration = true;
+            }
+            else
+                flagStopIteration = !specularScatter(hit, currentRay, attenuation);
             break;
         default:
             // No illumination.
@@ -740,8 +900,98 @@ vec3 castRay(Ray r)
     return color;
 }
 
+vec3 castRay(Ray r)
+{
+    // Trace a ray in iterative way.
+    HitRecord hit;
+
+    // Return the default (miss) color.
+    if (!trace(r, hit))
+        return texture(environmentMap, r.direction).rgb;
+    return castRayFrom(r, hit);
+}
+
+// Materials of the G-buffer ids, in the order given to HybridRenderer.
+Material hybridMaterial(int id)
+{
+    switch (id)
+    {
+    case 0: return material_ground;
+    case 1: return material_mirror;
+    case 2: return material_dielectric_glass;
+    case 3: return material_box;
+    case 4: return material_lambert;
+    case 5: return material_gold;
+    default: return material_mesh;
+    }
+}
+
+// Per-pixel mask of the hybrid mode: whether the paths from a surface go on
+// past it. Only those pixels need many paths; from the others the paths
+// differ in their shadow samples only.
+bool needsSecondaryRays(Material mat)
+{
+    switch (mat.scatter_type)
+    {
+    case SCATTER_TYPE_PHONG:
+        return !usePrefilteredEnvironment
+            || max(mat.R0.r, max(mat.R0.g, mat.R0.b)) >= GLOSSY_LOOKUP_MAX_R0;
+    case SCATTER_TYPE_LAMBERTIAN:
+        return !useProbes;
+    case SCATTER_TYPE_REFRACTIVE:
+        return true;
+    case SCATTER_TYPE_SPECULAR:
+        return !usePrefilteredEnvironment;
+    default:
+        return false;
+    }
+}
+
+// Shades a primary hit of the G-buffer. The subpixel jitter of every path is
+// projected onto the tangent plane of the hit, which decorrelates the paths
+// like the jittered primary rays do.
+vec3 shadeHybrid(vec4 position, vec4 normal)
+{
+    HitRecord surface;
+    surface.p = position.xyz;
+    surface.normal = normalize(normal.xyz);
+    surface.mat = hybridMaterial(int(normal.w + 0.5));
+    int numPaths = needsSecondaryRays(surface.mat) ? NUM_SAMPLES : HYBRID_SAMPLES_DIRECT;
+
+    vec3 color = vec3(0.0);
+    for (int s = 0; s < numPaths; ++s)
+    {
+        Ray r = getRay(TexCoord + 0.001 * randUnitDisk(color + s));
+        HitRecord hit = surface;
+        float dist = length(surface.p - r.origin);
+        float cosine = dot(r.direction, surface.normal);
+        hit.t = cosine != 0.0 ? dot(surface.p - r.origin, surface.normal) / cosine : -1.0;
+        hit.p = r.origin + hit.t * r.direction;
+        // Grazing rays would slide far along the plane; keep the raster hit.
+        if (hit.t <= 0.0 || length(hit.p - surface.p) > 0.01 * dist)
+        {
+            hit.t = dist;
+            hit.p = surface.p;
+            r.direction = normalize(surface.p - r.origin);
+        }
+        color += castRayFrom(r, hit);
+    }
+    return color / numPaths;
+}
+
 void main()
 {
+    // The G-buffer replaces the primary ray wherever it holds a surface.
+    if (useHybrid)
+    {
+        vec4 position = texture(gPosition, TexCoord);
+        if (position.w > 0.5)
+        {
+            FragColor = vec4(shadeHybrid(position, texture(gNormal, TexCoord)), 1.0);
+            return;
+        }
+    }
+
     vec3 color = vec3(0.0);
     Ray r;
     for (int s = 0; s < NUM_SAMPLES; ++s)
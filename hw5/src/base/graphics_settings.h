@@ -18,6 +18,10 @@ struct GraphicsSettings
     bool useNormalMap = true;
     bool useSpecularMap = true;
     bool useShadow = true;
+    bool useCaustics = true;
+    bool useProbes = true;
+    bool usePrefilteredEnvironment = true;
+    bool useHybrid = true;
 };
 }
 
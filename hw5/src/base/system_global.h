@@ -6,6 +6,7 @@
 #include "base/screen.h"
 #include "base/timer.h"
 #include "base/graphics_settings.h"
+#include "base/logger.h"
 
 // #include "base/behavior.h"
 
@@ -14,6 +15,8 @@
 engine::ScreenInfo screen;
 engine::Timer timer;
 engine::GraphicsSettings graphicsSettings;
+// Asynchronous log shared by every thread.
+engine::Logger logger;
 
 // TODO list of delegates to be called at startup or at each iteration.
 // std::vector<engine::Behavior*> behaviorQueue = {};
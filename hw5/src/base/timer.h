@@ -15,6 +15,13 @@ public:
 		this->lastFrame = currentFrame;
 	}
 
+	// Advances by one fixed simulation tick instead, see FixedTimestep.
+	void step(float tickDuration)
+	{
+		deltaTime = tickDuration;
+		this->lastFrame += tickDuration;
+	}
+
 	float getDeltaTime() { return this->deltaTime; }
 
     float getLastFrame() { return this->lastFrame; }
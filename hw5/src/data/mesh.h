@@ -41,7 +41,7 @@ public:
 
         // Now that we have all the required data, set the vertex buffers and
         // its attribute pointers.
-        // initialize(); TODO Uncomment it for later usage.
+        initialize();
     }
 
 private:
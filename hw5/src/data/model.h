@@ -16,6 +16,7 @@
 #include <map>
 
 #include "base/asset.h"
+#include "base/system_global.h"
 #include "data/mesh.h"
 #include "data/texture.h"
 
@@ -56,6 +57,9 @@ public:
         loadModel(path);
     }
 
+    // Wraps a mesh built in code. The model takes ownership of the mesh.
+    Model(const std::string& name, Mesh* mesh) : Asset(name), mesh(mesh) {}
+
     ~Model()
     {
         delete this->mesh;
@@ -92,7 +96,7 @@ private:
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate);
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
-            std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+            logger.error(engine::LOG_CATEGORY_RESOURCE, "ERROR::ASSIMP:: {}", importer.GetErrorString());
             return;
         }
 
@@ -107,7 +111,10 @@ private:
     //                    texture or material.
     void processNode(aiNode *node, const aiScene *scene)
     {
-        std::cout << node->mNumMeshes << std::endl;
+        logger.debug(
+            engine::LOG_CATEGORY_RESOURCE, "Node {} has {} meshes",
+            node->mName.C_Str(), node->mNumMeshes
+        );
         aiMesh* mesh = scene->mMeshes[node->mMeshes[0]];
         this->mesh = processMesh(mesh, scene);
     }
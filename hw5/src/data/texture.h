@@ -13,6 +13,7 @@
 #include <string>
 
 #include "base/asset.h"
+#include "base/system_global.h"
 
 
 namespace engine
@@ -57,13 +58,15 @@ public:
                     GL_RGBA, GL_UNSIGNED_BYTE, data
                 );
             else
-                std::cout << "ERROR::TEXTURE::WRONG_CHANNEL_SIZE" << std::endl;
+                logger.error(
+                    LOG_CATEGORY_RESOURCE, "Texture {} has {} channels", filePath, channels
+                );
             
             glGenerateMipmap(GL_TEXTURE_2D);
         }
         else
         {
-            std::cout << "ERROR::TEXTURE::FAILED_TO_LOAD_TEXTURE" << std::endl;
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to load texture {}", filePath);
         }
 
         stbi_image_free(data);
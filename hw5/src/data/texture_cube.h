@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "base/asset.h"
+#include "base/system_global.h"
 
 
 namespace engine
@@ -56,7 +57,7 @@ public:
             }
             else
             {
-                std::cout << "ERROR::TEXTURE::FAILED_TO_LOAD_TEXTURE: " << faces[i] << std::endl;
+                logger.error(LOG_CATEGORY_RESOURCE, "Failed to load cubemap face {}", faces[i]);
                 stbi_image_free(data);
             }
         }
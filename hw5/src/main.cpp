@@ -6,8 +6,13 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <string>
+#include <thread>
 #include <vector>
 #include <utility>
 
@@ -15,7 +20,9 @@
 #include "base/engine_global.h"
 
 #include "base/camera.h"
+#include "base/fixed_timestep.h"
 #include "base/scene.h"
+#include "base/triple_buffer.h"
 
 #include "data/geometry.h"
 #include "data/mesh.h"
@@ -24,6 +31,14 @@
 #include "data/texture.h"
 #include "data/texture_cube.h"
 
+#include "render/cubemap_sampler.h"
+#include "render/environment_prefilter.h"
+#include "render/frame_snapshot.h"
+#include "render/hybrid_renderer.h"
+#include "render/irradiance_volume.h"
+#include "render/photon_map.h"
+#include "render/rt_scene.h"
+
 #include "utils/math_utils.h"
 #include "utils/screen_utils.h"
 
@@ -36,6 +51,10 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
 
+// Screenshots requested by processInput(), taken by the render thread.
+unsigned int screenshotRequests = 0;
+std::string screenshotPath;
+
 
 int main()
 {
@@ -85,6 +104,8 @@ int main()
 
     // Configure global OpenGL state.
     // glEnable(GL_DEPTH_TEST);
+    // Filter across cube faces, the rough prefiltered levels are tiny.
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
     // Create scenes and declare assets.
     // TODO replace this whole initialization to parsing some serialized database.
@@ -142,107 +163,297 @@ int main()
     // Set materials. You can change this.
 
     // Ground plane
-    rtShader->setVec3("material_ground.Ka", glm::vec3(0.3f, 0.3f, 0.1f));
-    rtShader->setVec3(
-        "material_ground.Kd",
-        glm::vec3(194 / 255.0f * 0.6f, 186 / 255.0f * 0.6f, 151 / 255.0f * 0.6f)
-    );
-    rtShader->setVec3("material_ground.Ks", glm::vec3(0.4f, 0.4f, 0.4f));
-    rtShader->setFloat("material_ground.shininess", 88.0f);
-    rtShader->setVec3("material_ground.R0", glm::vec3(0.05f));
-    rtShader->setInt("material_ground.scatter_type", 0);
+    engine::RTMaterial groundMaterial;
+    groundMaterial.Ka = glm::vec3(0.3f, 0.3f, 0.1f);
+    groundMaterial.Kd
+        = glm::vec3(194 / 255.0f * 0.6f, 186 / 255.0f * 0.6f, 151 / 255.0f * 0.6f);
+    groundMaterial.Ks = glm::vec3(0.4f, 0.4f, 0.4f);
+    groundMaterial.shininess = 88.0f;
+    groundMaterial.R0 = glm::vec3(0.05f);
+    groundMaterial.scatterType = engine::SCATTER_TYPE_PHONG;
 
     // Mirror
-    rtShader->setVec3("material_mirror.Kd", glm::vec3(0.03f, 0.03f, 0.08f));
-    rtShader->setVec3("material_mirror.R0", glm::vec3(1.0f));
-    rtShader->setInt("material_mirror.scatter_type", 0);
+    engine::RTMaterial mirrorMaterial;
+    mirrorMaterial.Kd = glm::vec3(0.03f, 0.03f, 0.08f);
+    mirrorMaterial.R0 = glm::vec3(1.0f);
+    mirrorMaterial.scatterType = engine::SCATTER_TYPE_PHONG;
 
     // Dielectric glass
-    rtShader->setFloat("material_dielectric_glass.ior", 1.5f);
-    rtShader->setVec3(
-        "material_dielectric_glass.extinction_constant",
-        glm::log(glm::vec3(0.80f, 0.89f, 0.75f))
-    );
-    rtShader->setVec3(
-        "material_dielectric_glass.shadow_attenuation_constant",
-        glm::vec3(0.4f, 0.7f, 0.4f)
-    );
-    rtShader->setInt("material_dielectric_glass.scatter_type", 2);
+    engine::RTMaterial glassMaterial;
+    glassMaterial.ior = 1.5f;
+    glassMaterial.extinctionConstant = glm::log(glm::vec3(0.80f, 0.89f, 0.75f));
+    glassMaterial.shadowAttenuationConstant = glm::vec3(0.4f, 0.7f, 0.4f);
+    glassMaterial.scatterType = engine::SCATTER_TYPE_REFRACTIVE;
 
     // Material of the box
-    rtShader->setVec3("material_box.Kd", glm::vec3(0.3f, 0.3f, 0.6f));
-    rtShader->setVec3("material_box.Ks", glm::vec3(0.3f, 0.3f, 0.6f));
-    rtShader->setFloat("material_box.shininess", 200.0f);
-    rtShader->setVec3("material_box.R0", glm::vec3(0.1f));
-    rtShader->setInt("material_box.scatter_type", 0);
+    engine::RTMaterial boxMaterial;
+    boxMaterial.Kd = glm::vec3(0.3f, 0.3f, 0.6f);
+    boxMaterial.Ks = glm::vec3(0.3f, 0.3f, 0.6f);
+    boxMaterial.shininess = 200.0f;
+    boxMaterial.R0 = glm::vec3(0.1f);
+    boxMaterial.scatterType = engine::SCATTER_TYPE_PHONG;
 
     // Lambertian material
-    rtShader->setVec3("material_lambert.Kd", glm::vec3(0.8f, 0.8f, 0.0f));
-    rtShader->setInt("material_lambert.scatter_type", 1);
+    engine::RTMaterial lambertMaterial;
+    lambertMaterial.Kd = glm::vec3(0.8f, 0.8f, 0.0f);
+    lambertMaterial.scatterType = engine::SCATTER_TYPE_LAMBERTIAN;
 
     // Gold
-    rtShader->setVec3("material_gold.Kd", glm::vec3(0.8f, 0.6f, 0.2f) * 0.001f);
-    rtShader->setVec3("material_gold.Ks", glm::vec3(0.4f, 0.4f, 0.2f));
-    rtShader->setFloat("material_gold.shininess", 200.0f);
-    rtShader->setVec3("material_gold.R0", glm::vec3(0.8f, 0.6f, 0.2f));
-    rtShader->setInt("material_gold.scatter_type", 3);
+    engine::RTMaterial goldMaterial;
+    goldMaterial.Kd = glm::vec3(0.8f, 0.6f, 0.2f) * 0.001f;
+    goldMaterial.Ks = glm::vec3(0.4f, 0.4f, 0.2f);
+    goldMaterial.shininess = 200.0f;
+    goldMaterial.R0 = glm::vec3(0.8f, 0.6f, 0.2f);
+    goldMaterial.scatterType = engine::SCATTER_TYPE_SPECULAR;
+
+    engine::setMaterialUniforms(rtShader, "material_ground"s, groundMaterial);
+    engine::setMaterialUniforms(rtShader, "material_mirror"s, mirrorMaterial);
+    engine::setMaterialUniforms(rtShader, "material_dielectric_glass"s, glassMaterial);
+    engine::setMaterialUniforms(rtShader, "material_box"s, boxMaterial);
+    engine::setMaterialUniforms(rtShader, "material_lambert"s, lambertMaterial);
+    engine::setMaterialUniforms(rtShader, "material_gold"s, goldMaterial);
+
+    // CPU copy of the scene for the photon tracing pass.
+    engine::RTScene rtScene(
+        &groundMaterial, &mirrorMaterial, &glassMaterial,
+        &boxMaterial, &lambertMaterial, &goldMaterial
+    );
 
+    // Trace the caustic photons once; the scene and the lights are static.
+    engine::PhotonMap* causticMap = new engine::PhotonMap("Caustic Photon Map"s);
+    double photonStart = glfwGetTime();
+    causticMap->build(rtScene);
+    causticMap->upload();
+    logger.info(
+        engine::LOG_CATEGORY_RENDER, "Traced {} caustic photons in {}s",
+        (unsigned int)causticMap->photons.size(), glfwGetTime() - photonStart
+    );
 
-    while (!glfwWindowShouldClose(window))
+    // Proxies of the scene primitives for the rasterized primary hits. The
+    // materials are listed in the order of hybridMaterial() in the shader.
+    engine::HybridRenderer* hybridRenderer = new engine::HybridRenderer(
+        scene, rtScene,
+        {
+            &groundMaterial, &mirrorMaterial, &glassMaterial,
+            &boxMaterial, &lambertMaterial, &goldMaterial
+        }
+    );
+    hybridRenderer->setUniforms(rtShader, 6, 7);
+
+    rtShader->setInt("photonMap"s, 1);
+    rtShader->setInt("photonCells"s, 2);
+    rtShader->setInt("photonHashSize"s, (int)causticMap->hashSize);
+    rtShader->setFloat("photonGatherRadius"s, causticMap->gatherRadius);
+    rtShader->setInt("photonMaxGather"s, (int)causticMap->maxGather);
+
+    // CPU copy of the skybox for the bakes below.
+    engine::CubemapSampler sky(skyboxTexture);
+
+    // Bake the irradiance probes around the objects and below the area light.
+    engine::IrradianceVolume* probes = new engine::IrradianceVolume(
+        "Irradiance Probes"s,
+        glm::vec3(-4.0f, 0.05f, -5.0f),
+        glm::vec3(9.0f, 4.5f, 10.0f),
+        glm::ivec3(10, 5, 10)
+    );
     {
-        // Get current camera.
-		engine::Camera* currentCamera = gameManager.defaultCamera;
-
-        // Maintain loop time.
-        timer.update((float)glfwGetTime());
+        double probeStart = glfwGetTime();
+        probes->bake([&](const glm::vec3& p, const glm::vec3& dir, std::mt19937& rng) {
+            engine::RTRay ray = { p, dir };
+            return rtScene.radiance(ray, rng, &sky);
+        });
+        probes->upload();
+        logger.info(
+            engine::LOG_CATEGORY_RENDER, "Baked {} irradiance probes in {}s",
+            (unsigned int)probes->probes.size(), glfwGetTime() - probeStart
+        );
+    }
+    probes->setUniforms(rtShader, 3);
+
+    // Prefilter the skybox for the glossy reflections of the gold and the
+    // other non-mirror surfaces. Both tables are cached on disk; the
+    // environment is keyed by a hash of the skybox texels.
+    engine::PrefilteredEnvironment* environment
+        = new engine::PrefilteredEnvironment("Skybox Prefiltered"s);
+    if (!environment->load(
+        "../resources/cache/skybox.penv"s,
+        engine::PrefilteredEnvironment::hashSource(sky)
+    ))
+    {
+        double prefilterStart = glfwGetTime();
+        environment->prefilter(sky);
+        environment->save("../resources/cache/skybox.penv"s);
+        logger.info(
+            engine::LOG_CATEGORY_RENDER, "Prefiltered the environment in {}s",
+            glfwGetTime() - prefilterStart
+        );
+    }
+    environment->upload();
+    environment->setUniforms(rtShader, 4);
 
-        // Process input.
-        processInput(window);
-        gameManager.processCommands(&cmd);
+    engine::BRDFLookupTable* brdfLUT = new engine::BRDFLookupTable("BRDF LUT"s);
+    if (!brdfLUT->load("../resources/cache/brdf_lut.bin"s))
+    {
+        brdfLUT->compute();
+        brdfLUT->save("../resources/cache/brdf_lut.bin"s);
+    }
+    brdfLUT->upload();
+    brdfLUT->setUniforms(rtShader, 5);
+
+
+    // Snapshots of the simulation, handed from this thread to the render
+    // thread.
+    engine::TripleBuffer<engine::FrameSnapshot> snapshots;
+    engine::FixedTimestep timestep;
+    engine::CameraState previousCamera = gameManager.defaultCamera->getState();
+    auto publishSnapshot = [&]() {
+        engine::Camera* currentCamera = gameManager.defaultCamera;
+        engine::FrameSnapshot& snapshot = snapshots.getWriteBuffer();
+        snapshot.tick = timestep.getTick();
+        snapshot.time = (float)timestep.getTime();
+        snapshot.deltaTime = (float)timestep.getTickDuration();
+        snapshot.simulatedUntil = timestep.getSimulatedUntil();
+        snapshot.screenWidth = screen.width;
+        snapshot.screenHeight = screen.height;
+        snapshot.settings = graphicsSettings;
+        snapshot.previousCamera = previousCamera;
+        snapshot.camera = currentCamera->getState();
+        snapshot.cameraRotation = currentCamera->tf.rotation;
+        snapshot.zoom = currentCamera->zoom;
+        snapshot.screenshotRequests = screenshotRequests;
+        snapshot.screenshotPath = screenshotPath;
+        snapshots.publish();
+    };
+
+    // Draws one snapshot. Runs on the render thread and touches nothing the
+    // simulation writes.
+    unsigned int screenshotsTaken = 0;
+    engine::LogRateLimit frameLogLimit(1.0);
+    auto renderFrame = [&](const engine::FrameSnapshot& snapshot) {
+        // The camera is drawn between the last two ticks, so its motion stays
+        // smooth whatever the tick and frame rates are.
+        const engine::CameraState camera = snapshot.getCamera(glfwGetTime());
+        const glm::mat4 view = camera.getViewMatrix();
+
+        // Rasterize the primary hits; the ray tracer only shades them.
+        if (snapshot.settings.useHybrid)
+        {
+            hybridRenderer->renderGBuffer(
+                view, camera.position, snapshot.zoom,
+                (int)snapshot.screenWidth, (int)snapshot.screenHeight
+            );
+        }
 
+        glViewport(0, 0, snapshot.screenWidth, snapshot.screenHeight);
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
         rtShader->use();
-        rtShader->setFloat("W", (GLfloat)screen.width);
-        rtShader->setFloat("H", (GLfloat)screen.height);
-        rtShader->setFloat("fovY", glm::radians(currentCamera->zoom));
-        rtShader->setVec3("cameraPosition", currentCamera->tf.position);
+        rtShader->setFloat("W", (GLfloat)snapshot.screenWidth);
+        rtShader->setFloat("H", (GLfloat)snapshot.screenHeight);
+        rtShader->setFloat("fovY", glm::radians(snapshot.zoom));
+        rtShader->setVec3("cameraPosition", camera.position);
         rtShader->setMat3(
             "cameraToWorldRotMatrix",
-            glm::transpose(glm::mat3(currentCamera->getViewMatrix()))
+            glm::transpose(glm::mat3(view))
         );
 
         // For mesh rendering
         rtShader->setInt("meshTriangleNumber", 0);
 
+        rtShader->setBool("useCaustics"s, snapshot.settings.useCaustics);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture->ID);
+        causticMap->bind(1);
+        rtShader->setBool("useProbes"s, snapshot.settings.useProbes);
+        probes->bind(3);
+        rtShader->setBool(
+            "usePrefilteredEnvironment"s, snapshot.settings.usePrefilteredEnvironment
+        );
+        environment->bind(4);
+        brdfLUT->bind(5);
+        rtShader->setBool("useHybrid"s, snapshot.settings.useHybrid);
+        hybridRenderer->bind(6, 7);
 
         glBindVertexArray(quadGeometry->VAO);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
+        if (snapshot.screenshotRequests != screenshotsTaken)
+        {
+            saveImage(snapshot.screenshotPath, snapshot.screenWidth, snapshot.screenHeight);
+            screenshotsTaken = snapshot.screenshotRequests;
+        }
 
-        std::cout << std::setprecision(3) << "pos( "
-            << gameManager.defaultCamera->tf.position.x << ", "
-            << gameManager.defaultCamera->tf.position.y << ", "
-            << gameManager.defaultCamera->tf.position.z << " );  rot( "
-            << gameManager.defaultCamera->tf.rotation.x << ", "
-            << gameManager.defaultCamera->tf.rotation.y << ", "
-            << gameManager.defaultCamera->tf.rotation.z << " )" << std::endl;
+        // Log camera position and rotation, once a second.
+        if (frameLogLimit.allow())
+        {
+            logger.info(
+                engine::LOG_CATEGORY_RENDER, "pos {}  rot {}",
+                camera.position, snapshot.cameraRotation
+            );
+        }
+    };
+
+    // The GL context moves to a render thread, so a slow ray traced frame no
+    // longer holds up input and the camera. Window events stay on this
+    // thread, as GLFW requires.
+    publishSnapshot();
+    glfwMakeContextCurrent(NULL);
+    std::atomic<bool> rendering(true);
+    std::thread renderThread([&]() {
+        glfwMakeContextCurrent(window);
+        while (rendering.load())
+        {
+            // Always draw the latest snapshot; older ones are dropped.
+            snapshots.update();
+            renderFrame(snapshots.getReadBuffer());
+            glfwSwapBuffers(window);
+        }
+        glfwMakeContextCurrent(NULL);
+    });
 
-        // GLFW: Swap buffers and poll IO events (keys pressed/released, mouse moved etc.).
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
+    // Simulation loop. The simulation advances in fixed ticks, as many as
+    // the real time passed calls for, so it runs the same at any frame rate.
+    timestep.accumulate(glfwGetTime());
+    while (!glfwWindowShouldClose(window))
+    {
+        // Process input.
         glfwPollEvents();
+        processInput(window);
+
+        timestep.accumulate(glfwGetTime());
+        bool ticked = false;
+        while (timestep.step())
+        {
+            previousCamera = gameManager.defaultCamera->getState();
+            timer.step((float)timestep.getTickDuration());
+            gameManager.processCommands(&cmd);
+            ticked = true;
+        }
+        if (ticked)
+            publishSnapshot();
+
+        std::this_thread::sleep_for(
+            std::chrono::duration<double>(timestep.getTimeToNextTick())
+        );
     }
 
+    rendering.store(false);
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+
     // Optional: De-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
     //glDeleteVertexArrays(1,&VAOcube);
     //glDeleteBuffers(1, VBOcube);
     //glDeleteVertexArrays(1, &VAOquad);
     //glDeleteBuffers(1, &VBOquad);
+    delete probes;
+    delete environment;
+    delete brdfLUT;
+    delete hybridRenderer;
+    delete causticMap;
+    delete scene;
 
     // GLFW: Terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -314,13 +525,10 @@ void processInput(GLFWwindow* window)
     // Log current position and rotation.
     if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
     {
-        std::cout << std::setprecision(3) << "pos( "
-            << gameManager.defaultCamera->tf.position.x << ", "
-            << gameManager.defaultCamera->tf.position.y << ", "
-            << gameManager.defaultCamera->tf.position.z << " );  rot( "
-            << gameManager.defaultCamera->tf.rotation.x << ", "
-            << gameManager.defaultCamera->tf.rotation.y << ", "
-            << gameManager.defaultCamera->tf.rotation.z << " )" << std::endl;
+        logger.info(
+            engine::LOG_CATEGORY_INPUT, "pos {}  rot {}",
+            gameManager.defaultCamera->tf.position, gameManager.defaultCamera->tf.rotation
+        );
     }
 
     // Take a screenshot.
@@ -334,7 +542,8 @@ void processInput(GLFWwindow* window)
             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
             tm.tm_hour, tm.tm_min, tm.tm_sec
         );
-        saveImage(date_char);
+        screenshotPath = date_char;
+        ++screenshotRequests;
         screen.isKeyboardDone[GLFW_KEY_V] = true;
     }
     else if (glfwGetKey(window, GLFW_KEY_V) == GLFW_RELEASE)
@@ -342,6 +551,18 @@ void processInput(GLFWwindow* window)
         screen.isKeyboardDone[GLFW_KEY_V] = false;
     }
 
+    // Toggle the caustic photon map.
+    setToggle(window, GLFW_KEY_C, &graphicsSettings.useCaustics);
+
+    // Toggle the irradiance probes.
+    setToggle(window, GLFW_KEY_P, &graphicsSettings.useProbes);
+
+    // Toggle the prefiltered environment reflections.
+    setToggle(window, GLFW_KEY_R, &graphicsSettings.usePrefilteredEnvironment);
+
+    // Toggle the rasterized primary hits.
+    setToggle(window, GLFW_KEY_H, &graphicsSettings.useHybrid);
+
     // Toggle fullscreen ? TODO
     if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS && screen.isKeyboardDone[GLFW_KEY_Z] == false)
     {
@@ -379,12 +600,11 @@ void processInput(GLFWwindow* window)
 // ----------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+    // The render thread sets the viewport from the next snapshot; note that
+    // width and height will be significantly larger than specified on retina
+    // displays.
     screen.width = width;
     screen.height = height;
-
-    // Make sure the viewport matches the new window dimensions; note that width and 
-    // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
 }
 
 
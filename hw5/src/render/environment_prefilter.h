@@ -0,0 +1,470 @@
+#ifndef ENVIRONMENT_PREFILTER_H
+#define ENVIRONMENT_PREFILTER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/asset.h"
+#include "base/system_global.h"
+#include "data/shader.h"
+#include "render/cubemap_sampler.h"
+
+
+namespace engine
+{
+constexpr int DEFAULT_PREFILTER_RESOLUTION = 128;
+constexpr int DEFAULT_PREFILTER_LEVELS = 6;             // 128 down to 4
+constexpr unsigned int DEFAULT_PREFILTER_SAMPLES = 512;
+constexpr int DEFAULT_BRDF_LUT_RESOLUTION = 128;
+constexpr unsigned int DEFAULT_BRDF_LUT_SAMPLES = 1024;
+constexpr uint32_t PREFILTER_FILE_MAGIC = 0x564e4550;   // "PENV"
+constexpr uint32_t PREFILTER_FILE_VERSION = 1;
+constexpr uint32_t BRDF_LUT_FILE_MAGIC = 0x54554c42;    // "BLUT"
+constexpr uint32_t BRDF_LUT_FILE_VERSION = 1;
+
+
+// Low discrepancy point i of n in the unit square.
+glm::vec2 hammersley(uint32_t i, uint32_t n)
+{
+    uint32_t bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return glm::vec2((float)i / n, bits * 2.3283064365386963e-10f);
+}
+
+// GGX half vector around +z, distributed proportionally to D(h) (n.h).
+glm::vec3 importanceSampleGGX(const glm::vec2& xi, float alpha)
+{
+    float phi = 2.0f * glm::pi<float>() * xi.x;
+    float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+float distributionGGX(float NdotH, float alpha)
+{
+    float a2 = alpha * alpha;
+    float d = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+    return a2 / (glm::pi<float>() * d * d);
+}
+
+
+// Split-sum prefiltered environment: mip level l of the cubemap holds the
+// environment convolved with a GGX lobe of roughness l / (levels - 1),
+// assuming n = v = r. Shaders pick the level from the surface roughness, so a
+// glossy reflection of the sky costs a single textureLod().
+class PrefilteredEnvironment : public Asset
+{
+public:
+    unsigned int ID = 0;
+    int resolution;
+    int numLevels;
+    uint64_t sourceHash = 0;                // Of the sampler it was filtered from
+    std::vector<CubemapSampler::Faces> levels;
+
+
+    PrefilteredEnvironment(
+        const std::string& name,
+        int resolution = DEFAULT_PREFILTER_RESOLUTION,
+        int numLevels = DEFAULT_PREFILTER_LEVELS
+    ) : Asset(name), resolution(resolution),
+        numLevels(std::max(1, std::min(numLevels, (int)std::log2((float)resolution) + 1)))
+    {}
+
+    ~PrefilteredEnvironment()
+    {
+        if (this->ID)
+            glDeleteTextures(1, &(this->ID));
+    }
+
+    float getMaxLod() const
+    {
+        return (float)(this->numLevels - 1);
+    }
+
+    // FNV-1a of the source texels, stored in the cache to notice a changed
+    // skybox.
+    static uint64_t hashSource(const CubemapSampler& source)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const auto& face : source.faces)
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(face.data());
+            for (size_t i = 0; i < face.size() * sizeof(glm::vec3); ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ull;
+            }
+        }
+        return hash;
+    }
+
+    // Convolves the source with the GGX lobe of every level. Samples read the
+    // source mip whose texel covers the solid angle of the sample, which keeps
+    // the rough levels free of fireflies with few samples.
+    void prefilter(CubemapSampler& source, unsigned int numSamples = DEFAULT_PREFILTER_SAMPLES)
+    {
+        if (source.mips.empty())
+            source.generateMipmaps();
+        this->sourceHash = hashSource(source);
+
+        this->levels.assign(this->numLevels, CubemapSampler::Faces());
+        std::vector<glm::ivec3> rows;       // (level, face, row)
+        for (int l = 0; l < this->numLevels; ++l)
+        {
+            int res = this->resolution >> l;
+            for (int f = 0; f < 6; ++f)
+            {
+                this->levels[l][f].resize(res * res);
+                for (int y = 0; y < res; ++y)
+                    rows.push_back(glm::ivec3(l, f, y));
+            }
+        }
+
+        float sourceTexelAngle = 4.0f * glm::pi<float>()
+            / (6.0f * source.resolution * source.resolution);
+        float baseLod = std::log2((float)source.resolution / this->resolution);
+
+        std::atomic<size_t> next(0);
+        unsigned int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < numWorkers; ++w)
+        {
+            workers.emplace_back([&]() {
+                size_t idx;
+                while ((idx = next.fetch_add(1)) < rows.size())
+                {
+                    int l = rows[idx].x;
+                    int f = rows[idx].y;
+                    int y = rows[idx].z;
+                    int res = this->resolution >> l;
+                    float roughness = this->numLevels > 1 ? (float)l / (this->numLevels - 1) : 0.0f;
+                    float alpha = roughness * roughness;
+
+                    for (int x = 0; x < res; ++x)
+                    {
+                        glm::vec3 n = CubemapSampler::direction(f, (float)x, (float)y, res);
+                        glm::vec3& out = this->levels[l][f][y * res + x];
+                        if (l == 0)
+                        {
+                            out = source.sampleLod(n, baseLod);
+                            continue;
+                        }
+
+                        glm::vec3 up = std::abs(n.z) < 0.999f
+                            ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                        glm::vec3 t = glm::normalize(glm::cross(up, n));
+                        glm::vec3 b = glm::cross(n, t);
+
+                        glm::vec3 sum = glm::vec3(0.0f);
+                        float weight = 0.0f;
+                        for (unsigned int i = 0; i < numSamples; ++i)
+                        {
+                            glm::vec3 h = importanceSampleGGX(hammersley(i, numSamples), alpha);
+                            float NdotH = h.z;
+                            h = h.x * t + h.y * b + h.z * n;
+                            glm::vec3 dir = 2.0f * glm::dot(n, h) * h - n;
+                            float NdotL = glm::dot(n, dir);
+                            if (NdotL <= 0.0f)
+                                continue;
+
+                            // pdf of dir is D (n.h) / (4 v.h), and v.h = n.h here.
+                            float pdf = distributionGGX(NdotH, alpha) * 0.25f;
+                            float sampleAngle = 1.0f / (numSamples * pdf + 1e-4f);
+                            float lod = 0.5f * std::log2(sampleAngle / sourceTexelAngle) + 1.0f;
+                            sum += source.sampleLod(dir, lod) * NdotL;
+                            weight += NdotL;
+                        }
+                        out = weight > 0.0f ? sum / weight : glm::vec3(0.0f);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // Loads a cache written by save(). Fails if the file is missing, written
+    // for another layout or filtered from a different source.
+    bool load(const std::string& filePath, uint64_t expectedHash)
+    {
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t header[4];
+        uint64_t hash;
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        file.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+        if (!file || header[0] != PREFILTER_FILE_MAGIC
+            || header[1] != PREFILTER_FILE_VERSION)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Invalid prefiltered environment file {}", filePath);
+            return false;
+        }
+        if ((int)header[2] != this->resolution || (int)header[3] != this->numLevels
+            || hash != expectedHash)
+            return false;
+
+        std::vector<CubemapSampler::Faces> levels(this->numLevels);
+        for (int l = 0; l < this->numLevels; ++l)
+        {
+            int res = this->resolution >> l;
+            for (auto& face : levels[l])
+            {
+                face.resize(res * res);
+                file.read(
+                    reinterpret_cast<char*>(face.data()),
+                    face.size() * sizeof(glm::vec3)
+                );
+            }
+        }
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Truncated prefiltered environment file {}", filePath);
+            return false;
+        }
+        this->sourceHash = hash;
+        this->levels.swap(levels);
+        return true;
+    }
+
+    bool save(const std::string& filePath) const
+    {
+        std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to write prefiltered environment {}", filePath);
+            return false;
+        }
+
+        uint32_t header[4] = {
+            PREFILTER_FILE_MAGIC, PREFILTER_FILE_VERSION,
+            (uint32_t)this->resolution, (uint32_t)this->numLevels
+        };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(&this->sourceHash), sizeof(this->sourceHash));
+        for (const auto& level : this->levels)
+        {
+            for (const auto& face : level)
+            {
+                file.write(
+                    reinterpret_cast<const char*>(face.data()),
+                    face.size() * sizeof(glm::vec3)
+                );
+            }
+        }
+        return (bool)file;
+    }
+
+    void upload()
+    {
+        if (!this->ID)
+            glGenTextures(1, &(this->ID));
+        glBindTexture(GL_TEXTURE_CUBE_MAP, this->ID);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, this->numLevels - 1);
+
+        for (int l = 0; l < this->numLevels; ++l)
+        {
+            int res = this->resolution >> l;
+            for (int f = 0; f < 6; ++f)
+            {
+                glTexImage2D(
+                    GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, l, GL_RGB16F, res, res, 0,
+                    GL_RGB, GL_FLOAT, this->levels[l][f].data()
+                );
+            }
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    void setUniforms(Shader* shader, int unit) const
+    {
+        shader->setInt("prefilteredEnvMap", unit);
+        shader->setFloat("prefilteredEnvMaxLod", this->getMaxLod());
+    }
+
+    void bind(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, this->ID);
+    }
+};
+
+
+// Split-sum BRDF table: for (n.v, roughness) it holds the scale and bias to
+// F0 of the GGX specular lobe integrated over the hemisphere, so that
+// prefiltered * (F0 * lut.x + lut.y) is the glossy reflection.
+class BRDFLookupTable : public Asset
+{
+public:
+    unsigned int ID = 0;
+    int resolution;
+    std::vector<glm::vec2> texels;          // Row-major, roughness along y
+
+
+    BRDFLookupTable(
+        const std::string& name, int resolution = DEFAULT_BRDF_LUT_RESOLUTION
+    ) : Asset(name), resolution(resolution) {}
+
+    ~BRDFLookupTable()
+    {
+        if (this->ID)
+            glDeleteTextures(1, &(this->ID));
+    }
+
+    void compute(unsigned int numSamples = DEFAULT_BRDF_LUT_SAMPLES)
+    {
+        this->texels.assign(this->resolution * this->resolution, glm::vec2(0.0f));
+
+        std::atomic<int> next(0);
+        unsigned int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < numWorkers; ++w)
+        {
+            workers.emplace_back([this, &next, numSamples]() {
+                int y;
+                while ((y = next.fetch_add(1)) < this->resolution)
+                {
+                    float roughness = (y + 0.5f) / this->resolution;
+                    for (int x = 0; x < this->resolution; ++x)
+                    {
+                        float NdotV = (x + 0.5f) / this->resolution;
+                        this->texels[y * this->resolution + x]
+                            = integrate(NdotV, roughness, numSamples);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // Fails if the file is missing or was written at another resolution.
+    bool load(const std::string& filePath)
+    {
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t header[3];
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!file || header[0] != BRDF_LUT_FILE_MAGIC
+            || header[1] != BRDF_LUT_FILE_VERSION)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Invalid BRDF LUT file {}", filePath);
+            return false;
+        }
+        if ((int)header[2] != this->resolution)
+            return false;
+
+        std::vector<glm::vec2> texels(this->resolution * this->resolution);
+        file.read(
+            reinterpret_cast<char*>(texels.data()), texels.size() * sizeof(glm::vec2)
+        );
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Truncated BRDF LUT file {}", filePath);
+            return false;
+        }
+        this->texels.swap(texels);
+        return true;
+    }
+
+    bool save(const std::string& filePath) const
+    {
+        std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            logger.error(LOG_CATEGORY_RESOURCE, "Failed to write BRDF LUT {}", filePath);
+            return false;
+        }
+
+        uint32_t header[3] = {
+            BRDF_LUT_FILE_MAGIC, BRDF_LUT_FILE_VERSION, (uint32_t)this->resolution
+        };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(
+            reinterpret_cast<const char*>(this->texels.data()),
+            this->texels.size() * sizeof(glm::vec2)
+        );
+        return (bool)file;
+    }
+
+    void upload()
+    {
+        if (!this->ID)
+            glGenTextures(1, &(this->ID));
+        glBindTexture(GL_TEXTURE_2D, this->ID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_RG16F, this->resolution, this->resolution, 0,
+            GL_RG, GL_FLOAT, this->texels.data()
+        );
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void setUniforms(Shader* shader, int unit) const
+    {
+        shader->setInt("brdfLUT", unit);
+    }
+
+    void bind(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, this->ID);
+    }
+
+private:
+    // Scale and bias of F0 in the Schlick-GGX specular integral, with the
+    // Smith visibility remapped for image based lighting (k = alpha / 2).
+    static glm::vec2 integrate(float NdotV, float roughness, unsigned int numSamples)
+    {
+        float alpha = roughness * roughness;
+        float k = alpha * 0.5f;
+        glm::vec3 v = glm::vec3(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+
+        glm::vec2 result = glm::vec2(0.0f);
+        for (unsigned int i = 0; i < numSamples; ++i)
+        {
+            glm::vec3 h = importanceSampleGGX(hammersley(i, numSamples), alpha);
+            glm::vec3 l = 2.0f * glm::dot(v, h) * h - v;
+            float NdotL = l.z;
+            float NdotH = h.z;
+            float VdotH = std::max(glm::dot(v, h), 0.0f);
+            if (NdotL <= 0.0f)
+                continue;
+
+            float g = (NdotV / (NdotV * (1.0f - k) + k)) * (NdotL / (NdotL * (1.0f - k) + k));
+            float visibility = g * VdotH / (NdotH * NdotV);
+            float fresnel = std::pow(1.0f - VdotH, 5.0f);
+            result += glm::vec2((1.0f - fresnel) * visibility, fresnel * visibility);
+        }
+        return result / (float)numSamples;
+    }
+};
+}
+
+#endif
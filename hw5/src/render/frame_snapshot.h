@@ -0,0 +1,56 @@
+#ifndef FRAME_SNAPSHOT_H
+#define FRAME_SNAPSHOT_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+
+#include "base/camera.h"
+#include "base/graphics_settings.h"
+
+
+namespace engine
+{
+// Everything the render thread needs to draw a frame, copied out of the
+// camera and the settings by the simulation thread, so a slow ray traced
+// frame never holds up input. The scene itself is static once the render
+// thread starts. Snapshots travel through a TripleBuffer and are reused, so
+// every field is rewritten on each tick.
+struct FrameSnapshot
+{
+    uint64_t tick = 0;
+    float time = 0.0f;                  // Of the simulation, in seconds
+    float deltaTime = 0.0f;             // One tick
+    double simulatedUntil = 0.0;        // Real time the last tick caught up to
+    unsigned int screenWidth = 0;
+    unsigned int screenHeight = 0;
+    GraphicsSettings settings;
+
+    // Camera, at the previous tick and at the last one.
+    CameraState previousCamera;
+    CameraState camera;
+    glm::vec3 cameraRotation;           // Euler angles, for the log
+    float zoom = 0.0f;                  // Camera::zoom, in degrees
+
+    // The render thread saves a screenshot whenever the request count
+    // changes, so requests survive snapshots it never sees.
+    unsigned int screenshotRequests = 0;
+    std::string screenshotPath;
+
+
+    // The camera as seen at real time now, blended from the last two ticks.
+    // The snapshot is published when the simulation reaches simulatedUntil,
+    // which is one tick after previousCamera was current; rendering shows
+    // that much of the way from previousCamera to camera.
+    CameraState getCamera(double now) const
+    {
+        float alpha = 1.0f;
+        if (this->deltaTime > 0.0f)
+            alpha = (float)glm::clamp((now - this->simulatedUntil) / this->deltaTime, 0.0, 1.0);
+        return CameraState::interpolate(this->previousCamera, this->camera, alpha);
+    }
+};
+}
+
+#endif
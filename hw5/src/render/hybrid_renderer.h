@@ -0,0 +1,369 @@
+#ifndef HYBRID_RENDERER_H
+#define HYBRID_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "base/entity.h"
+#include "base/scene.h"
+#include "base/system_global.h"
+#include "data/mesh.h"
+#include "data/model.h"
+#include "data/shader.h"
+#include "render/rt_scene.h"
+
+
+namespace engine
+{
+constexpr int HYBRID_SPHERE_SLICES = 64;
+constexpr int HYBRID_SPHERE_STACKS = 32;
+// Half extent of the quad standing in for the infinite ground plane.
+constexpr float HYBRID_PLANE_EXTENT = 200.0f;
+constexpr float HYBRID_NEAR = 0.01f;
+constexpr float HYBRID_FAR = 1000.0f;
+
+
+// Rasterizes the primary visibility of the ray traced scene into a G-buffer,
+// so that the ray tracing shader only launches secondary rays. Every primitive
+// of the RTScene gets a proxy entity drawn through the regular Model path:
+// spheres are tessellated inside the analytic sphere and snapped back onto it
+// per fragment, the other primitives are exact. Pixels the proxies miss keep
+// a full primary ray.
+//
+// G-buffer layout:
+//     gPosition : world position, w = 1 where a proxy was drawn
+//     gNormal   : shading normal as the ray tracer defines it, w = material id
+class HybridRenderer
+{
+public:
+    unsigned int FBO = 0;
+    unsigned int gPosition = 0;
+    unsigned int gNormal = 0;
+    unsigned int depthRBO = 0;
+    int width = 0;
+    int height = 0;
+
+
+    // The material id of a primitive is the index of its material in
+    // materials; the ray tracing shader must list them in the same order.
+    // The proxies and the G-buffer shader are owned by the scene.
+    HybridRenderer(
+        Scene* scene, const RTScene& rtScene,
+        const std::vector<const RTMaterial*>& materials
+    ) : scene(scene), materials(materials)
+    {
+        this->shader = new Shader(
+            "G-Buffer Shader", "../shaders/shader_gbuffer.vert",
+            "../shaders/shader_gbuffer.frag"
+        );
+        scene->addShader(this->shader);
+        this->modelUniform = this->shader->getUniform<glm::mat4>("model");
+        this->materialIdUniform = this->shader->getUniform<int>("materialId");
+        this->sphereRadiusUniform = this->shader->getUniform<float>("sphereRadius");
+        this->doubleSidedUniform = this->shader->getUniform<int>("doubleSided");
+
+        Model* sphere = new Model("Hybrid Sphere", makeSphereMesh("Hybrid Sphere"));
+        Model* box = new Model("Hybrid Box", makeBoxMesh("Hybrid Box"));
+        scene->addModels({ sphere, box });
+
+        for (size_t i = 0; i < rtScene.spheres.size(); ++i)
+        {
+            const RTSphere& sp = rtScene.spheres[i];
+            this->addProxy(
+                "Hybrid Sphere " + std::to_string(i), sphere,
+                Transform(sp.center, glm::vec3(0.0f), sp.radius), sp.mat
+            ).sphereRadius = sp.radius;
+        }
+        for (size_t i = 0; i < rtScene.boxes.size(); ++i)
+        {
+            const RTBox& b = rtScene.boxes[i];
+            this->addProxy(
+                "Hybrid Box " + std::to_string(i), box,
+                Transform(0.5f * (b.bmin + b.bmax), glm::vec3(0.0f), b.bmax - b.bmin),
+                b.mat
+            );
+        }
+        for (size_t i = 0; i < rtScene.planes.size(); ++i)
+        {
+            std::string name = "Hybrid Plane " + std::to_string(i);
+            Model* model = new Model(name, makePlaneMesh(name, rtScene.planes[i]));
+            scene->addModel(model);
+            this->addProxy(name, model, Transform(), rtScene.planes[i].mat).doubleSided = true;
+        }
+        for (size_t i = 0; i < rtScene.triangles.size(); ++i)
+        {
+            const RTTriangle& tri = rtScene.triangles[i];
+            std::string name = "Hybrid Triangle " + std::to_string(i);
+            Model* model = new Model(name, makeTriangleMesh(name, tri));
+            scene->addModel(model);
+            this->addProxy(name, model, Transform(), tri.mat).doubleSided = true;
+        }
+    }
+
+    ~HybridRenderer()
+    {
+        this->release();
+    }
+
+    // Draws the proxies into the G-buffer, (re)allocating it to the screen
+    // size. The projection matches the pinhole camera of the ray tracer, for
+    // which fovY spans tan(fovY) at unit distance. zoom is Camera::zoom.
+    void renderGBuffer(
+        const glm::mat4& view, const glm::vec3& cameraPosition, float zoom,
+        int width, int height
+    ) {
+        if (width <= 0 || height <= 0)
+            return;
+        if (width != this->width || height != this->height)
+            this->allocate(width, height);
+
+        float fovY = 2.0f * std::atan(0.5f * std::tan(glm::radians(zoom)));
+        glm::mat4 projection = glm::perspective(
+            fovY, (float)width / height, HYBRID_NEAR, HYBRID_FAR
+        );
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+
+        this->shader->use();
+        this->shader->setMat4("view", view);
+        this->shader->setMat4("projection", projection);
+        this->shader->setVec3("cameraPosition", cameraPosition);
+        for (const Proxy& proxy : this->proxies)
+        {
+            Model* model = proxy.entity->getAttribute<ModelAttribute>()->model;
+            this->shader->set(this->modelUniform, proxy.entity->tf.getModelMatrix());
+            this->shader->set(this->materialIdUniform, proxy.materialId);
+            this->shader->set(this->sphereRadiusUniform, proxy.sphereRadius);
+            this->shader->set(this->doubleSidedUniform, (int)proxy.doubleSided);
+            glBindVertexArray(model->mesh->VAO);
+            glDrawElements(
+                GL_TRIANGLES, (GLsizei)model->mesh->indices.size(), GL_UNSIGNED_INT, 0
+            );
+        }
+        glBindVertexArray(0);
+
+        glDisable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void setUniforms(Shader* shader, int positionUnit, int normalUnit) const
+    {
+        shader->setInt("gPosition", positionUnit);
+        shader->setInt("gNormal", normalUnit);
+    }
+
+    void bind(unsigned int positionUnit, unsigned int normalUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + positionUnit);
+        glBindTexture(GL_TEXTURE_2D, this->gPosition);
+        glActiveTexture(GL_TEXTURE0 + normalUnit);
+        glBindTexture(GL_TEXTURE_2D, this->gNormal);
+    }
+
+private:
+    struct Proxy
+    {
+        Entity* entity;
+        int materialId;
+        float sphereRadius = 0.0f;      // Snap onto this sphere if positive
+        bool doubleSided = false;       // Normal faces the camera
+    };
+
+    Scene* scene;
+    Shader* shader;
+    // Per-proxy uniforms, resolved once.
+    Uniform<glm::mat4> modelUniform;
+    Uniform<int> materialIdUniform;
+    Uniform<float> sphereRadiusUniform;
+    Uniform<int> doubleSidedUniform;
+    std::vector<const RTMaterial*> materials;
+    std::vector<Proxy> proxies;
+
+
+    Proxy& addProxy(
+        const std::string& name, Model* model, const Transform& tf,
+        const RTMaterial* mat
+    ) {
+        auto ptr = std::find(this->materials.begin(), this->materials.end(), mat);
+        if (ptr == this->materials.end())
+        {
+            throw std::invalid_argument(
+                "ERROR::HYBRID_RENDERER::Material of " + name + " is not listed"
+            );
+        }
+
+        Entity* entity = new Entity(name, nullptr, tf, new ModelAttribute(model));
+        this->scene->addEntity(entity);
+
+        Proxy proxy;
+        proxy.entity = entity;
+        proxy.materialId = (int)(ptr - this->materials.begin());
+        this->proxies.push_back(proxy);
+        return this->proxies.back();
+    }
+
+    void allocate(int width, int height)
+    {
+        this->release();
+        this->width = width;
+        this->height = height;
+
+        glGenFramebuffers(1, &(this->FBO));
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+
+        // Nearest filtering: the ray tracer must never blend two surfaces.
+        unsigned int* targets[2] = { &(this->gPosition), &(this->gNormal) };
+        for (int i = 0; i < 2; ++i)
+        {
+            glGenTextures(1, targets[i]);
+            glBindTexture(GL_TEXTURE_2D, *targets[i]);
+            glTexImage2D(
+                GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL
+            );
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(
+                GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, *targets[i], 0
+            );
+        }
+        unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+
+        glGenRenderbuffers(1, &(this->depthRBO));
+        glBindRenderbuffer(GL_RENDERBUFFER, this->depthRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(
+            GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthRBO
+        );
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            logger.error(LOG_CATEGORY_RENDER, "Hybrid renderer G-buffer is not complete");
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void release()
+    {
+        if (this->FBO)
+            glDeleteFramebuffers(1, &(this->FBO));
+        if (this->gPosition)
+            glDeleteTextures(1, &(this->gPosition));
+        if (this->gNormal)
+            glDeleteTextures(1, &(this->gNormal));
+        if (this->depthRBO)
+            glDeleteRenderbuffers(1, &(this->depthRBO));
+        this->FBO = this->gPosition = this->gNormal = this->depthRBO = 0;
+    }
+
+    static Vertex makeVertex(const glm::vec3& position, const glm::vec3& normal)
+    {
+        Vertex v;
+        v.position = position;
+        v.texCoords = glm::vec2(0.0f);
+        v.normal = normal;
+        v.tangent = glm::vec3(0.0f);
+        return v;
+    }
+
+    // Unit sphere. Its vertices lie on the sphere, so every facet is inside
+    // it and the per fragment snap always finds the analytic surface.
+    static Mesh* makeSphereMesh(const std::string& name)
+    {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        for (int j = 0; j <= HYBRID_SPHERE_STACKS; ++j)
+        {
+            float theta = glm::pi<float>() * j / HYBRID_SPHERE_STACKS;
+            for (int i = 0; i <= HYBRID_SPHERE_SLICES; ++i)
+            {
+                float phi = 2.0f * glm::pi<float>() * i / HYBRID_SPHERE_SLICES;
+                glm::vec3 n = glm::vec3(
+                    std::sin(theta) * std::cos(phi), std::cos(theta),
+                    std::sin(theta) * std::sin(phi)
+                );
+                vertices.push_back(makeVertex(n, n));
+            }
+        }
+        for (int j = 0; j < HYBRID_SPHERE_STACKS; ++j)
+        {
+            for (int i = 0; i < HYBRID_SPHERE_SLICES; ++i)
+            {
+                unsigned int a = j * (HYBRID_SPHERE_SLICES + 1) + i;
+                unsigned int b = a + HYBRID_SPHERE_SLICES + 1;
+                indices.insert(indices.end(), { a, a + 1, b, a + 1, b + 1, b });
+            }
+        }
+        return new Mesh(name, vertices, indices);
+    }
+
+    // Unit cube centered at the origin, with flat faces.
+    static Mesh* makeBoxMesh(const std::string& name)
+    {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int side = -1; side <= 1; side += 2)
+            {
+                glm::vec3 n = glm::vec3(0.0f);
+                n[axis] = (float)side;
+                glm::vec3 u = glm::vec3(0.0f);
+                glm::vec3 v = glm::vec3(0.0f);
+                u[(axis + 1) % 3] = 0.5f;
+                v[(axis + 2) % 3] = 0.5f;
+                unsigned int base = (unsigned int)vertices.size();
+                glm::vec3 c = 0.5f * n;
+                vertices.push_back(makeVertex(c - u - v, n));
+                vertices.push_back(makeVertex(c + u - v, n));
+                vertices.push_back(makeVertex(c + u + v, n));
+                vertices.push_back(makeVertex(c - u + v, n));
+                indices.insert(indices.end(), {
+                    base, base + 1, base + 2, base, base + 2, base + 3
+                });
+            }
+        }
+        return new Mesh(name, vertices, indices);
+    }
+
+    // Large square of the plane around its anchor point, in world space.
+    static Mesh* makePlaneMesh(const std::string& name, const RTPlane& plane)
+    {
+        glm::vec3 n = glm::normalize(plane.normal);
+        glm::vec3 up = std::abs(n.y) < 0.999f
+            ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 t = HYBRID_PLANE_EXTENT * glm::normalize(glm::cross(up, n));
+        glm::vec3 b = HYBRID_PLANE_EXTENT * glm::normalize(glm::cross(n, t));
+        std::vector<Vertex> vertices = {
+            makeVertex(plane.p0 - t - b, n), makeVertex(plane.p0 + t - b, n),
+            makeVertex(plane.p0 + t + b, n), makeVertex(plane.p0 - t + b, n)
+        };
+        return new Mesh(name, vertices, { 0, 1, 2, 0, 2, 3 });
+    }
+
+    static Mesh* makeTriangleMesh(const std::string& name, const RTTriangle& tri)
+    {
+        glm::vec3 n = glm::normalize(glm::cross(tri.v2 - tri.v0, tri.v1 - tri.v0));
+        std::vector<Vertex> vertices = {
+            makeVertex(tri.v0, n), makeVertex(tri.v1, n), makeVertex(tri.v2, n)
+        };
+        return new Mesh(name, vertices, { 0, 1, 2 });
+    }
+};
+}
+
+#endif
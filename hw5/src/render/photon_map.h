@@ -0,0 +1,430 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/asset.h"
+#include "render/rt_scene.h"
+
+
+namespace engine
+{
+// Defaults for the caustic photon map.
+constexpr unsigned int DEFAULT_PHOTON_COUNT = 400000;
+constexpr unsigned int DEFAULT_PHOTON_MAX_DEPTH = 8;
+constexpr float DEFAULT_PHOTON_GATHER_RADIUS = 0.05f;
+// Number of buckets of the hashed grid. Must be a power of two.
+constexpr unsigned int DEFAULT_PHOTON_HASH_SIZE = 1u << 18;
+// Photons a gather reads from one bucket at most; denser buckets are
+// subsampled.
+constexpr unsigned int DEFAULT_PHOTON_MAX_GATHER = 64;
+
+
+// Laid out as two RGBA32F texels so the sorted array is uploaded as is.
+struct Photon
+{
+    glm::vec4 position;
+    glm::vec4 power;
+};
+
+
+// Caustic photon map (L S+ D paths). Photons are shot from the point and area
+// lights towards the bounding spheres of the refractive and specular objects,
+// traced through them on all cores, and stored at the first diffuse surface
+// they reach. The stored photons are sorted by the bucket of a hashed grid
+// whose cell size is twice the gather radius, so a density estimate only has
+// to visit the 2x2x2 cells overlapping the gather sphere and reads each of
+// them as a contiguous range.
+class PhotonMap : public Asset
+{
+public:
+    // Texture buffers consumed by the ray tracing shader.
+    unsigned int photonTexture = 0;
+    unsigned int cellTexture = 0;
+
+    unsigned int numPhotonsEmitted;
+    unsigned int maxDepth;
+    float gatherRadius;
+    unsigned int hashSize;
+    unsigned int maxGather = DEFAULT_PHOTON_MAX_GATHER;
+
+    std::vector<Photon> photons;
+    // (start, count) of each bucket in the sorted photon array.
+    std::vector<glm::ivec2> cells;
+
+
+    PhotonMap(
+        const std::string& name,
+        unsigned int numPhotons = DEFAULT_PHOTON_COUNT,
+        float gatherRadius = DEFAULT_PHOTON_GATHER_RADIUS,
+        unsigned int maxDepth = DEFAULT_PHOTON_MAX_DEPTH,
+        unsigned int hashSize = DEFAULT_PHOTON_HASH_SIZE
+    ) : Asset(name), numPhotonsEmitted(numPhotons), maxDepth(maxDepth),
+        gatherRadius(gatherRadius), hashSize(hashSize)
+    {
+        if (hashSize == 0 || (hashSize & (hashSize - 1)) != 0)
+        {
+            throw std::invalid_argument("ERROR::PHOTON_MAP::HASH_SIZE_NOT_POWER_OF_TWO");
+        }
+    }
+
+    ~PhotonMap()
+    {
+        this->release();
+    }
+
+    // Emits and traces all photons in parallel, then builds the hashed grid.
+    void build(const RTScene& scene)
+    {
+        this->photons.clear();
+
+        // Collect caustic casters. A photon that misses all of them can never
+        // contribute to a caustic, so we only emit towards them.
+        std::vector<Caster> casters;
+        for (const auto& sphere : scene.spheres)
+        {
+            if (isCausticCaster(sphere.mat))
+                casters.push_back({ sphere.center, sphere.radius });
+        }
+        for (const auto& box : scene.boxes)
+        {
+            if (isCausticCaster(box.mat))
+                casters.push_back({
+                    0.5f * (box.bmin + box.bmax),
+                    0.5f * glm::length(box.bmax - box.bmin)
+                });
+        }
+        // Distribute the photon budget evenly over the (light, caster) pairs.
+        std::vector<Emitter> emitters;
+        // Lights that do not cast shadows shine through every object in the
+        // shader, so they must not focus light either.
+        for (const auto& light : scene.pointLights)
+        {
+            if (!light.castShadow)
+                continue;
+            for (const auto& caster : casters)
+                emitters.push_back({
+                    light.position, light.position, light.position,
+                    light.color, caster
+                });
+        }
+        for (const auto& light : scene.areaLights)
+        {
+            if (!light.castShadow)
+                continue;
+            for (const auto& caster : casters)
+                emitters.push_back({
+                    light.geom.v0, light.geom.v1, light.geom.v2,
+                    light.color, caster
+                });
+        }
+        if (emitters.empty())
+        {
+            this->buildGrid();
+            return;
+        }
+        unsigned int photonsPerEmitter = this->numPhotonsEmitted / (unsigned int)emitters.size();
+
+        unsigned int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector< std::vector<Photon> > localPhotons(numWorkers);
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < numWorkers; ++w)
+        {
+            workers.emplace_back([&, w]() {
+                std::mt19937 rng(0x9e3779b9u * (w + 1));
+                std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+                auto rand = [&]() { return uniform(rng); };
+
+                for (const auto& emitter : emitters)
+                {
+                    // Split the emitter's photons into contiguous per-worker ranges.
+                    unsigned int begin = photonsPerEmitter * w / numWorkers;
+                    unsigned int end = photonsPerEmitter * (w + 1) / numWorkers;
+                    glm::vec3 power = emitter.color
+                        * (emitter.caster.radius * emitter.caster.radius
+                        * glm::pi<float>() / (float)photonsPerEmitter);
+                    for (unsigned int i = begin; i < end; ++i)
+                    {
+                        RTRay ray;
+                        ray.origin = RTScene::sampleTriangle(
+                            emitter.v0, emitter.v1, emitter.v2, rand(), rand()
+                        );
+                        ray.direction = sampleCone(
+                            ray.origin, emitter.caster, rand(), rand()
+                        );
+                        this->tracePhoton(scene, ray, power, rand, localPhotons[w]);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        for (auto& local : localPhotons)
+        {
+            this->photons.insert(this->photons.end(), local.begin(), local.end());
+        }
+
+        this->buildGrid();
+    }
+
+    // Uploads the photons and the bucket table as texture buffers.
+    void upload()
+    {
+        this->release();
+
+        // Texture buffers may not be empty.
+        if (this->photons.empty())
+        {
+            this->photons.push_back({ glm::vec4(0.0f), glm::vec4(0.0f) });
+        }
+        this->photonTexture = createTextureBuffer(
+            this->photonBuffer, GL_RGBA32F,
+            this->photons.size() * sizeof(Photon), &(this->photons[0])
+        );
+        this->cellTexture = createTextureBuffer(
+            this->cellBuffer, GL_RG32I,
+            this->cells.size() * sizeof(glm::ivec2), &(this->cells[0])
+        );
+    }
+
+    // Binds the texture buffers to two consecutive texture units.
+    void bind(unsigned int firstUnit)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, this->photonTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, this->cellTexture);
+    }
+
+    // Spatial hash of a grid cell. Must match photonHash() in the shader.
+    static unsigned int hashCell(glm::ivec3 cell, unsigned int hashSize)
+    {
+        uint32_t h = ((uint32_t)cell.x * 73856093u)
+            ^ ((uint32_t)cell.y * 19349663u)
+            ^ ((uint32_t)cell.z * 83492791u);
+        return h & (hashSize - 1);
+    }
+
+private:
+    unsigned int photonBuffer = 0;
+    unsigned int cellBuffer = 0;
+
+    struct Caster
+    {
+        glm::vec3 center;
+        float radius;
+    };
+
+    // A light sample domain (a point light is a degenerated triangle) paired
+    // with the caster its photons are aimed at.
+    struct Emitter
+    {
+        glm::vec3 v0;
+        glm::vec3 v1;
+        glm::vec3 v2;
+        glm::vec3 color;
+        Caster caster;
+    };
+
+
+    static bool isCausticCaster(const RTMaterial* mat)
+    {
+        return mat && (mat->scatterType == SCATTER_TYPE_REFRACTIVE
+            || mat->scatterType == SCATTER_TYPE_SPECULAR);
+    }
+
+    static bool isDiffuse(const RTMaterial* mat)
+    {
+        return mat && (mat->scatterType == SCATTER_TYPE_PHONG
+            || mat->scatterType == SCATTER_TYPE_LAMBERTIAN);
+    }
+
+    // Uniformly samples a direction in the cone subtended by the caster.
+    static glm::vec3 sampleCone(glm::vec3 origin, const Caster& caster, float rv0, float rv1)
+    {
+        glm::vec3 axis = caster.center - origin;
+        float dist = glm::length(axis);
+        axis /= dist;
+        float sinMax = std::min(caster.radius / dist, 1.0f);
+        float cosMax = std::sqrt(1.0f - sinMax * sinMax);
+
+        float cost = 1.0f - rv0 * (1.0f - cosMax);
+        float sint = std::sqrt(std::max(0.0f, 1.0f - cost * cost));
+        float phi = 2.0f * glm::pi<float>() * rv1;
+
+        glm::vec3 helper = std::abs(axis.x) > 0.9f
+            ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 u = glm::normalize(glm::cross(helper, axis));
+        glm::vec3 v = glm::cross(axis, u);
+        return glm::normalize(
+            sint * std::cos(phi) * u + sint * std::sin(phi) * v + cost * axis
+        );
+    }
+
+    static float schlick(float cosine, float ior)
+    {
+        float r0 = (1.0f - ior) / (1.0f + ior);
+        r0 = r0 * r0;
+        float cosrev = 1.0f - cosine;
+        float cosrev2 = cosrev * cosrev;
+        return r0 + (1.0f - r0) * cosrev2 * cosrev2 * cosrev;
+    }
+
+    template<typename Rand>
+    void tracePhoton(
+        const RTScene& scene, RTRay ray, glm::vec3 power, Rand& rand,
+        std::vector<Photon>& out
+    ) {
+        bool specularBounce = false;
+        RTHitRecord hit;
+        for (unsigned int depth = 0; depth < this->maxDepth; ++depth)
+        {
+            if (!scene.trace(ray, hit))
+                return;
+
+            const RTMaterial* mat = hit.mat;
+            if (isDiffuse(mat))
+            {
+                // Direct light is handled by the shader; only keep photons
+                // that went through at least one specular interaction.
+                if (specularBounce)
+                    out.push_back({ glm::vec4(hit.p, 1.0f), glm::vec4(power, 0.0f) });
+                return;
+            }
+
+            float cosine = -glm::dot(ray.direction, hit.normal);
+            if (mat->scatterType == SCATTER_TYPE_SPECULAR)
+            {
+                power *= RTScene::schlick(std::abs(cosine), mat->R0);
+                ray.origin = hit.p + (cosine > 0.0f ? 1.0f : -1.0f) * hit.normal * RT_EPSILON;
+                ray.direction = glm::normalize(glm::reflect(ray.direction, hit.normal));
+            }
+            else if (mat->scatterType == SCATTER_TYPE_REFRACTIVE)
+            {
+                float eta = 1.0f / mat->ior;
+                glm::vec3 n = hit.normal;
+                // Ray is inside the material.
+                if (cosine < 0.0f)
+                {
+                    eta = mat->ior;
+                    n = -n;
+                    cosine = -cosine;
+                    // Beer-Lambert law over the traveled distance.
+                    power *= glm::exp(mat->extinctionConstant * hit.t);
+                }
+
+                float costsq = 1.0f - eta * eta * (1.0f - cosine * cosine);
+                float reflectRatio = costsq > 0.0f
+                    ? schlick(eta > 1.0f ? std::sqrt(costsq) : cosine, mat->ior)
+                    : 1.0f;
+
+                // Russian roulette between reflection and refraction keeps
+                // the photon power constant.
+                if (rand() < reflectRatio)
+                {
+                    ray.origin = hit.p + n * RT_EPSILON;
+                    ray.direction = glm::normalize(glm::reflect(ray.direction, n));
+                }
+                else
+                {
+                    ray.origin = hit.p - n * RT_EPSILON;
+                    ray.direction = glm::normalize(
+                        eta * ray.direction + (eta * cosine - std::sqrt(costsq)) * n
+                    );
+                }
+            }
+            else
+            {
+                return;
+            }
+            specularBounce = true;
+        }
+    }
+
+    // Sorts the photons by bucket with a counting sort. They are shuffled
+    // first, so each bucket holds its photons in random order rather than
+    // by worker and emitter, and any prefix of it is a uniform sample.
+    void buildGrid()
+    {
+        this->cells.assign(this->hashSize, glm::ivec2(0));
+        std::mt19937 rng(this->hashSize);
+        std::shuffle(this->photons.begin(), this->photons.end(), rng);
+
+        float cellSize = 2.0f * this->gatherRadius;
+        std::vector<unsigned int> keys(this->photons.size());
+        for (size_t i = 0; i < this->photons.size(); ++i)
+        {
+            glm::ivec3 cell = glm::ivec3(glm::floor(
+                glm::vec3(this->photons[i].position) / cellSize
+            ));
+            keys[i] = hashCell(cell, this->hashSize);
+            ++(this->cells[keys[i]].y);
+        }
+
+        int start = 0;
+        for (auto& cell : this->cells)
+        {
+            cell.x = start;
+            start += cell.y;
+        }
+
+        std::vector<Photon> sorted(this->photons.size());
+        std::vector<int> cursor(this->hashSize);
+        for (size_t i = 0; i < this->cells.size(); ++i)
+        {
+            cursor[i] = this->cells[i].x;
+        }
+        for (size_t i = 0; i < this->photons.size(); ++i)
+        {
+            sorted[cursor[keys[i]]++] = this->photons[i];
+        }
+        this->photons.swap(sorted);
+    }
+
+    static unsigned int createTextureBuffer(
+        unsigned int& buffer, GLenum format, size_t size, const void* data
+    ) {
+        unsigned int texture;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STATIC_DRAW);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        return texture;
+    }
+
+    void release()
+    {
+        if (this->photonTexture)
+        {
+            unsigned int textures[] = { this->photonTexture, this->cellTexture };
+            unsigned int buffers[] = { this->photonBuffer, this->cellBuffer };
+            glDeleteTextures(2, textures);
+            glDeleteBuffers(2, buffers);
+            this->photonTexture = this->cellTexture = 0;
+            this->photonBuffer = this->cellBuffer = 0;
+        }
+    }
+};
+}
+
+#endif
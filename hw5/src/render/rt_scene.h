@@ -0,0 +1,457 @@
+#ifndef RT_SCENE_H
+#define RT_SCENE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "data/shader.h"
+#include "render/cubemap_sampler.h"
+
+
+namespace engine
+{
+// Options for materials. Must match the definitions in shader_ray_tracing.frag.
+constexpr int SCATTER_TYPE_PHONG         = 0;
+constexpr int SCATTER_TYPE_LAMBERTIAN    = 1;
+constexpr int SCATTER_TYPE_REFRACTIVE    = 2;
+constexpr int SCATTER_TYPE_SPECULAR      = 3;
+
+// To prevent point too close to surface.
+constexpr float RT_EPSILON = 0.00001f;
+// Bounces followed through mirrors and glass by RTScene::radiance.
+constexpr int RT_RADIANCE_MAX_DEPTH = 4;
+
+
+// CPU-side mirror of the Material struct of the ray tracing shader. The same
+// instance is uploaded to the shader and used by the CPU passes, so the two
+// renderers never disagree on the surface properties.
+struct RTMaterial
+{
+    // Phong shading coefficients
+    glm::vec3 Ka = glm::vec3(0.0f);
+    glm::vec3 Kd = glm::vec3(0.0f);
+    glm::vec3 Ks = glm::vec3(0.0f);
+    float shininess = 0.0f;
+
+    // Reflect / Refract
+    glm::vec3 R0 = glm::vec3(0.0f); // Schlick approximation
+    float ior = 0.0f; // Index of refration (> 1)
+
+    // For refractive material
+    glm::vec3 extinctionConstant = glm::vec3(0.0f);
+    glm::vec3 shadowAttenuationConstant = glm::vec3(0.0f);
+
+    int scatterType = SCATTER_TYPE_PHONG;
+};
+
+struct RTRay
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+// Hit information
+struct RTHitRecord
+{
+    float t;                        // Distance to hit point
+    glm::vec3 p;                    // Hit point
+    glm::vec3 normal;               // Hit point normal
+    const RTMaterial* mat;          // Hit point material
+};
+
+struct RTSphere
+{
+    glm::vec3 center;
+    float radius;
+    const RTMaterial* mat;
+};
+
+struct RTPlane
+{
+    glm::vec3 normal;
+    glm::vec3 p0;
+    const RTMaterial* mat;
+};
+
+struct RTBox
+{
+    glm::vec3 bmin;
+    glm::vec3 bmax;
+    const RTMaterial* mat;
+};
+
+struct RTTriangle
+{
+    glm::vec3 v0;
+    glm::vec3 v1;
+    glm::vec3 v2;
+    const RTMaterial* mat;
+};
+
+// Point light source
+struct RTPointLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    bool castShadow;
+};
+
+// Area light source
+struct RTTriangleLight
+{
+    RTTriangle geom;
+    glm::vec3 color;
+    bool castShadow;
+};
+
+
+// Uploads a material to the uniform struct of the given name.
+void setMaterialUniforms(
+    Shader* shader, const std::string& name, const RTMaterial& mat
+) {
+    shader->setVec3(name + ".Ka", mat.Ka);
+    shader->setVec3(name + ".Kd", mat.Kd);
+    shader->setVec3(name + ".Ks", mat.Ks);
+    shader->setFloat(name + ".shininess", mat.shininess);
+    shader->setVec3(name + ".R0", mat.R0);
+    shader->setFloat(name + ".ior", mat.ior);
+    shader->setVec3(name + ".extinction_constant", mat.extinctionConstant);
+    shader->setVec3(
+        name + ".shadow_attenuation_constant", mat.shadowAttenuationConstant
+    );
+    shader->setInt(name + ".scatter_type", mat.scatterType);
+}
+
+
+// CPU-side copy of the static environment of shader_ray_tracing.frag. The
+// intersection routines follow the shader line by line so that photons and
+// camera rays see exactly the same surfaces.
+class RTScene
+{
+public:
+    std::vector<RTSphere> spheres;
+    std::vector<RTBox> boxes;
+    std::vector<RTPlane> planes;
+    std::vector<RTTriangle> triangles;
+    std::vector<RTPointLight> pointLights;
+    std::vector<RTTriangleLight> areaLights;
+
+
+    RTScene() {}
+
+    // Builds the hard-coded scene of the ray tracing shader.
+    // Keep this in sync with the arrays in shader_ray_tracing.frag.
+    RTScene(
+        const RTMaterial* ground, const RTMaterial* mirror,
+        const RTMaterial* glass, const RTMaterial* box,
+        const RTMaterial* lambert, const RTMaterial* gold
+    ) {
+        this->spheres = {
+            { glm::vec3( 1.0f, 0.5f, -1.0f), 0.499f, gold },
+            { glm::vec3(-1.0f, 0.5f, -1.0f), 0.499f, gold },
+            { glm::vec3( 0.0f, 0.5f,  1.0f), 0.499f, glass },
+            { glm::vec3( 1.0f, 0.5f,  0.0f), 0.499f, lambert }
+        };
+        this->boxes = {
+            { glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.5f, 1.0f, 0.5f), glass },
+            { glm::vec3(2.0f, 0.0f, -3.0f), glm::vec3(3.0f, 1.0f, -2.0f), box }
+        };
+        this->planes = {
+            { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f), ground }
+        };
+        this->triangles = {
+            {
+                glm::vec3(-3.0f, 0.0f, 0.0f),
+                glm::vec3( 0.0f, 0.0f, -4.0f),
+                glm::vec3(-1.0f, 4.0f, -2.0f),
+                mirror
+            }
+        };
+        this->pointLights = {
+            { glm::vec3(-3.0f, 5.0f,  3.0f), glm::vec3(0.5f, 0.0f, 0.0f), false },
+            { glm::vec3(-3.0f, 5.0f, -3.0f), glm::vec3(0.0f, 0.5f, 0.0f), false },
+            { glm::vec3( 3.0f, 5.0f, -3.0f), glm::vec3(0.0f, 0.0f, 0.5f), false }
+        };
+        this->areaLights = {
+            {
+                {
+                    glm::vec3(2.0f, 5.0f, 3.0f),
+                    glm::vec3(4.0f, 5.0f, 3.0f),
+                    glm::vec3(3.0f, 5.0f, 4.7f),
+                    nullptr
+                },
+                glm::vec3(1.0f),
+                true
+            }
+        };
+    }
+
+    // Trace a single ray. Returns true if anything is hit.
+    bool trace(const RTRay& r, RTHitRecord& hit) const
+    {
+        hit.t = std::numeric_limits<float>::infinity();
+        hit.p = r.origin;
+        hit.normal = r.direction;
+        hit.mat = nullptr;
+
+        bool hitAny = false;
+        for (const auto& sphere : this->spheres)
+            hitAny = sphereIntersect(sphere, r, hit) || hitAny;
+        for (const auto& box : this->boxes)
+            hitAny = boxIntersect(box, r, hit) || hitAny;
+        for (const auto& plane : this->planes)
+            hitAny = planeIntersect(plane, r, hit) || hitAny;
+        for (const auto& triangle : this->triangles)
+            hitAny = triangleIntersect(triangle, r, hit) || hitAny;
+        return hitAny;
+    }
+
+    // Radiance arriving at the ray origin, seen by a diffuse-only camera: the
+    // sky on a miss, else the view-independent part of the shader's Phong
+    // term plus mirror reflections. Glass is treated as a clear pane and
+    // specular highlights are dropped, as the result feeds the irradiance
+    // probes.
+    glm::vec3 radiance(
+        const RTRay& r, std::mt19937& rng, const CubemapSampler* sky,
+        int depth = 0
+    ) const {
+        RTHitRecord hit;
+        if (!this->trace(r, hit))
+            return sky ? sky->sample(r.direction) : glm::vec3(0.0f);
+        if (depth >= RT_RADIANCE_MAX_DEPTH)
+            return glm::vec3(0.0f);
+
+        float cosine = glm::dot(r.direction, hit.normal);
+        glm::vec3 offset = (cosine < 0.0f ? 1.0f : -1.0f) * hit.normal * RT_EPSILON;
+        const RTMaterial* mat = hit.mat;
+        if (mat->scatterType == SCATTER_TYPE_REFRACTIVE)
+        {
+            RTRay next = { hit.p - offset, r.direction };
+            return this->radiance(next, rng, sky, depth + 1);
+        }
+
+        // Facing the ray, like the shader's lighting.
+        glm::vec3 n = cosine < 0.0f ? hit.normal : -hit.normal;
+        glm::vec3 p = hit.p + offset;
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        // The shader ignores lights that do not cast shadows, so do we.
+        glm::vec3 result = glm::vec3(0.0f);
+        for (const auto& light : this->pointLights)
+        {
+            if (!light.castShadow)
+                continue;
+            glm::vec3 lightDir = glm::normalize(light.position - p);
+            float lightCosine = std::max(glm::dot(n, lightDir), 0.0f);
+            glm::vec3 attn = this->transmittance(p, light.position);
+            result += attn * lightCosine * mat->Kd * light.color;
+        }
+        for (const auto& light : this->areaLights)
+        {
+            if (!light.castShadow)
+                continue;
+            glm::vec3 lightPos = sampleTriangle(
+                light.geom.v0, light.geom.v1, light.geom.v2,
+                uniform(rng), uniform(rng)
+            );
+            glm::vec3 lightDir = glm::normalize(lightPos - p);
+            float lightCosine = std::max(glm::dot(n, lightDir), 0.0f);
+            glm::vec3 attn = this->transmittance(p, lightPos);
+            result += attn * lightCosine * mat->Kd * light.color;
+        }
+        result = glm::clamp(result, 0.0f, 1.0f);
+
+        // Phong and specular surfaces reflect like in castRay.
+        if (mat->scatterType != SCATTER_TYPE_LAMBERTIAN)
+        {
+            RTRay next = { p, glm::normalize(glm::reflect(r.direction, hit.normal)) };
+            result += schlick(std::abs(cosine), mat->R0)
+                * this->radiance(next, rng, sky, depth + 1);
+        }
+        return result;
+    }
+
+    // Robert Osada et al., "Shape Distributions", ACM Trans. on Graphics 21(4), 2002.
+    static glm::vec3 sampleTriangle(
+        glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, float rv0, float rv1
+    ) {
+        return v0 + std::sqrt(rv0) * (v1 - v0 + rv1 * (v2 - v1));
+    }
+
+    static glm::vec3 schlick(float cosine, glm::vec3 r0)
+    {
+        float cosrev = 1.0f - cosine;
+        float cosrev2 = cosrev * cosrev;
+        return r0 + (glm::vec3(1.0f) - r0) * (cosrev2 * cosrev2 * cosrev);
+    }
+
+private:
+    // Light reaching p from the target point, dimmed by the glass in between
+    // like calculateShadow of the shader.
+    glm::vec3 transmittance(glm::vec3 p, glm::vec3 target) const
+    {
+        glm::vec3 attn = glm::vec3(1.0f);
+        for (int i = 0; i < RT_RADIANCE_MAX_DEPTH; ++i)
+        {
+            glm::vec3 toTarget = target - p;
+            float dist = glm::length(toTarget);
+            RTRay ray = { p, toTarget / dist };
+            RTHitRecord hit;
+            if (!this->trace(ray, hit) || hit.t >= dist)
+                return attn;
+            if (hit.mat->scatterType != SCATTER_TYPE_REFRACTIVE)
+                return glm::vec3(0.0f);
+            attn *= hit.mat->shadowAttenuationConstant;
+            p = hit.p + ray.direction * RT_EPSILON;
+        }
+        return glm::vec3(0.0f);
+    }
+
+    static bool sphereIntersect(const RTSphere& sp, const RTRay& r, RTHitRecord& hit)
+    {
+        glm::vec3 co = sp.center - r.origin;
+        float tc = glm::dot(co, r.direction);
+        glm::vec3 cp = co - tc * r.direction;
+        float dist = glm::length(cp);
+        // Test if the ray is too far away from the center of the sphere.
+        if (dist > sp.radius)
+            return false;
+
+        float dt = std::sqrt(sp.radius * sp.radius - dist * dist);
+        float t = tc - dt;
+        // t_min < 0 : Hit from the interior.
+        if (t < 0.0f)
+            t = tc + dt;
+        // t_min < 0 and t_max < 0, or already hit by nearer object.
+        if (t < 0.0f || t >= hit.t)
+            return false;
+
+        hit.t = t;
+        hit.p = r.origin + t * r.direction;
+        hit.normal = glm::normalize(hit.p - sp.center);
+        hit.mat = sp.mat;
+        return true;
+    }
+
+    static bool planeIntersect(const RTPlane& p, const RTRay& r, RTHitRecord& hit)
+    {
+        glm::vec3 n = glm::normalize(p.normal);
+        float cosine = glm::dot(r.direction, n);
+        // Test if the ray and the plane are parallel.
+        if (cosine == 0.0f)
+            return false;
+
+        float dist = glm::dot(r.origin - p.p0, n);
+        // Test if the ray is directed away from the plane.
+        if (dist * cosine > 0.0f)
+            return false;
+
+        float t = -dist / cosine;
+        // Already hit by nearer object.
+        if (t >= hit.t)
+            return false;
+
+        hit.t = t;
+        hit.p = r.origin + t * r.direction;
+        hit.normal = (dist < 0.0f ? -1.0f : 1.0f) * n;
+        hit.mat = p.mat;
+        return true;
+    }
+
+    // Assume an axis-aligned (bounding) box (AABB).
+    static bool boxIntersect(const RTBox& b, const RTRay& r, RTHitRecord& hit)
+    {
+        glm::vec3 invdir = 1.0f / r.direction;
+        glm::vec3 t0 = (b.bmin - r.origin) * invdir;
+        glm::vec3 t1 = (b.bmax - r.origin) * invdir;
+        glm::vec3 tmin = glm::min(t0, t1);
+        glm::vec3 tmax = glm::max(t0, t1);
+
+        int imaxtmin = 0;
+        int imintmax = 0;
+        for (int i = 1; i < 3; ++i)
+        {
+            if (tmin[i] > tmin[imaxtmin])
+                imaxtmin = i;
+            if (tmax[i] < tmax[imintmax])
+                imintmax = i;
+        }
+        float maxtmin = tmin[imaxtmin];
+        float mintmax = tmax[imintmax];
+        // The straight line do not intersect with the box.
+        if (maxtmin > mintmax)
+            return false;
+
+        float t;
+        int idx;
+        // Hit from the exterior.
+        if (maxtmin >= 0.0f)
+        {
+            t = maxtmin;
+            idx = imaxtmin;
+        }
+        // Hit from the interior.
+        else if (mintmax >= 0.0f)
+        {
+            t = mintmax;
+            idx = imintmax;
+        }
+        // The box is behind the ray.
+        else
+            return false;
+
+        // Ray has already hit by nearer object.
+        if (t >= hit.t)
+            return false;
+
+        glm::vec3 n = glm::vec3(0.0f);
+        n[idx] = (maxtmin < 0.0f ? -1.0f : 1.0f)
+            * (r.direction[idx] > 0.0f ? -1.0f : 1.0f);
+
+        hit.t = t;
+        hit.p = r.origin + t * r.direction;
+        hit.normal = n;
+        hit.mat = b.mat;
+        return true;
+    }
+
+    static bool triangleIntersect(const RTTriangle& tri, const RTRay& r, RTHitRecord& hit)
+    {
+        // Test if the ray hits the plane containing the triangle.
+        glm::vec3 n = glm::normalize(glm::cross(tri.v2 - tri.v0, tri.v1 - tri.v0));
+        float cosine = glm::dot(r.direction, n);
+        if (cosine == 0.0f)
+            return false;
+
+        float dist = glm::dot(r.origin - tri.v0, n);
+        if (dist * cosine > 0.0f)
+            return false;
+
+        float t = -dist / cosine;
+        if (t >= hit.t)
+            return false;
+
+        // Test if the hitpoint is inside the triangle.
+        glm::vec3 p = r.origin + t * r.direction;
+        n = (dist < 0.0f ? -1.0f : 1.0f) * n;
+        if (glm::dot(glm::cross(tri.v1 - tri.v0, p - tri.v0), n) <= 0.0f
+            || glm::dot(glm::cross(tri.v2 - tri.v1, p - tri.v1), n) <= 0.0f
+            || glm::dot(glm::cross(tri.v0 - tri.v2, p - tri.v2), n) <= 0.0f)
+            return false;
+
+        hit.t = t;
+        hit.p = p;
+        hit.normal = n;
+        hit.mat = tri.mat;
+        return true;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef FILE_VIEW_H
+#define FILE_VIEW_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "utils/mapped_file.h"
+
+
+namespace engine
+{
+// The contents of a file, read-only and never copied: the file is mapped
+// into memory. The view stays valid while the FileView lives.
+class FileView
+{
+public:
+    FileView() {}
+
+    FileView(const std::string& path)
+    {
+        this->open(path);
+    }
+
+    // No copy constructor nor copy assignment are allowed.
+    FileView(const FileView& other) = delete;
+    FileView& operator=(const FileView& other) = delete;
+
+    // False if the file is missing; an empty file gives an empty view.
+    bool open(const std::string& path)
+    {
+        if (!this->file.open(path))
+        {
+            this->bytes = nullptr;
+            this->length = 0;
+            return false;
+        }
+        this->bytes = reinterpret_cast<const char*>(this->file.data());
+        this->length = this->file.size();
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return this->bytes != nullptr;
+    }
+
+    // Not null-terminated. Empty, but not null, if the file could not be
+    // opened, so it can always be handed on as a C string and a length.
+    std::string_view getText() const
+    {
+        if (!this->bytes)
+            return std::string_view("", 0);
+        return std::string_view(this->bytes, this->length);
+    }
+
+private:
+    MappedFile file;
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+}
+
+#endif
@@ -9,14 +9,16 @@
 
 
 // Save Image to PNG file. Press V key to call.
+// Must be called on the thread holding the GL context.
 // Argument:
 //     filename: date.png (created in bin folder)
-void saveImage(const std::string& filename)
+//     width, height: size of the framebuffer
+void saveImage(const std::string& filename, unsigned int width, unsigned int height)
 {
     // Make the BYTE array, factor of 3 because it's RBG.
-    BYTE* pixels = new BYTE[3 * screen.width * screen.height];
+    BYTE* pixels = new BYTE[3 * width * height];
     glReadPixels(
-        0, 0, screen.width, screen.height,
+        0, 0, width, height,
         GL_BGR, GL_UNSIGNED_BYTE,
         pixels
     );
@@ -24,9 +26,9 @@ void saveImage(const std::string& filename)
     // Convert to FreeImage format & save to file
     FIBITMAP* image = FreeImage_ConvertFromRawBits(
         pixels,
-        screen.width,
-        screen.height,
-        3 * screen.width,
+        width,
+        height,
+        3 * width,
         24,
         0xFF0000,
         0x00FF00,